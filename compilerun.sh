@@ -93,7 +93,7 @@ PROJECTNAME=test_megatree
 
 GCC_PARAMETERS="-w -ffast-math -O2 -static-libgcc"
 
-LIBRARIES="-lSDLmain -lSDL"
+LIBRARIES="-lSDLmain -lSDL -lpthread"
 
 INCLUDE_DIRECTORIES=""
 
@@ -0,0 +1,1093 @@
+#define _POSIX_C_SOURCE 200809L    // For clock_gettime
+
+#include <stdlib.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <pthread.h>
+
+#include "debug.h"
+
+#include "common.h"
+
+
+#define ________BENCHMARKS
+
+// Benchmarks are run by passing `--bench` to the test program, e.g. `bin/test_megatree --bench`
+// They are not run as part of the normal test cycle because they take a while
+
+
+// Returns:     A monotonic timestamp in seconds, for timing benchmarks
+double __mt_bench_seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+#if INTERFACE
+typedef struct mt_bench_buffer     // Memory that a benchmark writes a snapshot to through `__mt_bench_buffer_write`
+{
+    char* buffer;
+    size_t length;
+    size_t capacity;
+} mt_bench_buffer;
+#endif
+
+// An `mt_write_function` which appends to the `mt_bench_buffer` `context`, growing it as needed
+//
+// Returns:     1 if all of `data` was written, 0 if not
+int __mt_bench_buffer_write(void* context, void* data, size_t length)
+{
+    mt_bench_buffer* out = context;
+    if(out->length + length > out->capacity)
+    {
+        size_t capacity = (out->length + length) * 2;
+        char* grown = realloc(out->buffer, capacity);
+        if(grown == NULL) return 0;
+        out->buffer = grown;
+        out->capacity = capacity;
+    }
+    memcpy(out->buffer + out->length, data, length);
+    out->length += length;
+    return 1;
+}
+
+// Build a tree with `width` first level branches, each with `width` children of its own
+//
+// Returns:     The root of the new tree
+mt_branch* __mt_bench_build_tree(size_t width)
+{
+    char label[32];
+    mt_branch* root = mt_create_root();
+
+    for(size_t i=0; i<width; i++)
+    {
+        snprintf(label, sizeof label, "branch_%ld", i);
+        mt_branch* first_level = mt_create_branch(root, label);
+
+        for(size_t j=0; j<width; j++)
+        {
+            snprintf(label, sizeof label, "leaf_%ld", j);
+            mt_create_branch(first_level, label);
+        }
+    }
+
+    return root;
+}
+
+// Build a tree of about a million branches and report how many heap allocations the pools saved,
+// and how long it takes to build and then destroy the tree
+void __mt_bench_bulk_build()
+{
+    double start = __mt_bench_seconds();
+    mt_branch* root = __mt_bench_build_tree(1000);
+    double built = __mt_bench_seconds();
+
+    mt_allocation_stats stats;
+    mt_get_allocation_stats(root, &stats);
+    mt_string_stats string_stats;
+    mt_get_string_stats(root, &string_stats);
+
+    double destroy_start = __mt_bench_seconds();
+    mt_destroy_tree(root);
+    double destroyed = __mt_bench_seconds();
+
+    printf("Bulk build of 1001001 branches: %.3f s, destroyed in %.4f s\n", built - start, destroyed - destroy_start);
+    printf("  %ld objects allocated with %ld heap allocations (%ld saved, %.1f MB of slabs)\n",
+        stats.objects_allocated, stats.heap_allocations, stats.allocations_saved, stats.bytes_reserved / 1e6);
+    printf("  %ld labels share %ld interned strings: %.1f MB instead of %.1f MB (%.1f MB saved)\n", string_stats.references,
+        string_stats.distinct_strings, (string_stats.bytes_stored + string_stats.table_bytes) / 1e6,
+        string_stats.bytes_without_interning / 1e6, string_stats.bytes_saved / 1e6);
+}
+
+// Build a tree like `__mt_bench_build_tree`, but add the leaves to randomly chosen first level branches
+// so that siblings end up scattered across memory rather than next to each other
+//
+// Returns:     The root of the new tree
+mt_branch* __mt_bench_build_scattered_tree(size_t width)
+{
+    char label[32];
+    mt_branch* root = mt_create_root();
+    mt_branch** first_level = malloc(width * sizeof *first_level);
+
+    for(size_t i=0; i<width; i++)
+    {
+        snprintf(label, sizeof label, "branch_%ld", i);
+        first_level[i] = mt_create_branch(root, label);
+    }
+
+    srand(1);
+    for(size_t j=0; j<width * width; j++)
+    {
+        snprintf(label, sizeof label, "leaf_%ld", j % width);
+        mt_create_branch(first_level[rand() % width], label);
+    }
+
+    free(first_level);
+    return root;
+}
+
+// Time repeated full-tree traversals of `root`
+void __mt_bench_time_traversal(mt_branch* root, char* description)
+{
+    const int repeats = 10;
+    size_t counted = 0;
+
+    double start = __mt_bench_seconds();
+    for(int i=0; i<repeats; i++) counted += mt_get_num_descendants(root, 0, -1);
+    double elapsed = __mt_bench_seconds() - start;
+
+    printf("Full traversal of %ld branches, %s: %.1f ms per traversal\n", counted / repeats, description, elapsed * 1000 / repeats);
+}
+
+// Time full-tree traversals, for comparing child list layouts between versions
+void __mt_bench_traversal()
+{
+    mt_branch* root = __mt_bench_build_tree(1000);
+    __mt_bench_time_traversal(root, "siblings created together");
+    mt_destroy_tree(root);
+
+    root = __mt_bench_build_scattered_tree(1000);
+    __mt_bench_time_traversal(root, "siblings scattered");
+    mt_destroy_tree(root);
+}
+
+// Visitor counting the branches visited in `context`
+int __mt_bench_visit_count(mt_branch* branch, int depth, void* context)
+{
+    (*(size_t*)context)++;
+    return MT_VISIT_CONTINUE;
+}
+
+// Walk a million branches with the traversal engine and with a plain `__mt_next_descendant` loop, then walk,
+// copy and delete a chain far deeper than a recursive walk could manage
+void __mt_bench_traversal_engine()
+{
+    const int repeats = 10;
+    mt_branch* root = __mt_bench_build_tree(1000);
+    size_t counted = 0;
+    double start = __mt_bench_seconds();
+    for(int i=0; i<repeats; i++) mt_traverse(root, -1, __mt_bench_visit_count, NULL, &counted);
+    double engine_time = (__mt_bench_seconds() - start) / repeats;
+
+    start = __mt_bench_seconds();
+    for(int i=0; i<repeats; i++) for(mt_branch* branch = root; branch != NULL; branch = __mt_next_descendant(branch, root)) counted++;
+    double loop_time = (__mt_bench_seconds() - start) / repeats;
+    printf("Traversal of %ld branches: %.1f ms with visitors, %.1f ms with a plain loop\n", counted / repeats / 2, engine_time * 1000, loop_time * 1000);
+    mt_destroy_tree(root);
+
+    const int chain_length = 1000000;
+    root = mt_create_root();
+    mt_branch* chain = mt_create_branch(root, "chain");
+    for(mt_branch* link = chain; link->id < chain_length; link = mt_create_branch(link, "link"));
+    mt_branch* copies = mt_create_root();
+
+    start = __mt_bench_seconds();
+    size_t descendants = mt_get_num_descendants(chain, 0, -1);
+    double count_time = __mt_bench_seconds() - start;
+    start = __mt_bench_seconds();
+    mt_copy_branch(chain, copies);
+    double copy_time = __mt_bench_seconds() - start;
+    start = __mt_bench_seconds();
+    mt_delete_branch(chain);
+    double delete_time = __mt_bench_seconds() - start;
+    printf("Chain %ld branches deep: counted in %.1f ms, copied in %.1f ms, deleted in %.1f ms\n", descendants + 1,
+        count_time * 1000, copy_time * 1000, delete_time * 1000);
+
+    mt_destroy_tree(copies);
+    mt_destroy_tree(root);
+}
+
+// Ask for the totals of a million-branch tree after each of a series of small changes, from the cache and by walking the tree
+void __mt_bench_totals()
+{
+    const int changes = 1000;
+    mt_branch* root = __mt_bench_build_tree(1000);
+    mt_branch* leaf = mt_get_by_path(root, "branch_500/leaf_500");
+
+    size_t total = 0;
+    double start = __mt_bench_seconds();
+    for(int i=0; i<changes; i++)
+    {
+        mt_set_data_copy(leaf, &i, sizeof i);
+        total += mt_get_num_descendants(root, 0, -1) + mt_get_childrens_data_size_recursive(root);
+    }
+    double cached_time = (__mt_bench_seconds() - start) / changes;
+
+    start = __mt_bench_seconds();
+    for(int i=0; i<changes / 100; i++)
+    {
+        mt_set_data_copy(leaf, &i, sizeof i);
+        size_t counted = 0;
+        mt_traverse(root, -1, __mt_bench_visit_count, NULL, &counted);
+        total += counted;
+    }
+    double walk_time = (__mt_bench_seconds() - start) / (changes / 100);
+
+    printf("Totals of %ld branches after each change: %.2f us cached, %.1f ms walking the tree (%ld)\n",
+        (size_t)mt_get_num_descendants(root, 0, -1) + 1, cached_time * 1e6, walk_time * 1000, total % 10);
+    mt_destroy_tree(root);
+}
+
+// Search, find the maximum id of and compare a million branches on 1, 2, 4 ... threads, up to one per processor
+// and at least 8. The queries run on a copy inside another tree, whose maximum id is not already known
+void __mt_bench_parallel_queries()
+{
+    const int repeats = 3;
+    mt_branch* root = __mt_bench_build_tree(1000);
+    mt_branch* copy_root = mt_create_root();
+    mt_copy_branch(root, copy_root);
+    mt_branch* copy = mt_get_first_child(copy_root);
+    mt_set_label(mt_get_by_path(copy, "branch_999/leaf_999"), "needle");   // Last in depth-first order
+    mt_set_label(mt_get_by_path(root, "branch_999/leaf_999"), "needle");
+
+    int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(max_threads < 8) max_threads = 8;
+    for(int threads=1; threads<=max_threads; threads*=2)
+    {
+        size_t found = 0;
+        double start = __mt_bench_seconds();
+        for(int i=0; i<repeats; i++) found += (mt_search_for_label_parallel(copy, "needle", threads) != NULL);
+        double search_time = (__mt_bench_seconds() - start) / repeats;
+        start = __mt_bench_seconds();
+        for(int i=0; i<repeats; i++) found += mt_find_max_id_parallel(copy, 0, threads);
+        double max_id_time = (__mt_bench_seconds() - start) / repeats;
+        start = __mt_bench_seconds();
+        for(int i=0; i<repeats; i++) found += (mt_check_branches_identical_parallel(root, copy, threads) == NULL);
+        double compare_time = (__mt_bench_seconds() - start) / repeats;
+
+        printf("Queries of 1001001 branches on %d threads: search %.1f ms, maximum id %.1f ms, comparison %.1f ms (%ld)\n",
+            threads, search_time * 1000, max_id_time * 1000, compare_time * 1000, found % 10);
+    }
+    mt_destroy_tree(copy_root);
+    mt_destroy_tree(root);
+}
+
+// Find every branch with a label, a label prefix and a glob among a million branches, by searching the tree and
+// then with a label index
+void __mt_bench_label_index()
+{
+    const int repeats = 5;
+    mt_branch* root = __mt_bench_build_tree(1000);
+    mt_branch** found = malloc(20000 * sizeof *found);
+
+    for(int indexed=0; indexed<2; indexed++)
+    {
+        double start = __mt_bench_seconds();
+        if(indexed) mt_enable_label_index(root);
+        double index_time = __mt_bench_seconds() - start;
+
+        size_t exact = 0, prefix = 0, glob = 0;
+        start = __mt_bench_seconds();
+        for(int i=0; i<repeats; i++) exact += mt_find_by_label(root, "leaf_500", found, 20000);
+        double exact_time = (__mt_bench_seconds() - start) / repeats;
+        start = __mt_bench_seconds();
+        for(int i=0; i<repeats; i++) prefix += mt_find_by_label_prefix(root, "branch_99", found, 20000);
+        double prefix_time = (__mt_bench_seconds() - start) / repeats;
+        start = __mt_bench_seconds();
+        for(int i=0; i<repeats; i++) glob += mt_find_by_label_glob(root, "leaf_99?", found, 20000);
+        double glob_time = (__mt_bench_seconds() - start) / repeats;
+
+        printf("Label queries of 1001001 branches %s: exact %.3f ms (%ld), prefix %.3f ms (%ld), glob %.3f ms (%ld)",
+            indexed ? "with an index" : "by searching", exact_time * 1000, exact / repeats, prefix_time * 1000, prefix / repeats,
+            glob_time * 1000, glob / repeats);
+        if(indexed) printf(", indexed in %.1f ms", index_time * 1000);
+        printf("\n");
+    }
+    free(found);
+    mt_destroy_tree(root);
+}
+
+// Link each of a million branches to an object of its own, then find and detach some of those objects,
+// by searching the tree and then with a data index
+void __mt_bench_data_index()
+{
+    const size_t num_objects = 1000000;
+    double* objects = malloc(num_objects * 2 * sizeof *objects);
+    mt_branch* root = __mt_bench_build_tree(1000);
+
+    for(int indexed=0; indexed<2; indexed++)
+    {
+        size_t i = 0;
+        for(mt_branch* branch = root->first_child; branch != NULL; branch = branch->next_sibling)
+        {
+            for(mt_branch* leaf = branch->first_child; leaf != NULL; leaf = leaf->next_sibling, i++)
+            {
+                mt_set_data_pointer(leaf, &objects[i * 2], 2 * sizeof *objects);
+            }
+        }
+
+        double start = __mt_bench_seconds();
+        if(indexed) mt_enable_data_index(root);
+        double index_time = __mt_bench_seconds() - start;
+
+        size_t num_detached = indexed ? 1000 : 10;   // Searching the tree for each takes far longer
+        size_t found = 0;
+        start = __mt_bench_seconds();
+        for(size_t j=0; j<num_detached; j++) found += (mt_get_by_data_address(root, &objects[(j * 997) % num_objects * 2 + 1]) != NULL);
+        double lookup_time = __mt_bench_seconds() - start;
+        start = __mt_bench_seconds();
+        for(size_t j=0; j<num_detached; j++) found += mt_detach_data(root, &objects[(j * 997) % num_objects * 2]);
+        double detach_time = __mt_bench_seconds() - start;
+
+        printf("Data of %ld objects linked to by 1001001 branches %s: %ld interior lookups %.1f ms, %ld detaches %.1f ms (%ld)",
+            num_objects, indexed ? "with an index" : "by searching", num_detached, lookup_time * 1000, num_detached,
+            detach_time * 1000, found);
+        if(indexed) printf(", indexed in %.1f ms", index_time * 1000);
+        printf("\n");
+    }
+    mt_destroy_tree(root);
+    free(objects);
+}
+
+// Resolve the same set of deep paths over and over as strings, with and without the path cache, and compiled
+void __mt_bench_compiled_paths()
+{
+    const size_t num_paths = 4096;
+    const int repeats = 100;
+    char** paths = malloc(num_paths * sizeof *paths);
+    mt_path** compiled = malloc(num_paths * sizeof *compiled);
+
+    mt_branch* root = __mt_bench_build_tree(1000);
+    for(size_t i=0; i<num_paths; i++)
+    {
+        paths[i] = malloc(128);
+        sprintf(paths[i], "/branch_%ld/leaf_%ld/settings/values/current", i % 1000, (i * 7) % 1000);
+        mt_create_path(root, paths[i]);
+    }
+
+    double start = __mt_bench_seconds();
+    for(size_t i=0; i<num_paths; i++) compiled[i] = mt_compile_path(root, paths[i]);
+    double compile_time = __mt_bench_seconds() - start;
+
+    double times[3];
+    size_t found = 0;
+    for(int method=0; method<3; method++)
+    {
+        mt_set_path_cache_size(root, (method == 1) ? num_paths * 2 : 0);
+        start = __mt_bench_seconds();
+        for(int r=0; r<repeats; r++)
+        {
+            if(method < 2) for(size_t i=0; i<num_paths; i++) found += (mt_get_by_path(root, paths[i]) != NULL);
+            else for(size_t i=0; i<num_paths; i++) found += (mt_get_by_compiled_path(root, compiled[i]) != NULL);
+        }
+        times[method] = (__mt_bench_seconds() - start) * 1e9 / (repeats * num_paths);
+    }
+
+    printf("Lookups of %ld deep paths: %.0f ns uncached, %.0f ns cached, %.0f ns compiled (compiled in %.0f ns each, %ld found)\n",
+        num_paths, times[0], times[1], times[2], compile_time * 1e9 / num_paths, found);
+
+    for(size_t i=0; i<num_paths; i++) { mt_free_path(compiled[i]); free(paths[i]); }
+    free(compiled);
+    free(paths);
+    mt_destroy_tree(root);
+}
+
+// Create a million paths of the form "tenants/<t>/sessions/<s>/state" one at a time and as a batch, then look them
+// all up again in a shuffled order, one at a time and as a batch
+void __mt_bench_batch_paths()
+{
+    const size_t num_paths = 1000000;
+    char** paths = malloc(num_paths * sizeof *paths);
+    mt_branch** branches = malloc(num_paths * sizeof *branches);
+    for(size_t i=0; i<num_paths; i++)
+    {
+        paths[i] = malloc(48);
+        sprintf(paths[i], "tenants/%ld/sessions/%ld/state", i / 1000, i % 1000);
+    }
+
+    double create_time[2], lookup_time[2];
+    size_t found[2] = { 0, 0 };
+    for(int batch=0; batch<2; batch++)
+    {
+        mt_branch* root = mt_create_root();
+        double start = __mt_bench_seconds();
+        if(batch) mt_create_paths(root, paths, num_paths, branches);
+        else for(size_t i=0; i<num_paths; i++) branches[i] = mt_create_path(root, paths[i]);
+        create_time[batch] = __mt_bench_seconds() - start;
+
+        // Shuffle the paths, the same way for both
+        char** shuffled = malloc(num_paths * sizeof *shuffled);
+        memcpy(shuffled, paths, num_paths * sizeof *shuffled);
+        unsigned long long seed = 88172645463325252ULL;
+        for(size_t i=num_paths-1; i>0; i--)
+        {
+            seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+            size_t j = seed % (i + 1);
+            char* swap = shuffled[i]; shuffled[i] = shuffled[j]; shuffled[j] = swap;
+        }
+
+        start = __mt_bench_seconds();
+        if(batch) found[batch] = mt_get_by_paths(root, shuffled, num_paths, branches);
+        else for(size_t i=0; i<num_paths; i++) found[batch] += ((branches[i] = mt_get_by_path(root, shuffled[i])) != NULL);
+        lookup_time[batch] = __mt_bench_seconds() - start;
+
+        free(shuffled);
+        mt_destroy_tree(root);
+    }
+
+    printf("Creating %ld paths: %.1f ms one at a time, %.1f ms as a batch (%.1fx)\n", num_paths,
+        create_time[0] * 1000, create_time[1] * 1000, create_time[0] / create_time[1]);
+    printf("Looking up %ld shuffled paths: %.1f ms one at a time, %.1f ms as a batch (%.1fx), %ld and %ld found\n", num_paths,
+        lookup_time[0] * 1000, lookup_time[1] * 1000, lookup_time[0] / lookup_time[1], found[0], found[1]);
+
+    for(size_t i=0; i<num_paths; i++) free(paths[i]);
+    free(paths);
+    free(branches);
+}
+
+// Resolve the same set of deep paths over and over, with and without the path cache
+void __mt_bench_path_cache()
+{
+    const size_t num_paths = 4096;
+    const int repeats = 100;
+    char** paths = malloc(num_paths * sizeof *paths);
+
+    mt_branch* root = __mt_bench_build_tree(1000);
+    for(size_t i=0; i<num_paths; i++)
+    {
+        paths[i] = malloc(128);
+        sprintf(paths[i], "/branch_%ld/leaf_%ld/settings/values/current", i % 1000, (i * 7) % 1000);
+        mt_create_path(root, paths[i]);
+    }
+
+    for(int cached=0; cached<2; cached++)
+    {
+        mt_set_path_cache_size(root, cached ? num_paths * 2 : 0);
+
+        size_t found = 0;
+        double start = __mt_bench_seconds();
+        for(int r=0; r<repeats; r++)
+        {
+            for(size_t i=0; i<num_paths; i++) found += (mt_get_by_path(root, paths[i]) != NULL);
+        }
+        double elapsed = __mt_bench_seconds() - start;
+
+        mt_path_cache_stats stats;
+        mt_get_path_cache_stats(root, &stats);
+        printf("Path lookups %s: %.0f ns per lookup (%ld found, %ld hits, %ld misses)\n", cached ? "with cache" : "without cache",
+            elapsed * 1e9 / (num_paths * repeats), found, stats.hits, stats.misses);
+    }
+
+    for(size_t i=0; i<num_paths; i++) free(paths[i]);
+    free(paths);
+    mt_destroy_tree(root);
+}
+
+// Look branches up by id, through `mt_get_by_id` and through {id} path segments
+void __mt_bench_id_lookup()
+{
+    const size_t num_lookups = 1000000;
+    mt_branch* root = __mt_bench_build_tree(1000);
+    mt_set_path_cache_size(root, 0);    // Time the lookups themselves
+
+    size_t found = 0;
+    double start = __mt_bench_seconds();
+    for(size_t i=0; i<num_lookups; i++) found += (mt_get_by_id(root, (i * 7919) % 1001001) != NULL);
+    double by_id = __mt_bench_seconds() - start;
+
+    char path[64];
+    start = __mt_bench_seconds();
+    for(size_t i=0; i<num_lookups; i++)
+    {
+        mt_branch* leaf = mt_get_by_id(root, 2 + (i * 7919) % 1000000);
+        if(leaf->parent == root) continue;
+        sprintf(path, "{%ld}/{%ld}", leaf->parent->id, leaf->id);
+        found += (mt_get_by_path(root, path) == leaf);
+    }
+    double by_path = __mt_bench_seconds() - start;
+
+    start = __mt_bench_seconds();
+    size_t max_id = 0;
+    for(int i=0; i<1000; i++) max_id += mt_find_max_id(root, 0, -1);
+    double max_ids = __mt_bench_seconds() - start;
+
+    printf("Id lookups: %.0f ns by id, %.0f ns by {id}/{id} path, %.0f ns for the maximum id (%ld found)\n",
+        by_id * 1e9 / num_lookups, by_path * 1e9 / num_lookups, max_ids * 1e9 / 1000, found);
+    mt_destroy_tree(root);
+}
+
+// Look up the children of a very wide branch by label, with and without its child label index
+void __mt_bench_wide_lookup()
+{
+    const size_t width = 100000;
+    const size_t num_lookups = 1000000;
+    char label[32];
+
+    mt_branch* root = mt_create_root();
+    mt_set_path_cache_size(root, 0);    // Time the lookups themselves
+    mt_branch* wide = mt_create_branch(root, "wide");
+    for(size_t i=0; i<width; i++)
+    {
+        snprintf(label, sizeof label, "child_%ld", i);
+        mt_create_branch(wide, label);
+    }
+
+    for(int indexed=1; indexed>=0; indexed--)
+    {
+        if(!indexed) __mt_child_index_release(wide);   // Fall back to searching the siblings
+        size_t lookups = indexed ? num_lookups : num_lookups / 1000;
+
+        size_t found = 0;
+        double start = __mt_bench_seconds();
+        for(size_t i=0; i<lookups; i++)
+        {
+            snprintf(label, sizeof label, "child_%ld", (i * 7919) % width);
+            found += (mt_get_by_path(wide, label) != NULL);
+        }
+        double elapsed = __mt_bench_seconds() - start;
+
+        printf("Lookups among %ld children %s: %.0f ns per lookup (%ld found)\n", width,
+            indexed ? "with label index" : "without label index", elapsed * 1e9 / lookups, found);
+    }
+
+    mt_destroy_tree(root);
+}
+
+// Copy a small payload into every leaf of a million-branch tree and read them all back, once with payloads
+// small enough to be stored inside the branches and once with payloads just too large for that
+void __mt_bench_small_data()
+{
+    mt_branch* root = __mt_bench_build_tree(1000);
+    size_t sizes[2] = { 8, MT_INLINE_DATA_SIZE + 8 };
+    unsigned char payload[MT_INLINE_DATA_SIZE + 8] = { 1 };
+
+    for(int s=0; s<2; s++)
+    {
+        double start = __mt_bench_seconds();
+        for(mt_branch* branch = root->first_child; branch != NULL; branch = branch->next_sibling)
+        {
+            for(mt_branch* leaf = branch->first_child; leaf != NULL; leaf = leaf->next_sibling) mt_set_data_copy(leaf, payload, sizes[s]);
+        }
+        double set = __mt_bench_seconds() - start;
+
+        size_t total = 0;
+        start = __mt_bench_seconds();
+        for(mt_branch* branch = root->first_child; branch != NULL; branch = branch->next_sibling)
+        {
+            for(mt_branch* leaf = branch->first_child; leaf != NULL; leaf = leaf->next_sibling) total += *(unsigned char*)leaf->data;
+        }
+        double read = __mt_bench_seconds() - start;
+
+        printf("%ld-byte payloads %s: %.1f ms to copy into 1M branches, %.1f ms to read back (%ld)\n", sizes[s],
+            sizes[s] <= MT_INLINE_DATA_SIZE ? "stored inline" : "on the heap", set * 1e3, read * 1e3, total);
+
+        for(mt_branch* branch = root->first_child; branch != NULL; branch = branch->next_sibling)
+        {
+            for(mt_branch* leaf = branch->first_child; leaf != NULL; leaf = leaf->next_sibling) mt_set_data_copy(leaf, NULL, 0);
+        }
+    }
+
+    mt_destroy_tree(root);
+}
+
+// Attach a thousand 1 MB buffers to branches, first by copying them and then by handing them over
+void __mt_bench_data_handover()
+{
+    const int num_buffers = 1000;
+    const size_t buffer_size = 1000000;
+    char** buffers = malloc(num_buffers * sizeof *buffers);
+    for(int i=0; i<num_buffers; i++) buffers[i] = calloc(1, buffer_size);
+
+    mt_branch* root = mt_create_root();
+    mt_branch* copied = mt_create_branch(root, "copied");
+    mt_branch* owned = mt_create_branch(root, "owned");
+    for(int i=0; i<num_buffers; i++)
+    {
+        mt_create_branch(copied, "buffer");
+        mt_create_branch(owned, "buffer");
+    }
+
+    double start = __mt_bench_seconds();
+    int i = 0;
+    for(mt_branch* branch = copied->first_child; branch != NULL; branch = branch->next_sibling) mt_set_data_copy(branch, buffers[i++], buffer_size);
+    double copy_time = __mt_bench_seconds() - start;
+
+    start = __mt_bench_seconds();
+    i = 0;
+    for(mt_branch* branch = owned->first_child; branch != NULL; branch = branch->next_sibling) mt_set_data_owned(branch, buffers[i++], buffer_size);
+    double handover_time = __mt_bench_seconds() - start;
+
+    printf("Attaching %d buffers of 1 MB: %.1f ms by copying, %.3f ms by handing them over\n", num_buffers, copy_time * 1e3, handover_time * 1e3);
+    mt_destroy_tree(root);      // Frees the buffers handed over, as well as the copies
+    free(buffers);
+}
+
+// Save a generated tree of ten million branches to a buffer and load it back, reporting the throughput of each
+void __mt_bench_serialization()
+{
+    const size_t width = 3163;      // width * width is just over ten million branches
+    mt_branch* root = __mt_bench_build_tree(width);
+    size_t value = 0;
+    for(mt_branch* branch = root->first_child; branch != NULL; branch = branch->next_sibling)
+    {
+        mt_set_data_type(branch, "record");
+        for(mt_branch* leaf = branch->first_child; leaf != NULL; leaf = leaf->next_sibling)
+        {
+            value++;
+            mt_set_data_copy(leaf, &value, sizeof value);
+        }
+    }
+    char large_payload[64] = "A payload too large to be stored inside the branch";
+    mt_set_data_copy(root->first_child, large_payload, sizeof large_payload);
+
+    double start = __mt_bench_seconds();
+    size_t file_size = mt_get_tree_file_size(root);
+    double sized = __mt_bench_seconds();
+
+    char* buffer = malloc(file_size);
+    memset(buffer, 0, file_size);   // Fault the pages in, so that only writing is timed
+    double write_start = __mt_bench_seconds();
+    size_t written = mt_write_tree_to_buffer(root, buffer, file_size);
+    double write_time = __mt_bench_seconds() - write_start;
+    size_t num_branches = mt_get_num_descendants(root, 0, -1) + 1;
+    mt_destroy_tree(root);
+
+    double load_start = __mt_bench_seconds();
+    mt_branch* loaded = mt_load_tree_from_buffer(NULL, buffer, written);
+    double load_time = __mt_bench_seconds() - load_start;
+
+    printf("Serialised %ld branches to %.1f MB: sized in %.0f ms, written at %.0f MB/s (%.0f ms), loaded at %.0f MB/s (%.0f ms)\n",
+        num_branches, written / 1e6, (sized - start) * 1e3, written / 1e6 / write_time, write_time * 1e3,
+        written / 1e6 / load_time, load_time * 1e3);
+
+    mt_destroy_tree(loaded);
+
+    // Open the same snapshot from a file, mapping it instead of copying it
+    char* filename = "bench_megatree_snapshot.tmp";
+    FILE* file = fopen(filename, "wb");
+    if(file == NULL || fwrite(buffer, 1, written, file) != written) { printf("Could not write %s\n", filename); exit(1); }
+    fclose(file);
+    free(buffer);
+
+    double map_start = __mt_bench_seconds();
+    mt_branch* mapped = mt_map_tree_from_file(NULL, filename);
+    double map_time = __mt_bench_seconds() - map_start;
+
+    double read_start = __mt_bench_seconds();
+    size_t total = 0;
+    for(mt_branch* branch = mapped->first_child; branch != NULL; branch = branch->next_sibling)
+    {
+        for(mt_branch* leaf = branch->first_child; leaf != NULL; leaf = leaf->next_sibling) total += *(size_t*)leaf->data;
+    }
+    double read_time = __mt_bench_seconds() - read_start;
+
+    printf("Mapped the same %.1f MB snapshot from a file in %.0f ms, then read every payload in %.0f ms (%ld)\n",
+        written / 1e6, map_time * 1e3, read_time * 1e3, total);
+    mt_destroy_tree(mapped);
+
+    // Open it lazily, and only decode the branches on the way to a thousand leaves
+    double lazy_start = __mt_bench_seconds();
+    mapped = mt_map_tree_lazily_from_file(NULL, filename);
+    double lazy_time = __mt_bench_seconds() - lazy_start;
+
+    double lookup_start = __mt_bench_seconds();
+    char path[64];
+    total = 0;
+    for(size_t i=0; i<1000; i++)
+    {
+        snprintf(path, sizeof path, "branch_%ld/leaf_%ld", (i * 7919) % width, (i * 104729) % width);
+        total += *(size_t*)mt_get_by_path(mapped, path)->data;
+    }
+    double lookup_time = __mt_bench_seconds() - lookup_start;
+
+    printf("Mapped it lazily in %.2f ms, then found 1000 leaves by path in %.0f ms (%ld)\n", lazy_time * 1e3, lookup_time * 1e3, total);
+    mt_destroy_tree(mapped);
+    remove(filename);
+}
+
+// Compare loading and mapping a snapshot made of fewer, larger payloads, where copying the data dominates
+void __mt_bench_mapped_payloads()
+{
+    const size_t num_payloads = 10000;
+    const size_t payload_size = 65536;
+    char* payload = calloc(1, payload_size);
+    mt_branch* root = mt_create_root();
+    for(size_t i=0; i<num_payloads; i++) mt_set_data_copy(mt_create_branch(root, "payload"), payload, payload_size);
+    free(payload);
+
+    size_t file_size = mt_get_tree_file_size(root);
+    char* buffer = malloc(file_size);
+    mt_write_tree_to_buffer(root, buffer, file_size);
+    mt_destroy_tree(root);
+
+    char* filename = "bench_megatree_snapshot.tmp";
+    FILE* file = fopen(filename, "wb");
+    if(file == NULL || fwrite(buffer, 1, file_size, file) != file_size) { printf("Could not write %s\n", filename); exit(1); }
+    fclose(file);
+
+    double load_start = __mt_bench_seconds();
+    mt_branch* loaded = mt_load_tree_from_buffer(NULL, buffer, file_size);
+    double load_time = __mt_bench_seconds() - load_start;
+    mt_destroy_tree(loaded);
+    free(buffer);
+
+    double map_start = __mt_bench_seconds();
+    mt_branch* mapped = mt_map_tree_from_file(NULL, filename);
+    double map_time = __mt_bench_seconds() - map_start;
+    mt_destroy_tree(mapped);
+    remove(filename);
+
+    printf("Opening %ld payloads of %ld KB (%.0f MB): %.1f ms loaded from a buffer, %.2f ms mapped from a file\n",
+        num_payloads, payload_size / 1024, file_size / 1e6, load_time * 1e3, map_time * 1e3);
+}
+
+// Time saving `root` to a file and loading it again, through a buffer holding the whole snapshot and then by streaming it.
+// `root` is destroyed afterwards
+void __mt_bench_time_streaming(mt_branch* root, char* description)
+{
+#if !defined(_WIN32)
+    char* filename = "bench_megatree_snapshot.tmp";
+
+    double start = __mt_bench_seconds();
+    size_t file_size = mt_get_tree_file_size(root);
+    char* buffer = malloc(file_size);
+    mt_write_tree_to_buffer(root, buffer, file_size);
+    FILE* file = fopen(filename, "wb");
+    if(file == NULL || fwrite(buffer, 1, file_size, file) != file_size) { printf("Could not write %s\n", filename); exit(1); }
+    fclose(file);
+    free(buffer);
+    double buffered_save = __mt_bench_seconds() - start;
+
+    start = __mt_bench_seconds();
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    size_t streamed_size = mt_write_tree_to_fd(root, fd);
+    close(fd);
+    double streamed_save = __mt_bench_seconds() - start;
+    if(streamed_size != file_size) { printf("Streamed %ld bytes instead of %ld\n", streamed_size, file_size); exit(1); }
+    mt_destroy_tree(root);
+
+    start = __mt_bench_seconds();
+    buffer = malloc(file_size);
+    file = fopen(filename, "rb");
+    if(file == NULL || fread(buffer, 1, file_size, file) != file_size) { printf("Could not read %s\n", filename); exit(1); }
+    fclose(file);
+    mt_branch* loaded = mt_load_tree_from_buffer(NULL, buffer, file_size);
+    free(buffer);
+    double buffered_load = __mt_bench_seconds() - start;
+    mt_destroy_tree(loaded);
+
+    start = __mt_bench_seconds();
+    fd = open(filename, O_RDONLY);
+    loaded = mt_load_tree_from_fd(NULL, fd);
+    close(fd);
+    double streamed_load = __mt_bench_seconds() - start;
+    mt_destroy_tree(loaded);
+    remove(filename);
+
+    printf("Saving and loading %.0f MB of %s: through a %.0f MB buffer %.0f + %.0f ms, streamed through %d KB %.0f + %.0f ms\n",
+        file_size / 1e6, description, file_size / 1e6, buffered_save * 1e3, buffered_load * 1e3,
+        MT_STREAM_BUFFER_SIZE / 1024, streamed_save * 1e3, streamed_load * 1e3);
+#endif
+}
+
+// Compare saving and loading snapshots through a buffer holding all of them with streaming them through a file descriptor
+void __mt_bench_streaming()
+{
+    mt_branch* root = __mt_bench_build_tree(3163);
+    size_t value = 0;
+    for(mt_branch* branch = root->first_child; branch != NULL; branch = branch->next_sibling)
+    {
+        for(mt_branch* leaf = branch->first_child; leaf != NULL; leaf = leaf->next_sibling) mt_set_data_copy(leaf, &value, sizeof value);
+    }
+    __mt_bench_time_streaming(root, "ten million small branches");
+
+    const size_t payload_size = 65536;
+    char* payload = calloc(1, payload_size);
+    root = mt_create_root();
+    for(size_t i=0; i<10000; i++) mt_set_data_copy(mt_create_branch(root, "payload"), payload, payload_size);
+    free(payload);
+    __mt_bench_time_streaming(root, "64 KB payloads");
+}
+
+// Change a hundred leaves of a ten million branch tree, and compare saving a delta of the changes with saving the
+// whole tree again, then fold the delta back into a full snapshot
+void __mt_bench_deltas()
+{
+    const size_t width = 3163;
+    mt_branch* root = __mt_bench_build_tree(width);
+    size_t value = 0;
+    for(mt_branch* branch = root->first_child; branch != NULL; branch = branch->next_sibling)
+    {
+        for(mt_branch* leaf = branch->first_child; leaf != NULL; leaf = leaf->next_sibling) mt_set_data_copy(leaf, &value, sizeof value);
+    }
+
+    double start = __mt_bench_seconds();
+    size_t file_size = mt_get_tree_file_size(root);
+    char* base = malloc(file_size);
+    mt_write_tree_to_buffer(root, base, file_size);
+    double full_time = __mt_bench_seconds() - start;
+    mt_mark_clean(root);
+
+    char path[64];
+    for(size_t i=0; i<100; i++)
+    {
+        value = i;
+        snprintf(path, sizeof path, "branch_%ld/leaf_%ld", (i * 7919) % width, (i * 104729) % width);
+        mt_set_data_copy(mt_get_by_path(root, path), &value, sizeof value);
+    }
+
+    start = __mt_bench_seconds();
+    size_t delta_size = mt_get_delta_file_size(root);
+    void* delta = malloc(delta_size);
+    mt_write_delta_to_buffer(root, delta, delta_size);
+    double delta_time = __mt_bench_seconds() - start;
+    mt_destroy_tree(root);
+
+    start = __mt_bench_seconds();
+    mt_bench_buffer compacted = {0};
+    mt_compact_snapshot(base, file_size, &delta, &delta_size, 1, __mt_bench_buffer_write, &compacted);
+    double compact_time = __mt_bench_seconds() - start;
+
+    printf("Saving 100 changed leaves of %ld: the whole %.0f MB tree in %.0f ms, a delta of %.0f KB in %.2f ms; compacted in %.0f ms\n",
+        width * width, file_size / 1e6, full_time * 1e3, delta_size / 1e3, delta_time * 1e3, compact_time * 1e3);
+    free(compacted.buffer);
+    free(delta);
+    free(base);
+}
+
+// Make changes to a tree recording them in a journal, syncing every change and then in groups over wider commit windows,
+// and then replay the journal onto a new tree
+void __mt_bench_journal()
+{
+    const size_t num_changes = 20000;
+    const double windows[] = {0, 0.001, 0.01, 0.1};
+    char* filename = "bench_megatree_journal.tmp";
+
+    for(size_t w=0; w<sizeof windows / sizeof windows[0]; w++)
+    {
+        remove(filename);
+        mt_branch* root = mt_create_root();
+        mt_open_journal(root, filename, windows[w]);
+        mt_branch* branch = mt_create_branch(root, "branch");
+
+        // Syncing every change is slow enough to need fewer of them
+        size_t changes = (windows[w] > 0) ? num_changes : num_changes / 10;
+        double start = __mt_bench_seconds();
+        for(size_t i=0; i<changes; i++)
+        {
+            if(i % 4 == 0) branch = mt_create_branch(root, "branch");
+            else mt_set_data_copy(branch, &i, sizeof i);
+        }
+        mt_sync_journal(root);
+        double seconds = __mt_bench_seconds() - start;
+
+        mt_journal_stats stats;
+        mt_get_journal_stats(root, &stats);
+        printf("Journalling %ld changes with a %g ms commit window: %.0f changes/s, %ld syncs\n",
+            changes, windows[w] * 1e3, changes / seconds, stats.syncs);
+        mt_destroy_tree(root);
+    }
+
+    mt_branch* root = mt_create_root();
+    double start = __mt_bench_seconds();
+    size_t replayed = mt_replay_journal(root, filename);
+    printf("Replaying %ld journal records: %.1f ms\n", replayed, (__mt_bench_seconds() - start) * 1e3);
+    mt_destroy_tree(root);
+    remove(filename);
+}
+
+#if INTERFACE
+typedef struct mt_bench_thread     // One thread of `__mt_bench_concurrent_reads`
+{
+    mt_branch* root;
+    size_t width;
+    void* lock;                     // A `pthread_mutex_t` held around every read and write, or NULL to read without locks
+    int* stop;
+    size_t operations;
+    unsigned int seed;
+} mt_bench_thread;
+#endif
+
+// Look leaves up by path until stopped, holding `lock` around each lookup if there is one
+void* __mt_bench_reader_thread(void* context)
+{
+    mt_bench_thread* thread = context;
+    mt_reader* reader = (thread->lock == NULL) ? mt_register_reader(thread->root) : NULL;
+    char path[64];
+    while(!__atomic_load_n(thread->stop, __ATOMIC_ACQUIRE))
+    {
+        thread->seed = thread->seed * 1103515245 + 12345;
+        snprintf(path, sizeof path, "branch_%u/leaf_%u", (thread->seed >> 8) % (unsigned)thread->width, (thread->seed >> 4) % (unsigned)thread->width);
+
+        if(reader != NULL) mt_begin_read(reader);
+        else pthread_mutex_lock(thread->lock);
+        size_t value = 0;
+        mt_get_data_copy(mt_get_by_path(thread->root, path), &value, sizeof value);
+        if(reader != NULL) mt_end_read(reader);
+        else pthread_mutex_unlock(thread->lock);
+        thread->operations++;
+    }
+    if(reader != NULL) mt_unregister_reader(reader);
+    return NULL;
+}
+
+// Change data, and create and delete branches, until stopped, holding `lock` around each change if there is one
+void* __mt_bench_writer_thread(void* context)
+{
+    mt_bench_thread* thread = context;
+    mt_branch* scratch = mt_get_by_path(thread->root, "scratch");
+    while(!__atomic_load_n(thread->stop, __ATOMIC_ACQUIRE))
+    {
+        if(thread->lock != NULL) pthread_mutex_lock(thread->lock);
+        size_t value = thread->operations;
+        mt_set_data_copy(mt_get_nth_child(mt_get_nth_child(thread->root, value % thread->width), value % 7), &value, sizeof value);
+        mt_branch* added = mt_create_branch(scratch, "added");
+        if(thread->operations % 2) mt_delete_branch(added);
+        if(mt_get_num_children(scratch) > 1000) mt_delete_branch(scratch->first_child);
+        if(thread->lock != NULL) pthread_mutex_unlock(thread->lock);
+        thread->operations++;
+    }
+    return NULL;
+}
+
+// Look paths up from a growing number of threads while one more thread changes the tree, first with every call
+// under one global lock and then with lock-free reads, to show how each scales
+void __mt_bench_concurrent_reads()
+{
+    const size_t width = 1000;
+    const int max_readers = 8;
+    mt_branch* root = __mt_bench_build_tree(width);
+    mt_create_branch(root, "scratch");
+    pthread_mutex_t lock;
+    pthread_mutex_init(&lock, NULL);
+
+    for(int lock_free=0; lock_free<2; lock_free++)
+    {
+        if(lock_free) mt_enable_concurrent_reads(root);
+        for(int num_readers=1; num_readers<=max_readers; num_readers*=2)
+        {
+            int stop = 0;
+            mt_bench_thread threads[9];     // The writer, then the readers
+            pthread_t handles[9];
+            for(int i=0; i<=num_readers; i++)
+            {
+                threads[i] = (mt_bench_thread){ root, width, lock_free ? NULL : &lock, &stop, 0, 1234567u * (i + 1) };
+                pthread_create(&handles[i], NULL, i ? __mt_bench_reader_thread : __mt_bench_writer_thread, &threads[i]);
+            }
+
+            struct timespec duration = { 0, 500000000 };
+            nanosleep(&duration, NULL);
+            __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+            size_t reads = 0;
+            for(int i=0; i<=num_readers; i++)
+            {
+                pthread_join(handles[i], NULL);
+                if(i) reads += threads[i].operations;
+            }
+            printf("%s, %d reader threads and a writer: %.2f M lookups/s, %.0f k changes/s\n", lock_free ? "Lock-free reads" : "One global lock",
+                num_readers, reads / 0.5 / 1e6, threads[0].operations / 0.5 / 1e3);
+        }
+    }
+
+    mt_disable_concurrent_reads(root);
+    pthread_mutex_destroy(&lock);
+    mt_destroy_tree(root);
+}
+
+// Fork a template of 10,000 branches for each of many tenants, as deep copies into another tree and as copies
+// within the same tree that share their sub-branches, and then change one setting of each tenant
+void __mt_bench_copy_on_write()
+{
+    const size_t width = 100, deep_copies = 100, shared_copies = 10000;
+    char label[32];
+    mt_branch* root = mt_create_root();
+    mt_branch* template = mt_create_branch(root, "template");
+    for(size_t i=0; i<width; i++)
+    {
+        snprintf(label, sizeof label, "section_%ld", i);
+        mt_branch* section = mt_create_branch(template, label);
+        for(size_t j=0; j<width; j++)
+        {
+            snprintf(label, sizeof label, "setting_%ld", j);
+            mt_set_data_copy(mt_create_branch(section, label), &j, sizeof j);
+        }
+    }
+
+    mt_branch* other_root = mt_create_root();
+    double start = __mt_bench_seconds();
+    for(size_t i=0; i<deep_copies; i++) mt_copy_branch(template, other_root);
+    double deep_time = (__mt_bench_seconds() - start) / deep_copies;
+    size_t deep_branches = (mt_get_num_branches(other_root) - 1) / deep_copies;
+    mt_destroy_tree(other_root);
+
+    mt_branch* tenants = mt_create_branch(root, "tenants");
+    size_t branches_before = mt_get_num_branches(root);
+    start = __mt_bench_seconds();
+    for(size_t i=0; i<shared_copies; i++) mt_copy_branch(template, tenants);
+    double shared_time = (__mt_bench_seconds() - start) / shared_copies;
+    size_t shared_branches = mt_get_num_branches(root) - branches_before;
+
+    char path[64];
+    size_t i = 0;
+    start = __mt_bench_seconds();
+    for(mt_branch* tenant = mt_get_first_child(tenants); tenant != NULL; tenant = tenant->next_sibling, i++)
+    {
+        snprintf(path, sizeof path, "section_%ld/setting_%ld", (i * 7919) % width, (i * 104729) % width);
+        mt_set_data_copy(mt_get_by_path(tenant, path), &i, sizeof i);
+    }
+    double change_time = (__mt_bench_seconds() - start) / shared_copies;
+    size_t changed_branches = mt_get_num_branches(root) - branches_before - shared_branches;
+
+    printf("Copying a template of %ld branches: deep copies %.2f ms and %ld branches each, shared copies %.2f us and %.0f branches each\n",
+        deep_branches, deep_time * 1e3, deep_branches, shared_time * 1e6, (double)shared_branches / shared_copies);
+    printf("Changing one setting of each of %ld shared copies: %.1f us and %.0f branches created each\n",
+        shared_copies, change_time * 1e6, (double)changed_branches / shared_copies);
+    mt_destroy_tree(root);
+}
+
+// Move subtrees of a thousand branches back and forth between two parents, by relinking them and, with concurrent
+// reads enabled, by copying them and deleting the originals
+void __mt_bench_moves()
+{
+    const size_t width = 1000, moves = 1000;
+    mt_branch* root = __mt_bench_build_tree(width);
+    mt_branch* parents[2] = { mt_create_branch(root, "left"), mt_create_branch(root, "right") };
+    for(size_t i=0; i<10; i++) mt_move_branch(mt_get_first_child(root), parents[0]);
+
+    for(int concurrent=0; concurrent<2; concurrent++)
+    {
+        if(concurrent) mt_enable_concurrent_reads(root);
+        size_t count = concurrent ? moves / 100 : moves;
+        double start = __mt_bench_seconds();
+        for(size_t i=0; i<count; i++) mt_move_branch(mt_get_first_child(parents[i % 2]), parents[(i + 1) % 2]);
+        double elapsed = (__mt_bench_seconds() - start) / count;
+        printf("Moving a subtree of %ld branches %s: %.2f us each\n", width + 1, concurrent ? "by copying it, with concurrent reads" : "by relinking it", elapsed * 1e6);
+    }
+
+    mt_disable_concurrent_reads(root);
+    mt_destroy_tree(root);
+}
+
+// Run every benchmark
+void __mt_run_benchmarks()
+{
+    __mt_bench_bulk_build();
+    __mt_bench_traversal();
+    __mt_bench_traversal_engine();
+    __mt_bench_totals();
+    __mt_bench_parallel_queries();
+    __mt_bench_label_index();
+    __mt_bench_data_index();
+    __mt_bench_path_cache();
+    __mt_bench_compiled_paths();
+    __mt_bench_batch_paths();
+    __mt_bench_id_lookup();
+    __mt_bench_wide_lookup();
+    __mt_bench_small_data();
+    __mt_bench_data_handover();
+    __mt_bench_serialization();
+    __mt_bench_mapped_payloads();
+    __mt_bench_streaming();
+    __mt_bench_deltas();
+    __mt_bench_journal();
+    __mt_bench_concurrent_reads();
+    __mt_bench_copy_on_write();
+    __mt_bench_moves();
+}
@@ -1,15 +1,364 @@
+typedef struct mt_bench_buffer mt_bench_buffer;
+typedef struct mt_bench_thread mt_bench_thread;
 typedef struct mt_branch mt_branch;
 typedef struct mt_list mt_list;
-struct mt_list {
-    mt_list* prev;                 // The previous item, or NULL if this is the first item
-    mt_list* next;                 // The next item, or NULL if this is the last item
+typedef struct mt_slab mt_slab;
+typedef struct mt_pool mt_pool;
+typedef struct mt_large_string mt_large_string;
+typedef struct mt_path_cache_entry mt_path_cache_entry;
+typedef struct mt_path_cache mt_path_cache;
+typedef struct mt_path_cache_stats mt_path_cache_stats;
+typedef struct mt_id_index_slot mt_id_index_slot;
+typedef struct mt_id_index mt_id_index;
+typedef struct mt_interned_string mt_interned_string;
+typedef struct mt_string_table mt_string_table;
+typedef struct mt_string_stats mt_string_stats;
+typedef struct mt_child_index_slot mt_child_index_slot;
+typedef struct mt_child_index mt_child_index;
+typedef struct mt_label_postings mt_label_postings;
+typedef struct mt_label_index mt_label_index;
+typedef struct mt_data_index_node mt_data_index_node;
+typedef struct mt_data_index mt_data_index;
+typedef struct mt_mapping mt_mapping;
+typedef struct mt_lazy_snapshot mt_lazy_snapshot;
+typedef struct mt_unloaded_slot mt_unloaded_slot;
+typedef struct mt_unloaded_index mt_unloaded_index;
+typedef struct mt_reader mt_reader;
+typedef struct mt_retired mt_retired;
+typedef struct mt_reclaimer mt_reclaimer;
+typedef struct mt_tree mt_tree;
+typedef struct mt_allocation_stats mt_allocation_stats;
+typedef struct mt_path_step mt_path_step;
+typedef struct mt_path_steps mt_path_steps;
+typedef struct mt_batch_path mt_batch_path;
+typedef struct mt_path_segment mt_path_segment;
+typedef struct mt_path mt_path;
+typedef struct mt_label_matches mt_label_matches;
+typedef struct mt_copy_cursor mt_copy_cursor;
+typedef struct mt_unshare_walk mt_unshare_walk;
+typedef struct mt_journal_stats mt_journal_stats;
+typedef struct mt_parallel_task mt_parallel_task;
+typedef struct mt_parallel_queue mt_parallel_queue;
+typedef struct mt_parallel_job mt_parallel_job;
+typedef struct mt_parallel_worker mt_parallel_worker;
+typedef struct mt_serialize_plan mt_serialize_plan;
+typedef struct mt_delta_plan mt_delta_plan;
+typedef struct mt_tree_checker mt_tree_checker;
+typedef struct mt_stream_segment mt_stream_segment;
+typedef struct mt_stream_writer mt_stream_writer;
+typedef struct mt_stream_reader mt_stream_reader;
+typedef struct mt_test_stream mt_test_stream;
+typedef struct mt_test_reader mt_test_reader;
+#define MT_INLINE_DATA_SIZE 16      // Copied data of up to this many bytes is stored inside the branch instead of on the heap
+#define MT_DATA_NONE     0          // The branch has no data
+#define MT_DATA_INLINE   1          // `data` points at the branch's own `inline_data`
+#define MT_DATA_HEAP     2          // `data` is owned by the branch, and is freed with it. See `mt_set_data_owned`
+#define MT_DATA_EXTERNAL 3          // `data` belongs to the caller, see `mt_set_data_pointer`
+#define MT_DATA_MAPPED   4          // `data` lies in a read-only snapshot mapped by the tree, see `mt_map_tree_from_file`
+#define MT_BRANCH_UNLOADED 1        // The branch's children are still in a snapshot, and are loaded when they are first reached.
+                                    // See `mt_load_tree_lazily_from_buffer`
+#define MT_BRANCH_CHANGED 2         // The branch's label, data or list of children has changed since the tree was last marked clean
+#define MT_BRANCH_CHANGED_BELOW 4   // Some descendant of the branch is MT_BRANCH_CHANGED. See `mt_write_delta_to_buffer`
+#define MT_BRANCH_VISITED 8         // Used while a delta is applied, to check that it names each branch only once
+#define MT_BRANCH_SHARING 16        // The branch is a copy whose children are still those of the branch it was copied from,
+                                    // and are copied when they are first reached. See `mt_copy_branch`
+#define MT_BRANCH_SHARED 32         // Copies may still be sharing the children of this branch
+#define MT_BRANCH_TOTALS_STALE 64   // The branch's cached totals have to be counted again, and so do its ancestors'. See `num_descendants`
+#define MT_BRANCH_WITHIN_QUERY 128  // Used while a label query runs, for branches known to be below the branch it is for
+#define MT_BRANCH_OUTSIDE_QUERY 256 // Used while a label query runs, for branches known not to be. See `__mt_label_matches_within`
+#define MT_BRANCH_SHARE_STAMP_SHIFT 9       // The rest of the bits hold the share epoch in which neither the branch
+#define MT_BRANCH_SHARE_STAMP_MAX 0x3fffff  // nor any ancestor was found to be MT_BRANCH_SHARED. See `__mt_unshare_path`
+#define MT_SLAB_SIZE (256 * 1024)  // Bytes requested from the heap each time a pool runs out of room
+#define MT_LABEL_SIZE_CLASSES 3    // Strings of up to 16, 32 and 64 bytes (including the terminator) are pooled
+#define MT_PATH_CACHE_DEFAULT_ENTRIES 1024  // The number of paths each tree can cache, unless changed with `mt_set_path_cache_size`
+#define MT_PATH_CACHE_WAYS 4               // The number of entries any one path could be stored in
+#define MT_ID_INDEX_RUN 16                // Consecutive ids kept together in the id index. The minimum capacity is a multiple
+#define MT_MAX_ID_STEPS 64                // Ids the maximum id steps down past when its branch is deleted, before it is left stale
+#define MT_CHILD_INDEX_THRESHOLD 32       // Branches with at least this many children index them by label
+#define MT_MAX_READERS 64                 // Threads that can be registered to read one tree at the same time
+#define MT_RECLAIM_THRESHOLD 1024         // Retired objects a writer collects before it tries to reclaim them
+#define MT_RETIRE_BRANCH 1                // A branch to give back to the tree's branch pool
+#define MT_RETIRE_STRING 2                // A string to give back with `__mt_tree_free_string`
+#define MT_RETIRE_MEMORY 3                // A heap block to `free`
+#if defined(_MSC_VER)
+#define MT_THREAD_LOCAL __declspec(thread)
+#else
+#define MT_THREAD_LOCAL __thread
+#endif
+#define MT_ERROR_MESSAGE_SIZE 256
+#define MT_VISIT_CONTINUE 0         // Carry on, visiting the branch's children next
+#define MT_VISIT_SKIP 1             // Carry on, without visiting the branch's children or calling `after_children` for it
+#define MT_VISIT_STOP 2             // End the traversal
+// Called for each branch visited by `mt_traverse`, with its depth below the branch the traversal started from.
+// Returns one of the MT_VISIT_ values
+typedef int mt_visit_function(mt_branch* branch, int depth, void* context);
+#if defined(__GNUC__)
+#define MT_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define MT_PREFETCH(address) ((void)(address))
+#endif
+#define MT_TOTALS_EAGER_DEPTH 32    // The number of ancestors whose totals are updated straight away when a branch changes
+#define MT_JOURNAL_MAGIC "MTJOURNL"
+#define MT_JOURNAL_VERSION 1
+#define MT_JOURNAL_HEADER_SIZE          16
+#define MT_JOURNAL_RECORD_SIZE          32
+#define MT_JOURNAL_RECORD_LENGTH        0   // u64: the size of the record, including its bytes
+#define MT_JOURNAL_RECORD_CHECKSUM      8   // u32: checksum of everything in the record after this field
+#define MT_JOURNAL_RECORD_TYPE          12  // u32: one of the MT_JOURNAL_ types below
+#define MT_JOURNAL_RECORD_ID            16  // u64: the id of the branch that changed
+#define MT_JOURNAL_RECORD_ARGUMENT      24  // u64: the parent's id for MT_JOURNAL_CREATE and MT_JOURNAL_MOVE, 1 if MT_JOURNAL_DATA_TYPE sets a type
+#define MT_JOURNAL_CREATE       1   // The branch was created as the last child of `argument`, with the bytes as its label
+#define MT_JOURNAL_LABEL        2   // The branch was relabelled with the bytes
+#define MT_JOURNAL_DATA_TYPE    3   // The branch's data type was set to the bytes, or removed if `argument` is 0
+#define MT_JOURNAL_DATA         4   // The branch's data was set to a copy of the bytes
+#define MT_JOURNAL_DELETE       5   // The branch and all of its sub-branches were deleted
+#define MT_JOURNAL_MOVE         6   // The branch and all of its sub-branches were moved to the end of the children of `argument`
+#define MT_JOURNAL_BUFFER_SIZE  4096        // Bytes kept for putting a record together. It grows to fit bigger records
+typedef struct mt_journal mt_journal;     // A journal that changes to a tree are being recorded in, defined below
+#define MT_PARALLEL_MIN_BRANCHES 65536     // Subtrees with fewer branches than this are not worth starting threads for
+#define MT_PARALLEL_TASK_BRANCHES 4096     // Branches with fewer descendants than this are walked by one thread
+#define MT_PARALLEL_MAX_THREADS 256
+#define MT_FILE_MAGIC "MEGATREE"
+#define MT_FILE_VERSION 1
+#define MT_FILE_HEADER_SIZE             64
+#define MT_FILE_HEADER_MAGIC            0   // 8 bytes: MT_FILE_MAGIC, without a terminator
+#define MT_FILE_HEADER_VERSION          8   // u32: MT_FILE_VERSION
+#define MT_FILE_HEADER_HEADER_SIZE      12  // u32: MT_FILE_HEADER_SIZE
+#define MT_FILE_HEADER_FILE_SIZE        16  // u64: the size of the whole file
+#define MT_FILE_HEADER_NUM_STRINGS      24  // u64: the number of strings
+#define MT_FILE_HEADER_STRINGS          32  // u64: offset of the string offsets
+#define MT_FILE_HEADER_NUM_BRANCHES     40  // u64: the number of branch records
+#define MT_FILE_HEADER_BRANCHES         48  // u64: offset of the first branch record
+#define MT_FILE_HEADER_DATA             56  // u64: offset of the data section
+#define MT_FILE_BRANCH_SIZE             48
+#define MT_FILE_BRANCH_ID               0   // u64: the branch's id
+#define MT_FILE_BRANCH_PARENT           8   // u64: index of the parent's record. The first record refers to itself
+#define MT_FILE_BRANCH_SUBTREE_END      16  // u64: index of the first record after this branch's descendants
+#define MT_FILE_BRANCH_LABEL            24  // u32: index of the label in the string offsets
+#define MT_FILE_BRANCH_DATA_TYPE        28  // u32: index of the data type plus one, or 0 if there is none
+#define MT_FILE_BRANCH_DATA_OFFSET      32  // u64: offset of the data, or 0 if there is none
+#define MT_FILE_BRANCH_DATA_SIZE        40  // u64: the size of the data in bytes
+#define MT_FILE_DATA_ALIGNMENT          16
+// A delta holds the changes made to a tree since an earlier snapshot of it, see `mt_write_delta_to_buffer`.
+// It is laid out in the same way, but its records may also keep a branch of the earlier snapshot as it is
+#define MT_DELTA_MAGIC "MEGADLTA"
+#define MT_FILE_LABEL_KEPT              0xffffffff  // In place of a label: keep the branch with this id as it is
+// Streams. A writer function is handed the bytes of a serialised tree in order, and a reader function is asked for them in order
+typedef int mt_write_function(void* context, void* data, size_t length);          // Returns 1 if all `length` bytes were written, 0 if not
+typedef size_t mt_read_function(void* context, void* out_data, size_t capacity);  // Returns the number of bytes read, or 0 at the end or on error
+#define MT_STREAM_BUFFER_SIZE   65536   // Bytes staged before they are written, and bytes of records read at a time
+#define MT_STREAM_GATHER_SIZE   4096    // Payloads at least this big are written from where they are instead of being staged
+#define MT_STREAM_SEGMENTS      64      // The most pieces gathered into one write
+struct mt_bench_buffer {
+    char* buffer;
+    size_t length;
+    size_t capacity;
+};
+struct mt_child_index_slot {
+    char* label;                   // The interned label, kept here so that probing doesn't touch the children
+    mt_branch* head;               // The first child with this label, or NULL if the slot is empty
+    mt_branch* tail;               // The last child with this label
+};
+struct mt_child_index {
+    mt_child_index* prev;          // The previous index belonging to the same tree, or NULL
+    mt_child_index* next;          // The next index belonging to the same tree, or NULL
+
+    mt_child_index_slot* slots;    // `capacity` slots
+    size_t capacity;               // The number of slots. Always a power of 2
+    size_t count;                  // The number of distinct labels
+};
+struct mt_slab {
+    mt_slab* next;                 // The previously allocated slab, or NULL if this is the first one
+    size_t used;                   // The number of objects handed out from this slab so far
+};
+struct mt_pool {
+    size_t object_size;            // The size of every object in this pool, in bytes
+    size_t objects_per_slab;       // How many objects fit in one slab
+    mt_slab* slabs;                // The most recently allocated slab, or NULL if none have been allocated
+
+    void* free_list;               // Objects that have been freed, linked together through their first word
+    size_t objects_in_use;         // Objects currently handed out and not yet freed
+    size_t total_allocations;      // Objects handed out over the lifetime of the pool
+    size_t num_slabs;              // Slabs allocated (i.e. the number of heap allocations the pool has made)
+};
+struct mt_large_string {
+    mt_large_string* prev;         // The previous large string belonging to the tree, or NULL
+    mt_large_string* next;         // The next large string belonging to the tree, or NULL
+};
+struct mt_path_cache_entry {
+    size_t hash;                   // Hash of `root` and `key`, or 0 if the entry is empty
+    size_t generation;             // The cache generation the entry was stored in. Entries from earlier generations are stale
+    size_t last_used;              // When the entry was last stored or hit, for choosing which entry to evict
+    mt_branch* root;               // The branch the path was resolved relative to
+    mt_branch* branch;             // The branch the path resolved to
+    char* key;                     // The normalised path
+};
+struct mt_path_cache {
+    mt_path_cache_entry* entries;  // `capacity` entries, or NULL if nothing has been cached yet
+    size_t capacity;               // The number of entries, a multiple of MT_PATH_CACHE_WAYS. 0 disables the cache
+    size_t generation;             // Incremented to make every existing entry stale
+    size_t clock;                  // Incremented on every store and hit, to order entries by recent use
+
+    size_t hits;                   // Lookups answered from the cache
+    size_t misses;                 // Lookups that had to walk the tree
+    size_t invalidations;          // Times the cache has been made stale by a change to the tree
+};
+struct mt_id_index_slot {
+    size_t id;                     // The id of `branch`
+    mt_branch* branch;             // The branch with this id, or NULL if the slot is empty
+};
+struct mt_id_index {
+    mt_id_index_slot* slots;       // `capacity` slots, or NULL if nothing has been indexed
+    size_t capacity;               // The number of slots. Always a power of 2
+    size_t count;                  // The number of slots in use
+};
+struct mt_interned_string {
+    char* string;                  // The tree's only copy of the string, or NULL if the slot is empty
+    size_t hash;                   // Hash of the string
+    size_t length;                 // Length of the string, excluding the terminator
+    size_t references;             // Labels and data types currently using it
+    int borrowed;                  // 1 if `string` lies in a mapped snapshot rather than the tree's own storage
+};
+struct mt_string_table {
+    mt_interned_string* slots;     // `capacity` slots, or NULL if nothing has been interned
+    size_t capacity;               // The number of slots. Always a power of 2
+    size_t count;                  // The number of distinct strings
+};
+struct mt_label_postings {
+    char* label;                   // The interned label
+    mt_branch* first;              // The branch labelled most recently, linked to the others through `next_labelled`
+    size_t count;                  // The number of branches with the label
+    mt_label_postings* left;       // The node whose labels sort before `label`, or NULL
+    mt_label_postings* right;      // The node whose labels sort after `label`, or NULL
+    unsigned priority;             // Random, and never lower than the priorities below it, which keeps the index balanced
+};
+struct mt_label_index {
+    mt_label_postings* top;        // The node with the highest priority, or NULL if nothing has been indexed
+    mt_pool nodes;                 // Storage for the nodes
+    size_t count;                  // The number of distinct labels
+    unsigned seed;                 // State of the generator the priorities are drawn from
+};
+struct mt_data_index_node {
+    size_t start;                  // The address of the branch's data
+    size_t end;                    // The address just past it. At least `start + 1`, so that empty data has an address too
+    mt_branch* branch;             // The branch. Nodes are ordered by `start`, then by the address of `branch`
+    size_t max_end;                // The largest `end` of this node and every node below it
+    mt_data_index_node* left;      // The node whose keys sort before this one's, or NULL
+    mt_data_index_node* right;     // The node whose keys sort after this one's, or NULL
+    unsigned priority;             // Random, and never lower than the priorities below it, which keeps the index balanced
+};
+struct mt_data_index {
+    mt_data_index_node* top;       // The node with the highest priority, or NULL if nothing has been indexed
+    mt_pool nodes;                 // Storage for the nodes
+    size_t count;                  // The number of branches indexed
+    unsigned seed;                 // State of the generator the priorities are drawn from
+};
+struct mt_mapping {
+    mt_mapping* next;              // The next mapping belonging to the same tree, or NULL
+    void* address;                 // Where the file is mapped
+    size_t size;                   // The size of the mapping in bytes
+};
+struct mt_lazy_snapshot {
+    mt_lazy_snapshot* next;        // The next lazy snapshot belonging to the same tree, or NULL
+    unsigned char* buffer;         // The snapshot, which stays where it is until the tree is destroyed
+    int zero_copy;                 // 1 if `buffer` is a mapped file that loaded labels and data can point into
+    size_t file_size;
+    size_t num_strings;
+    size_t strings_offset;
+    size_t num_branches;
+    size_t branches_offset;
+    size_t data_offset;
+    unsigned char* labels_checked; // Which strings are known to be valid labels
+    int changed;                   // 1 if it was loaded into an existing tree, so that every branch loaded from it counts as changed
+};
+struct mt_unloaded_slot {
+    mt_branch* branch;             // A branch with the MT_BRANCH_UNLOADED or MT_BRANCH_SHARING flag, or NULL if the slot is empty
+    mt_lazy_snapshot* snapshot;    // The snapshot its children are in
+    size_t record;                 // The index of its own record in `snapshot`
+    mt_branch* source;             // For a sharing branch, the branch whose children it shares. For a shared branch, in the
+                                   // tree's `sharers`, the first copy sharing its children
+    mt_branch* next_copy;          // For a sharing branch, the next and previous copies sharing the same children
+    mt_branch* prev_copy;
+};
+struct mt_unloaded_index {
+    mt_unloaded_slot* slots;       // `capacity` slots, or NULL if nothing has been indexed
+    size_t capacity;               // The number of slots. Always a power of 2
+    size_t count;                  // The number of unloaded branches
+};
+struct mt_reader {
+    mt_tree* tree;                 // The tree being read, or NULL if the slot is free
+    size_t epoch;                  // The tree's epoch when the current read began, or 0 between reads
+    unsigned char padding[64 - sizeof(mt_tree*) - sizeof(size_t)];  // Each reader has a cache line to itself
+};
+struct mt_retired {
+    void* pointer;
+    size_t epoch;                  // The tree's epoch when it was removed
+    int kind;                      // One of the MT_RETIRE_ kinds
+};
+struct mt_reclaimer {
+    mt_reader readers[MT_MAX_READERS];
+    size_t epoch;                  // Advanced each time the writer reclaims memory. Starts at 1
+    size_t sequence;               // Odd while the writer is moving entries of the tree's hash tables
+    int write_depth;               // How deeply the writer's changes to the hash tables are nested
+
+    mt_retired* retired;           // Objects waiting until no reader can still be looking at them
+    size_t num_retired;
+    size_t capacity;
+    size_t retired_branches;       // Branches among them, which no longer count as part of the tree
+    size_t reclaimed;              // Objects reclaimed since concurrent reads were enabled
+};
+struct mt_tree {
+    mt_branch* root;               // The root branch of the tree
 
-    mt_branch* item;               // The branch itself
+    mt_pool branch_pool;           // Storage for every `mt_branch`
+    mt_pool label_pools[MT_LABEL_SIZE_CLASSES];  // Storage for short label and data type strings
+
+    mt_large_string* large_strings;  // Strings too long for the label pools, allocated individually
+    size_t large_string_allocations; // Total number of large strings allocated
+    mt_string_table strings;       // Every distinct label and data type, each stored once
+
+    mt_path_cache path_cache;      // Recently resolved paths
+
+    mt_id_index id_index;          // Every branch of the tree, by id
+    size_t last_issued_id;         // The id given to the most recently created branch. Ids are never issued twice
+    size_t max_id;                 // The highest id belonging to a branch that currently exists, unless `max_id_stale` is set
+    int max_id_stale;              // Set if `max_id` may belong to a deleted branch, and has to be found again from the id index
+
+    size_t heap_data_buffers;      // Branches whose data was allocated on the heap, and must be freed with the tree
+
+    mt_child_index* child_indexes; // Every child label index belonging to branches of this tree
+    mt_label_index* label_index;   // Every branch of the tree by label, or NULL. See `mt_enable_label_index`
+    mt_data_index* data_index;     // Every branch of the tree with data by its address, or NULL. See `mt_enable_data_index`
+
+    mt_mapping* mappings;          // Snapshot files that branches' labels and data point into
+    mt_lazy_snapshot* lazy_snapshots;  // Snapshots that are being loaded a branch at a time
+    mt_unloaded_index unloaded;    // Branches whose children have not been loaded from those snapshots yet
+    mt_unloaded_index shared;      // Copies whose children have not been copied yet, see `mt_copy_branch`
+    mt_unloaded_index sharers;     // Branches whose children copies are sharing, each with the first of those copies
+    unsigned int share_epoch;      // Advanced whenever a branch becomes MT_BRANCH_SHARED, see `__mt_unshare_path`
+
+    mt_journal* journal;           // Where every change to the tree is recorded, or NULL. See `mt_open_journal`
+    mt_reclaimer* reclaimer;       // Set while other threads may be reading the tree. See `mt_enable_concurrent_reads`
 };
 struct mt_branch {
+    mt_branch* first_child;         // The first child of this branch, of NULL if there are no children. The children of a
+                                    // branch marked MT_BRANCH_UNLOADED or MT_BRANCH_SHARING are not created yet, and this reads
+                                    // NULL until they are: walk children with `mt_get_first_child` and `mt_get_next_sibling`,
+                                    // which create them, rather than through this field and `next_sibling`
+    mt_branch* next_sibling;        // The next child of `parent`, or NULL if this is the last child
     mt_branch* parent;              // The parent of this branch
-    mt_list* first_child;           // The first child of this branch, of NULL if there are no children
-    mt_list* last_child;            // The last child of this branch, or NULL if there are no children
+    mt_branch* last_child;          // The last child of this branch, or NULL if there are no children
+    mt_branch* prev_sibling;        // The previous child of `parent`, or NULL if this is the first child
+    mt_tree* tree;                  // The tree this branch belongs to (and whose pools it was allocated from)
+    size_t num_children;            // The number of children this branch has
+    size_t num_descendants;         // The number of branches below this one. Like the two totals below, it is kept up to date
+                                    // as the tree changes, unless the branch is marked MT_BRANCH_TOTALS_STALE
+    size_t childrens_data_size;     // The total size of the data of this branch's children, in bytes
+    size_t descendants_data_size;   // The total size of the data of all the branches below this one, in bytes
+    mt_child_index* child_index;    // Index of the children's labels, or NULL if this branch has too few children to need one
+    mt_branch* next_same_label;     // When the parent has a `child_index`, the next sibling with the same label as this one
+    mt_branch* next_labelled;       // When the tree has a `label_index`, the next branch anywhere in it with the same label
+    mt_branch* prev_labelled;       // When the tree has a `label_index`, the previous branch with the same label
 
     size_t id;                      // This branch's id. Should be unique. Can be used instead of labels in paths e.g. {<id>}
     char* label;                    // A label identifying this branch. Not necessarily unique among siblings.
@@ -20,57 +369,600 @@ struct mt_branch {
 
     size_t data_size;               // The size of `data` in bytes
     void* data;                     // Pointer to a buffer containing the data. Should always be exactly `data_size` bytes long
+    int data_storage;               // Where `data` lives; one of the MT_DATA_ values
+    unsigned char inline_data[MT_INLINE_DATA_SIZE];  // Storage for copied data small enough to keep in the branch itself
+    int flags;                      // Any of the MT_BRANCH_ bits
 
 };
+struct mt_bench_thread {
+    mt_branch* root;
+    size_t width;
+    void* lock;                     // A `pthread_mutex_t` held around every read and write, or NULL to read without locks
+    int* stop;
+    size_t operations;
+    unsigned int seed;
+};
+struct mt_list {                                  // Children are linked to each other directly through `prev_sibling` and `next_sibling`
+    mt_branch* prev;               // The child returned before `item`, or NULL
+    mt_branch* next;               // The child that will be returned next, or NULL if there are no more children
+
+    mt_branch* item;               // The child returned most recently, or NULL if the iteration has not started
+};
+struct mt_path_cache_stats {
+    size_t hits;                   // Lookups answered from the cache
+    size_t misses;                 // Lookups that had to walk the tree
+    size_t invalidations;          // Times the cache has been made stale by a change to the tree
+    size_t entries_in_use;         // Entries currently holding a valid path
+    size_t capacity;               // The maximum number of entries
+};
+struct mt_string_stats {
+    size_t distinct_strings;       // Different label and data type strings stored
+    size_t references;             // Labels and data types using them
+    size_t bytes_stored;           // Bytes taken by the strings themselves, including terminators
+    size_t table_bytes;            // Bytes taken by the table that finds them
+    size_t bytes_without_interning;  // Bytes a separate copy of every label and data type would take
+    long bytes_saved;              // `bytes_without_interning - bytes_stored - table_bytes`
+};
+struct mt_allocation_stats {
+    size_t objects_allocated;      // Branches and strings handed out over the tree's lifetime
+    size_t heap_allocations;       // Calls actually made to the heap allocator to provide them
+    size_t allocations_saved;      // `objects_allocated - heap_allocations`
+    size_t objects_in_use;         // Branches and strings currently in use
+    size_t bytes_reserved;         // Total bytes held in slabs
+};
+struct mt_path_step {
+    char* segment;                 // The segment, within the caller's path. Not null-terminated
+    size_t length;                 // The length of the segment
+    mt_branch* branch;             // The branch it led to, or NULL if there is none
+};
+struct mt_path_steps {
+    mt_path_step* steps;           // `count` segments, starting from the root of the batch
+    size_t count;
+    size_t capacity;
+};
+struct mt_batch_path {
+    unsigned long long key;        // The 8 characters of `path` that are being sorted on, the first in the highest byte
+    char* path;                    // The caller's path
+    size_t index;                  // Its position in the batch
+};
+struct mt_path_segment {
+    char* label;                   // The label, interned in the path's tree, or NULL if the segment is an id
+    size_t id;                     // The id, if `label` is NULL
+};
+struct mt_path {
+    mt_tree* tree;                 // The tree that the labels are interned in, and that the path can be used with
+    size_t num_segments;           // The number of segments
+    mt_path_segment segments[];    // The segments, from the branch the path is relative to downwards
+};
+struct mt_label_matches {
+    mt_branch* root;               // Only branches below this one are wanted
+    mt_branch** out;               // Where to put the branches found
+    size_t capacity;               // The number of branches `out` has room for
+    size_t count;                  // The number of branches found so far, including those there was no room for
+    char* pattern;                 // A glob that the labels must match, or NULL if the labels have been checked already
+
+    mt_branch** marked;            // Branches marked MT_BRANCH_WITHIN_QUERY or MT_BRANCH_OUTSIDE_QUERY, to clear afterwards
+    size_t num_marked;
+    size_t marked_capacity;
+};
+struct mt_copy_cursor {
+    mt_branch* counterpart;         // The branch that the branch visited last was copied or merged into
+    int depth;                      // The depth of the branch visited last, or -1 before the first
+    mt_branch* exclude;             // A child of the destination not to merge into, or NULL
+    mt_branch* result;              // The copy of the first branch visited
+    int failed;                     // Set if the traversal was stopped by an error
+};
+struct mt_unshare_walk {
+    mt_branch* deleted;            // The branch being deleted
+    mt_branch** copies;            // Copies outside it sharing the children of a branch within it
+    size_t num_copies;
+    size_t capacity;
+};
+struct mt_journal_stats {
+    size_t records;                // Changes recorded since the journal was opened
+    size_t bytes;                  // Bytes of records written for them
+    size_t syncs;                  // Times the journal has been synced to disk. Fewer than `records` with group commit
+    size_t pending;                // Bytes of records that have been written, but not synced yet
+};
+struct mt_parallel_task {
+    mt_branch* branch;
+    mt_branch* other;               // The branch that `branch` is being compared with, or NULL
+    size_t position;                // The position of `branch` in a depth-first walk of the whole query
+};
+struct mt_parallel_queue {
+    mt_parallel_task* tasks;
+    size_t front;                   // The first task still queued
+    size_t back;                    // One past the last task still queued
+    size_t capacity;
+    int lock;                       // Held while the queue is changed. See `__mt_parallel_lock`
+};
+struct mt_parallel_job {
+    int (*split)(mt_parallel_job* job, mt_parallel_task* task);    // Handles the branch of a task that is split up.
+                                                                    // Returns 0 if its children need not be walked
+    void (*walk)(mt_parallel_job* job, mt_parallel_task* task);    // Handles the branch of a task and all its descendants
+    void* context;                  // Anything the query needs, such as what it is searching for
+    int num_threads;
+    mt_parallel_queue* queues;      // One for each thread
+    size_t outstanding;             // The number of tasks queued or being worked on. The threads finish when it reaches 0
+
+    size_t first_position;          // The position of the earliest branch found so far, or SIZE_MAX
+    mt_branch* first_found;         // The branch found at `first_position`
+    int found_lock;                 // Held while `first_position` and `first_found` are changed
+    size_t max_id;                  // The largest id seen by any thread
+};
+struct mt_parallel_worker {
+    mt_parallel_job* job;
+    int index;                      // The worker's own queue in `job->queues`
+};
+struct mt_serialize_plan {
+    size_t num_branches;           // Branches in the (sub-)tree
+    size_t num_strings;            // Distinct labels and data types used by them
+    size_t strings_size;           // Bytes taken by the strings, including terminators and padding
+    size_t data_size;              // Bytes taken by the data, including alignment padding
+
+    char** strings;                // The distinct strings, in the order they will be written
+    size_t strings_capacity;       // Space in `strings`
+
+    char** map_keys;               // Hash table from interned string to its index in `strings`
+    size_t* map_values;
+    size_t map_capacity;           // The number of slots. Always a power of 2
+
+    size_t* extents;               // For streams: where the subtree of each branch with children ends, in depth-first order
+    size_t num_extents;
+    size_t extents_capacity;
+};
+struct mt_delta_plan {
+    mt_serialize_plan plan;        // The strings and data of the changed branches, and the number of records
+    mt_branch** branches;          // The branch of each record, in depth-first order
+    size_t* parents;               // The index of each record's parent
+    size_t* subtree_ends;          // The index of the first record after each record's descendants
+    size_t capacity;               // Space in each of the arrays
+};
+struct mt_tree_checker {
+    size_t num_branches;
+    size_t num_strings;
+    size_t data_offset;
+    size_t file_size;
+    unsigned char* strings;        // The string offsets followed by the strings, as they are in the file
+    size_t strings_offset;         // Where `strings` starts in the file
+    unsigned char* labels_checked; // Which strings are known to be valid labels
+
+    size_t* open_ends;             // The index just past each subtree that is still open, innermost last
+    size_t* open_indexes;          // And the record each of those subtrees starts at
+    size_t num_open;
+    size_t open_capacity;
+
+    int data_in_order;             // Set if each record's data must directly follow the previous record's, as in a stream
+    size_t data_end;               // Where the previous record's data ended
+    int kept_allowed;              // Set for deltas, whose records may keep a branch as it is with MT_FILE_LABEL_KEPT
+};
+struct mt_stream_segment {
+    void* address;
+    size_t length;
+};
+struct mt_stream_writer {
+    int fd;                        // The file descriptor to write to, if there is no `write` function
+    mt_write_function* write;
+    void* context;                 // Passed to `write`
+
+    unsigned char* buffer;         // MT_STREAM_BUFFER_SIZE bytes for staging small pieces
+    size_t used;                   // Bytes of `buffer` in use
+    size_t gathered;               // Bytes of `buffer` already added to `segments`
+    mt_stream_segment segments[MT_STREAM_SEGMENTS];
+    int num_segments;
+
+    size_t position;               // Bytes written so far, counting those still waiting
+    int failed;
+};
+struct mt_stream_reader {
+    int fd;                        // The file descriptor to read from, if there is no `read` function
+    mt_read_function* read;
+    void* context;                 // Passed to `read`
+
+    unsigned char* buffer;         // MT_STREAM_BUFFER_SIZE bytes read ahead, so that small pieces do not each need a call
+    size_t start;                  // The bytes of `buffer` which have been read ahead but not used yet
+    size_t end;
+    size_t position;               // Bytes used so far
+    size_t limit;                  // Where the tree ends, which is never read past
+};
+struct mt_test_stream {
+    char* buffer;
+    size_t length;
+    size_t capacity;
+    size_t position;    // Where the next read starts
+    size_t chunk;
+};
+struct mt_test_reader {
+    mt_branch* root;
+    int* stop;                  // Set by the main thread once it has finished changing the tree
+    mt_path* compiled;          // "wide/stable", compiled
+    size_t reads;
+    size_t misses;              // Lookups of branches that were never removed, which failed
+    size_t torn;                // Copies of data which mixed two different values
+};
+double __mt_bench_seconds();
+int __mt_bench_buffer_write(void *context,void *data,size_t length);
+mt_branch *__mt_bench_build_tree(size_t width);
+void __mt_bench_bulk_build();
+mt_branch *__mt_bench_build_scattered_tree(size_t width);
+void __mt_bench_time_traversal(mt_branch *root,char *description);
+void __mt_bench_traversal();
+int __mt_bench_visit_count(mt_branch *branch,int depth,void *context);
+void __mt_bench_traversal_engine();
+void __mt_bench_totals();
+void __mt_bench_parallel_queries();
+void __mt_bench_label_index();
+void __mt_bench_data_index();
+void __mt_bench_compiled_paths();
+void __mt_bench_batch_paths();
+void __mt_bench_path_cache();
+void __mt_bench_id_lookup();
+void __mt_bench_wide_lookup();
+void __mt_bench_small_data();
+void __mt_bench_data_handover();
+void __mt_bench_serialization();
+void __mt_bench_mapped_payloads();
+void __mt_bench_time_streaming(mt_branch *root,char *description);
+void __mt_bench_streaming();
+void __mt_bench_deltas();
+void __mt_bench_journal();
+void *__mt_bench_reader_thread(void *context);
+void *__mt_bench_writer_thread(void *context);
+void __mt_bench_concurrent_reads();
+void __mt_bench_copy_on_write();
+void __mt_bench_moves();
+void __mt_run_benchmarks();
 extern int MT_ERRORS_ARE_FATAL;
-extern int MT_ERROR_FLAG;
+extern MT_THREAD_LOCAL int MT_ERROR_FLAG;
+extern MT_THREAD_LOCAL char MT_ERROR_MESSAGE[MT_ERROR_MESSAGE_SIZE];
 int __mt_check_error_flag();
 int mt_error(const char *format,...);
-extern size_t MT_CURRENT_NUM_BRANCHES;
-extern size_t MT_MAX_ID;
+char *mt_get_last_error();
+void mt_clear_last_error();
+void __mt_pool_init(mt_pool *pool,size_t object_size);
+void *__mt_pool_alloc(mt_pool *pool);
+void __mt_pool_free(mt_pool *pool,void *object);
+void __mt_pool_release(mt_pool *pool);
+int __mt_label_size_class(size_t length);
+char *__mt_tree_strdup(mt_tree *tree,const char *string);
+void __mt_tree_free_string(mt_tree *tree,char *string);
+void mt_get_allocation_stats(mt_branch *branch,mt_allocation_stats *out_stats);
+int mt_enable_concurrent_reads(mt_branch *root);
+int mt_disable_concurrent_reads(mt_branch *root);
+mt_reader *mt_register_reader(mt_branch *branch);
+void mt_unregister_reader(mt_reader *reader);
+void mt_begin_read(mt_reader *reader);
+void mt_end_read(mt_reader *reader);
+void __mt_retire(mt_tree *tree,int kind,void *pointer);
+int __mt_reclaim_retired(mt_tree *tree,size_t spins);
+size_t mt_reclaim(mt_branch *branch);
+void __mt_begin_write(mt_tree *tree);
+void __mt_end_write(mt_tree *tree);
+size_t __mt_read_sequence(mt_tree *tree);
+int __mt_check_read_sequence(mt_tree *tree,size_t sequence);
+void __mt_set_flags(mt_branch *branch,int bits);
+void __mt_clear_flags(mt_branch *branch,int bits);
+void __mt_copy_shared_bytes(void *to,void *from,size_t bytes);
+size_t __mt_label_hash(char *label,size_t label_length);
+mt_interned_string *__mt_string_table_probe(mt_string_table *table,char *string,size_t length,size_t hash);
+void __mt_string_table_move(mt_interned_string *to,mt_interned_string *from);
+char *__mt_tree_find_string(mt_tree *tree,char *string,size_t length);
+char *__mt_tree_intern_string(mt_tree *tree,char *string);
+char *__mt_tree_intern_string_references(mt_tree *tree,char *string,size_t references,int borrow);
+void __mt_tree_release_string(mt_tree *tree,char *string);
+void mt_get_string_stats(mt_branch *branch,mt_string_stats *out_stats);
+size_t __mt_id_index_home(mt_id_index *index,size_t id);
+int __mt_id_index_reserve(mt_tree *tree,size_t count);
+int __mt_id_index_insert(mt_tree *tree,mt_branch *branch);
+mt_branch *__mt_id_index_find(mt_tree *tree,size_t id);
+void __mt_id_index_remove(mt_tree *tree,size_t id);
+int __mt_tree_register_branch(mt_tree *tree,mt_branch *branch);
+int __mt_tree_register_branch_as(mt_tree *tree,mt_branch *branch,size_t id);
+void __mt_tree_unregister_branch(mt_tree *tree,mt_branch *branch);
+size_t __mt_tree_max_id(mt_tree *tree);
+mt_branch *mt_get_by_id(mt_branch *branch,size_t id);
+size_t __mt_child_index_hash(char *label);
+mt_child_index_slot *__mt_child_index_probe(mt_child_index *index,char *label);
+void __mt_child_index_move(mt_child_index_slot *to,mt_child_index_slot *from);
+mt_branch *__mt_child_index_find(mt_child_index *index,char *label);
+void __mt_child_index_insert(mt_child_index *index,mt_branch *child,int appending);
+void __mt_child_index_remove(mt_child_index *index,mt_branch *child);
+void __mt_child_index_unchain(mt_child_index *index,mt_child_index_slot *entry,mt_branch *child);
+void __mt_child_index_build(mt_branch *branch);
+void __mt_child_index_release(mt_branch *branch);
+mt_branch *__mt_next_sibling_with_same_label(mt_branch *child);
+size_t mt_get_num_branches(mt_branch *branch);
+size_t __mt_count_shared_branches(mt_tree *tree);
+size_t mt_get_max_id(mt_branch *branch);
 size_t mt_find_max_id(mt_branch *root,size_t max_id,int max_depth);
-void mt_update_max_id(mt_branch *root);
+int __mt_visit_max_id(mt_branch *branch,int depth,void *context);
 int mt_check_label_valid(char *new_label);
 int mt_check_is_root(mt_branch *branch);
 mt_branch *mt_check_branches_identical(mt_branch *branch_a,mt_branch *branch_b);
+int __mt_check_branch_matches(mt_branch *branch_a,mt_branch *branch_b);
 mt_branch *mt_get_parent(mt_branch *branch);
 int mt_get_num_descendants(mt_branch *branch,size_t num_descendants,int max_depth);
+int __mt_visit_count(mt_branch *branch,int depth,void *context);
 int mt_get_num_children(mt_branch *branch);
 mt_branch *mt_get_nth_child(mt_branch *branch,int n);
 mt_branch *mt_get_first_child(mt_branch *branch);
 mt_branch *mt_get_next_sibling(mt_branch *parent,mt_list *iterator);
-int mt_get_children_as_pointer_array(mt_branch *branch,mt_list *iterator,mt_branch *out_pointer_array,int out_capacity);
+int mt_get_children_as_pointer_array(mt_branch *branch,mt_list *iterator,mt_branch **out_pointer_array,int out_capacity);
+void __mt_ensure_children(mt_branch *branch);
+mt_branch *__mt_next_descendant(mt_branch *branch,mt_branch *root);
+int __mt_traverse(mt_branch *root,int max_depth,mt_visit_function *before_children,mt_visit_function *after_children,void *context,int load);
+int mt_traverse(mt_branch *root,int max_depth,mt_visit_function *before_children,mt_visit_function *after_children,void *context);
+void __mt_totals_add(mt_branch *branch,size_t descendants,size_t data_size,int sign);
+void __mt_totals_invalidate(mt_branch *branch);
+void __mt_totals_link(mt_branch *parent,mt_branch *child,int sign);
+void __mt_totals_update(mt_branch *branch);
+int __mt_visit_totals_stale(mt_branch *branch,int depth,void *context);
+int __mt_visit_recount_totals(mt_branch *branch,int depth,void *context);
+int mt_check_totals(mt_branch *branch);
+int __mt_visit_check_pending_totals(mt_branch *branch,int depth,void *context);
+int __mt_visit_check_totals(mt_branch *branch,int depth,void *context);
+char *__mt_path_next_segment(char *path,size_t *position,size_t *segment_length);
+int __mt_parse_id_segment(char *segment,size_t segment_length,size_t *out_id);
+size_t __mt_normalize_path(char *path,char *out_buffer,size_t out_capacity);
+mt_branch *__mt_find_child_by_label(mt_branch *parent,char *label,size_t label_length);
+mt_branch *__mt_find_child_by_interned_label(mt_branch *parent,char *label);
+mt_branch *__mt_find_child_by_id(mt_branch *parent,size_t id);
+mt_branch *__mt_resolve_segment(mt_branch *parent,char *segment,size_t segment_length);
+mt_branch *__mt_resolve_path(mt_branch *root,char *path);
+size_t __mt_path_cache_hash(mt_branch *root,char *key,size_t key_length);
+mt_path_cache_entry *__mt_path_cache_set(mt_path_cache *cache,size_t hash);
+mt_branch *__mt_path_cache_lookup(mt_branch *root,char *key,size_t key_length,size_t hash);
+void __mt_path_cache_store(mt_branch *root,char *key,size_t key_length,size_t hash,mt_branch *branch);
+void __mt_path_cache_invalidate(mt_tree *tree);
+void __mt_path_cache_release(mt_tree *tree);
+int mt_set_path_cache_size(mt_branch *branch,size_t num_entries);
+void mt_get_path_cache_stats(mt_branch *branch,mt_path_cache_stats *out_stats);
+mt_branch *__mt_resolve_path_from_steps(mt_branch *root,char *path,mt_path_steps *steps,int create);
+void __mt_sort_batch_path_keys(mt_batch_path *paths,mt_batch_path *scratch,size_t count);
+void __mt_sort_batch_paths(mt_batch_path *paths,mt_batch_path *scratch,size_t count,size_t offset);
+size_t mt_get_by_paths(mt_branch *root,char **paths,size_t num_paths,mt_branch **out_branches);
+int mt_create_paths(mt_branch *root,char **paths,size_t num_paths,mt_branch **out_branches);
+mt_path *mt_compile_path(mt_branch *branch,char *path);
+void mt_free_path(mt_path *path);
+int __mt_check_compiled_path_arguments(mt_branch *root,mt_path *path);
+mt_branch *__mt_follow_compiled_path(mt_branch *root,mt_path *path,size_t *out_followed);
+mt_branch *mt_get_by_compiled_path(mt_branch *root,mt_path *path);
+mt_branch *mt_create_compiled_path(mt_branch *root,mt_path *path);
 mt_branch *mt_search_for_label(mt_branch *root,char *label);
+char *__mt_tree_find_label(mt_tree *tree,char *label);
 mt_branch *mt_get_by_path(mt_branch *root,char *path);
 int mt_check_path_exists(mt_branch *root,char *path);
-void *mt_get_data_pointer(mt_branch branch);
-int mt_get_data_copy(mt_branch branch,void *out_buffer,size_t out_capacity);
-size_t mt_get_data_size(mt_branch branch);
-size_t mt_get_childrens_data_size(mt_branch branch);
-size_t mt_get_childrens_data_size_recursive(mt_branch branch);
+int mt_enable_label_index(mt_branch *root);
+int mt_disable_label_index(mt_branch *root);
+void __mt_label_index_release(mt_tree *tree);
+int __mt_visit_index_label(mt_branch *branch,int depth,void *context);
+mt_label_postings *__mt_label_index_find(mt_label_index *index,char *label);
+mt_label_postings *__mt_label_index_insert(mt_label_postings *node,mt_label_postings *added);
+mt_label_postings *__mt_label_index_join(mt_label_postings *left,mt_label_postings *right);
+mt_label_postings *__mt_label_index_unlink(mt_label_postings *node,mt_label_postings *removed);
+void __mt_label_index_add(mt_branch *branch);
+void __mt_label_index_remove(mt_branch *branch);
+int __mt_check_glob_matches(char *label,char *pattern);
+int __mt_label_matches_mark(mt_label_matches *matches,mt_branch *branch);
+int __mt_label_matches_within(mt_label_matches *matches,mt_branch *branch);
+size_t __mt_label_matches_finish(mt_label_matches *matches);
+void __mt_label_matches_load(mt_label_matches *matches);
+void __mt_label_matches_put(mt_label_matches *matches,mt_branch *branch);
+void __mt_label_matches_add(mt_label_matches *matches,mt_branch *branch);
+void __mt_label_matches_add_postings(mt_label_matches *matches,mt_label_postings *postings);
+void __mt_label_index_collect_prefix(mt_label_postings *node,char *prefix,size_t prefix_length,mt_label_matches *matches);
+int __mt_check_label_query(mt_branch *root,char *label,mt_branch **out,size_t capacity);
+size_t mt_find_by_label(mt_branch *root,char *label,mt_branch **out,size_t capacity);
+size_t mt_find_by_label_prefix(mt_branch *root,char *prefix,mt_branch **out,size_t capacity);
+size_t mt_find_by_label_glob(mt_branch *root,char *pattern,mt_branch **out,size_t capacity);
+int mt_enable_data_index(mt_branch *root);
+int mt_disable_data_index(mt_branch *root);
+void __mt_data_index_release(mt_tree *tree);
+int __mt_visit_index_data(mt_branch *branch,int depth,void *context);
+int __mt_data_index_compare(mt_data_index_node *node,size_t start,mt_branch *branch);
+void __mt_data_index_update(mt_data_index_node *node);
+mt_data_index_node *__mt_data_index_insert(mt_data_index_node *node,mt_data_index_node *added);
+mt_data_index_node *__mt_data_index_join(mt_data_index_node *left,mt_data_index_node *right);
+mt_data_index_node *__mt_data_index_unlink(mt_data_index_node *node,size_t start,mt_branch *branch,mt_data_index_node **out_removed);
+void __mt_data_index_add(mt_branch *branch);
+void __mt_data_index_remove(mt_branch *branch);
+mt_data_index_node *__mt_data_index_next(mt_data_index *index,size_t start,mt_branch *branch);
+mt_data_index_node *__mt_data_index_containing(mt_data_index_node *node,size_t address);
+int __mt_check_data_query(mt_branch *branch,void *data);
+mt_branch *mt_get_by_data(mt_branch *branch,void *data);
+mt_branch *mt_get_by_data_address(mt_branch *branch,void *address);
+size_t mt_detach_data(mt_branch *branch,void *data);
+void *mt_get_data_pointer(mt_branch *branch);
+void *mt_get_data_pointer_writable(mt_branch *branch);
+int mt_get_data_copy(mt_branch *branch,void *out_buffer,size_t out_capacity);
+size_t mt_get_data_size(mt_branch *branch);
+size_t mt_get_childrens_data_size(mt_branch *branch);
+size_t mt_get_childrens_data_size_recursive(mt_branch *branch);
+void __mt_mark_changed(mt_branch *branch);
+int mt_check_changed(mt_branch *branch);
+void mt_mark_clean(mt_branch *branch);
 char *mt_set_label(mt_branch *branch,char *new_label);
 char *mt_set_data_type(mt_branch *branch,char *data_type);
 mt_branch *mt_create_root();
 mt_branch *mt_create_branch(mt_branch *parent,char *label);
+mt_branch *__mt_create_branch_as(mt_branch *parent,char *label,size_t id);
+mt_branch *__mt_new_branch(mt_branch *parent,char *label,size_t id);
+void __mt_link_child(mt_branch *parent,mt_branch *child);
+void __mt_unlink_child(mt_branch *child);
 mt_branch *mt_create_path(mt_branch *root,char *path);
+int __mt_check_path_creatable(char *path,size_t first_missing);
+mt_branch *__mt_create_segment(mt_branch *parent,char *segment,size_t segment_length);
 int mt_set_data_copy(mt_branch *branch,void *data,size_t data_length);
+void __mt_set_data_storage(mt_branch *branch,void *data,size_t data_size,int data_storage);
 int mt_set_data_pointer(mt_branch *branch,void *data,size_t data_length);
+int mt_set_data_owned(mt_branch *branch,void *data,size_t data_length);
+int mt_check_data_owned(mt_branch *branch);
+void __mt_free_branch_recursive(mt_branch *branch);
+int __mt_visit_free(mt_branch *branch,int depth,void *context);
 mt_branch *mt_delete_branch(mt_branch *branch);
+int mt_destroy_tree(mt_branch *root);
+int __mt_is_within(mt_branch *branch,mt_branch *ancestor);
+int __mt_check_copy_arguments(mt_branch *to_copy,mt_branch *new_parent);
+void __mt_copy_data(mt_branch *source,mt_branch *destination);
+void __mt_copy_cursor_init(mt_copy_cursor *cursor,mt_branch *new_parent,mt_branch *exclude);
+mt_branch *__mt_copy_cursor_parent(mt_copy_cursor *cursor,int depth);
+void __mt_copy_cursor_visited(mt_copy_cursor *cursor,mt_branch *counterpart,int depth);
+mt_branch *__mt_find_merge_target(mt_branch *parent,mt_branch *source,mt_branch *exclude);
+mt_branch *__mt_copy_branch_recursive(mt_branch *to_copy,mt_branch *new_parent);
+int __mt_visit_copy(mt_branch *branch,int depth,void *context);
+void __mt_delete_children_labelled(mt_branch *parent,char *label,mt_branch *keep);
+int __mt_merge_branch_recursive(mt_branch *source,mt_branch *new_parent,mt_branch *exclude);
+int __mt_visit_merge(mt_branch *branch,int depth,void *context);
 int mt_copy_branch(mt_branch *to_copy,mt_branch *new_parent);
 int mt_copy_branch_replace(mt_branch *to_copy,mt_branch *new_parent);
 int mt_copy_branch_merge(mt_branch *to_copy,mt_branch *new_parent);
+int __mt_check_can_share(mt_branch *source,mt_branch *copy);
+int __mt_share_children(mt_branch *source,mt_branch *copy);
+int __mt_copy_data_to_new_branch(mt_branch *source,mt_branch *copy);
+void __mt_copy_shared_children(mt_branch *branch);
+int __mt_sharing_add(mt_tree *tree,mt_branch *copy,mt_branch *source);
+mt_unloaded_slot *__mt_sharer_find(mt_tree *tree,mt_branch *source);
+void __mt_sharing_remove(mt_tree *tree,mt_branch *copy);
+unsigned int __mt_share_stamp(mt_branch *branch);
+void __mt_set_share_stamp(mt_branch *branch,unsigned int epoch);
+void __mt_share_epoch_advance(mt_tree *tree);
+int __mt_visit_clear_share_stamp(mt_branch *branch,int depth,void *context);
+void __mt_unshare_branch(mt_tree *tree,mt_branch *source,int deep);
+int __mt_visit_find_copies(mt_branch *branch,int depth,void *context);
+void __mt_unshare_path(mt_branch *branch);
+int __mt_check_can_relink(mt_branch *to_move,mt_branch *new_parent);
+void __mt_relink_branch(mt_branch *to_move,mt_branch *new_parent);
+int __mt_move_data(mt_branch *source,mt_branch *destination);
+int __mt_merge_by_relinking(mt_branch *source,mt_branch *new_parent,mt_branch *exclude);
+int __mt_visit_merge_by_relinking(mt_branch *branch,int depth,void *context);
+int __mt_visit_delete_merged(mt_branch *branch,int depth,void *context);
 int mt_move_branch(mt_branch *to_move,mt_branch *new_parent);
 int mt_move_branch_replace(mt_branch *to_move,mt_branch *new_parent);
 int mt_move_branch_merge(mt_branch *to_move,mt_branch *new_parent);
+unsigned long __mt_journal_checksum(unsigned char *data,size_t length);
+double __mt_journal_seconds();
+int __mt_journal_sync_locked(mt_journal *journal);
+int __mt_journal_sync(mt_journal *journal);
+void *__mt_journal_flusher_thread(void *context);
+int __mt_journal_write(mt_journal *journal,unsigned char *bytes,size_t length);
+void __mt_journal_record(mt_tree *tree,int type,size_t id,size_t argument,void *bytes,size_t length);
+size_t __mt_journal_valid_length(unsigned char *in,size_t length);
+unsigned char *__mt_journal_read_file(char *filename,size_t *out_length);
+int mt_open_journal(mt_branch *root,char *filename,double commit_window);
+int mt_sync_journal(mt_branch *branch);
+int __mt_close_journal(mt_tree *tree);
+void __mt_free_journal(mt_journal *journal);
+int mt_close_journal(mt_branch *branch);
+void mt_get_journal_stats(mt_branch *branch,mt_journal_stats *out_stats);
+int __mt_replay_journal_record(mt_tree *tree,unsigned char *record);
+int __mt_replay_journal(mt_tree *tree,char *filename,size_t *out_replayed);
+size_t mt_replay_journal(mt_branch *root,char *filename);
+int mt_checkpoint_journal(mt_branch *root,char *snapshot_filename);
+mt_branch *mt_recover_tree(char *snapshot_filename,char *journal_filename,double commit_window);
+void __mt_parallel_lock(int *lock);
+void __mt_parallel_unlock(int *lock);
+int __mt_parallel_push(mt_parallel_queue *queue,mt_parallel_task *task);
+int __mt_parallel_take(mt_parallel_queue *queue,mt_parallel_task *out_task,int steal);
+void __mt_parallel_found(mt_parallel_job *job,size_t position,mt_branch *branch);
+int __mt_parallel_found_before(mt_parallel_job *job,size_t position);
+void __mt_parallel_run_task(mt_parallel_job *job,int index,mt_parallel_task *task);
+void *__mt_parallel_worker_thread(void *context);
+int __mt_parallel_threads_for(mt_branch *root,int num_threads);
+void __mt_parallel_run(mt_parallel_job *job,mt_branch *root,mt_branch *other);
+void __mt_parallel_walk_search(mt_parallel_job *job,mt_parallel_task *task);
+int __mt_parallel_split_search(mt_parallel_job *job,mt_parallel_task *task);
+mt_branch *mt_search_for_label_parallel(mt_branch *root,char *label,int num_threads);
+void __mt_parallel_max_id(mt_parallel_job *job,size_t max_id);
+void __mt_parallel_walk_max_id(mt_parallel_job *job,mt_parallel_task *task);
+int __mt_parallel_split_max_id(mt_parallel_job *job,mt_parallel_task *task);
+size_t mt_find_max_id_parallel(mt_branch *root,size_t max_id,int num_threads);
+void __mt_parallel_walk_identical(mt_parallel_job *job,mt_parallel_task *task);
+int __mt_parallel_split_identical(mt_parallel_job *job,mt_parallel_task *task);
+mt_branch *mt_check_branches_identical_parallel(mt_branch *branch_a,mt_branch *branch_b,int num_threads);
+size_t __mt_align(size_t size,size_t alignment);
+void __mt_put_u64(unsigned char *at,unsigned long long value);
+void __mt_put_u32(unsigned char *at,unsigned long value);
+unsigned long long __mt_get_u64(unsigned char *at);
+unsigned long __mt_get_u32(unsigned char *at);
+size_t __mt_serialize_plan_string(mt_serialize_plan *plan,char *string);
+int __mt_serialize_plan_build(mt_serialize_plan *plan,mt_branch *root);
+void __mt_serialize_plan_release(mt_serialize_plan *plan);
+size_t __mt_serialize_plan_find(mt_serialize_plan *plan,char *string);
+void __mt_serialize_plan_layout(mt_serialize_plan *plan,size_t *out_strings,size_t *out_branches,size_t *out_data,size_t *out_size);
+int __mt_serialize_plan_extents(mt_serialize_plan *plan,mt_branch *root);
+void __mt_put_tree_header(unsigned char *out,mt_serialize_plan *plan);
+void __mt_put_string_table(unsigned char *out,mt_serialize_plan *plan);
+void __mt_put_branch_record(unsigned char *record,mt_serialize_plan *plan,mt_branch *branch,size_t parent,size_t subtree_end,size_t data_offset);
 size_t mt_get_tree_file_size(mt_branch *root);
-int mt_write_tree_to_buffer(mt_branch *root,void *out_buffer,size_t out_capacity);
+size_t mt_write_tree_to_buffer(mt_branch *root,void *out_buffer,size_t out_capacity);
+void __mt_check_tree_header(unsigned char *in,size_t available);
+int __mt_tree_checker_init(mt_tree_checker *checker,unsigned char *header,unsigned char *strings);
+char *__mt_tree_checker_string(mt_tree_checker *checker,size_t index);
+int __mt_tree_checker_record(mt_tree_checker *checker,unsigned char *record,size_t i);
+void __mt_tree_checker_release(mt_tree_checker *checker);
+int __mt_validate_tree_buffer(unsigned char *in,size_t *out_references,int is_delta);
+mt_branch *__mt_load_branch(mt_tree *tree,mt_branch *parent,unsigned char *record,mt_branch *replaced_root,char *label,char *data_type);
+void __mt_mark_loaded_changed(mt_branch *new_parent,mt_branch *loaded_root);
+int __mt_load_branch_data(mt_branch *branch,unsigned char *in,unsigned char *record,int zero_copy);
 mt_branch *mt_load_tree_from_buffer(mt_branch *new_parent,void *in_buffer,size_t buffer_length);
+mt_branch *__mt_load_tree(mt_branch *new_parent,void *in_buffer,size_t buffer_length,mt_mapping *mapping);
+void __mt_stream_flush(mt_stream_writer *writer);
+int __mt_write_segments_to_fd(int fd,mt_stream_segment *segments,int num_segments);
+void __mt_stream_gather(mt_stream_writer *writer,void *address,size_t length);
+void __mt_stream_write(mt_stream_writer *writer,void *data,size_t length);
+void __mt_stream_pad(mt_stream_writer *writer,size_t to);
+size_t __mt_write_tree_to_stream(mt_branch *root,mt_stream_writer *writer);
+size_t mt_write_tree_to_fd(mt_branch *root,int fd);
+size_t mt_write_tree_to_callback(mt_branch *root,mt_write_function *write,void *context);
+size_t __mt_stream_fill(mt_stream_reader *reader,unsigned char *out,size_t capacity);
+int __mt_stream_read(mt_stream_reader *reader,void *out,size_t length);
+int __mt_stream_skip(mt_stream_reader *reader,size_t to);
+char *__mt_load_stream_string(mt_tree *tree,mt_tree_checker *checker,char **interned,size_t *references,size_t index);
+void __mt_add_string_references(mt_tree *tree,char **interned,size_t *references,size_t num_strings);
+mt_branch *__mt_load_tree_from_stream(mt_branch *new_parent,mt_stream_reader *reader);
+mt_branch *mt_load_tree_from_fd(mt_branch *new_parent,int fd);
+mt_branch *mt_load_tree_from_callback(mt_branch *new_parent,mt_read_function *read,void *context);
+mt_unloaded_slot *__mt_unloaded_index_probe(mt_unloaded_index *index,mt_branch *branch);
+int __mt_unloaded_index_insert(mt_unloaded_index *index,mt_unloaded_slot *entry);
+void __mt_unloaded_index_remove(mt_unloaded_index *index,mt_branch *branch);
+int __mt_check_lazy_record(mt_lazy_snapshot *snapshot,size_t i,size_t parent,size_t parent_end);
+mt_branch *__mt_load_lazy_branch(mt_tree *tree,mt_lazy_snapshot *snapshot,mt_branch *parent,size_t i,mt_branch *replaced_root);
+void __mt_load_children(mt_branch *branch);
+void __mt_load_all_children(mt_tree *tree);
+void __mt_release_lazy_snapshots(mt_tree *tree);
+mt_branch *mt_load_tree_lazily_from_buffer(mt_branch *new_parent,void *in_buffer,size_t buffer_length);
+size_t __mt_snapshot_max_id(mt_lazy_snapshot *snapshot);
+mt_branch *__mt_load_tree_lazily(mt_branch *new_parent,void *in_buffer,size_t buffer_length,mt_mapping *mapping);
+mt_branch *mt_map_tree_from_file(mt_branch *new_parent,char *filename);
+mt_branch *mt_map_tree_lazily_from_file(mt_branch *new_parent,char *filename);
+mt_mapping *__mt_map_file(char *filename);
+void __mt_release_mapping(mt_mapping *mapping);
+void __mt_release_mappings(mt_tree *tree);
+int __mt_delta_has_record(mt_branch *branch);
+mt_branch *__mt_next_delta_branch(mt_branch *branch,mt_branch *root);
+int __mt_delta_plan_build(mt_delta_plan *delta,mt_branch *root);
+void __mt_delta_plan_release(mt_delta_plan *delta);
+size_t mt_get_delta_file_size(mt_branch *root);
+size_t mt_write_delta_to_buffer(mt_branch *root,void *out_buffer,size_t out_capacity);
+int __mt_check_delta_matches(mt_branch *root,unsigned char *in,mt_branch **out_branches);
+int __mt_apply_delta_record(mt_branch *branch,unsigned char *in,unsigned char *record,char *label,char *data_type,mt_branch ***detached,size_t *num_detached,size_t *detached_capacity);
+int mt_apply_delta_from_buffer(mt_branch *root,void *in_buffer,size_t buffer_length);
+mt_branch *mt_load_tree_with_deltas(void *base,size_t base_length,void **deltas,size_t *delta_lengths,size_t num_deltas);
+size_t mt_compact_snapshot(void *base,size_t base_length,void **deltas,size_t *delta_lengths,size_t num_deltas,mt_write_function *write,void *context);
 void __mt_test_print_tree(mt_branch branch,int max_depth);
 int __mt_rand(int min,int max);
 int __mt_generate_random_data(void *out_buffer,size_t bytes);
 int __mt_rand_string(char *out_buffer,size_t length);
 __mt_test_log(char *to_log);
 int __mt_strings_equal(char *string_a,char *string_b);
+int __mt_buffers_identical(void *buffer_a,void *buffer_b,size_t length);
+int __mt_branches_identical(mt_branch *branch_a,mt_branch *branch_b);
+int __mt_test_stream_write(void *context,void *data,size_t length);
+size_t __mt_test_stream_read(void *context,void *out_data,size_t capacity);
+void *__mt_test_error_thread(void *context);
+void *__mt_test_concurrent_reader(void *context);
+int __mt_test_visit_before(mt_branch *branch,int depth,void *context);
+int __mt_test_visit_after(mt_branch *branch,int depth,void *context);
 void __mt_assert(int condition,char *error_message);
 #define INTERFACE 0
 #define EXPORT_INTERFACE 0
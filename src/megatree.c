@@ -10,19 +10,14 @@ Useful features:
     There could be a 'copy' version and also a 'pointer' version
     In the case of the `pointer` version
    
--   An error system. e.g. get_last_error_type, get_last_error_message
 
--   A way of finding megatree branches by the pointer their `data` is assigned to
-
--   A list of transactions
-
-   
 Things that could potentially speed up the megatree:
 -   A path string ->  maybe stored as a hashmap/binary tree for effecient text searching  
 
 */
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
 
@@ -35,11 +30,48 @@ Things that could potentially speed up the megatree:
 #define ________MEGATREE_STRUCTS
 
 #if INTERFACE
+#define MT_INLINE_DATA_SIZE 16      // Copied data of up to this many bytes is stored inside the branch instead of on the heap
+
+#define MT_DATA_NONE     0          // The branch has no data
+#define MT_DATA_INLINE   1          // `data` points at the branch's own `inline_data`
+#define MT_DATA_HEAP     2          // `data` is owned by the branch, and is freed with it. See `mt_set_data_owned`
+#define MT_DATA_EXTERNAL 3          // `data` belongs to the caller, see `mt_set_data_pointer`
+#define MT_DATA_MAPPED   4          // `data` lies in a read-only snapshot mapped by the tree, see `mt_map_tree_from_file`
+
+#define MT_BRANCH_UNLOADED 1        // The branch's children are still in a snapshot, and are loaded when they are first reached.
+                                    // See `mt_load_tree_lazily_from_buffer`
+#define MT_BRANCH_CHANGED 2         // The branch's label, data or list of children has changed since the tree was last marked clean
+#define MT_BRANCH_CHANGED_BELOW 4   // Some descendant of the branch is MT_BRANCH_CHANGED. See `mt_write_delta_to_buffer`
+#define MT_BRANCH_VISITED 8         // Used while a delta is applied, to check that it names each branch only once
+#define MT_BRANCH_SHARING 16        // The branch is a copy whose children are still those of the branch it was copied from,
+                                    // and are copied when they are first reached. See `mt_copy_branch`
+#define MT_BRANCH_SHARED 32         // Copies may still be sharing the children of this branch
+#define MT_BRANCH_TOTALS_STALE 64   // The branch's cached totals have to be counted again, and so do its ancestors'. See `num_descendants`
+#define MT_BRANCH_WITHIN_QUERY 128  // Used while a label query runs, for branches known to be below the branch it is for
+#define MT_BRANCH_OUTSIDE_QUERY 256 // Used while a label query runs, for branches known not to be. See `__mt_label_matches_within`
+#define MT_BRANCH_SHARE_STAMP_SHIFT 9       // The rest of the bits hold the share epoch in which neither the branch
+#define MT_BRANCH_SHARE_STAMP_MAX 0x3fffff  // nor any ancestor was found to be MT_BRANCH_SHARED. See `__mt_unshare_path`
+
 typedef struct mt_branch            // Main data unit
 {
+    mt_branch* first_child;         // The first child of this branch, of NULL if there are no children. The children of a
+                                    // branch marked MT_BRANCH_UNLOADED or MT_BRANCH_SHARING are not created yet, and this reads
+                                    // NULL until they are: walk children with `mt_get_first_child` and `mt_get_next_sibling`,
+                                    // which create them, rather than through this field and `next_sibling`
+    mt_branch* next_sibling;        // The next child of `parent`, or NULL if this is the last child
     mt_branch* parent;              // The parent of this branch
-    mt_list* first_child;           // The first child of this branch, of NULL if there are no children
-    mt_list* last_child;            // The last child of this branch, or NULL if there are no children
+    mt_branch* last_child;          // The last child of this branch, or NULL if there are no children
+    mt_branch* prev_sibling;        // The previous child of `parent`, or NULL if this is the first child
+    mt_tree* tree;                  // The tree this branch belongs to (and whose pools it was allocated from)
+    size_t num_children;            // The number of children this branch has
+    size_t num_descendants;         // The number of branches below this one. Like the two totals below, it is kept up to date
+                                    // as the tree changes, unless the branch is marked MT_BRANCH_TOTALS_STALE
+    size_t childrens_data_size;     // The total size of the data of this branch's children, in bytes
+    size_t descendants_data_size;   // The total size of the data of all the branches below this one, in bytes
+    mt_child_index* child_index;    // Index of the children's labels, or NULL if this branch has too few children to need one
+    mt_branch* next_same_label;     // When the parent has a `child_index`, the next sibling with the same label as this one
+    mt_branch* next_labelled;       // When the tree has a `label_index`, the next branch anywhere in it with the same label
+    mt_branch* prev_labelled;       // When the tree has a `label_index`, the previous branch with the same label
 
     size_t id;                      // This branch's id. Should be unique. Can be used instead of labels in paths e.g. {<id>}
     char* label;                    // A label identifying this branch. Not necessarily unique among siblings.
@@ -50,398 +82,3814 @@ typedef struct mt_branch            // Main data unit
 
     size_t data_size;               // The size of `data` in bytes
     void* data;                     // Pointer to a buffer containing the data. Should always be exactly `data_size` bytes long
+    int data_storage;               // Where `data` lives; one of the MT_DATA_ values
+    unsigned char inline_data[MT_INLINE_DATA_SIZE];  // Storage for copied data small enough to keep in the branch itself
+    int flags;                      // Any of the MT_BRANCH_ bits
 
 } mt_branch;
 
 
-typedef struct mt_list             // Doubly-linked list containing the children of each `mt_branch`
-{
-    mt_list* prev;                 // The previous item, or NULL if this is the first item
-    mt_list* next;                 // The next item, or NULL if this is the last item
+typedef struct mt_list             // Position of an iteration through the children of a branch. Zero it before the first use
+{                                  // Children are linked to each other directly through `prev_sibling` and `next_sibling`
+    mt_branch* prev;               // The child returned before `item`, or NULL
+    mt_branch* next;               // The child that will be returned next, or NULL if there are no more children
 
-    mt_branch* item;               // The branch itself
+    mt_branch* item;               // The child returned most recently, or NULL if the iteration has not started
 } mt_list;
-#endif
 
-#define ________ERROR_HANDLING
 
+#define MT_SLAB_SIZE (256 * 1024)  // Bytes requested from the heap each time a pool runs out of room
+#define MT_LABEL_SIZE_CLASSES 3    // Strings of up to 16, 32 and 64 bytes (including the terminator) are pooled
 
-int MT_ERRORS_ARE_FATAL = 1;    // If set to 1, then terminate program if any error occurs
+typedef struct mt_slab             // One large block of memory that same-sized objects are carved out of
+{
+    mt_slab* next;                 // The previously allocated slab, or NULL if this is the first one
+    size_t used;                   // The number of objects handed out from this slab so far
+} mt_slab;
 
-int MT_ERROR_FLAG = 0;          // If 1, an error has 
 
-// When `MT_ERRORS_ARE_FATAL` is disabled, the mt_error_flag is set to 1 if an mt_error has occurred
-// during the execution of a function. This function `check_error_flag()` returns the result of that
-// flag and also clears it by setting it back to 0, allowing the function to detect an error condition
-// and terminate in a safe way.
-int __mt_check_error_flag()
+typedef struct mt_pool             // Hands out same-sized objects from slabs and recycles freed ones
 {
-    int temp_error_flag = MT_ERROR_FLAG;
-    MT_ERROR_FLAG = 0;
-    return temp_error_flag;
-}
+    size_t object_size;            // The size of every object in this pool, in bytes
+    size_t objects_per_slab;       // How many objects fit in one slab
+    mt_slab* slabs;                // The most recently allocated slab, or NULL if none have been allocated
 
-// Called when there is an error message to display
-int mt_error(const char *format, ...)
-{
-    va_list args;
-    va_start(args, format);
-    vprintf("*** Megatree error: %s\n", format, args);
-    va_end(args);
-    if(MT_ERRORS_ARE_FATAL)
-    {
-        printf("MT_ERRORS_ARE_FATAL is set to 1, so the program will now terminate.\n");
-        exit(0);
-    }
-    MT_ERROR_FLAG = 1;
-}
+    void* free_list;               // Objects that have been freed, linked together through their first word
+    size_t objects_in_use;         // Objects currently handed out and not yet freed
+    size_t total_allocations;      // Objects handed out over the lifetime of the pool
+    size_t num_slabs;              // Slabs allocated (i.e. the number of heap allocations the pool has made)
+} mt_pool;
 
 
-#define ________HOUSEKEEPING
+typedef struct mt_large_string     // Header placed in front of strings too long for the label pools
+{
+    mt_large_string* prev;         // The previous large string belonging to the tree, or NULL
+    mt_large_string* next;         // The next large string belonging to the tree, or NULL
+} mt_large_string;
 
-// Keeps track of the total number of branches in the megatree
-// Should be incremented every time a branch is added and decremented every time a branch is removed
-size_t MT_CURRENT_NUM_BRANCHES = 0;
 
-// This counter holds the maximum ID value in the entire megatree
-// This may be higher than the number of nodes in the case of 
-// In any case in which it may become desynchronised with the actual number, `mt_find_max_id` must be run
-size_t MT_MAX_ID = 0;
+#define MT_PATH_CACHE_DEFAULT_ENTRIES 1024  // The number of paths each tree can cache, unless changed with `mt_set_path_cache_size`
+#define MT_PATH_CACHE_WAYS 4               // The number of entries any one path could be stored in
 
-// Recursively traverse the entire tree, starting at root, to find the highest `id` field
-// 
-// `root`       The root node to start searching from
-// `max_id`     The maximum `id` field currently known (for recursive use)
-// `max_depth`  The maximum depth to traverse to. If -1, go as deep as necessary (no limit on depth)
-// 
-// Returns:     The maximum `id` field found in the entire tree starting at `root`
-size_t mt_find_max_id(mt_branch* root, size_t max_id, int max_depth)
+typedef struct mt_path_cache_entry // A path that has been resolved to a branch
 {
-    if(max_depth == 0) return max_id; // Stop if we have already reached max_depth
-    
-    // Check this node
-    if(root->id > max_id) max_id = root->id; 
+    size_t hash;                   // Hash of `root` and `key`, or 0 if the entry is empty
+    size_t generation;             // The cache generation the entry was stored in. Entries from earlier generations are stale
+    size_t last_used;              // When the entry was last stored or hit, for choosing which entry to evict
+    mt_branch* root;               // The branch the path was resolved relative to
+    mt_branch* branch;             // The branch the path resolved to
+    char* key;                     // The normalised path
+} mt_path_cache_entry;
 
-    // Recursively check deeper nodes
-    mt_list* list_position = root->first_child;
-    mt_branch* this_child = list_position->item;
 
-    while(list_position != NULL && this_child != NULL) 
-    {
-        int new_depth = max_depth; // If max_depth is -1, ignore depth limit
-        if(max_depth != -1) new_depth = max_depth - 1; 
+typedef struct mt_path_cache       // A bounded, set-associative cache of resolved paths
+{
+    mt_path_cache_entry* entries;  // `capacity` entries, or NULL if nothing has been cached yet
+    size_t capacity;               // The number of entries, a multiple of MT_PATH_CACHE_WAYS. 0 disables the cache
+    size_t generation;             // Incremented to make every existing entry stale
+    size_t clock;                  // Incremented on every store and hit, to order entries by recent use
 
-        max_id = mt_find_max_id(this_child, max_id, new_depth);
-        list_position = list_position->next;
-        this_child = list_position->item;
-    }
+    size_t hits;                   // Lookups answered from the cache
+    size_t misses;                 // Lookups that had to walk the tree
+    size_t invalidations;          // Times the cache has been made stale by a change to the tree
+} mt_path_cache;
 
-    return max_id;
-}
 
-// Finds the highest extant `id` field across the tree starting at `branch` and sets MT_MAX_ID to it
-void mt_update_max_id(mt_branch* root) { MT_MAX_ID = mt_find_max_id(root, 0, -1); }
+typedef struct mt_path_cache_stats // Summary of a tree's path cache, see `mt_get_path_cache_stats`
+{
+    size_t hits;                   // Lookups answered from the cache
+    size_t misses;                 // Lookups that had to walk the tree
+    size_t invalidations;          // Times the cache has been made stale by a change to the tree
+    size_t entries_in_use;         // Entries currently holding a valid path
+    size_t capacity;               // The maximum number of entries
+} mt_path_cache_stats;
 
 
+typedef struct mt_id_index_slot    // One slot of a tree's id index
+{
+    size_t id;                     // The id of `branch`
+    mt_branch* branch;             // The branch with this id, or NULL if the slot is empty
+} mt_id_index_slot;
 
-#define ________DATA_VALIDATION
 
-// Checks whether the provided label is a valid
-//
-// Returns:     1 if the label is valid, 0 if it is invalid
-int mt_check_label_valid(char* new_label)
+typedef struct mt_id_index         // Hash table finding each branch of a tree from its id
 {
-    int i = 0;
-    while(new_label[i] != 0)
-    {
-        if(new_label[i] == ' ' || new_label[i] == '/'   // ' ' is a general separator, '/' is the path separator, 
-        || new_label[i] == '{' || new_label[i] == '}')  // and {  } are used to denote referencing using IDs rather than labels
-        {
-            return 0;
-        }
+    mt_id_index_slot* slots;       // `capacity` slots, or NULL if nothing has been indexed
+    size_t capacity;               // The number of slots. Always a power of 2
+    size_t count;                  // The number of slots in use
+} mt_id_index;
 
-        i++;
-    }
+#define MT_ID_INDEX_RUN 16                // Consecutive ids kept together in the id index. The minimum capacity is a multiple
+#define MT_MAX_ID_STEPS 64                // Ids the maximum id steps down past when its branch is deleted, before it is left stale
 
-    return 1;
-}
 
-// Check whether `branch` is the root node
-// Returns:      1 if `branch` is the root node, or 0 if not
-int mt_check_is_root(mt_branch* branch)
+typedef struct mt_interned_string  // One distinct string shared by the labels and data types of a tree
 {
-    if (branch->parent == NULL) return 1;
-    return 0;
-}
+    char* string;                  // The tree's only copy of the string, or NULL if the slot is empty
+    size_t hash;                   // Hash of the string
+    size_t length;                 // Length of the string, excluding the terminator
+    size_t references;             // Labels and data types currently using it
+    int borrowed;                  // 1 if `string` lies in a mapped snapshot rather than the tree's own storage
+} mt_interned_string;
 
 
-// Check whether these two branches (and all their sub-branches and data fields) are identical
-// 
-// `branch_a`   Branch to compare to `branch_b`
-// `branch_b`   Branch to compare to `branch_a`
-//
-// Returns:     NULL if the branches are identical,
-//              or a pointer to the first branch found in `branch_a` that does not match its `branch_b` counterpart
-//              (you can run the function again with the branches swapped to find said non-matching counterpart)
-mt_branch* mt_check_branches_identical(mt_branch* branch_a, mt_branch* branch_b)
+typedef struct mt_string_table     // Hash table of every distinct label and data type string in a tree
 {
-
-}
+    mt_interned_string* slots;     // `capacity` slots, or NULL if nothing has been interned
+    size_t capacity;               // The number of slots. Always a power of 2
+    size_t count;                  // The number of distinct strings
+} mt_string_table;
 
 
+typedef struct mt_string_stats     // Summary of a tree's interned strings, see `mt_get_string_stats`
+{
+    size_t distinct_strings;       // Different label and data type strings stored
+    size_t references;             // Labels and data types using them
+    size_t bytes_stored;           // Bytes taken by the strings themselves, including terminators
+    size_t table_bytes;            // Bytes taken by the table that finds them
+    size_t bytes_without_interning;  // Bytes a separate copy of every label and data type would take
+    long bytes_saved;              // `bytes_without_interning - bytes_stored - table_bytes`
+} mt_string_stats;
 
 
-#define ________GET_BRANCHES
+#define MT_CHILD_INDEX_THRESHOLD 32       // Branches with at least this many children index them by label
 
-// Get the parent of the specified branch
-//
-// `branch`     The branch to find the parent of
-//
-// Returns:     A pointer to the parent of `branch`, or NULL if there is none (e.g. the branch is the root)
-mt_branch* mt_get_parent(mt_branch* branch)
+typedef struct mt_child_index_slot // One distinct label among the children of an indexed branch
 {
-    if (branch == NULL)  mt_error("Attempted to get the parent of a branch which is a null pointer"); 
-    if (__mt_check_error_flag()) return 0;
+    char* label;                   // The interned label, kept here so that probing doesn't touch the children
+    mt_branch* head;               // The first child with this label, or NULL if the slot is empty
+    mt_branch* tail;               // The last child with this label
+} mt_child_index_slot;
 
-    return branch->parent;
-}
 
+typedef struct mt_child_index      // Hash table finding the children of a wide branch from their labels
+{
+    mt_child_index* prev;          // The previous index belonging to the same tree, or NULL
+    mt_child_index* next;          // The next index belonging to the same tree, or NULL
 
+    mt_child_index_slot* slots;    // `capacity` slots
+    size_t capacity;               // The number of slots. Always a power of 2
+    size_t count;                  // The number of distinct labels
+} mt_child_index;
 
-// Get the total number of recursive sub-branches (all descendants) of `branch`
-//
-// `branch`             The branch to start searching at
-// `num_descendants`    Set to 0 -- Start counting at this number (for recursive use)
-// `max_depth`          The maximum depth to traverse to. If -1, go as deep as necessary (no limit on depth)
-//
-//  Returns:            The total number of branches that descend from this branch
-int mt_get_num_descendants(mt_branch* branch, size_t num_descendants, int max_depth)
+
+typedef struct mt_label_postings   // Every branch of a tree with one label, as a node of the tree's label index
 {
-    if(max_depth == 0) return num_descendants; // Stop if we have already reached max_depth
+    char* label;                   // The interned label
+    mt_branch* first;              // The branch labelled most recently, linked to the others through `next_labelled`
+    size_t count;                  // The number of branches with the label
+    mt_label_postings* left;       // The node whose labels sort before `label`, or NULL
+    mt_label_postings* right;      // The node whose labels sort after `label`, or NULL
+    unsigned priority;             // Random, and never lower than the priorities below it, which keeps the index balanced
+} mt_label_postings;
 
-    // Recursively check deeper nodes
-    mt_list* list_position = branch->first_child;
-    mt_branch* this_child = list_position->item;
 
-    while(list_position != NULL && this_child != NULL) 
-    {
-        int new_depth = max_depth; // If max_depth is -1, ignore depth limit
-        if(max_depth != -1) new_depth = max_depth - 1; 
+typedef struct mt_label_index      // Every branch of a tree, by label, see `mt_enable_label_index`
+{
+    mt_label_postings* top;        // The node with the highest priority, or NULL if nothing has been indexed
+    mt_pool nodes;                 // Storage for the nodes
+    size_t count;                  // The number of distinct labels
+    unsigned seed;                 // State of the generator the priorities are drawn from
+} mt_label_index;
 
-        num_descendants++; // Count this node
-        num_descendants = mt_get_num_descendants(this_child, num_descendants, new_depth);
-        list_position = list_position->next;
-        this_child = list_position->item;
-    }
 
-    return num_descendants;
-}
+typedef struct mt_data_index_node  // One branch with data, as a node of the tree's data index
+{
+    size_t start;                  // The address of the branch's data
+    size_t end;                    // The address just past it. At least `start + 1`, so that empty data has an address too
+    mt_branch* branch;             // The branch. Nodes are ordered by `start`, then by the address of `branch`
+    size_t max_end;                // The largest `end` of this node and every node below it
+    mt_data_index_node* left;      // The node whose keys sort before this one's, or NULL
+    mt_data_index_node* right;     // The node whose keys sort after this one's, or NULL
+    unsigned priority;             // Random, and never lower than the priorities below it, which keeps the index balanced
+} mt_data_index_node;
 
-// Get the number of direct children that `branch` has
-int mt_get_num_children(mt_branch* branch)
+
+typedef struct mt_data_index       // Every branch of a tree with data, by the address of its data, see `mt_enable_data_index`
 {
-    mt_get_num_descendants(branch, 0, 1);
-}
+    mt_data_index_node* top;       // The node with the highest priority, or NULL if nothing has been indexed
+    mt_pool nodes;                 // Storage for the nodes
+    size_t count;                  // The number of branches indexed
+    unsigned seed;                 // State of the generator the priorities are drawn from
+} mt_data_index;
 
 
-// Get the nth child of `branch`
-//
-// `branch`     The branch to look for children in
-//
-// Returns:     A pointer to the parent of `branch`, or NULL if there are less than `n` children
-mt_branch* mt_get_nth_child(mt_branch* branch, int n)
+typedef struct mt_mapping          // A snapshot file mapped into memory, which branches of a tree point into
 {
+    mt_mapping* next;              // The next mapping belonging to the same tree, or NULL
+    void* address;                 // Where the file is mapped
+    size_t size;                   // The size of the mapping in bytes
+} mt_mapping;
 
-}
 
-// Get the first child of `branch`
-//
-// Returns:     A pointer to the first child, or NULL if there are no children
-mt_branch* mt_get_first_child(mt_branch* branch)
+typedef struct mt_lazy_snapshot    // A snapshot that some branches of a tree have not been loaded from yet
+{
+    mt_lazy_snapshot* next;        // The next lazy snapshot belonging to the same tree, or NULL
+    unsigned char* buffer;         // The snapshot, which stays where it is until the tree is destroyed
+    int zero_copy;                 // 1 if `buffer` is a mapped file that loaded labels and data can point into
+    size_t file_size;
+    size_t num_strings;
+    size_t strings_offset;
+    size_t num_branches;
+    size_t branches_offset;
+    size_t data_offset;
+    unsigned char* labels_checked; // Which strings are known to be valid labels
+    int changed;                   // 1 if it was loaded into an existing tree, so that every branch loaded from it counts as changed
+} mt_lazy_snapshot;
+
+
+typedef struct mt_unloaded_slot    // One slot of a tree's index of unloaded or sharing branches
 {
+    mt_branch* branch;             // A branch with the MT_BRANCH_UNLOADED or MT_BRANCH_SHARING flag, or NULL if the slot is empty
+    mt_lazy_snapshot* snapshot;    // The snapshot its children are in
+    size_t record;                 // The index of its own record in `snapshot`
+    mt_branch* source;             // For a sharing branch, the branch whose children it shares. For a shared branch, in the
+                                   // tree's `sharers`, the first copy sharing its children
+    mt_branch* next_copy;          // For a sharing branch, the next and previous copies sharing the same children
+    mt_branch* prev_copy;
+} mt_unloaded_slot;
 
-}
 
-// Iterate through the children of `parent` by maintaining an `iterator` pointer
-// 
-// If `iterator` is null, returns the first child of `parent` and sets `iterator` to the new sibling position
-// If `iterator` is non-null, uses it to find the next sibling in the list
-// 
-// Returns: the first child of `parent`, 
-//          or the next child pointed to by `iterator`,
-//          or NULL if there are no more children
-// 
-// Also modifies `iterator` each time. Please pass it in the next time you call!
-mt_branch* mt_get_next_sibling(mt_branch* parent, mt_list* iterator)
+typedef struct mt_unloaded_index   // Hash table finding where the children of each unloaded or sharing branch are
 {
+    mt_unloaded_slot* slots;       // `capacity` slots, or NULL if nothing has been indexed
+    size_t capacity;               // The number of slots. Always a power of 2
+    size_t count;                  // The number of unloaded branches
+} mt_unloaded_index;
 
-}
 
+#define MT_MAX_READERS 64                 // Threads that can be registered to read one tree at the same time
+#define MT_RECLAIM_THRESHOLD 1024         // Retired objects a writer collects before it tries to reclaim them
 
-// Retrieve pointers to every child of the specified `branch` and write them into `out_pointer_array`
-// This can be done in batches, for instance, when `out_pointer_array` is smaller than the total number
-// of children belonging to this branch. If `iterator` is provided, it is modified each time to allow
-// multiple sequential reads of pointers.
-// 
-// `branch`             The branch to retrieve the children of
-// `iterator`           The iterator from a previous execution of this function, or NULL to start from the first child
-// `out_pointer_array`  An array of pointers to branches written out by the function. Unused elements are filled with `NULL`
-// `out_capacity`       The number of pointers that can fit in `out_pointer_array`
-//   
-// Returns:             The number of branch pointers written to `out_pointer_array` in this batch
-//
-// Also modifies `iterator` each time. Please pass it in the next time you call!
-int mt_get_children_as_pointer_array(mt_branch* branch, mt_list* iterator, mt_branch* out_pointer_array, int out_capacity)
+#define MT_RETIRE_BRANCH 1                // A branch to give back to the tree's branch pool
+#define MT_RETIRE_STRING 2                // A string to give back with `__mt_tree_free_string`
+#define MT_RETIRE_MEMORY 3                // A heap block to `free`
+
+typedef struct mt_reader           // A thread reading a tree while another thread changes it, see `mt_register_reader`
 {
-    
-    // Remember to pad up to `out_capacity` with NULLs
-}
+    mt_tree* tree;                 // The tree being read, or NULL if the slot is free
+    size_t epoch;                  // The tree's epoch when the current read began, or 0 between reads
+    unsigned char padding[64 - sizeof(mt_tree*) - sizeof(size_t)];  // Each reader has a cache line to itself
+} mt_reader;
 
 
+typedef struct mt_retired          // Something removed from a tree that a reader may still be looking at
+{
+    void* pointer;
+    size_t epoch;                  // The tree's epoch when it was removed
+    int kind;                      // One of the MT_RETIRE_ kinds
+} mt_retired;
 
 
-#define ________SEARCH
+typedef struct mt_reclaimer        // Lets threads read a tree without locks while one thread changes it
+{
+    mt_reader readers[MT_MAX_READERS];
+    size_t epoch;                  // Advanced each time the writer reclaims memory. Starts at 1
+    size_t sequence;               // Odd while the writer is moving entries of the tree's hash tables
+    int write_depth;               // How deeply the writer's changes to the hash tables are nested
 
-// Find the first occurrence of a branch descending from `root` with the label `label`
-mt_branch* mt_search_for_label(mt_branch* root, char* label)
+    mt_retired* retired;           // Objects waiting until no reader can still be looking at them
+    size_t num_retired;
+    size_t capacity;
+    size_t retired_branches;       // Branches among them, which no longer count as part of the tree
+    size_t reclaimed;              // Objects reclaimed since concurrent reads were enabled
+} mt_reclaimer;
+
+
+typedef struct mt_tree             // Bookkeeping shared by every branch of one megatree
 {
+    mt_branch* root;               // The root branch of the tree
 
+    mt_pool branch_pool;           // Storage for every `mt_branch`
+    mt_pool label_pools[MT_LABEL_SIZE_CLASSES];  // Storage for short label and data type strings
 
-}
+    mt_large_string* large_strings;  // Strings too long for the label pools, allocated individually
+    size_t large_string_allocations; // Total number of large strings allocated
+    mt_string_table strings;       // Every distinct label and data type, each stored once
 
+    mt_path_cache path_cache;      // Recently resolved paths
 
+    mt_id_index id_index;          // Every branch of the tree, by id
+    size_t last_issued_id;         // The id given to the most recently created branch. Ids are never issued twice
+    size_t max_id;                 // The highest id belonging to a branch that currently exists, unless `max_id_stale` is set
+    int max_id_stale;              // Set if `max_id` may belong to a deleted branch, and has to be found again from the id index
 
+    size_t heap_data_buffers;      // Branches whose data was allocated on the heap, and must be freed with the tree
 
-// Return the branch pointed to by `path`, relative to the branch `root`
-//
-// Path format:   root/label/another_label/{12}/{132}/final_label
-mt_branch* mt_get_by_path(mt_branch* root, char* path)
-{
-    if(path == NULL) return NULL;
+    mt_child_index* child_indexes; // Every child label index belonging to branches of this tree
+    mt_label_index* label_index;   // Every branch of the tree by label, or NULL. See `mt_enable_label_index`
+    mt_data_index* data_index;     // Every branch of the tree with data by its address, or NULL. See `mt_enable_data_index`
 
-    mt_branch* current_branch = root;
+    mt_mapping* mappings;          // Snapshot files that branches' labels and data point into
+    mt_lazy_snapshot* lazy_snapshots;  // Snapshots that are being loaded a branch at a time
+    mt_unloaded_index unloaded;    // Branches whose children have not been loaded from those snapshots yet
+    mt_unloaded_index shared;      // Copies whose children have not been copied yet, see `mt_copy_branch`
+    mt_unloaded_index sharers;     // Branches whose children copies are sharing, each with the first of those copies
+    unsigned int share_epoch;      // Advanced whenever a branch becomes MT_BRANCH_SHARED, see `__mt_unshare_path`
 
-    // TODO: This is where we check in the cache first, when we have one
+    mt_journal* journal;           // Where every change to the tree is recorded, or NULL. See `mt_open_journal`
+    mt_reclaimer* reclaimer;       // Set while other threads may be reading the tree. See `mt_enable_concurrent_reads`
+} mt_tree;
 
-    // Iterate through each token in the path
-    for (char *label = strtok(path," "); label != NULL; label = strtok(NULL, "/"))
-    {
-        // If label starts with { and ends with }
-        int starts_with = (label[0] == '{');
-        int i=0;
-        while(label[i] != 0) { i++; }    // Go to the end of the string
-        int ends_with = (label[i-1] == '}');
 
-        if(starts_with && ends_with)
-        {
-            size_t id_to_find = atoi(label);    // Try to parse the string inside into an integer
+typedef struct mt_allocation_stats // Summary of the memory a tree has requested, see `mt_get_allocation_stats`
+{
+    size_t objects_allocated;      // Branches and strings handed out over the tree's lifetime
+    size_t heap_allocations;       // Calls actually made to the heap allocator to provide them
+    size_t allocations_saved;      // `objects_allocated - heap_allocations`
+    size_t objects_in_use;         // Branches and strings currently in use
+    size_t bytes_reserved;         // Total bytes held in slabs
+} mt_allocation_stats;
+#endif
 
-            if(id_to_find != 0) // If it's valid, try to find a child of the current branch with a matching ID
-            {   // If found, set current_branch to the matching branch and continue loop
-                
-                
-            }   
-        }
-        else
-        {
+#define ________ERROR_HANDLING
 
-        }
-        
-        // Else, try to find a child of the current branch with a matching label
-        
+// Error state is kept separately for each thread, so that threads working on their own trees never share it.
+// Whether errors are fatal is configuration rather than state, so it is shared by every thread
+#if INTERFACE
+#if defined(_MSC_VER)
+#define MT_THREAD_LOCAL __declspec(thread)
+#else
+#define MT_THREAD_LOCAL __thread
+#endif
 
-        // If found, set current_branch to the matching branch and continue loop
+#define MT_ERROR_MESSAGE_SIZE 256
+#endif
 
-        
-        // If not found, return NULL
-    }
+int MT_ERRORS_ARE_FATAL = 1;                    // If set to 1, then terminate program if any error occurs on any thread
 
-    // TODO: This is where we add the path to the path cache, when  we have one
+MT_THREAD_LOCAL int MT_ERROR_FLAG = 0;          // If 1, an error has occurred on this thread and not been handled yet
 
-    return current_branch;
+MT_THREAD_LOCAL char MT_ERROR_MESSAGE[MT_ERROR_MESSAGE_SIZE];  // The last error on this thread, or empty if none
+
+// When `MT_ERRORS_ARE_FATAL` is disabled, the mt_error_flag is set to 1 if an mt_error has occurred
+// during the execution of a function. This function `check_error_flag()` returns the result of that
+// flag and also clears it by setting it back to 0, allowing the function to detect an error condition
+// and terminate in a safe way.
+int __mt_check_error_flag()
+{
+    int temp_error_flag = MT_ERROR_FLAG;
+    MT_ERROR_FLAG = 0;
+    return temp_error_flag;
 }
 
-// Check whether the branch pointed to by `path` exists
-// Returns:     1 if found, 0 if not found
-int mt_check_path_exists(mt_branch* root, char* path)
+// Called when there is an error message to display
+int mt_error(const char *format, ...)
 {
-    if(mt_get_by_path(root, path) != NULL) return 1;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(MT_ERROR_MESSAGE, MT_ERROR_MESSAGE_SIZE, format, args);
+    va_end(args);
+    printf("*** Megatree error: %s\n", MT_ERROR_MESSAGE);
+    if(MT_ERRORS_ARE_FATAL)
+    {
+        printf("MT_ERRORS_ARE_FATAL is set to 1, so the program will now terminate.\n");
+        exit(0);
+    }
+    MT_ERROR_FLAG = 1;
     return 0;
 }
 
+// Get the message of the last error that occurred on the calling thread, when `MT_ERRORS_ARE_FATAL` is disabled.
+// Errors on other threads are not seen, so each thread can check the calls it made
+//
+// Returns:     The message, or NULL if there has been no error since `mt_clear_last_error` was last called
+char* mt_get_last_error()
+{
+    return MT_ERROR_MESSAGE[0] ? MT_ERROR_MESSAGE : NULL;
+}
 
+// Forget the last error that occurred on the calling thread
+void mt_clear_last_error()
+{
+    MT_ERROR_MESSAGE[0] = 0;
+}
 
 
+#define ________MEMORY_POOL
 
-#define ________GET_DATA
-
+// Every tree owns a set of pools. Branches and short strings are carved out of large slabs
+// rather than being allocated one by one, so building a tree costs one heap allocation per slab instead
+// of several per branch. Freed objects are kept on a free list and handed out again, and a whole tree can
+// be released by freeing its slabs without visiting any of its branches.
 
-// Get a pointer to the data belonging to `branch`
-//
-// Returns:     A pointer to the data or NULL if there is no data or if `branch` doesn't exist
-void* mt_get_data_pointer(mt_branch branch)
+// Prepare an empty pool that hands out objects of `object_size` bytes
+void __mt_pool_init(mt_pool* pool, size_t object_size)
 {
+    if(object_size < sizeof(void*)) object_size = sizeof(void*);        // Room for the free list link
+    object_size = (object_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);  // Keep every object aligned
 
+    memset(pool, 0, sizeof *pool);
+    pool->object_size = object_size;
+    pool->objects_per_slab = (MT_SLAB_SIZE - sizeof(mt_slab)) / object_size;
 }
 
-// Copies the data belonging to `branch` into `out_buffer`, up to a maximum of `out_capacity` bytes
+// Get a zeroed object from `pool`, reusing a freed one if there is one
 //
-// Returns:     The number of bytes copied; 0 if there is no data or e.g. `branch` doesn't exist
-int mt_get_data_copy(mt_branch branch, void* out_buffer, size_t out_capacity)
+// Returns:     A pointer to the object, or NULL if the heap is exhausted
+void* __mt_pool_alloc(mt_pool* pool)
 {
-    
+    void* object = pool->free_list;
+
+    if(object != NULL)
+    {
+        pool->free_list = *(void**)object;
+    }
+    else
+    {
+        if(pool->slabs == NULL || pool->slabs->used == pool->objects_per_slab) // Start a new slab if needed
+        {
+            mt_slab* slab = malloc(MT_SLAB_SIZE);
+            if (slab == NULL) mt_error("Could not allocate a new slab of %d bytes", MT_SLAB_SIZE);
+            if (__mt_check_error_flag()) return 0;
+
+            slab->next = pool->slabs;
+            slab->used = 0;
+            pool->slabs = slab;
+            pool->num_slabs++;
+        }
+
+        object = (char*)(pool->slabs + 1) + pool->slabs->used * pool->object_size;
+        pool->slabs->used++;
+    }
+
+    memset(object, 0, pool->object_size);
+    pool->objects_in_use++;
+    pool->total_allocations++;
+    return object;
 }
 
+// Return `object` to `pool` so it can be handed out again
+void __mt_pool_free(mt_pool* pool, void* object)
+{
+    if(object == NULL) return;
 
-// Get the size of the data belonging to `branch`
-// This only includes data fields, and not any tree metadata
-//
-// Returns:     the data size, in bytes, or 0 if there is no data or if the branch doesn't exist
-size_t mt_get_data_size(mt_branch branch)
+    *(void**)object = pool->free_list;
+    pool->free_list = object;
+    pool->objects_in_use--;
+}
+
+// Release every slab belonging to `pool`. Any objects still in use become invalid
+void __mt_pool_release(mt_pool* pool)
 {
+    mt_slab* slab = pool->slabs;
+    while(slab != NULL)
+    {
+        mt_slab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
 
+    pool->slabs = NULL;
+    pool->free_list = NULL;
+    pool->objects_in_use = 0;
 }
 
-// Get the total size of the data belonging to the direct children of `branch`
-// This only includes data fields, and not any tree metadata
+// Find which of the tree's label pools can hold a string of `length` bytes (including the terminator)
 //
-// Returns:     the data size, in bytes, or 0 if there is no data or if there are no children
-size_t mt_get_childrens_data_size(mt_branch branch)
+// Returns:     The index of the pool, or MT_LABEL_SIZE_CLASSES if the string is too long to be pooled
+int __mt_label_size_class(size_t length)
 {
-
+    int size_class = 0;
+    size_t class_size = 16;
+    while(size_class < MT_LABEL_SIZE_CLASSES && length > class_size)
+    {
+        size_class++;
+        class_size *= 2;
+    }
+    return size_class;
 }
 
-// Get the total size of the data belonging to the direct children of `branch`
-// This only includes data fields, and not any tree metadata
+// Copy `string` into storage owned by `tree`
 //
-// Returns:     the data size, in bytes, or 0 if there is no data or if there are no children
-size_t mt_get_childrens_data_size_recursive(mt_branch branch)
+// Returns:     A pointer to the copy, or NULL if the heap is exhausted
+char* __mt_tree_strdup(mt_tree* tree, const char* string)
 {
+    size_t length = strlen(string) + 1;
+    int size_class = __mt_label_size_class(length);
+    char* copy;
 
-}
+    if(size_class < MT_LABEL_SIZE_CLASSES)
+    {
+        copy = __mt_pool_alloc(&tree->label_pools[size_class]);
+    }
+    else    // Too long for the pools; allocate it on its own and remember it so the tree can release it
+    {
+        mt_large_string* header = malloc(sizeof *header + length);
+        if (header == NULL) mt_error("Could not allocate %ld bytes for a string", length);
+        if (__mt_check_error_flag()) return 0;
 
+        header->prev = NULL;
+        header->next = tree->large_strings;
+        if(tree->large_strings != NULL) tree->large_strings->prev = header;
+        tree->large_strings = header;
+        tree->large_string_allocations++;
 
+        copy = (char*)(header + 1);
+    }
 
+    if(copy != NULL) memcpy(copy, string, length);
+    return copy;
+}
 
-#define ________EDIT
+// Give the storage for a string created by `__mt_tree_strdup` back to `tree`
+void __mt_tree_free_string(mt_tree* tree, char* string)
+{
+    if(string == NULL) return;
 
-// Sets the label for the specified Megatree branch.
-// 
-// `branch`     The branch to set the label of
-// `new_label`  The label to set it to
-//
+    int size_class = __mt_label_size_class(strlen(string) + 1);
+
+    if(size_class < MT_LABEL_SIZE_CLASSES)
+    {
+        __mt_pool_free(&tree->label_pools[size_class], string);
+    }
+    else
+    {
+        mt_large_string* header = (mt_large_string*)string - 1;
+        if(header->prev != NULL) header->prev->next = header->next;
+        else tree->large_strings = header->next;
+        if(header->next != NULL) header->next->prev = header->prev;
+        free(header);
+    }
+}
+
+// Summarise the memory requested by the tree that `branch` belongs to
+//
+// `branch`     Any branch of the tree
+// `out_stats`  Filled with the totals across all of the tree's pools
+void mt_get_allocation_stats(mt_branch* branch, mt_allocation_stats* out_stats)
+{
+    if (branch == NULL)     mt_error("Attempted to get the allocation stats of a branch which is a null pointer");
+    if (out_stats == NULL)  mt_error("Attempted to get allocation stats into a null pointer");
+    if (__mt_check_error_flag()) return;
+
+    mt_tree* tree = branch->tree;
+    mt_pool* pools[1 + MT_LABEL_SIZE_CLASSES] = { &tree->branch_pool };
+    for(int i=0; i<MT_LABEL_SIZE_CLASSES; i++) pools[1 + i] = &tree->label_pools[i];
+
+    memset(out_stats, 0, sizeof *out_stats);
+    for(int i=0; i<1 + MT_LABEL_SIZE_CLASSES; i++)
+    {
+        out_stats->objects_allocated += pools[i]->total_allocations;
+        out_stats->heap_allocations += pools[i]->num_slabs;
+        out_stats->objects_in_use += pools[i]->objects_in_use;
+        out_stats->bytes_reserved += pools[i]->num_slabs * MT_SLAB_SIZE;
+    }
+
+    out_stats->objects_allocated += tree->large_string_allocations;   // Each of these was its own heap allocation
+    out_stats->heap_allocations += tree->large_string_allocations;
+    out_stats->allocations_saved = out_stats->objects_allocated - out_stats->heap_allocations;
+}
+
+
+#define ________CONCURRENT_READS
+
+// A tree can be read by many threads at once while one thread changes it, without any locks. Readers register
+// with the tree and wrap each group of reads in `mt_begin_read` and `mt_end_read`. Anything the writer removes
+// from the tree (branches, strings, data and the old tables of a grown hash table) is retired rather than freed,
+// tagged with the tree's epoch, and only reclaimed once every reader has moved on to a later epoch.
+// Lookups through the tree's hash tables could miss an entry while the writer is moving it, so the writer
+// makes a sequence number odd while it does, and lookups that overlap a change are simply repeated.
+
+// Prepare `tree` so that other threads can read it while this thread changes it, until `mt_disable_concurrent_reads`.
+// Lazily loaded branches are all loaded first, as readers must never change the tree. Paths are then resolved
+// without the path cache, which every lookup would otherwise write to. Applying deltas is not allowed meanwhile
+//
+// `root`       The root of the tree
+//
+// Returns:     1 if success, 0 if error
+int mt_enable_concurrent_reads(mt_branch* root)
+{
+    if (root == NULL) mt_error("Attempted to enable concurrent reads of a tree whose root is a null pointer");
+    else if (!mt_check_is_root(root)) mt_error("Attempted to enable concurrent reads from a branch which is not the root");
+    else if (root->tree->reclaimer != NULL) mt_error("Attempted to enable concurrent reads of a tree twice");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_tree* tree = root->tree;
+    __mt_load_all_children(tree);
+    mt_reclaimer* reclaimer = calloc(1, sizeof *reclaimer);
+    if (reclaimer == NULL) mt_error("Could not allocate memory for concurrent reads");
+    if (__mt_check_error_flag()) return 0;
+
+    reclaimer->epoch = 1;
+    __mt_path_cache_invalidate(tree);
+    __atomic_store_n(&tree->reclaimer, reclaimer, __ATOMIC_SEQ_CST);
+    return 1;
+}
+
+// Stop other threads reading the tree of `root`, and reclaim everything retired meanwhile. No read may be in progress
+//
+// Returns:     1 if success, 0 if error
+int mt_disable_concurrent_reads(mt_branch* root)
+{
+    if (root == NULL) mt_error("Attempted to disable concurrent reads of a tree whose root is a null pointer");
+    else if (root->tree->reclaimer == NULL) mt_error("Attempted to disable concurrent reads of a tree which does not allow them");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_reclaimer* reclaimer = root->tree->reclaimer;
+    for(int i=0; i<MT_MAX_READERS; i++)
+    {
+        if (__atomic_load_n(&reclaimer->readers[i].epoch, __ATOMIC_SEQ_CST) != 0) mt_error("Attempted to disable concurrent reads while a read is in progress");
+    }
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_reclaim_retired(root->tree, (size_t)-1);
+    free(reclaimer->retired);
+    free(reclaimer);
+    __atomic_store_n(&root->tree->reclaimer, NULL, __ATOMIC_SEQ_CST);
+    return 1;
+}
+
+// Register the calling thread to read the tree that `branch` belongs to while another thread changes it.
+// Each reading thread needs its own reader
+//
+// Returns:     The reader, or NULL if concurrent reads are not enabled or MT_MAX_READERS are registered already
+mt_reader* mt_register_reader(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to register a reader of a branch which is a null pointer");
+    else if (__atomic_load_n(&branch->tree->reclaimer, __ATOMIC_ACQUIRE) == NULL) mt_error("Attempted to register a reader of a tree which does not allow concurrent reads");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_reclaimer* reclaimer = __atomic_load_n(&branch->tree->reclaimer, __ATOMIC_ACQUIRE);
+    for(int i=0; i<MT_MAX_READERS; i++)
+    {
+        mt_tree* expected = NULL;
+        if (__atomic_compare_exchange_n(&reclaimer->readers[i].tree, &expected, branch->tree, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        {
+            return &reclaimer->readers[i];
+        }
+    }
+    mt_error("Attempted to register more than %d readers of one tree", MT_MAX_READERS);
+    __mt_check_error_flag();
+    return 0;
+}
+
+// Give up a reader registered with `mt_register_reader`, outside of any read
+void mt_unregister_reader(mt_reader* reader)
+{
+    if (reader == NULL) mt_error("Attempted to unregister a reader which is a null pointer");
+    if (__mt_check_error_flag()) return;
+
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&reader->tree, NULL, __ATOMIC_SEQ_CST);
+}
+
+// Start reading the tree through `reader`. Until `mt_end_read`, every branch, label and data buffer reached stays
+// in memory, even if the writer deletes or replaces it meanwhile. Pointers must not be kept from one read to the next.
+// While reading, the thread may look branches up (`mt_get_by_path`, `mt_get_by_id`, `mt_search_for_label`),
+// walk children (`mt_get_first_child`, `mt_get_next_sibling`) and get data (`mt_get_data_pointer`, `mt_get_data_copy`).
+// The writer may be changing the `first_child` and `next_sibling` links meanwhile, so they are only followed
+// through those functions. Data the writer changes in place may be seen half written through a pointer;
+// `mt_get_data_copy` always copies it whole
+void mt_begin_read(mt_reader* reader)
+{
+    mt_tree* tree = __atomic_load_n(&reader->tree, __ATOMIC_ACQUIRE);
+    mt_reclaimer* reclaimer = __atomic_load_n(&tree->reclaimer, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&reader->epoch, __atomic_load_n(&reclaimer->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);   // Pairs with the fence in `__mt_reclaim_retired`
+}
+
+// Finish a read started with `mt_begin_read`, letting the writer reclaim what the thread might have been looking at
+void mt_end_read(mt_reader* reader)
+{
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+// Dispose of an object removed from `tree`, or retire it until no reader can be looking at it
+//
+// `kind`       One of the MT_RETIRE_ kinds
+void __mt_retire(mt_tree* tree, int kind, void* pointer)
+{
+    if (pointer == NULL) return;
+
+    mt_reclaimer* reclaimer = tree->reclaimer;
+    if (reclaimer != NULL && reclaimer->num_retired == reclaimer->capacity)
+    {
+        size_t capacity = reclaimer->capacity ? reclaimer->capacity * 2 : MT_RECLAIM_THRESHOLD;
+        mt_retired* grown = realloc(reclaimer->retired, capacity * sizeof *grown);
+        if (grown != NULL) { reclaimer->retired = grown; reclaimer->capacity = capacity; }
+        else if (!__mt_reclaim_retired(tree, (size_t)-1)) reclaimer = NULL;    // Wait for the readers rather than leak
+    }
+
+    if (reclaimer == NULL)
+    {
+        if (kind == MT_RETIRE_BRANCH) __mt_pool_free(&tree->branch_pool, pointer);
+        else if (kind == MT_RETIRE_STRING) __mt_tree_free_string(tree, pointer);
+        else free(pointer);
+        return;
+    }
+
+    mt_retired* retired = &reclaimer->retired[reclaimer->num_retired++];
+    retired->pointer = pointer;
+    retired->epoch = reclaimer->epoch;
+    retired->kind = kind;
+    if (kind == MT_RETIRE_BRANCH) reclaimer->retired_branches++;
+    if (reclaimer->num_retired >= MT_RECLAIM_THRESHOLD && reclaimer->num_retired % MT_RECLAIM_THRESHOLD == 0) __mt_reclaim_retired(tree, 0);
+}
+
+// Advance the epoch of `tree` and free every retired object that no reader can still be looking at.
+// If `spins` is not 0, wait up to that many times for readers to move on until everything has been freed
+//
+// Returns:     1 if everything retired was freed, 0 if some is still waiting for readers
+int __mt_reclaim_retired(mt_tree* tree, size_t spins)
+{
+    mt_reclaimer* reclaimer = tree->reclaimer;
+    for(size_t spin=0; ; spin++)
+    {
+        __atomic_store_n(&reclaimer->epoch, reclaimer->epoch + 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);   // Pairs with the fence in `mt_begin_read`
+
+        // Anything retired before the oldest read in progress began can no longer be reached
+        size_t oldest = reclaimer->epoch;
+        for(int i=0; i<MT_MAX_READERS; i++)
+        {
+            size_t epoch = __atomic_load_n(&reclaimer->readers[i].epoch, __ATOMIC_SEQ_CST);
+            if (epoch != 0 && epoch < oldest) oldest = epoch;
+        }
+
+        size_t kept = 0;
+        for(size_t i=0; i<reclaimer->num_retired; i++)
+        {
+            mt_retired* retired = &reclaimer->retired[i];
+            if (retired->epoch >= oldest) { reclaimer->retired[kept++] = *retired; continue; }
+
+            if (retired->kind == MT_RETIRE_BRANCH)
+            {
+                __mt_pool_free(&tree->branch_pool, retired->pointer);
+                reclaimer->retired_branches--;
+            }
+            else if (retired->kind == MT_RETIRE_STRING) __mt_tree_free_string(tree, retired->pointer);
+            else free(retired->pointer);
+            reclaimer->reclaimed++;
+        }
+        reclaimer->num_retired = kept;
+        if (kept == 0 || spin >= spins) return kept == 0;
+    }
+}
+
+// Free whatever the writer has removed from the tree of `branch` that no reader can still be looking at.
+// This happens by itself as objects are removed, so calling it is only needed to free memory sooner
+//
+// Returns:     The number of objects still waiting for readers to finish
+size_t mt_reclaim(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to reclaim memory from a branch which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    if (branch->tree->reclaimer == NULL) return 0;
+    __mt_reclaim_retired(branch->tree, 0);
+    return branch->tree->reclaimer->num_retired;
+}
+
+// Mark the start of a change that could make a reader's lookup miss an entry of one of the tree's hash tables.
+// Changes may be nested, and must each be ended with `__mt_end_write`
+void __mt_begin_write(mt_tree* tree)
+{
+    mt_reclaimer* reclaimer = tree->reclaimer;
+    if (reclaimer == NULL || reclaimer->write_depth++ > 0) return;
+    __atomic_store_n(&reclaimer->sequence, reclaimer->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// Mark the end of a change started with `__mt_begin_write`
+void __mt_end_write(mt_tree* tree)
+{
+    mt_reclaimer* reclaimer = tree->reclaimer;
+    if (reclaimer == NULL || --reclaimer->write_depth > 0) return;
+    __atomic_store_n(&reclaimer->sequence, reclaimer->sequence + 1, __ATOMIC_RELEASE);
+}
+
+// Get the writer's sequence number before a lookup, waiting for any change in progress to finish.
+// Pass it to `__mt_check_read_sequence` afterwards
+size_t __mt_read_sequence(mt_tree* tree)
+{
+    mt_reclaimer* reclaimer = __atomic_load_n(&tree->reclaimer, __ATOMIC_ACQUIRE);
+    if (reclaimer == NULL) return 0;
+
+    size_t sequence;
+    while((sequence = __atomic_load_n(&reclaimer->sequence, __ATOMIC_ACQUIRE)) & 1);
+    return sequence;
+}
+
+// Check whether a lookup that started at `sequence` overlapped a change, and so must be repeated
+//
+// Returns:     1 if the lookup is good, 0 if it must be repeated
+int __mt_check_read_sequence(mt_tree* tree, size_t sequence)
+{
+    mt_reclaimer* reclaimer = __atomic_load_n(&tree->reclaimer, __ATOMIC_ACQUIRE);
+    if (reclaimer == NULL) return 1;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&reclaimer->sequence, __ATOMIC_RELAXED) == sequence;
+}
+
+// Set `bits` in the flags of `branch`. Readers check the flags while the writer changes them,
+// so the writer always stores them whole
+void __mt_set_flags(mt_branch* branch, int bits)
+{
+    __atomic_store_n(&branch->flags, branch->flags | bits, __ATOMIC_RELAXED);
+}
+
+// Clear `bits` in the flags of `branch`, storing them whole as `__mt_set_flags` does
+void __mt_clear_flags(mt_branch* branch, int bits)
+{
+    __atomic_store_n(&branch->flags, branch->flags & ~bits, __ATOMIC_RELAXED);
+}
+
+// Copy `bytes` bytes from `from` to `to` one whole byte at a time, for data that the writer changes in place
+// while readers may be copying it. A copy that overlaps a change is repeated, see `mt_get_data_copy`
+void __mt_copy_shared_bytes(void* to, void* from, size_t bytes)
+{
+    unsigned char* out = to;
+    unsigned char* in = from;
+    for(size_t i=0; i<bytes; i++) __atomic_store_n(&out[i], __atomic_load_n(&in[i], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+
+#define ________STRING_INTERNING
+
+// Trees tend to repeat the same few labels and data types across huge numbers of branches, so each distinct
+// string is stored once per tree and shared, with a count of the labels and data types using it.
+// Since every label in a tree is then a pointer into the same table, two labels of a tree are equal exactly
+// when their pointers are, and labels can be compared without looking at their characters.
+
+// Hash the `label_length` characters at `label`
+size_t __mt_label_hash(char* label, size_t label_length)
+{
+    size_t hash = 14695981039346656037UL;   // FNV-1a
+    for(size_t i=0; i<label_length; i++)
+    {
+        hash ^= (unsigned char)label[i];
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+// Find the slot in `table` holding the `length` characters at `string`, or the empty slot where they would go
+mt_interned_string* __mt_string_table_probe(mt_string_table* table, char* string, size_t length, size_t hash)
+{
+    // The capacity is read first, as a growing table publishes its new slots before its new capacity
+    size_t mask = __atomic_load_n(&table->capacity, __ATOMIC_ACQUIRE) - 1;
+    mt_interned_string* slots = __atomic_load_n(&table->slots, __ATOMIC_ACQUIRE);
+    for(size_t slot = hash & mask; ; slot = (slot + 1) & mask)
+    {
+        mt_interned_string* entry = &slots[slot];
+        char* found = __atomic_load_n(&entry->string, __ATOMIC_ACQUIRE);
+        if(found == NULL) return entry;
+        if(__atomic_load_n(&entry->hash, __ATOMIC_RELAXED) == hash && __atomic_load_n(&entry->length, __ATOMIC_RELAXED) == length
+            && memcmp(found, string, length) == 0) return entry;
+    }
+}
+
+// Move the string in the slot `from` of a string table to the slot `to`, or empty `to` if `from` is NULL.
+// Readers may be probing the slot meanwhile, so each field they look at is stored whole
+void __mt_string_table_move(mt_interned_string* to, mt_interned_string* from)
+{
+    mt_interned_string empty = { 0 };
+    if(from == NULL) from = &empty;
+    __atomic_store_n(&to->hash, from->hash, __ATOMIC_RELAXED);
+    __atomic_store_n(&to->length, from->length, __ATOMIC_RELAXED);
+    __atomic_store_n(&to->string, from->string, __ATOMIC_RELEASE);
+    to->references = from->references;
+    to->borrowed = from->borrowed;
+}
+
+// Find the tree's copy of the `length` characters at `string`, without adding a reference to it
+//
+// Returns:     The interned string, or NULL if no label or data type in the tree has that value
+char* __mt_tree_find_string(mt_tree* tree, char* string, size_t length)
+{
+    if(__atomic_load_n(&tree->strings.count, __ATOMIC_RELAXED) == 0) return NULL;
+    mt_interned_string* entry = __mt_string_table_probe(&tree->strings, string, length, __mt_label_hash(string, length));
+    return __atomic_load_n(&entry->string, __ATOMIC_ACQUIRE);
+}
+
+// Get the tree's copy of `string`, adding it to the tree if it isn't there yet.
+// Each call must be balanced by a call to `__mt_tree_release_string`
+//
+// Returns:     The interned string, or NULL if the heap is exhausted
+char* __mt_tree_intern_string(mt_tree* tree, char* string)
+{
+    return __mt_tree_intern_string_references(tree, string, 1, 0);
+}
+
+// Get the tree's copy of `string` for `references` labels or data types at once, as if
+// `__mt_tree_intern_string` had been called `references` times.
+// If `borrow` is set and the tree has no copy yet, `string` itself is used rather than a copy of it,
+// so it must last as long as the tree (as the strings of a mapped snapshot do)
+//
+// Returns:     The interned string, or NULL if the heap is exhausted
+char* __mt_tree_intern_string_references(mt_tree* tree, char* string, size_t references, int borrow)
+{
+    mt_string_table* table = &tree->strings;
+    if((table->count + 1) * 10 > table->capacity * 7)   // Keep the load factor below 70%
+    {
+        mt_string_table grown = { NULL, table->capacity ? table->capacity * 2 : 64, table->count };
+        grown.slots = calloc(grown.capacity, sizeof *grown.slots);
+        if(grown.slots == NULL) mt_error("Could not allocate a string table of %ld slots", grown.capacity);
+        if(__mt_check_error_flag()) return 0;
+
+        for(size_t i=0; i<table->capacity; i++)
+        {
+            mt_interned_string* old = &table->slots[i];
+            if(old->string != NULL) *__mt_string_table_probe(&grown, old->string, old->length, old->hash) = *old;
+        }
+        __mt_begin_write(tree);
+        mt_interned_string* old_slots = table->slots;
+        __atomic_store_n(&table->slots, grown.slots, __ATOMIC_RELEASE);
+        __atomic_store_n(&table->capacity, grown.capacity, __ATOMIC_RELEASE);
+        __mt_end_write(tree);
+        __mt_retire(tree, MT_RETIRE_MEMORY, old_slots);
+    }
+
+    size_t length = strlen(string);
+    size_t hash = __mt_label_hash(string, length);
+    mt_interned_string* entry = __mt_string_table_probe(table, string, length, hash);
+    if(entry->string == NULL)
+    {
+        char* copy = borrow ? string : __mt_tree_strdup(tree, string);
+        if(copy == NULL) return NULL;
+        entry->borrowed = borrow;
+        __atomic_store_n(&entry->hash, hash, __ATOMIC_RELAXED);
+        __atomic_store_n(&entry->length, length, __ATOMIC_RELAXED);
+        entry->references = 0;
+        __atomic_store_n(&entry->string, copy, __ATOMIC_RELEASE);   // Filled in before readers can find it
+        __atomic_store_n(&table->count, table->count + 1, __ATOMIC_RELAXED);
+    }
+
+    entry->references += references;
+    return entry->string;
+}
+
+// Drop a reference to a string returned by `__mt_tree_intern_string`, freeing it once nothing uses it
+void __mt_tree_release_string(mt_tree* tree, char* string)
+{
+    if(string == NULL) return;
+
+    mt_string_table* table = &tree->strings;
+    size_t length = strlen(string);
+    mt_interned_string* entry = __mt_string_table_probe(table, string, length, __mt_label_hash(string, length));
+    if(entry->string != string) return;     // Not interned in this tree
+    if(--entry->references > 0) return;
+
+    if(!entry->borrowed) __mt_retire(tree, MT_RETIRE_STRING, entry->string);
+
+    // Empty the slot, shifting later entries back to fill the gap
+    __mt_begin_write(tree);
+    size_t mask = table->capacity - 1;
+    size_t gap = entry - table->slots;
+    for(size_t next = (gap + 1) & mask; table->slots[next].string != NULL; next = (next + 1) & mask)
+    {
+        size_t home = table->slots[next].hash & mask;
+        if(((next - home) & mask) >= ((next - gap) & mask))
+        {
+            __mt_string_table_move(&table->slots[gap], &table->slots[next]);
+            gap = next;
+        }
+    }
+    __mt_string_table_move(&table->slots[gap], NULL);
+    __atomic_store_n(&table->count, table->count - 1, __ATOMIC_RELAXED);
+    __mt_end_write(tree);
+}
+
+// Report how much memory sharing labels and data types saves, compared with giving each branch its own copies
+//
+// `branch`     Any branch of the tree
+// `out_stats`  Filled with the totals for the tree's strings
+void mt_get_string_stats(mt_branch* branch, mt_string_stats* out_stats)
+{
+    if (branch == NULL)     mt_error("Attempted to get the string stats of a branch which is a null pointer");
+    if (out_stats == NULL)  mt_error("Attempted to get string stats into a null pointer");
+    if (__mt_check_error_flag()) return;
+
+    mt_string_table* table = &branch->tree->strings;
+    memset(out_stats, 0, sizeof *out_stats);
+    for(size_t i=0; i<table->capacity; i++)
+    {
+        mt_interned_string* entry = &table->slots[i];
+        if(entry->string == NULL) continue;
+
+        out_stats->distinct_strings++;
+        out_stats->references += entry->references;
+        out_stats->bytes_stored += entry->length + 1;
+        out_stats->bytes_without_interning += (entry->length + 1) * entry->references;
+    }
+
+    out_stats->table_bytes = table->capacity * sizeof *table->slots;
+    out_stats->bytes_saved = (long)out_stats->bytes_without_interning - (long)out_stats->bytes_stored - (long)out_stats->table_bytes;
+}
+
+
+#define ________ID_INDEX
+
+// Every tree keeps an index from id to branch, so that ids can be looked up without searching the tree.
+// It is an open-addressed hash table with linear probing, holding the id next to the branch pointer so that
+// probing never has to touch the branches themselves.
+
+// Find the slot that `id` would be stored in, starting from its home slot.
+// Ids are issued in sequence, so runs of MT_ID_INDEX_RUN consecutive ids are kept in consecutive slots,
+// and only the runs themselves are scattered. Branches created together then share cache lines in the index
+size_t __mt_id_index_home(mt_id_index* index, size_t id)
+{
+    int run_bits = __builtin_ctzl(index->capacity / MT_ID_INDEX_RUN);        // The capacity is a power of 2
+    size_t run = ((id / MT_ID_INDEX_RUN) * 11400714819323198485UL) >> (63 - run_bits) >> 1;  // Fibonacci hashing
+    return run * MT_ID_INDEX_RUN + id % MT_ID_INDEX_RUN;
+}
+
+// Grow the id index of `tree` if needed, so that it can hold `count` branches
+//
+// Returns:     1 if success, 0 if failure
+int __mt_id_index_reserve(mt_tree* tree, size_t count)
+{
+    mt_id_index* index = &tree->id_index;
+    if(count * 10 <= index->capacity * 7) return 1;     // Keep the load factor below 70%
+
+    mt_id_index grown = { NULL, index->capacity ? index->capacity : 64, index->count };
+    while(count * 10 > grown.capacity * 7) grown.capacity *= 2;
+    grown.slots = calloc(grown.capacity, sizeof *grown.slots);
+    if (grown.slots == NULL) mt_error("Could not allocate an id index of %ld slots", grown.capacity);
+    if (__mt_check_error_flag()) return 0;
+
+    // Move the entries across using the ids stored in the slots, without touching the branches
+    size_t mask = grown.capacity - 1;
+    for(size_t i=0; i<index->capacity; i++)
+    {
+        if(index->slots[i].branch == NULL) continue;
+        size_t slot = __mt_id_index_home(&grown, index->slots[i].id);
+        while(grown.slots[slot].branch != NULL) slot = (slot + 1) & mask;
+        grown.slots[slot] = index->slots[i];
+    }
+
+    // Readers read the capacity first, so the new slots are published before it
+    __mt_begin_write(tree);
+    mt_id_index_slot* old_slots = index->slots;
+    __atomic_store_n(&index->slots, grown.slots, __ATOMIC_RELEASE);
+    __atomic_store_n(&index->capacity, grown.capacity, __ATOMIC_RELEASE);
+    __mt_end_write(tree);
+    __mt_retire(tree, MT_RETIRE_MEMORY, old_slots);
+    return 1;
+}
+
+// Insert `branch` into the id index of its tree, growing the index if needed
+//
+// Returns:     1 if success, 0 if failure
+int __mt_id_index_insert(mt_tree* tree, mt_branch* branch)
+{
+    mt_id_index* index = &tree->id_index;
+    if(!__mt_id_index_reserve(tree, index->count + 1)) return 0;
+
+    size_t slot = __mt_id_index_home(index, branch->id);
+    while(index->slots[slot].branch != NULL) slot = (slot + 1) & (index->capacity - 1);
+
+    __atomic_store_n(&index->slots[slot].id, branch->id, __ATOMIC_RELAXED);
+    __atomic_store_n(&index->slots[slot].branch, branch, __ATOMIC_RELEASE);  // After its id, for concurrent readers
+    index->count++;
+    return 1;
+}
+
+// Find the branch with the id `id` in `tree`
+//
+// Returns:     The branch, or NULL if there is no branch with that id
+mt_branch* __mt_id_index_find(mt_tree* tree, size_t id)
+{
+    mt_id_index index;      // The capacity is read first, as a growing index publishes its new slots before its new capacity
+    index.capacity = __atomic_load_n(&tree->id_index.capacity, __ATOMIC_ACQUIRE);
+    index.slots = __atomic_load_n(&tree->id_index.slots, __ATOMIC_ACQUIRE);
+    if(index.capacity == 0) return NULL;
+
+    size_t slot = __mt_id_index_home(&index, id);
+    mt_branch* branch;
+    while((branch = __atomic_load_n(&index.slots[slot].branch, __ATOMIC_ACQUIRE)) != NULL)
+    {
+        if(__atomic_load_n(&index.slots[slot].id, __ATOMIC_RELAXED) == id) return branch;
+        slot = (slot + 1) & (index.capacity - 1);
+    }
+    return NULL;
+}
+
+// Remove the branch with the id `id` from the id index of `tree`
+void __mt_id_index_remove(mt_tree* tree, size_t id)
+{
+    mt_id_index* index = &tree->id_index;
+    if(index->capacity == 0) return;
+
+    size_t mask = index->capacity - 1;
+    size_t slot = __mt_id_index_home(index, id);
+    while(index->slots[slot].branch != NULL && index->slots[slot].id != id) slot = (slot + 1) & mask;
+    if(index->slots[slot].branch == NULL) return;
+
+    // Shift any later entries of the same probe run back, so that lookups never stop early at the gap
+    __mt_begin_write(tree);
+    size_t gap = slot;
+    for(size_t next = (gap + 1) & mask; index->slots[next].branch != NULL; next = (next + 1) & mask)
+    {
+        size_t home = __mt_id_index_home(index, index->slots[next].id);
+        if(((next - home) & mask) >= ((next - gap) & mask))     // The gap lies between this entry's home and its slot
+        {
+            __atomic_store_n(&index->slots[gap].id, index->slots[next].id, __ATOMIC_RELAXED);
+            __atomic_store_n(&index->slots[gap].branch, index->slots[next].branch, __ATOMIC_RELEASE);
+            gap = next;
+        }
+    }
+
+    __atomic_store_n(&index->slots[gap].branch, NULL, __ATOMIC_RELAXED);
+    __atomic_store_n(&index->slots[gap].id, 0, __ATOMIC_RELAXED);
+    index->count--;
+    __mt_end_write(tree);
+}
+
+// Give a new branch of `tree` the next id and add it to the index
+//
+// Returns:     1 if success, 0 if failure
+int __mt_tree_register_branch(mt_tree* tree, mt_branch* branch)
+{
+    branch->id = ++tree->last_issued_id;
+    if(!__mt_id_index_insert(tree, branch)) return 0;
+
+    __atomic_store_n(&tree->max_id, branch->id, __ATOMIC_RELAXED);     // Higher than any id ever issued
+    __atomic_store_n(&tree->max_id_stale, 0, __ATOMIC_RELAXED);
+    return 1;
+}
+
+// Give a new branch of `tree` the id `id` if no other branch has it, or else the next id, and add it to the index.
+// This lets loaded branches keep their ids wherever possible
+//
+// Returns:     1 if success, 0 if failure
+int __mt_tree_register_branch_as(mt_tree* tree, mt_branch* branch, size_t id)
+{
+    if(id == 0 || __mt_id_index_find(tree, id) != NULL) return __mt_tree_register_branch(tree, branch);
+
+    branch->id = id;
+    if(!__mt_id_index_insert(tree, branch)) return 0;
+
+    if(id > tree->last_issued_id) tree->last_issued_id = id;    // So that it is never issued again
+    if(id > tree->max_id)           // Stale or not, the old maximum is no higher than any id that exists
+    {
+        __atomic_store_n(&tree->max_id, id, __ATOMIC_RELAXED);
+        __atomic_store_n(&tree->max_id_stale, 0, __ATOMIC_RELAXED);
+    }
+    return 1;
+}
+
+// Remove a branch that is being deleted from the index of `tree`.
+// When it had the maximum id, the maximum steps down past at most MT_MAX_ID_STEPS ids that are gone. Ids that are
+// mostly in use, as issued ids are, lead to the next highest within those steps. Sparse ids, as a snapshot may hold,
+// could be any distance apart, so the maximum is then left stale, and found from the id index when it is next asked for
+void __mt_tree_unregister_branch(mt_tree* tree, mt_branch* branch)
+{
+    __mt_id_index_remove(tree, branch->id);
+
+    if(branch->id != tree->max_id || tree->max_id_stale) return;
+
+    size_t max_id = tree->max_id;
+    for(int steps = 0; max_id > 0 && __mt_id_index_find(tree, max_id) == NULL; steps++)
+    {
+        if(steps == MT_MAX_ID_STEPS) { __atomic_store_n(&tree->max_id_stale, 1, __ATOMIC_RELAXED); return; }
+        max_id--;
+    }
+    __atomic_store_n(&tree->max_id, max_id, __ATOMIC_RELAXED);
+}
+
+// Get the highest id belonging to a branch of `tree`, finding it again from the id index if it is stale. The index
+// is only updated by the thread changing the tree, so readers leave the maximum stale for that thread to store
+//
+// Returns:     The maximum id
+size_t __mt_tree_max_id(mt_tree* tree)
+{
+    size_t max_id;
+    size_t sequence;
+    do  // Repeated if it overlapped a concurrent change to the index, see `mt_enable_concurrent_reads`
+    {
+        sequence = __mt_read_sequence(tree);
+        max_id = __atomic_load_n(&tree->max_id, __ATOMIC_RELAXED);
+        if(!__atomic_load_n(&tree->max_id_stale, __ATOMIC_RELAXED)) continue;
+
+        size_t capacity = __atomic_load_n(&tree->id_index.capacity, __ATOMIC_ACQUIRE);
+        mt_id_index_slot* slots = __atomic_load_n(&tree->id_index.slots, __ATOMIC_ACQUIRE);
+        max_id = 0;
+        for(size_t i=0; i<capacity; i++)
+        {
+            if(__atomic_load_n(&slots[i].branch, __ATOMIC_ACQUIRE) == NULL) continue;
+            size_t id = __atomic_load_n(&slots[i].id, __ATOMIC_RELAXED);
+            if(id > max_id) max_id = id;
+        }
+    } while(!__mt_check_read_sequence(tree, sequence));
+
+    if(tree->max_id_stale && tree->reclaimer == NULL)
+    {
+        tree->max_id = max_id;
+        tree->max_id_stale = 0;
+    }
+    return max_id;
+}
+
+// Get the branch with the id `id`, from the same tree as `branch`
+//
+// `branch`     Any branch of the tree to search
+// `id`         The id to look for
+//
+// Returns:     The branch, or NULL if there is no branch with that id
+mt_branch* mt_get_by_id(mt_branch* branch, size_t id)
+{
+    if (branch == NULL) mt_error("Attempted to get the branch with id %ld from a branch which is a null pointer", id); 
+    if (__mt_check_error_flag()) return 0;
+
+    mt_branch* found;
+    size_t sequence;
+    do  // Repeated if it overlapped a concurrent change to the index, see `mt_enable_concurrent_reads`
+    {
+        sequence = __mt_read_sequence(branch->tree);
+        found = __mt_id_index_find(branch->tree, id);
+    } while(!__mt_check_read_sequence(branch->tree, sequence));
+
+    if(found == NULL && branch->tree->unloaded.count > 0)   // It may not have been loaded yet
+    {
+        __mt_load_all_children(branch->tree);
+        found = __mt_id_index_find(branch->tree, id);
+    }
+    return found;
+}
+
+
+
+#define ________CHILD_INDEX
+
+// Branches with many children keep an index of their children's labels, so that finding a child by label
+// doesn't mean comparing it against every sibling. The index is built when a branch reaches
+// MT_CHILD_INDEX_THRESHOLD children and dropped again once it falls below half that.
+// Each slot holds one distinct label. Siblings that share it are chained through `next_same_label`
+// in sibling order, so the first match is always the head of the chain.
+// Labels are interned, so the index is keyed on the label pointers rather than their characters.
+
+// Hash an interned label by its address
+size_t __mt_child_index_hash(char* label)
+{
+    return ((size_t)label >> 3) * 11400714819323198485UL;   // Fibonacci hashing; the low bits of an address carry little
+}
+
+// Find the slot in `index` holding the interned label `label`, or the empty slot where it would go
+mt_child_index_slot* __mt_child_index_probe(mt_child_index* index, char* label)
+{
+    // The capacity is read first, as a growing index publishes its new slots before its new capacity
+    size_t mask = __atomic_load_n(&index->capacity, __ATOMIC_ACQUIRE) - 1;
+    mt_child_index_slot* slots = __atomic_load_n(&index->slots, __ATOMIC_ACQUIRE);
+    for(size_t slot = __mt_child_index_hash(label) >> 32 & mask; ; slot = (slot + 1) & mask)
+    {
+        mt_child_index_slot* entry = &slots[slot];
+        if(__atomic_load_n(&entry->head, __ATOMIC_ACQUIRE) == NULL || __atomic_load_n(&entry->label, __ATOMIC_RELAXED) == label) return entry;
+    }
+}
+
+// Move the label in the slot `from` of a child index to the slot `to`, or empty `to` if `from` is NULL.
+// Readers may be probing the slot meanwhile, so each field they look at is stored whole
+void __mt_child_index_move(mt_child_index_slot* to, mt_child_index_slot* from)
+{
+    mt_child_index_slot empty = { 0 };
+    if(from == NULL) from = &empty;
+    __atomic_store_n(&to->label, from->label, __ATOMIC_RELAXED);
+    __atomic_store_n(&to->head, from->head, __ATOMIC_RELEASE);
+    to->tail = from->tail;
+}
+
+// Find the first child of an indexed branch with the interned label `label`
+//
+// Returns:     The child, or NULL if there is none
+mt_branch* __mt_child_index_find(mt_child_index* index, char* label)
+{
+    return __atomic_load_n(&__mt_child_index_probe(index, label)->head, __ATOMIC_ACQUIRE);
+}
+
+// Add `child` to the index of its parent. It is placed in the chain of siblings sharing its label according to
+// its position among its siblings. If `appending` is set, it is known to come after all of them
+void __mt_child_index_insert(mt_child_index* index, mt_branch* child, int appending)
+{
+    mt_tree* tree = child->tree;
+    if((index->count + 1) * 10 > index->capacity * 7)   // Keep the load factor below 70%
+    {
+        mt_child_index grown = { NULL, NULL, NULL, index->capacity ? index->capacity * 2 : 64, index->count };
+        grown.slots = calloc(grown.capacity, sizeof *grown.slots);
+        if(grown.slots == NULL) mt_error("Could not allocate a child index of %ld slots", grown.capacity);
+        if(__mt_check_error_flag()) return;
+
+        for(size_t i=0; i<index->capacity; i++)
+        {
+            if(index->slots[i].head != NULL) *__mt_child_index_probe(&grown, index->slots[i].label) = index->slots[i];
+        }
+        __mt_begin_write(tree);
+        mt_child_index_slot* old_slots = index->slots;
+        __atomic_store_n(&index->slots, grown.slots, __ATOMIC_RELEASE);
+        __atomic_store_n(&index->capacity, grown.capacity, __ATOMIC_RELEASE);
+        __mt_end_write(tree);
+        __mt_retire(tree, MT_RETIRE_MEMORY, old_slots);
+    }
+
+    mt_child_index_slot* entry = __mt_child_index_probe(index, child->label);
+    __atomic_store_n(&child->next_same_label, NULL, __ATOMIC_RELAXED);     // A relabelled child may still be being read
+
+    if(entry->head == NULL)
+    {
+        __atomic_store_n(&entry->label, child->label, __ATOMIC_RELAXED);
+        entry->tail = child;
+        __atomic_store_n(&entry->head, child, __ATOMIC_RELEASE);     // After its label, for concurrent readers
+        index->count++;
+    }
+    else if(appending || child->next_sibling == NULL)    // The usual case: a new last child
+    {
+        __atomic_store_n(&entry->tail->next_same_label, child, __ATOMIC_RELEASE);
+        entry->tail = child;
+    }
+    else    // Find the closest earlier sibling with the same label, and follow it in the chain
+    {
+        mt_branch* previous = NULL;
+        for(mt_branch* sibling = child->parent->first_child; sibling != child; sibling = sibling->next_sibling)
+        {
+            if(sibling->label == child->label) previous = sibling;
+        }
+
+        if(previous == NULL)
+        {
+            __atomic_store_n(&child->next_same_label, entry->head, __ATOMIC_RELAXED);
+            __atomic_store_n(&entry->head, child, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            __atomic_store_n(&child->next_same_label, previous->next_same_label, __ATOMIC_RELAXED);
+            __atomic_store_n(&previous->next_same_label, child, __ATOMIC_RELEASE);
+        }
+        if(child->next_same_label == NULL) entry->tail = child;
+    }
+}
+
+// Remove `child` from the index of its parent
+void __mt_child_index_remove(mt_child_index* index, mt_branch* child)
+{
+    mt_child_index_slot* entry = __mt_child_index_probe(index, child->label);
+    if(entry->head == NULL) return;
+
+    __mt_begin_write(child->tree);
+    __mt_child_index_unchain(index, entry, child);
+    __mt_end_write(child->tree);
+}
+
+// Remove `child` from the chain of siblings in the slot `entry` of its parent's index, emptying the slot if it was the last
+void __mt_child_index_unchain(mt_child_index* index, mt_child_index_slot* entry, mt_branch* child)
+{
+    // Unlink it from the chain of siblings sharing its label
+    mt_branch* previous = NULL;
+    mt_branch* member = entry->head;
+    while(member != NULL && member != child) { previous = member; member = member->next_same_label; }
+    if(member == NULL) return;
+
+    if(previous == NULL) __atomic_store_n(&entry->head, child->next_same_label, __ATOMIC_RELEASE);
+    else __atomic_store_n(&previous->next_same_label, child->next_same_label, __ATOMIC_RELEASE);
+    if(entry->tail == child) entry->tail = previous;
+    __atomic_store_n(&child->next_same_label, NULL, __ATOMIC_RELAXED);
+    if(entry->head != NULL) return;
+
+    // That was the last sibling with this label, so empty the slot, shifting later entries back to fill the gap
+    size_t mask = index->capacity - 1;
+    size_t gap = entry - index->slots;
+    for(size_t next = (gap + 1) & mask; index->slots[next].head != NULL; next = (next + 1) & mask)
+    {
+        size_t home = __mt_child_index_hash(index->slots[next].label) >> 32 & mask;
+        if(((next - home) & mask) >= ((next - gap) & mask))
+        {
+            __mt_child_index_move(&index->slots[gap], &index->slots[next]);
+            gap = next;
+        }
+    }
+    __mt_child_index_move(&index->slots[gap], NULL);
+    index->count--;
+}
+
+// Build an index of the children of `branch`
+void __mt_child_index_build(mt_branch* branch)
+{
+    mt_tree* tree = branch->tree;
+    mt_child_index* index = calloc(1, sizeof *index);
+    if(index == NULL) return;   // Without an index, children are simply found by searching
+
+    // Keep track of every index so that the tree can free them all when it is destroyed
+    index->next = tree->child_indexes;
+    if(tree->child_indexes != NULL) tree->child_indexes->prev = index;
+    tree->child_indexes = index;
+
+    for(mt_branch* child = branch->first_child; child != NULL; child = child->next_sibling)
+    {
+        __mt_child_index_insert(index, child, 1);
+    }
+    __atomic_store_n(&branch->child_index, index, __ATOMIC_RELEASE);   // Complete before readers can use it
+}
+
+// Free the index of the children of `branch`, if it has one
+void __mt_child_index_release(mt_branch* branch)
+{
+    mt_child_index* index = branch->child_index;
+    if(index == NULL) return;
+
+    if(index->prev != NULL) index->prev->next = index->next;
+    else branch->tree->child_indexes = index->next;
+    if(index->next != NULL) index->next->prev = index->prev;
+
+    __atomic_store_n(&branch->child_index, NULL, __ATOMIC_RELEASE);
+    __mt_retire(branch->tree, MT_RETIRE_MEMORY, index->slots);
+    __mt_retire(branch->tree, MT_RETIRE_MEMORY, index);
+}
+
+// Find the next sibling after `child` that has the same label as it
+//
+// Returns:     The sibling, or NULL if there is none
+mt_branch* __mt_next_sibling_with_same_label(mt_branch* child)
+{
+    mt_branch* parent = __atomic_load_n(&child->parent, __ATOMIC_ACQUIRE);
+    if(parent != NULL && __atomic_load_n(&parent->child_index, __ATOMIC_ACQUIRE) != NULL)
+    {
+        return __atomic_load_n(&child->next_same_label, __ATOMIC_ACQUIRE);
+    }
+
+    char* label = __atomic_load_n(&child->label, __ATOMIC_RELAXED);
+    mt_branch* sibling = __atomic_load_n(&child->next_sibling, __ATOMIC_ACQUIRE);
+    while(sibling != NULL && __atomic_load_n(&sibling->label, __ATOMIC_RELAXED) != label)
+    {
+        sibling = __atomic_load_n(&sibling->next_sibling, __ATOMIC_ACQUIRE);
+    }
+    return sibling;
+}
+
+
+
+#define ________HOUSEKEEPING
+
+// Get the number of branches in the tree that `branch` belongs to, counting the root.
+// Each tree keeps its own count, so trees used by different threads never touch the same counter.
+// Branches of a lazily loaded snapshot are only counted once they have been loaded. The branches that copies
+// share, see `mt_copy_branch`, are counted even though they are only created when they are first reached
+//
+// Returns:     The number of branches, or 0 if `branch` is a null pointer
+size_t mt_get_num_branches(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to count the branches of a tree using a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_tree* tree = branch->tree;
+    mt_reclaimer* reclaimer = tree->reclaimer;
+    return tree->branch_pool.objects_in_use - (reclaimer ? reclaimer->retired_branches : 0) + __mt_count_shared_branches(tree);
+}
+
+// Count the branches below copies that are still sharing the children of their originals, which the copies
+// have yet to create. Each has as many as its original has descendants
+//
+// Returns:     The number of branches still to be created
+size_t __mt_count_shared_branches(mt_tree* tree)
+{
+    size_t count = 0;
+    for(size_t i=0; tree->shared.count > 0 && i<tree->shared.capacity; i++)
+    {
+        mt_unloaded_slot* slot = &tree->shared.slots[i];
+        if(slot->branch == NULL) continue;
+        __mt_totals_update(slot->source);
+        count += slot->source->num_descendants;
+    }
+    return count;
+}
+
+// Get the highest id of any branch in the tree that `branch` belongs to.
+// This may be higher than the number of branches in the case of branches having been deleted.
+// Each tree keeps its own, up to date through its id index, so this is O(1) once the tree is loaded, unless a branch
+// with a sparse id has been deleted since it was last asked for, which takes one sweep of the id index
+//
+// Returns:     The maximum id, or 0 if `branch` is a null pointer
+size_t mt_get_max_id(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to get the maximum id of a tree using a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    return mt_find_max_id(branch->tree->root, 0, -1);
+}
+
+// Recursively traverse the entire tree, starting at root, to find the highest `id` field
+// When `root` is the root of its tree and there is no depth limit, the answer comes from the id index instead
+// 
+// `root`       The root node to start searching from
+// `max_id`     The maximum `id` field currently known (for recursive use)
+// `max_depth`  The maximum depth to traverse to. If -1, go as deep as necessary (no limit on depth)
+// 
+// Returns:     The maximum `id` field found in the entire tree starting at `root`
+size_t mt_find_max_id(mt_branch* root, size_t max_id, int max_depth)
+{
+    if(max_depth == 0) return max_id; // Stop if we have already reached max_depth
+
+    if(max_depth == -1 && root == root->tree->root)     // The whole tree: no need to search
+    {
+        if(root->tree->unloaded.count > 0) __mt_load_all_children(root->tree);    // Unless some branches' ids have not been loaded yet
+        size_t tree_max_id = __mt_tree_max_id(root->tree);
+        return (tree_max_id > max_id) ? tree_max_id : max_id;
+    }
+
+    // `max_depth` counts `root` itself as the first level
+    __mt_traverse(root, (max_depth == -1) ? -1 : max_depth - 1, __mt_visit_max_id, NULL, &max_id, 1);
+    return max_id;
+}
+
+// Visitor for `mt_find_max_id`, keeping the highest id seen in `context`
+int __mt_visit_max_id(mt_branch* branch, int depth, void* context)
+{
+    size_t* max_id = context;
+    if(branch->id > *max_id) *max_id = branch->id;
+    return MT_VISIT_CONTINUE;
+}
+
+
+
+#define ________DATA_VALIDATION
+
+// Checks whether the provided label is a valid
+//
+// Returns:     1 if the label is valid, 0 if it is invalid
+int mt_check_label_valid(char* new_label)
+{
+    int i = 0;
+    while(new_label[i] != 0)
+    {
+        if(new_label[i] == ' ' || new_label[i] == '/'   // ' ' is a general separator, '/' is the path separator, 
+        || new_label[i] == '{' || new_label[i] == '}')  // and {  } are used to denote referencing using IDs rather than labels
+        {
+            return 0;
+        }
+
+        i++;
+    }
+
+    return 1;
+}
+
+// Check whether `branch` is the root node
+// Returns:      1 if `branch` is the root node, or 0 if not
+int mt_check_is_root(mt_branch* branch)
+{
+    if (branch->parent == NULL) return 1;
+    return 0;
+}
+
+
+// Check whether these two branches (and all their sub-branches and data fields) are identical
+// 
+// `branch_a`   Branch to compare to `branch_b`
+// `branch_b`   Branch to compare to `branch_a`
+//
+// Returns:     NULL if the branches are identical,
+//              or a pointer to the first branch found in `branch_a` that does not match its `branch_b` counterpart
+//              (you can run the function again with the branches swapped to find said non-matching counterpart)
+mt_branch* mt_check_branches_identical(mt_branch* branch_a, mt_branch* branch_b)
+{
+    if (branch_a == NULL || branch_b == NULL) mt_error("Attempted to compare a branch which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    // Each branch is checked to have as many children as its counterpart, so the two walks stay in step
+    mt_branch* other = branch_b;
+    for(mt_branch* branch = branch_a; branch != NULL; branch = __mt_next_descendant(branch, branch_a))
+    {
+        if(!__mt_check_branch_matches(branch, other)) return branch;
+        other = __mt_next_descendant(other, branch_b);
+    }
+    return NULL;
+}
+
+// Check whether two branches have the same label, data type and data, and the same number of children
+//
+// Returns:     1 if they match, 0 if not
+int __mt_check_branch_matches(mt_branch* branch_a, mt_branch* branch_b)
+{
+    if (branch_a->label != branch_b->label && strcmp(branch_a->label, branch_b->label) != 0) return 0;
+    if ((branch_a->data_type == NULL) != (branch_b->data_type == NULL)) return 0;
+    if (branch_a->data_type != branch_b->data_type && strcmp(branch_a->data_type, branch_b->data_type) != 0) return 0;
+    if (branch_a->data_size != branch_b->data_size) return 0;
+    if (branch_a->data_size > 0 && memcmp(branch_a->data, branch_b->data, branch_a->data_size) != 0) return 0;
+
+    __mt_ensure_children(branch_a);
+    __mt_ensure_children(branch_b);
+    return branch_a->num_children == branch_b->num_children;
+}
+
+
+
+
+#define ________GET_BRANCHES
+
+// Get the parent of the specified branch
+//
+// `branch`     The branch to find the parent of
+//
+// Returns:     A pointer to the parent of `branch`, or NULL if there is none (e.g. the branch is the root)
+mt_branch* mt_get_parent(mt_branch* branch)
+{
+    if (branch == NULL)  mt_error("Attempted to get the parent of a branch which is a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+
+    return __atomic_load_n(&branch->parent, __ATOMIC_ACQUIRE);
+}
+
+
+
+// Get the total number of recursive sub-branches (all descendants) of `branch`
+//
+// `branch`             The branch to start searching at
+// `num_descendants`    Set to 0 -- Start counting at this number (for recursive use)
+// `max_depth`          The maximum depth to traverse to. If -1, go as deep as necessary (no limit on depth)
+//
+//  Returns:            The total number of branches that descend from this branch
+int mt_get_num_descendants(mt_branch* branch, size_t num_descendants, int max_depth)
+{
+    if(max_depth == 0) return num_descendants; // Stop if we have already reached max_depth
+    if(max_depth == -1)
+    {
+        __mt_totals_update(branch);
+        return num_descendants + branch->num_descendants;
+    }
+
+    __mt_traverse(branch, max_depth, __mt_visit_count, NULL, &num_descendants, 1);
+    return num_descendants - 1;     // Not counting `branch` itself
+}
+
+// Visitor counting the branches visited in `context`
+int __mt_visit_count(mt_branch* branch, int depth, void* context)
+{
+    (*(size_t*)context)++;
+    return MT_VISIT_CONTINUE;
+}
+
+// Get the number of direct children that `branch` has
+int mt_get_num_children(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to count the children of a branch which is a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_ensure_children(branch);
+    return branch->num_children;
+}
+
+
+// Get the nth child of `branch`
+//
+// `branch`     The branch to look for children in
+// `n`          The index of the child, starting at 0 for the first child
+//
+// Returns:     A pointer to the nth child of `branch`, or NULL if there are not enough children
+mt_branch* mt_get_nth_child(mt_branch* branch, int n)
+{
+    if (branch == NULL) mt_error("Attempted to get a child of a branch which is a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+    if (n < 0) return NULL;
+
+    __mt_ensure_children(branch);
+    mt_branch* child = __atomic_load_n(&branch->first_child, __ATOMIC_ACQUIRE);
+    while(child != NULL && n > 0)
+    {
+        child = __atomic_load_n(&child->next_sibling, __ATOMIC_ACQUIRE);
+        n--;
+    }
+    return child;
+}
+
+// Get the first child of `branch`
+//
+// Returns:     A pointer to the first child, or NULL if there are no children
+mt_branch* mt_get_first_child(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to get the first child of a branch which is a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_ensure_children(branch);
+    return __atomic_load_n(&branch->first_child, __ATOMIC_ACQUIRE);
+}
+
+// Iterate through the children of `parent` by maintaining an `iterator`
+// 
+// If `iterator` has not been used yet (it has been zeroed), returns the first child of `parent` and sets `iterator` to the new sibling position
+// If `iterator` has been used, uses it to find the next sibling in the list
+// If `iterator` is null, just returns the first child of `parent`
+// 
+// The next sibling is remembered in `iterator`, so the child that was just returned can be deleted before calling again
+// 
+// Returns: the first child of `parent`, 
+//          or the next child pointed to by `iterator`,
+//          or NULL if there are no more children
+// 
+// Also modifies `iterator` each time. Please pass it in the next time you call!
+mt_branch* mt_get_next_sibling(mt_branch* parent, mt_list* iterator)
+{
+    if (parent == NULL) mt_error("Attempted to iterate through the children of a branch which is a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_ensure_children(parent);
+    mt_branch* first_child = __atomic_load_n(&parent->first_child, __ATOMIC_ACQUIRE);
+    if (iterator == NULL) return first_child;
+
+    mt_branch* child = (iterator->item == NULL) ? first_child : iterator->next;
+    if (child == NULL) return NULL;     // Leave `iterator` at the last child so further calls keep returning NULL
+
+    iterator->prev = iterator->item;
+    iterator->item = child;
+    iterator->next = __atomic_load_n(&child->next_sibling, __ATOMIC_ACQUIRE);
+    return child;
+}
+
+
+// Retrieve pointers to every child of the specified `branch` and write them into `out_pointer_array`
+// This can be done in batches, for instance, when `out_pointer_array` is smaller than the total number
+// of children belonging to this branch. If `iterator` is provided, it is modified each time to allow
+// multiple sequential reads of pointers.
+// 
+// `branch`             The branch to retrieve the children of
+// `iterator`           The iterator from a previous execution of this function, or NULL to start from the first child
+// `out_pointer_array`  An array of pointers to branches written out by the function. Unused elements are filled with `NULL`
+// `out_capacity`       The number of pointers that can fit in `out_pointer_array`
+//   
+// Returns:             The number of branch pointers written to `out_pointer_array` in this batch
+//
+// Also modifies `iterator` each time. Please pass it in the next time you call!
+int mt_get_children_as_pointer_array(mt_branch* branch, mt_list* iterator, mt_branch** out_pointer_array, int out_capacity)
+{
+    if (branch == NULL) mt_error("Attempted to get the children of a branch which is a null pointer"); 
+    if (out_pointer_array == NULL) mt_error("Attempted to get the children of a branch into an array which is a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+
+    mt_list first_batch = { 0 };    // Without an iterator, always start at the first child
+    if (iterator == NULL) iterator = &first_batch;
+
+    int written = 0;
+    mt_branch* child;
+    while(written < out_capacity && (child = mt_get_next_sibling(branch, iterator)) != NULL)
+    {
+        out_pointer_array[written++] = child;
+    }
+
+    // Remember to pad up to `out_capacity` with NULLs
+    for(int i=written; i<out_capacity; i++) out_pointer_array[i] = NULL;
+
+    return written;
+}
+
+
+// Load the children of `branch` from its snapshot if that has not been done yet, see `mt_load_tree_lazily_from_buffer`,
+// or copy them if it is a copy still sharing them, see `mt_copy_branch`.
+// Anything that looks at a branch's children must call this first
+void __mt_ensure_children(mt_branch* branch)
+{
+    int flags = __atomic_load_n(&branch->flags, __ATOMIC_RELAXED);
+    if(flags & MT_BRANCH_UNLOADED) __mt_load_children(branch);
+    else if(flags & MT_BRANCH_SHARING) __mt_copy_shared_children(branch);
+}
+
+// Step through the descendants of `root` in depth-first order, following the parent links back up
+// instead of keeping a stack. Start with `branch` set to `root`
+//
+// Returns:     The descendant after `branch`, or NULL once every descendant has been visited
+mt_branch* __mt_next_descendant(mt_branch* branch, mt_branch* root)
+{
+    __mt_ensure_children(branch);
+    mt_branch* first_child = __atomic_load_n(&branch->first_child, __ATOMIC_ACQUIRE);
+    if(first_child != NULL) return first_child;
+    while(branch != root && __atomic_load_n(&branch->next_sibling, __ATOMIC_ACQUIRE) == NULL)
+    {
+        branch = __atomic_load_n(&branch->parent, __ATOMIC_ACQUIRE);
+    }
+    return (branch == root) ? NULL : __atomic_load_n(&branch->next_sibling, __ATOMIC_ACQUIRE);
+}
+
+
+
+#define ________TRAVERSAL
+
+// One depth-first walk serves every operation that visits a whole subtree. Like `__mt_next_descendant` it follows
+// the parent links back up rather than keeping a stack, so it takes the same small, fixed amount of memory however
+// deep the tree is, and only a depth counter is needed to know where it is
+
+#if INTERFACE
+#define MT_VISIT_CONTINUE 0         // Carry on, visiting the branch's children next
+#define MT_VISIT_SKIP 1             // Carry on, without visiting the branch's children or calling `after_children` for it
+#define MT_VISIT_STOP 2             // End the traversal
+
+// Called for each branch visited by `mt_traverse`, with its depth below the branch the traversal started from.
+// Returns one of the MT_VISIT_ values
+typedef int mt_visit_function(mt_branch* branch, int depth, void* context);
+
+#if defined(__GNUC__)
+#define MT_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define MT_PREFETCH(address) ((void)(address))
+#endif
+#endif
+
+// Traverse `root` and its descendants as `mt_traverse` does. Unless `load` is set, branches whose children have not
+// been loaded or copied yet are treated as having none, for walks that only dispose of the branches they find
+//
+// Returns:     1 if every branch was visited, 0 if a visitor stopped the traversal
+int __mt_traverse(mt_branch* root, int max_depth, mt_visit_function* before_children, mt_visit_function* after_children, void* context, int load)
+{
+    mt_branch* branch = root;
+    int depth = 0;
+    while(1)
+    {
+        // Arriving at `branch`. Its links are read first, as `before_children` may move or delete it when it skips it
+        mt_branch* next = (branch == root) ? NULL : branch->next_sibling;
+        mt_branch* parent = branch->parent;
+        MT_PREFETCH(next);      // Visited straight after `branch` whenever it has no children
+
+        int action = (before_children != NULL) ? before_children(branch, depth, context) : MT_VISIT_CONTINUE;
+        if(action == MT_VISIT_STOP) return 0;
+        if(action == MT_VISIT_CONTINUE)
+        {
+            if(load && depth != max_depth) __mt_ensure_children(branch);
+            if(depth != max_depth && branch->first_child != NULL)
+            {
+                branch = branch->first_child;
+                depth++;
+                continue;
+            }
+            if(after_children != NULL && after_children(branch, depth, context) == MT_VISIT_STOP) return 0;
+        }
+
+        // Leaving `branch`, and each ancestor whose last child it was
+        while(next == NULL)
+        {
+            if(branch == root) return 1;
+            branch = parent;
+            depth--;
+            next = (branch == root) ? NULL : branch->next_sibling;
+            parent = branch->parent;
+            if(after_children != NULL && after_children(branch, depth, context) == MT_VISIT_STOP) return 0;
+        }
+        branch = next;
+    }
+}
+
+// Visit `root` and all of its descendants depth-first, without recursion, so trees of any depth can be walked.
+// `before_children` is called for each branch before its children are visited (pre-order), and can skip them
+// or stop the traversal. `after_children` is called for each branch once its children have been visited
+// (post-order), and can stop the traversal. Either can be NULL. A visitor can move or delete the branch it is given
+// when it skips it, or after its children have been visited, but must not change any other part of the subtree
+// 
+// `root`               The branch to start from, which is visited at depth 0
+// `max_depth`          Branches deeper than this below `root` are not visited. If -1, there is no limit
+// `before_children`    Called before each branch's children, or NULL
+// `after_children`     Called after each branch's children, or NULL
+// `context`            Passed to both visitors
+//
+// Returns:     1 if every branch was visited, 0 if a visitor stopped the traversal or there was an error
+int mt_traverse(mt_branch* root, int max_depth, mt_visit_function* before_children, mt_visit_function* after_children, void* context)
+{
+    if (root == NULL) mt_error("Attempted to traverse from a branch which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    return __mt_traverse(root, max_depth, before_children, after_children, context, 1);
+}
+
+
+
+#define ________TOTALS
+
+// Each branch keeps the number of branches below it, and the total size of their data, so that these can be read in O(1).
+// Every change adds its difference to the totals of the branch's ancestors. Only the nearest MT_TOTALS_EAGER_DEPTH are
+// updated straight away: those further up, and any whose totals cannot be known without loading or copying the branches
+// below them, are marked MT_BRANCH_TOTALS_STALE instead, and counted again when they are next asked for. A stale branch
+// only ever has stale ancestors, so an update stops at the first stale branch it reaches
+
+#if INTERFACE
+#define MT_TOTALS_EAGER_DEPTH 32    // The number of ancestors whose totals are updated straight away when a branch changes
+#endif
+
+// Add `descendants` branches and `data_size` bytes of data below `branch` to the totals of `branch` and of its ancestors,
+// or take them away if `sign` is negative
+void __mt_totals_add(mt_branch* branch, size_t descendants, size_t data_size, int sign)
+{
+    for(int depth = 0; branch != NULL && !(branch->flags & MT_BRANCH_TOTALS_STALE); branch = branch->parent, depth++)
+    {
+        if(depth == MT_TOTALS_EAGER_DEPTH)
+        {
+            __mt_totals_invalidate(branch);
+            return;
+        }
+        if(sign > 0)
+        {
+            branch->num_descendants += descendants;
+            branch->descendants_data_size += data_size;
+        }
+        else
+        {
+            branch->num_descendants -= descendants;
+            branch->descendants_data_size -= data_size;
+        }
+    }
+}
+
+// Mark the totals of `branch` and of its ancestors as stale, so that they are counted again when they are next asked for
+void __mt_totals_invalidate(mt_branch* branch)
+{
+    for(; branch != NULL && !(branch->flags & MT_BRANCH_TOTALS_STALE); branch = branch->parent)
+    {
+        __mt_set_flags(branch, MT_BRANCH_TOTALS_STALE);
+    }
+}
+
+// Add the branches and data of `child`, which has just been linked to `parent`, to the totals of `parent` and its ancestors,
+// or take them away if `sign` is negative as it is about to be unlinked
+void __mt_totals_link(mt_branch* parent, mt_branch* child, int sign)
+{
+    if(sign > 0) parent->childrens_data_size += child->data_size;
+    else parent->childrens_data_size -= child->data_size;
+
+    // A stale child already has stale ancestors, except where it is being linked
+    if(child->flags & MT_BRANCH_TOTALS_STALE) __mt_totals_invalidate(parent);
+    else __mt_totals_add(parent, 1 + child->num_descendants, child->data_size + child->descendants_data_size, sign);
+}
+
+// Count the totals of `branch` again if they are stale, loading or copying any branches below it that have not been yet
+void __mt_totals_update(mt_branch* branch)
+{
+    if(branch->flags & MT_BRANCH_TOTALS_STALE) __mt_traverse(branch, -1, __mt_visit_totals_stale, __mt_visit_recount_totals, NULL, 1);
+}
+
+// Visitor for `__mt_totals_update`, skipping branches whose totals are up to date. A copy still sharing the
+// children of its original has the same totals as the original, so its children are not copied just to count them
+int __mt_visit_totals_stale(mt_branch* branch, int depth, void* context)
+{
+    if(!(branch->flags & MT_BRANCH_TOTALS_STALE)) return MT_VISIT_SKIP;
+    if(!(branch->flags & MT_BRANCH_SHARING)) return MT_VISIT_CONTINUE;
+
+    mt_branch* source = __mt_unloaded_index_probe(&branch->tree->shared, branch)->source;
+    __mt_totals_update(source);
+    branch->num_descendants = source->num_descendants;
+    branch->childrens_data_size = source->childrens_data_size;
+    branch->descendants_data_size = source->descendants_data_size;
+    __mt_clear_flags(branch, MT_BRANCH_TOTALS_STALE);
+    return MT_VISIT_SKIP;
+}
+
+// Visitor for `__mt_totals_update`, adding up the totals of a stale branch's children once they are up to date
+int __mt_visit_recount_totals(mt_branch* branch, int depth, void* context)
+{
+    size_t descendants = 0, childrens_data_size = 0, descendants_data_size = 0;
+    for(mt_branch* child = branch->first_child; child != NULL; child = child->next_sibling)
+    {
+        descendants += 1 + child->num_descendants;
+        childrens_data_size += child->data_size;
+        descendants_data_size += child->data_size + child->descendants_data_size;
+    }
+    branch->num_descendants = descendants;
+    branch->childrens_data_size = childrens_data_size;
+    branch->descendants_data_size = descendants_data_size;
+    __mt_clear_flags(branch, MT_BRANCH_TOTALS_STALE);
+    return MT_VISIT_CONTINUE;
+}
+
+// Check that the cached totals of `branch` and of every branch below it match what a full count would find.
+// Branches that have not been loaded or copied yet are left as they are. This takes a walk of the whole subtree,
+// so it is meant for debugging and tests
+//
+// Returns:     1 if they all match, 0 reporting an error if any does not
+int mt_check_totals(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to check the totals of a branch which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_branch* mismatched = NULL;
+    __mt_traverse(branch, -1, __mt_visit_check_pending_totals, __mt_visit_check_totals, &mismatched, 0);
+    if (mismatched != NULL) mt_error("The cached totals of branch %ld ('%s') do not match its descendants", mismatched->id, mismatched->label);
+    if (__mt_check_error_flag()) return 0;
+    return 1;
+}
+
+// Visitor for `mt_check_totals`, checking a branch whose children have not been loaded or copied yet
+// against its original, and skipping them. The first branch that does not match is left in `context`
+int __mt_visit_check_pending_totals(mt_branch* branch, int depth, void* context)
+{
+    if(!(branch->flags & (MT_BRANCH_UNLOADED | MT_BRANCH_SHARING))) return MT_VISIT_CONTINUE;
+    if(!(branch->flags & MT_BRANCH_TOTALS_STALE))
+    {
+        mt_branch* source = (branch->flags & MT_BRANCH_SHARING) ? __mt_unloaded_index_probe(&branch->tree->shared, branch)->source : NULL;
+        if(source == NULL || (!(source->flags & MT_BRANCH_TOTALS_STALE) && (source->num_descendants != branch->num_descendants
+            || source->childrens_data_size != branch->childrens_data_size || source->descendants_data_size != branch->descendants_data_size)))
+        {
+            *(mt_branch**)context = branch;
+            return MT_VISIT_STOP;
+        }
+    }
+    return MT_VISIT_SKIP;
+}
+
+// Visitor for `mt_check_totals`, checking a branch's totals against those of its children, which have been checked already.
+// Only stale branches may have stale children, and only they may have totals that do not add up
+int __mt_visit_check_totals(mt_branch* branch, int depth, void* context)
+{
+    size_t children = 0, descendants = 0, childrens_data_size = 0, descendants_data_size = 0;
+    int stale_children = 0;
+    for(mt_branch* child = branch->first_child; child != NULL; child = child->next_sibling)
+    {
+        children++;
+        descendants += 1 + child->num_descendants;
+        childrens_data_size += child->data_size;
+        descendants_data_size += child->data_size + child->descendants_data_size;
+        if(child->flags & MT_BRANCH_TOTALS_STALE) stale_children = 1;
+    }
+
+    int matches = (children == branch->num_children);
+    if(!(branch->flags & MT_BRANCH_TOTALS_STALE))
+    {
+        matches = matches && !stale_children && descendants == branch->num_descendants
+            && childrens_data_size == branch->childrens_data_size && descendants_data_size == branch->descendants_data_size;
+    }
+    if(matches) return MT_VISIT_CONTINUE;
+    *(mt_branch**)context = branch;
+    return MT_VISIT_STOP;
+}
+
+
+
+#define ________PATHS
+
+// Paths are made up of segments separated by '/' or ' '. Leading, trailing and repeated separators are ignored,
+// so "/a//b/ " and "a/b" refer to the same branch. A segment is either a label, or an id in braces e.g. {12}
+
+// Find the next segment of `path`, starting the search at `*position`
+//
+// `path`               The path to read
+// `position`           The offset to start at. Updated to point just past the segment that was found
+// `segment_length`     Set to the length of the segment that was found
+//
+// Returns:     A pointer to the start of the segment (which is not null-terminated), or NULL if there are no more segments
+char* __mt_path_next_segment(char* path, size_t* position, size_t* segment_length)
+{
+    size_t i = *position;
+    while(path[i] == '/' || path[i] == ' ') i++;   // Skip any separators
+
+    size_t start = i;
+    while(path[i] != 0 && path[i] != '/' && path[i] != ' ') i++;
+
+    *position = i;
+    *segment_length = i - start;
+    if(i == start) return NULL;
+    return path + start;
+}
+
+// Check whether a path segment refers to a branch by id, e.g. {12}, and if so, read the id
+//
+// Returns:     1 if the segment is an id, 0 if it is not
+int __mt_parse_id_segment(char* segment, size_t segment_length, size_t* out_id)
+{
+    if(segment_length < 3 || segment[0] != '{' || segment[segment_length - 1] != '}') return 0;
+
+    size_t id = 0;
+    for(size_t i=1; i<segment_length - 1; i++)
+    {
+        if(segment[i] < '0' || segment[i] > '9') return 0;
+        id = id * 10 + (segment[i] - '0');
+    }
+
+    *out_id = id;
+    return 1;
+}
+
+// Write the normalised form of `path` into `out_buffer`: its segments separated by single slashes,
+// with no leading or trailing separators. Writes nothing if the buffer is too small.
+//
+// Returns:     The length of the normalised path (not including the terminator)
+size_t __mt_normalize_path(char* path, char* out_buffer, size_t out_capacity)
+{
+    size_t length = 0;
+    size_t position = 0;
+    size_t segment_length;
+    char* segment;
+
+    // Measure it first
+    while((segment = __mt_path_next_segment(path, &position, &segment_length)) != NULL)
+    {
+        length += segment_length + (length > 0);
+    }
+    if(length + 1 > out_capacity) return length;
+
+    length = 0;
+    position = 0;
+    while((segment = __mt_path_next_segment(path, &position, &segment_length)) != NULL)
+    {
+        if(length > 0) out_buffer[length++] = '/';
+        memcpy(out_buffer + length, segment, segment_length);
+        length += segment_length;
+    }
+    out_buffer[length] = 0;
+    return length;
+}
+
+// Find the first child of `parent` whose label matches the `label_length` characters at `label`
+//
+// Returns:     The child, or NULL if there is none
+mt_branch* __mt_find_child_by_label(mt_branch* parent, char* label, size_t label_length)
+{
+    // If no branch of the tree has this label, then neither does any child of `parent`, once they have been loaded
+    __mt_ensure_children(parent);
+    char* interned = __mt_tree_find_string(parent->tree, label, label_length);
+    if(interned == NULL) return NULL;
+    return __mt_find_child_by_interned_label(parent, interned);
+}
+
+// Find the first child of `parent` whose label is the interned string `label`
+//
+// Returns:     The child, or NULL if there is none
+mt_branch* __mt_find_child_by_interned_label(mt_branch* parent, char* label)
+{
+    __mt_ensure_children(parent);
+    mt_child_index* index = __atomic_load_n(&parent->child_index, __ATOMIC_ACQUIRE);
+    if(index != NULL) return __mt_child_index_find(index, label);
+
+    mt_branch* child = __atomic_load_n(&parent->first_child, __ATOMIC_ACQUIRE);
+    for(; child != NULL; child = __atomic_load_n(&child->next_sibling, __ATOMIC_ACQUIRE))
+    {
+        if(__atomic_load_n(&child->label, __ATOMIC_RELAXED) == label) return child;
+    }
+    return NULL;
+}
+
+// Find the child of `parent` with the id `id`
+//
+// Returns:     The child, or NULL if there is none
+mt_branch* __mt_find_child_by_id(mt_branch* parent, size_t id)
+{
+    __mt_ensure_children(parent);
+    mt_branch* branch = __mt_id_index_find(parent->tree, id);
+    if(branch != NULL && __atomic_load_n(&branch->parent, __ATOMIC_ACQUIRE) == parent) return branch;
+    return NULL;
+}
+
+// Find the child of `parent` that a single path segment refers to
+//
+// Returns:     The child, or NULL if there is none
+mt_branch* __mt_resolve_segment(mt_branch* parent, char* segment, size_t segment_length)
+{
+    size_t id;
+    if(__mt_parse_id_segment(segment, segment_length, &id)) return __mt_find_child_by_id(parent, id);
+    return __mt_find_child_by_label(parent, segment, segment_length);
+}
+
+// Follow `path` down from `root`, one segment at a time, without using the path cache
+//
+// Returns:     The branch `path` refers to, or NULL if there is no such branch
+mt_branch* __mt_resolve_path(mt_branch* root, char* path)
+{
+    mt_branch* current_branch = root;
+    size_t position = 0;
+    size_t segment_length;
+    char* segment;
+
+    while(current_branch != NULL && (segment = __mt_path_next_segment(path, &position, &segment_length)) != NULL)
+    {
+        current_branch = __mt_resolve_segment(current_branch, segment, segment_length);
+    }
+
+    return current_branch;
+}
+
+
+
+
+#define ________PATH_CACHE
+
+// Each tree keeps a bounded cache of recently resolved paths, keyed on the branch the path was resolved
+// from plus the normalised path. Any change that could make a cached path resolve differently (a branch
+// being removed from its parent, or relabelled) starts a new cache generation, which makes every existing 
+// entry stale. Adding branches does not, because a path always resolves to the first matching child.
+
+// Hash the normalised path `key` together with the branch it is relative to
+size_t __mt_path_cache_hash(mt_branch* root, char* key, size_t key_length)
+{
+    size_t hash = 14695981039346656037UL ^ (size_t)root;   // FNV-1a
+    for(size_t i=0; i<key_length; i++)
+    {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211UL;
+    }
+    return hash | 1;    // Never 0, which marks an empty entry
+}
+
+// Find the group of entries that the path with `hash` may be stored in
+mt_path_cache_entry* __mt_path_cache_set(mt_path_cache* cache, size_t hash)
+{
+    size_t num_sets = cache->capacity / MT_PATH_CACHE_WAYS;
+    return cache->entries + (hash % num_sets) * MT_PATH_CACHE_WAYS;
+}
+
+// Look for `key` in the path cache of the tree that `root` belongs to
+//
+// Returns:     The cached branch, or NULL if the path has not been cached (or its entry is stale)
+mt_branch* __mt_path_cache_lookup(mt_branch* root, char* key, size_t key_length, size_t hash)
+{
+    mt_path_cache* cache = &root->tree->path_cache;
+    if(cache->entries == NULL) return NULL;
+
+    mt_path_cache_entry* set = __mt_path_cache_set(cache, hash);
+    for(int way=0; way<MT_PATH_CACHE_WAYS; way++)
+    {
+        mt_path_cache_entry* entry = &set[way];
+        if(entry->hash == hash && entry->generation == cache->generation && entry->root == root
+        && strncmp(entry->key, key, key_length) == 0 && entry->key[key_length] == 0)
+        {
+            entry->last_used = ++cache->clock;
+            return entry->branch;
+        }
+    }
+    return NULL;
+}
+
+// Remember that `key`, relative to `root`, resolves to `branch`
+void __mt_path_cache_store(mt_branch* root, char* key, size_t key_length, size_t hash, mt_branch* branch)
+{
+    mt_tree* tree = root->tree;
+    mt_path_cache* cache = &tree->path_cache;
+    if(cache->capacity == 0) return;
+
+    if(cache->entries == NULL)  // The entries are only allocated once a path is actually looked up
+    {
+        cache->entries = calloc(cache->capacity, sizeof *cache->entries);
+        if(cache->entries == NULL) return;
+    }
+
+    // Use an empty or stale entry if there is one, otherwise evict the least recently used
+    mt_path_cache_entry* set = __mt_path_cache_set(cache, hash);
+    mt_path_cache_entry* victim = &set[0];
+    for(int way=0; way<MT_PATH_CACHE_WAYS; way++)
+    {
+        mt_path_cache_entry* entry = &set[way];
+        if(entry->hash == 0 || entry->generation != cache->generation) { victim = entry; break; }
+        if(entry->last_used < victim->last_used) victim = entry;
+    }
+
+    char* new_key = __mt_tree_strdup(tree, key);
+    if(new_key == NULL) return;
+    if(victim->key != NULL) __mt_tree_free_string(tree, victim->key);
+
+    victim->hash = hash;
+    victim->generation = cache->generation;
+    victim->last_used = ++cache->clock;
+    victim->root = root;
+    victim->branch = branch;
+    victim->key = new_key;
+}
+
+// Make every path cached for `tree` stale. Called whenever a branch is relabelled or removed from its parent
+void __mt_path_cache_invalidate(mt_tree* tree)
+{
+    tree->path_cache.generation++;
+    tree->path_cache.invalidations++;
+}
+
+// Free the memory used by a tree's path cache
+void __mt_path_cache_release(mt_tree* tree)
+{
+    mt_path_cache* cache = &tree->path_cache;
+    if(cache->entries != NULL)
+    {
+        for(size_t i=0; i<cache->capacity; i++) __mt_tree_free_string(tree, cache->entries[i].key);
+        free(cache->entries);
+    }
+    cache->entries = NULL;
+}
+
+// Set the number of paths that the tree `branch` belongs to can cache. Any cached paths are discarded
+//
+// `branch`         Any branch of the tree
+// `num_entries`    The number of paths to cache (rounded up to a multiple of MT_PATH_CACHE_WAYS), or 0 to disable the cache
+//
+// Returns:     1 if success, 0 if failure
+int mt_set_path_cache_size(mt_branch* branch, size_t num_entries)
+{
+    if (branch == NULL) mt_error("Attempted to set the path cache size of a branch which is a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+
+    mt_tree* tree = branch->tree;
+    __mt_path_cache_release(tree);
+    tree->path_cache.capacity = (num_entries + MT_PATH_CACHE_WAYS - 1) / MT_PATH_CACHE_WAYS * MT_PATH_CACHE_WAYS;
+    tree->path_cache.generation++;
+    return 1;
+}
+
+// Get the hit, miss and invalidation counters of the path cache belonging to the tree `branch` is in
+void mt_get_path_cache_stats(mt_branch* branch, mt_path_cache_stats* out_stats)
+{
+    if (branch == NULL)     mt_error("Attempted to get the path cache stats of a branch which is a null pointer");
+    if (out_stats == NULL)  mt_error("Attempted to get path cache stats into a null pointer");
+    if (__mt_check_error_flag()) return;
+
+    mt_path_cache* cache = &branch->tree->path_cache;
+    memset(out_stats, 0, sizeof *out_stats);
+    out_stats->hits = cache->hits;
+    out_stats->misses = cache->misses;
+    out_stats->invalidations = cache->invalidations;
+    out_stats->capacity = cache->capacity;
+
+    if(cache->entries == NULL) return;
+    for(size_t i=0; i<cache->capacity; i++)
+    {
+        if(cache->entries[i].hash != 0 && cache->entries[i].generation == cache->generation) out_stats->entries_in_use++;
+    }
+}
+
+
+
+
+#define ________BATCH_PATHS
+
+// Importers tend to create and look up huge numbers of paths that share their first few segments, such as
+// "tenants/<id>/sessions/<n>/...". The batch functions remember the branch each segment of the previous path led to,
+// so each path only resolves the segments that differ from the path before it. Lookups are sorted first, so that
+// paths sharing a prefix are next to each other however they were given. Creation keeps the order it was given in,
+// since that is the order the new siblings end up in
+
+#if INTERFACE
+typedef struct mt_path_step        // One segment of the path that a batch resolved last
+{
+    char* segment;                 // The segment, within the caller's path. Not null-terminated
+    size_t length;                 // The length of the segment
+    mt_branch* branch;             // The branch it led to, or NULL if there is none
+} mt_path_step;
+
+
+typedef struct mt_path_steps       // The segments of the path that a batch resolved last, see `mt_get_by_paths`
+{
+    mt_path_step* steps;           // `count` segments, starting from the root of the batch
+    size_t count;
+    size_t capacity;
+} mt_path_steps;
+
+
+typedef struct mt_batch_path       // One path of a batch of lookups, as it is sorted
+{
+    unsigned long long key;        // The 8 characters of `path` that are being sorted on, the first in the highest byte
+    char* path;                    // The caller's path
+    size_t index;                  // Its position in the batch
+} mt_batch_path;
+#endif
+
+// Resolve `path` from `root` as `__mt_resolve_path` does, or create it as `mt_create_path` does if `create` is set,
+// starting from the branch that the segments it shares with the previous path of the batch led to.
+// `steps` is updated to hold the segments of `path`
+//
+// Returns:     The branch `path` refers to, or NULL if there is none or there was an error
+mt_branch* __mt_resolve_path_from_steps(mt_branch* root, char* path, mt_path_steps* steps, int create)
+{
+    mt_branch* current_branch = root;
+    size_t depth = 0;
+    size_t position = 0;
+    size_t segment_length;
+    char* segment;
+
+    // Skip the segments that match those of the previous path
+    while(depth < steps->count && (segment = __mt_path_next_segment(path, &position, &segment_length)) != NULL)
+    {
+        mt_path_step* step = &steps->steps[depth];
+        if(step->length != segment_length || memcmp(step->segment, segment, segment_length) != 0)
+        {
+            position -= segment_length;     // Resolve this one afresh
+            break;
+        }
+        current_branch = step->branch;
+        depth++;
+    }
+    steps->count = depth;   // The rest of the previous path's steps don't apply to this one
+
+    int checked = 0;        // Whether the rest of the path has been checked, once the first branch is missing
+    while((segment = __mt_path_next_segment(path, &position, &segment_length)) != NULL)
+    {
+        mt_branch* next_branch = NULL;
+        if(current_branch != NULL) next_branch = __mt_resolve_segment(current_branch, segment, segment_length);
+        if(next_branch == NULL && current_branch != NULL && create)
+        {
+            if(!checked && !__mt_check_path_creatable(path, position - segment_length)) return 0;
+            checked = 1;
+            next_branch = __mt_create_segment(current_branch, segment, segment_length);
+            if(next_branch == NULL) return 0;
+        }
+
+        if(steps->count == steps->capacity)
+        {
+            size_t capacity = steps->capacity ? steps->capacity * 2 : 16;
+            mt_path_step* grown = realloc(steps->steps, capacity * sizeof *grown);
+            if(grown == NULL) mt_error("Could not allocate memory to resolve the path '%s'", path);
+            if(__mt_check_error_flag()) return 0;
+            steps->steps = grown;
+            steps->capacity = capacity;
+        }
+        steps->steps[steps->count++] = (mt_path_step){ segment, segment_length, next_branch };
+        current_branch = next_branch;
+    }
+
+    return current_branch;
+}
+
+// Sort `count` paths of a batch by their keys, using `scratch`, which has room for as many.
+// Long runs are radix sorted a byte at a time, skipping the bytes that every key shares
+void __mt_sort_batch_path_keys(mt_batch_path* paths, mt_batch_path* scratch, size_t count)
+{
+    if(count < 32)
+    {
+        for(size_t i=1; i<count; i++)
+        {
+            mt_batch_path moving = paths[i];
+            size_t j = i;
+            for(; j > 0 && paths[j - 1].key > moving.key; j--) paths[j] = paths[j - 1];
+            paths[j] = moving;
+        }
+        return;
+    }
+
+    for(int shift=0; shift<64; shift+=8)
+    {
+        size_t starts[256] = { 0 };
+        for(size_t i=0; i<count; i++) starts[(paths[i].key >> shift) & 0xff]++;
+        if(starts[(paths[0].key >> shift) & 0xff] == count) continue;
+
+        size_t total = 0;
+        for(int digit=0; digit<256; digit++)
+        {
+            size_t in_bucket = starts[digit];
+            starts[digit] = total;
+            total += in_bucket;
+        }
+        for(size_t i=0; i<count; i++) scratch[starts[(paths[i].key >> shift) & 0xff]++] = paths[i];
+        memcpy(paths, scratch, count * sizeof *paths);
+    }
+}
+
+// Sort `count` paths of a batch by their characters, from the offset `offset` on, which brings together the paths
+// that share a prefix. Comparing whole paths would chase a pointer to each string for every comparison, so the paths
+// are sorted on 8 characters at a time, held in their keys, and only the runs that share those are sorted further.
+// `scratch` has room for `count` paths
+void __mt_sort_batch_paths(mt_batch_path* paths, mt_batch_path* scratch, size_t count, size_t offset)
+{
+    for(size_t i=0; i<count; i++)
+    {
+        unsigned long long key = 0;
+        char* characters = paths[i].path + offset;
+        int length = 0;
+        while(length < 8 && characters[length] != 0) length++;
+        for(int j=0; j<8; j++) key = (key << 8) | (j < length ? (unsigned char)characters[j] : 0);
+        paths[i].key = key;
+    }
+    __mt_sort_batch_path_keys(paths, scratch, count);
+
+    for(size_t run=0; run<count; )
+    {
+        size_t end = run + 1;
+        while(end < count && paths[end].key == paths[run].key) end++;
+
+        // Paths whose key ends before its last character end at the same place, so they are the same path
+        if(end - run > 1 && (paths[run].key & 0xff) != 0) __mt_sort_batch_paths(paths + run, scratch, end - run, offset + 8);
+        run = end;
+    }
+}
+
+// Find the branches that each of `num_paths` paths point to, relative to the branch `root`, as `mt_get_by_path` does.
+// The paths are sorted so that those sharing a prefix are resolved together, and each prefix is followed only once
+//
+// `root`           The branch the paths are relative to
+// `paths`          The paths to look up. They are not modified
+// `num_paths`      The number of paths
+// `out_branches`   Filled with the branch each path points to, in the same order as `paths`, or NULL for those that
+//                  point to no branch
+//
+// Returns:     The number of paths that point to a branch
+size_t mt_get_by_paths(mt_branch* root, char** paths, size_t num_paths, mt_branch** out_branches)
+{
+    if (root == NULL) mt_error("Attempted to get paths from a branch which is a null pointer");
+    if (paths == NULL && num_paths > 0) mt_error("Attempted to get paths from an array which is a null pointer");
+    if (out_branches == NULL && num_paths > 0) mt_error("Attempted to get paths into an array which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    size_t found = 0;
+    mt_batch_path* sorted = malloc(2 * num_paths * sizeof *sorted);    // With room to sort them
+    if (sorted == NULL || root->tree->reclaimer != NULL)    // Other threads may be reading, see `mt_get_by_path`
+    {
+        for(size_t i=0; i<num_paths; i++) found += ((out_branches[i] = mt_get_by_path(root, paths[i])) != NULL);
+        free(sorted);
+        return found;
+    }
+
+    size_t num_sorted = 0;
+    for(size_t i=0; i<num_paths; i++)
+    {
+        if(paths[i] != NULL) sorted[num_sorted++] = (mt_batch_path){ 0, paths[i], i };
+        else out_branches[i] = NULL;
+    }
+    __mt_sort_batch_paths(sorted, sorted + num_paths, num_sorted, 0);
+
+    mt_path_steps steps = { 0 };
+    for(size_t i=0; i<num_sorted; i++)
+    {
+        mt_branch* branch = __mt_resolve_path_from_steps(root, sorted[i].path, &steps, 0);
+        out_branches[sorted[i].index] = branch;
+        found += (branch != NULL);
+    }
+
+    free(steps.steps);
+    free(sorted);
+    return found;
+}
+
+// Create each of `num_paths` paths relative to the branch `root` as `mt_create_path` does, in the order they are given.
+// Only the segments that differ from the path before each one are followed
+//
+// `root`           The branch the paths are relative to
+// `paths`          The paths to create. They are not modified
+// `num_paths`      The number of paths
+// `out_branches`   Filled with the branch at the end of each path, in the same order as `paths`. May be NULL
+//
+// Returns:     1 if success, 0 if error. The paths before the one that failed have been created
+int mt_create_paths(mt_branch* root, char** paths, size_t num_paths, mt_branch** out_branches)
+{
+    if (root == NULL) mt_error("Attempted to create paths from a branch which is a null pointer");
+    if (paths == NULL && num_paths > 0) mt_error("Attempted to create paths from an array which is a null pointer");
+    for(size_t i=0; paths != NULL && i<num_paths; i++)
+    {
+        if (paths[i] == NULL) { mt_error("Attempted to create path %ld of a batch, which is a null pointer", i); break; }
+    }
+    if (__mt_check_error_flag()) return 0;
+
+    mt_path_steps steps = { 0 };
+    for(size_t i=0; i<num_paths; i++)
+    {
+        mt_branch* branch = __mt_resolve_path_from_steps(root, paths[i], &steps, 1);
+        if(out_branches != NULL) out_branches[i] = branch;
+        if(branch == NULL)
+        {
+            free(steps.steps);
+            return 0;
+        }
+    }
+
+    free(steps.steps);
+    return 1;
+}
+
+
+
+
+#define ________COMPILED_PATHS
+
+// A path that is looked up over and over can be compiled once into an `mt_path`, which holds each of its segments
+// already parsed: an id, or a label interned in the tree, so that following it compares labels by their pointers
+// without hashing them again. Compiled paths are not normalised or cached on each lookup as `mt_get_by_path` does,
+// so a lookup allocates nothing. It does create any branches it reaches that are not loaded or copied yet, see
+// `__mt_ensure_children`, so other threads may only follow compiled paths once `mt_enable_concurrent_reads` has been called
+
+#if INTERFACE
+typedef struct mt_path_segment     // One segment of a compiled path
+{
+    char* label;                   // The label, interned in the path's tree, or NULL if the segment is an id
+    size_t id;                     // The id, if `label` is NULL
+} mt_path_segment;
+
+
+typedef struct mt_path             // A path parsed once for repeated use, see `mt_compile_path`
+{
+    mt_tree* tree;                 // The tree that the labels are interned in, and that the path can be used with
+    size_t num_segments;           // The number of segments
+    mt_path_segment segments[];    // The segments, from the branch the path is relative to downwards
+} mt_path;
+#endif
+
+// Parse and check `path` once, for use with `mt_get_by_compiled_path` and `mt_create_compiled_path` on the tree
+// of `branch`. Paths follow the same rules as for `mt_get_by_path`. Labels in it that no branch of the tree has yet
+// are added to the tree's strings, so this has to be called from the thread that changes the tree
+//
+// `branch`     Any branch of the tree the path is for
+// `path`       The path to compile. It is not modified
+//
+// Returns:     The compiled path, to be freed with `mt_free_path` before the tree is destroyed, or NULL if there was an error
+mt_path* mt_compile_path(mt_branch* branch, char* path)
+{
+    if (branch == NULL) mt_error("Attempted to compile a path for a branch which is a null pointer");
+    if (path == NULL)   mt_error("Attempted to compile a path which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    // Count and check the segments first
+    size_t num_segments = 0;
+    size_t longest = 0;
+    size_t position = 0;
+    size_t segment_length;
+    size_t id;
+    char* segment;
+    while((segment = __mt_path_next_segment(path, &position, &segment_length)) != NULL)
+    {
+        if(!__mt_parse_id_segment(segment, segment_length, &id) && (memchr(segment, '{', segment_length) || memchr(segment, '}', segment_length)))
+        {
+            mt_error("Attempted to compile the path '%s', which contains disallowed characters", path);
+        }
+        if (__mt_check_error_flag()) return 0;
+        if(segment_length > longest) longest = segment_length;
+        num_segments++;
+    }
+
+    mt_path* compiled = calloc(1, sizeof *compiled + num_segments * sizeof compiled->segments[0]);
+    char* label = malloc(longest + 1);
+    if (compiled == NULL || label == NULL) mt_error("Could not allocate memory to compile the path '%s'", path);
+    if (__mt_check_error_flag()) { free(compiled); free(label); return 0; }
+
+    compiled->tree = branch->tree;
+    position = 0;
+    while((segment = __mt_path_next_segment(path, &position, &segment_length)) != NULL)
+    {
+        mt_path_segment* compiled_segment = &compiled->segments[compiled->num_segments];
+        if(!__mt_parse_id_segment(segment, segment_length, &compiled_segment->id))
+        {
+            memcpy(label, segment, segment_length);
+            label[segment_length] = 0;
+            compiled_segment->label = __mt_tree_intern_string(branch->tree, label);
+            if(compiled_segment->label == NULL) break;
+        }
+        compiled->num_segments++;
+    }
+
+    free(label);
+    if (compiled->num_segments < num_segments)
+    {
+        mt_free_path(compiled);
+        return 0;
+    }
+    return compiled;
+}
+
+// Free a path compiled with `mt_compile_path`, releasing its labels
+void mt_free_path(mt_path* path)
+{
+    if(path == NULL) return;
+    for(size_t i=0; i<path->num_segments; i++) __mt_tree_release_string(path->tree, path->segments[i].label);
+    free(path);
+}
+
+// Check that the compiled path `path` can be followed from `root`
+//
+// Returns:     1 if it can, 0 if not
+int __mt_check_compiled_path_arguments(mt_branch* root, mt_path* path)
+{
+    if (root == NULL) mt_error("Attempted to follow a compiled path from a branch which is a null pointer");
+    if (path == NULL) mt_error("Attempted to follow a compiled path which is a null pointer");
+    else if (root != NULL && root->tree != path->tree) mt_error("Attempted to follow a path compiled for another tree");
+    if (__mt_check_error_flag()) return 0;
+    return 1;
+}
+
+// Follow the first `num_segments` segments of the compiled path `path` down from `root`, as far as they go
+//
+// `out_followed`   Set to the number of segments that led to a branch
+//
+// Returns:     The last branch reached
+mt_branch* __mt_follow_compiled_path(mt_branch* root, mt_path* path, size_t* out_followed)
+{
+    mt_branch* current_branch = root;
+    size_t i = 0;
+    for(; i<path->num_segments; i++)
+    {
+        mt_path_segment* segment = &path->segments[i];
+        mt_branch* next_branch = (segment->label != NULL) ? __mt_find_child_by_interned_label(current_branch, segment->label)
+                                                          : __mt_find_child_by_id(current_branch, segment->id);
+        if(next_branch == NULL) break;
+        current_branch = next_branch;
+    }
+    *out_followed = i;
+    return current_branch;
+}
+
+// Return the branch that the compiled path `path` points to, relative to the branch `root`, as `mt_get_by_path` does.
+// Nothing is allocated, but branches that have not been loaded or copied yet are created as they are reached, so
+// several threads may only do this at once after `mt_enable_concurrent_reads`, which creates them all first
+//
+// Returns:     The branch, or NULL if there is no such branch. If several siblings share a label, the first is used
+mt_branch* mt_get_by_compiled_path(mt_branch* root, mt_path* path)
+{
+    if (!__mt_check_compiled_path_arguments(root, path)) return 0;
+
+    mt_branch* found;
+    size_t followed;
+    size_t sequence;
+    do  // Repeated if it overlapped a concurrent change, see `mt_enable_concurrent_reads`
+    {
+        sequence = __mt_read_sequence(root->tree);
+        found = __mt_follow_compiled_path(root, path, &followed);
+    } while(!__mt_check_read_sequence(root->tree, sequence));
+
+    return (followed == path->num_segments) ? found : NULL;
+}
+
+// Create the branches of the compiled path `path` that don't exist yet below `root`, as `mt_create_path` does
+//
+// Returns:     The branch at the end of the path, or NULL if there was an error
+mt_branch* mt_create_compiled_path(mt_branch* root, mt_path* path)
+{
+    if (!__mt_check_compiled_path_arguments(root, path)) return 0;
+
+    size_t followed;
+    mt_branch* current_branch = __mt_follow_compiled_path(root, path, &followed);
+    for(size_t i=followed; i<path->num_segments; i++)
+    {
+        if (path->segments[i].label == NULL) mt_error("Attempted to create a compiled path, but the branch with id %ld does not exist there", path->segments[i].id);
+        if (__mt_check_error_flag()) return 0;
+    }
+
+    for(size_t i=followed; i<path->num_segments && current_branch != NULL; i++)
+    {
+        current_branch = __mt_create_branch_as(current_branch, path->segments[i].label, 0);
+    }
+    return current_branch;
+}
+
+
+
+
+#define ________SEARCH
+
+// Find the first occurrence of a branch descending from `root` with the label `label`
+// Descendants are searched depth first, so a branch's own sub-branches are searched before its later siblings
+//
+// Returns:     The branch, or NULL if there is none
+mt_branch* mt_search_for_label(mt_branch* root, char* label)
+{
+    if (root == NULL)   mt_error("Attempted to search for a label in a branch which is a null pointer"); 
+    if (label == NULL)  mt_error("Attempted to search for a label which is a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+
+    if (root->tree->unloaded.count > 0) __mt_load_all_children(root->tree);     // So that every label has been interned
+    char* interned = __mt_tree_find_label(root->tree, label);
+    if (interned == NULL) return NULL;      // No branch of the tree has this label
+
+    for(mt_branch* branch = __mt_next_descendant(root, root); branch != NULL; branch = __mt_next_descendant(branch, root))
+    {
+        if(__atomic_load_n(&branch->label, __ATOMIC_RELAXED) == interned) return branch;
+    }
+    return NULL;
+}
+
+// Find the interned copy of `label` that every branch of `tree` with that label points to, so that searches
+// can compare labels by their pointers
+//
+// Returns:     The interned string, or NULL if no branch of `tree` has the label
+char* __mt_tree_find_label(mt_tree* tree, char* label)
+{
+    char* interned;
+    size_t sequence;
+    do
+    {
+        sequence = __mt_read_sequence(tree);
+        interned = __mt_tree_find_string(tree, label, strlen(label));
+    } while(!__mt_check_read_sequence(tree, sequence));
+    return interned;
+}
+
+
+
+
+// Return the branch pointed to by `path`, relative to the branch `root`
+// `path` is not modified, so it can be a string literal
+//
+// Path format:   root/label/another_label/{12}/{132}/final_label
+//
+// Returns:     The branch, or NULL if there is no such branch. If several siblings share a label, the first is used
+mt_branch* mt_get_by_path(mt_branch* root, char* path)
+{
+    if(path == NULL) return NULL;
+    if (root == NULL) mt_error("Attempted to get the path '%s' from a branch which is a null pointer", path); 
+    if (__mt_check_error_flag()) return 0;
+
+    mt_path_cache* cache = &root->tree->path_cache;
+    if(root->tree->reclaimer != NULL)   // Other threads may be reading, so the cache is left alone
+    {
+        mt_branch* found;
+        size_t sequence;
+        do
+        {
+            sequence = __mt_read_sequence(root->tree);
+            found = __mt_resolve_path(root, path);
+        } while(!__mt_check_read_sequence(root->tree, sequence));
+        return found;
+    }
+    if(cache->capacity == 0) return __mt_resolve_path(root, path);
+
+    // Paths are cached in their normalised form, so that e.g. "/a/b" and "a//b/" share an entry
+    char key_buffer[256];
+    char* key = key_buffer;
+    size_t key_length = __mt_normalize_path(path, key_buffer, sizeof key_buffer);
+    if(key_length >= sizeof key_buffer)
+    {
+        key = malloc(key_length + 1);
+        if (key == NULL) return __mt_resolve_path(root, path);
+        __mt_normalize_path(path, key, key_length + 1);
+    }
+
+    // Check in the cache first
+    size_t hash = __mt_path_cache_hash(root, key, key_length);
+    mt_branch* current_branch = __mt_path_cache_lookup(root, key, key_length, hash);
+
+    if(current_branch != NULL)
+    {
+        cache->hits++;
+    }
+    else
+    {
+        cache->misses++;
+        current_branch = __mt_resolve_path(root, key);
+
+        // Add the path to the path cache. Paths that don't exist aren't cached, as they may be created later
+        if(current_branch != NULL) __mt_path_cache_store(root, key, key_length, hash, current_branch);
+    }
+
+    if(key != key_buffer) free(key);
+    return current_branch;
+}
+
+// Check whether the branch pointed to by `path` exists
+// Returns:     1 if found, 0 if not found
+int mt_check_path_exists(mt_branch* root, char* path)
+{
+    if(mt_get_by_path(root, path) != NULL) return 1;
+    return 0;
+}
+
+
+
+
+
+#define ________LABEL_INDEX
+
+// A tree can keep an index of every one of its branches by label, so that all the branches with a label, or with
+// labels that start with the same characters, are found without searching the tree.
+// The index is a treap: a binary search tree of the distinct labels in the order `strcmp` puts them in, balanced by
+// giving each node a random priority that is never lower than those below it. Each node lists the branches with
+// its label, linked through `next_labelled` and `prev_labelled`, so a branch is indexed or removed in O(log L) time
+// for L distinct labels, and the branches with a prefix take O(log L) time to reach plus the time to list them.
+// Branches are filed when they are created or loaded, refiled when they are relabelled and removed when they are
+// deleted. Moving a branch within a tree doesn't change its label, so it stays where it is filed
+
+#if INTERFACE
+typedef struct mt_label_matches    // Where a query of the label index has got to
+{
+    mt_branch* root;               // Only branches below this one are wanted
+    mt_branch** out;               // Where to put the branches found
+    size_t capacity;               // The number of branches `out` has room for
+    size_t count;                  // The number of branches found so far, including those there was no room for
+    char* pattern;                 // A glob that the labels must match, or NULL if the labels have been checked already
+
+    mt_branch** marked;            // Branches marked MT_BRANCH_WITHIN_QUERY or MT_BRANCH_OUTSIDE_QUERY, to clear afterwards
+    size_t num_marked;
+    size_t marked_capacity;
+} mt_label_matches;
+#endif
+
+// Index every branch of the tree of `root` by label, and keep the index up to date as the tree changes until
+// `mt_disable_label_index`. Lazily loaded branches and branches that copies are still sharing are all loaded or
+// copied first. The index is only for the thread that changes the tree, not for concurrent readers
+//
+// `root`       The root of the tree
+//
+// Returns:     1 if success, 0 if error
+int mt_enable_label_index(mt_branch* root)
+{
+    if (root == NULL) mt_error("Attempted to index the labels of a tree whose root is a null pointer");
+    else if (!mt_check_is_root(root)) mt_error("Attempted to index the labels of a tree from a branch which is not the root");
+    else if (root->tree->label_index != NULL) mt_error("Attempted to index the labels of a tree twice");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_tree* tree = root->tree;
+    __mt_load_all_children(tree);
+    mt_label_index* index = calloc(1, sizeof *index);
+    if (index == NULL) mt_error("Could not allocate memory for a label index");
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_pool_init(&index->nodes, sizeof(mt_label_postings));
+    index->seed = 2463534242u;
+    tree->label_index = index;
+    __mt_traverse(root, -1, __mt_visit_index_label, NULL, NULL, 0);
+    return tree->label_index != NULL;      // Which is cleared if the heap ran out meanwhile
+}
+
+// Stop indexing the labels of the tree of `root`, and free the index
+//
+// Returns:     1 if success, 0 if error
+int mt_disable_label_index(mt_branch* root)
+{
+    if (root == NULL) mt_error("Attempted to stop indexing the labels of a tree whose root is a null pointer");
+    else if (root->tree->label_index == NULL) mt_error("Attempted to stop indexing the labels of a tree which does not index them");
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_label_index_release(root->tree);
+    return 1;
+}
+
+// Free the label index of `tree`, if it has one
+void __mt_label_index_release(mt_tree* tree)
+{
+    if(tree->label_index == NULL) return;
+    __mt_pool_release(&tree->label_index->nodes);
+    free(tree->label_index);
+    tree->label_index = NULL;
+}
+
+// Visitor for `mt_enable_label_index`, filing each branch under its label
+int __mt_visit_index_label(mt_branch* branch, int depth, void* context)
+{
+    __mt_label_index_add(branch);
+    return (branch->tree->label_index != NULL) ? MT_VISIT_CONTINUE : MT_VISIT_STOP;
+}
+
+// Find the node of `index` for the interned label `label`
+//
+// Returns:     The node, or NULL if no branch has the label
+mt_label_postings* __mt_label_index_find(mt_label_index* index, char* label)
+{
+    mt_label_postings* node = index->top;
+    while(node != NULL && node->label != label)
+    {
+        node = (strcmp(label, node->label) < 0) ? node->left : node->right;
+    }
+    return node;
+}
+
+// Put the new node `added` into the subtree under `node`, rotating it up past any nodes of lower priority
+//
+// Returns:     The node now at the top of the subtree
+mt_label_postings* __mt_label_index_insert(mt_label_postings* node, mt_label_postings* added)
+{
+    if(node == NULL) return added;
+
+    if(strcmp(added->label, node->label) < 0)
+    {
+        node->left = __mt_label_index_insert(node->left, added);
+        if(node->left->priority <= node->priority) return node;
+        mt_label_postings* top = node->left;
+        node->left = top->right;
+        top->right = node;
+        return top;
+    }
+
+    node->right = __mt_label_index_insert(node->right, added);
+    if(node->right->priority <= node->priority) return node;
+    mt_label_postings* top = node->right;
+    node->right = top->left;
+    top->left = node;
+    return top;
+}
+
+// Join two subtrees, where every label in `left` sorts before every label in `right`
+//
+// Returns:     The node at the top of the joined subtree
+mt_label_postings* __mt_label_index_join(mt_label_postings* left, mt_label_postings* right)
+{
+    if(left == NULL) return right;
+    if(right == NULL) return left;
+    if(left->priority > right->priority)
+    {
+        left->right = __mt_label_index_join(left->right, right);
+        return left;
+    }
+    right->left = __mt_label_index_join(left, right->left);
+    return right;
+}
+
+// Take `removed` out of the subtree under `node`, joining its two subtrees in its place
+//
+// Returns:     The node now at the top of the subtree
+mt_label_postings* __mt_label_index_unlink(mt_label_postings* node, mt_label_postings* removed)
+{
+    if(node == removed) return __mt_label_index_join(node->left, node->right);
+    if(strcmp(removed->label, node->label) < 0) node->left = __mt_label_index_unlink(node->left, removed);
+    else node->right = __mt_label_index_unlink(node->right, removed);
+    return node;
+}
+
+// File `branch` under its label in the label index of its tree, if the tree has one.
+// If the heap is exhausted the index is dropped, leaving queries to search the tree instead
+void __mt_label_index_add(mt_branch* branch)
+{
+    mt_label_index* index = branch->tree->label_index;
+    if(index == NULL || branch->label == NULL) return;
+
+    mt_label_postings* postings = __mt_label_index_find(index, branch->label);
+    if(postings == NULL)
+    {
+        postings = __mt_pool_alloc(&index->nodes);
+        if(postings == NULL)
+        {
+            __mt_label_index_release(branch->tree);
+            mt_error("Could not allocate memory to index the label '%s'", branch->label);
+            return;
+        }
+
+        index->seed ^= index->seed << 13;       // xorshift32
+        index->seed ^= index->seed >> 17;
+        index->seed ^= index->seed << 5;
+        postings->label = branch->label;
+        postings->priority = index->seed;
+        index->top = __mt_label_index_insert(index->top, postings);
+        index->count++;
+    }
+
+    branch->prev_labelled = NULL;
+    branch->next_labelled = postings->first;
+    if(postings->first != NULL) postings->first->prev_labelled = branch;
+    postings->first = branch;
+    postings->count++;
+}
+
+// Take `branch` out of the label index of its tree, if the tree has one, before it is relabelled or freed
+void __mt_label_index_remove(mt_branch* branch)
+{
+    mt_label_index* index = branch->tree->label_index;
+    if(index == NULL || branch->label == NULL) return;
+
+    mt_label_postings* postings = __mt_label_index_find(index, branch->label);
+    if(postings == NULL) return;
+
+    if(branch->prev_labelled != NULL) branch->prev_labelled->next_labelled = branch->next_labelled;
+    else postings->first = branch->next_labelled;
+    if(branch->next_labelled != NULL) branch->next_labelled->prev_labelled = branch->prev_labelled;
+    branch->next_labelled = branch->prev_labelled = NULL;
+
+    if(--postings->count > 0) return;
+    index->top = __mt_label_index_unlink(index->top, postings);
+    __mt_pool_free(&index->nodes, postings);
+    index->count--;
+}
+
+// Check whether `label` matches the glob `pattern`, where '*' stands for any number of characters and '?' for any one
+//
+// Returns:     1 if it does, 0 if not
+int __mt_check_glob_matches(char* label, char* pattern)
+{
+    char* star = NULL;          // The last '*' seen, and where in `label` it has been matched up to
+    char* resume = NULL;
+    while(*label != 0)
+    {
+        if(*pattern == '*') { star = pattern++; resume = label; }
+        else if(*pattern == '?' || *pattern == *label) { pattern++; label++; }
+        else if(star != NULL) { pattern = star + 1; label = ++resume; }
+        else return 0;
+    }
+    while(*pattern == '*') pattern++;
+    return *pattern == 0;
+}
+
+// Remember that `branch` is about to be marked for the query `matches`, so that the mark can be cleared afterwards
+//
+// Returns:     1 if success, 0 if the heap is exhausted, in which case the branch must not be marked
+int __mt_label_matches_mark(mt_label_matches* matches, mt_branch* branch)
+{
+    if(matches->num_marked == matches->marked_capacity)
+    {
+        size_t capacity = matches->marked_capacity ? matches->marked_capacity * 2 : 64;
+        mt_branch** marked = realloc(matches->marked, capacity * sizeof *marked);
+        if(marked == NULL) return 0;
+        matches->marked = marked;
+        matches->marked_capacity = capacity;
+    }
+    matches->marked[matches->num_marked++] = branch;
+    return 1;
+}
+
+// Check whether `branch` is below the branch that `matches` is for. Each branch passed on the way up is marked with
+// the answer, so that later checks stop as soon as they reach it: a query walks each branch between its matches and
+// the branch it is for at most once, rather than once for every match below it
+//
+// Returns:     1 if it is, 0 if not
+int __mt_label_matches_within(mt_label_matches* matches, mt_branch* branch)
+{
+    mt_branch* known = branch;
+    while(known != NULL && known != matches->root && !(known->flags & (MT_BRANCH_WITHIN_QUERY | MT_BRANCH_OUTSIDE_QUERY)))
+    {
+        known = known->parent;
+    }
+    int within = known == matches->root || (known != NULL && (known->flags & MT_BRANCH_WITHIN_QUERY));
+
+    for(mt_branch* passed = branch; passed != known; passed = passed->parent)
+    {
+        if(!__mt_label_matches_mark(matches, passed)) break;    // Later checks then walk further up instead
+        __mt_set_flags(passed, within ? MT_BRANCH_WITHIN_QUERY : MT_BRANCH_OUTSIDE_QUERY);
+    }
+    return within;
+}
+
+// Finish the query `matches`, clearing the marks it left on branches
+//
+// Returns:     The number of branches found
+size_t __mt_label_matches_finish(mt_label_matches* matches)
+{
+    for(size_t i=0; i<matches->num_marked; i++) __mt_clear_flags(matches->marked[i], MT_BRANCH_WITHIN_QUERY | MT_BRANCH_OUTSIDE_QUERY);
+    free(matches->marked);
+    return matches->count;
+}
+
+// Load the branches below the branch that `matches` is for that have not been loaded yet, and create those that copies
+// below it are still sharing, so that every branch the query could find is in the label index. The rest of the tree
+// is left as it is, so a query of a small subtree costs time in proportion to the branches waiting to be loaded or
+// copied, not to the tree
+void __mt_label_matches_load(mt_label_matches* matches)
+{
+    mt_tree* tree = matches->root->tree;
+    if(tree->unloaded.count == 0 && tree->shared.count == 0) return;
+    if(matches->root->parent == NULL) { __mt_load_all_children(tree); return; }
+
+    // Loading and copying changes the indexes, so the branches to start from are found first
+    size_t num_waiting = tree->unloaded.count + tree->shared.count;
+    mt_branch** waiting = malloc(num_waiting * sizeof *waiting);
+    if(waiting == NULL) { __mt_load_all_children(tree); return; }      // Which needs no memory, and loads this subtree too
+
+    num_waiting = 0;
+    mt_unloaded_index* indexes[2] = { &tree->unloaded, &tree->shared };
+    for(int i=0; i<2; i++)
+    {
+        for(size_t j=0; j<indexes[i]->capacity; j++)
+        {
+            mt_branch* branch = indexes[i]->slots[j].branch;
+            if(branch != NULL && (branch == matches->root || __mt_label_matches_within(matches, branch))) waiting[num_waiting++] = branch;
+        }
+    }
+
+    for(size_t i=0; i<num_waiting; i++)
+    {
+        for(mt_branch* branch = waiting[i]; branch != NULL; branch = __mt_next_descendant(branch, waiting[i]));
+    }
+    free(waiting);
+}
+
+// Add `branch` to `matches`, which it is already known to belong in
+void __mt_label_matches_put(mt_label_matches* matches, mt_branch* branch)
+{
+    if(matches->count < matches->capacity) matches->out[matches->count] = branch;
+    matches->count++;
+}
+
+// Add `branch` to `matches` if it is below the branch the query is for
+void __mt_label_matches_add(mt_label_matches* matches, mt_branch* branch)
+{
+    if(branch == matches->root) return;
+    if(matches->root->parent != NULL && !__mt_label_matches_within(matches, branch)) return;
+    __mt_label_matches_put(matches, branch);
+}
+
+// Add every branch filed under `postings` to `matches`, if its label matches the query's glob
+void __mt_label_matches_add_postings(mt_label_matches* matches, mt_label_postings* postings)
+{
+    if(matches->pattern != NULL && !__mt_check_glob_matches(postings->label, matches->pattern)) return;
+    for(mt_branch* branch = postings->first; branch != NULL; branch = branch->next_labelled)
+    {
+        __mt_label_matches_add(matches, branch);
+    }
+}
+
+// Add the branches of every node under `node` whose label starts with the `prefix_length` characters at `prefix`
+// to `matches`, in the order of their labels. Only the nodes along the edges of that range and within it are visited
+void __mt_label_index_collect_prefix(mt_label_postings* node, char* prefix, size_t prefix_length, mt_label_matches* matches)
+{
+    while(node != NULL)
+    {
+        int order = strncmp(node->label, prefix, prefix_length);
+        if(order < 0) node = node->right;
+        else if(order > 0) node = node->left;
+        else
+        {
+            __mt_label_index_collect_prefix(node->left, prefix, prefix_length, matches);
+            __mt_label_matches_add_postings(matches, node);
+            node = node->right;
+        }
+    }
+}
+
+// Check the arguments shared by every label query
+//
+// Returns:     1 if the query can go ahead, 0 if not
+int __mt_check_label_query(mt_branch* root, char* label, mt_branch** out, size_t capacity)
+{
+    if (root == NULL)   mt_error("Attempted to search for labels in a branch which is a null pointer");
+    if (label == NULL)  mt_error("Attempted to search for a label which is a null pointer");
+    if (out == NULL && capacity > 0)  mt_error("Attempted to search for labels into an array which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+    return 1;
+}
+
+// Find every branch descending from `root` whose label is `label`, in no particular order.
+// Uses the tree's label index if it has one, see `mt_enable_label_index`, and searches the subtree if not.
+// Either way only the branches below `root` are loaded or copied, if they are still waiting to be
+//
+// `root`       The branch to search below. It is not included itself
+// `label`      The label to look for
+// `out`        Filled with up to `capacity` of the branches found. May be NULL if `capacity` is 0
+// `capacity`   The number of branches `out` has room for
+//
+// Returns:     The number of branches found, which may be more than `capacity`
+size_t mt_find_by_label(mt_branch* root, char* label, mt_branch** out, size_t capacity)
+{
+    if (!__mt_check_label_query(root, label, out, capacity)) return 0;
+
+    mt_label_matches matches = { .root = root, .out = out, .capacity = capacity };
+    char* interned = __mt_tree_find_label(root->tree, label);
+    if (interned == NULL) return 0;        // No branch of the tree has this label
+
+    mt_label_index* index = root->tree->label_index;
+    if (index != NULL)
+    {
+        __mt_label_matches_load(&matches);
+        mt_label_postings* postings = __mt_label_index_find(index, interned);
+        if (postings != NULL) __mt_label_matches_add_postings(&matches, postings);
+        return __mt_label_matches_finish(&matches);
+    }
+
+    for(mt_branch* branch = __mt_next_descendant(root, root); branch != NULL; branch = __mt_next_descendant(branch, root))
+    {
+        if(branch->label == interned) __mt_label_matches_put(&matches, branch);
+    }
+    return __mt_label_matches_finish(&matches);
+}
+
+// Find every branch descending from `root` whose label starts with `prefix`, as `mt_find_by_label` does.
+// With an index the branches come in the order of their labels
+//
+// Returns:     The number of branches found, which may be more than `capacity`
+size_t mt_find_by_label_prefix(mt_branch* root, char* prefix, mt_branch** out, size_t capacity)
+{
+    if (!__mt_check_label_query(root, prefix, out, capacity)) return 0;
+
+    mt_label_matches matches = { .root = root, .out = out, .capacity = capacity };
+    size_t prefix_length = strlen(prefix);
+    if (root->tree->label_index != NULL)
+    {
+        __mt_label_matches_load(&matches);
+        __mt_label_index_collect_prefix(root->tree->label_index->top, prefix, prefix_length, &matches);
+        return __mt_label_matches_finish(&matches);
+    }
+
+    for(mt_branch* branch = __mt_next_descendant(root, root); branch != NULL; branch = __mt_next_descendant(branch, root))
+    {
+        if(strncmp(branch->label, prefix, prefix_length) == 0) __mt_label_matches_put(&matches, branch);
+    }
+    return __mt_label_matches_finish(&matches);
+}
+
+// Find every branch descending from `root` whose label matches the glob `pattern`, as `mt_find_by_label` does.
+// In `pattern`, '*' stands for any number of characters and '?' for any one character. With an index only the
+// labels starting with the characters before the first wildcard are checked, so a pattern that starts with one
+// checks every distinct label in the tree, though still without looking at the branches whose labels don't match
+//
+// Returns:     The number of branches found, which may be more than `capacity`
+size_t mt_find_by_label_glob(mt_branch* root, char* pattern, mt_branch** out, size_t capacity)
+{
+    if (!__mt_check_label_query(root, pattern, out, capacity)) return 0;
+
+    size_t literal_length = strcspn(pattern, "*?");
+    if (pattern[literal_length] == 0) return mt_find_by_label(root, pattern, out, capacity);
+
+    mt_label_matches matches = { .root = root, .out = out, .capacity = capacity, .pattern = pattern };
+    if (root->tree->label_index != NULL)
+    {
+        __mt_label_matches_load(&matches);
+        __mt_label_index_collect_prefix(root->tree->label_index->top, pattern, literal_length, &matches);
+        return __mt_label_matches_finish(&matches);
+    }
+
+    for(mt_branch* branch = __mt_next_descendant(root, root); branch != NULL; branch = __mt_next_descendant(branch, root))
+    {
+        if(__mt_check_glob_matches(branch->label, pattern)) __mt_label_matches_put(&matches, branch);
+    }
+    return __mt_label_matches_finish(&matches);
+}
+
+
+
+
+#define ________DATA_INDEX
+
+// A tree can also keep an index of its branches by the address of their data, so that the branches linked to an
+// object with `mt_set_data_pointer` can be found, and detached when the object is freed, without searching the tree.
+// Like the label index it is a treap, here of one node per branch with data, ordered by the address of the data.
+// Each node also keeps the furthest end of any data below it, which lets a lookup skip every subtree whose data all
+// ends before an address, and so find the data that an address lies inside in O(log n) time
+
+// Index every branch of the tree of `root` that has data by the address of that data, and keep the index up to date
+// as the tree changes until `mt_disable_data_index`. Lazily loaded branches and branches that copies are still
+// sharing are all loaded or copied first. The index is only for the thread that changes the tree
+//
+// `root`       The root of the tree
+//
+// Returns:     1 if success, 0 if error
+int mt_enable_data_index(mt_branch* root)
+{
+    if (root == NULL) mt_error("Attempted to index the data of a tree whose root is a null pointer");
+    else if (!mt_check_is_root(root)) mt_error("Attempted to index the data of a tree from a branch which is not the root");
+    else if (root->tree->data_index != NULL) mt_error("Attempted to index the data of a tree twice");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_tree* tree = root->tree;
+    __mt_load_all_children(tree);
+    mt_data_index* index = calloc(1, sizeof *index);
+    if (index == NULL) mt_error("Could not allocate memory for a data index");
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_pool_init(&index->nodes, sizeof(mt_data_index_node));
+    index->seed = 2463534242u;
+    tree->data_index = index;
+    __mt_traverse(root, -1, __mt_visit_index_data, NULL, NULL, 0);
+    return tree->data_index != NULL;       // Which is cleared if the heap ran out meanwhile
+}
+
+// Stop indexing the data of the tree of `root`, and free the index
+//
+// Returns:     1 if success, 0 if error
+int mt_disable_data_index(mt_branch* root)
+{
+    if (root == NULL) mt_error("Attempted to stop indexing the data of a tree whose root is a null pointer");
+    else if (root->tree->data_index == NULL) mt_error("Attempted to stop indexing the data of a tree which does not index it");
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_data_index_release(root->tree);
+    return 1;
+}
+
+// Free the data index of `tree`, if it has one
+void __mt_data_index_release(mt_tree* tree)
+{
+    if(tree->data_index == NULL) return;
+    __mt_pool_release(&tree->data_index->nodes);
+    free(tree->data_index);
+    tree->data_index = NULL;
+}
+
+// Visitor for `mt_enable_data_index`, indexing each branch that has data
+int __mt_visit_index_data(mt_branch* branch, int depth, void* context)
+{
+    __mt_data_index_add(branch);
+    return (branch->tree->data_index != NULL) ? MT_VISIT_CONTINUE : MT_VISIT_STOP;
+}
+
+// Compare the key of `node` with the data address `start` of the branch `branch`
+//
+// Returns:     A negative number if the node sorts first, a positive number if it sorts after, or 0 if they are the same
+int __mt_data_index_compare(mt_data_index_node* node, size_t start, mt_branch* branch)
+{
+    if(node->start != start) return (node->start < start) ? -1 : 1;
+    if(node->branch != branch) return ((size_t)node->branch < (size_t)branch) ? -1 : 1;
+    return 0;
+}
+
+// Recalculate `max_end` of `node` from its own data and that of the nodes just below it
+void __mt_data_index_update(mt_data_index_node* node)
+{
+    node->max_end = node->end;
+    if(node->left != NULL && node->left->max_end > node->max_end) node->max_end = node->left->max_end;
+    if(node->right != NULL && node->right->max_end > node->max_end) node->max_end = node->right->max_end;
+}
+
+// Put the new node `added` into the subtree under `node`, rotating it up past any nodes of lower priority
+//
+// Returns:     The node now at the top of the subtree
+mt_data_index_node* __mt_data_index_insert(mt_data_index_node* node, mt_data_index_node* added)
+{
+    if(node == NULL) return added;
+
+    mt_data_index_node* top = node;
+    if(__mt_data_index_compare(node, added->start, added->branch) > 0)
+    {
+        node->left = __mt_data_index_insert(node->left, added);
+        if(node->left->priority > node->priority)
+        {
+            top = node->left;
+            node->left = top->right;
+            top->right = node;
+        }
+    }
+    else
+    {
+        node->right = __mt_data_index_insert(node->right, added);
+        if(node->right->priority > node->priority)
+        {
+            top = node->right;
+            node->right = top->left;
+            top->left = node;
+        }
+    }
+    __mt_data_index_update(node);
+    if(top != node) __mt_data_index_update(top);
+    return top;
+}
+
+// Join two subtrees, where every key in `left` sorts before every key in `right`
+//
+// Returns:     The node at the top of the joined subtree
+mt_data_index_node* __mt_data_index_join(mt_data_index_node* left, mt_data_index_node* right)
+{
+    if(left == NULL) return right;
+    if(right == NULL) return left;
+    if(left->priority > right->priority)
+    {
+        left->right = __mt_data_index_join(left->right, right);
+        __mt_data_index_update(left);
+        return left;
+    }
+    right->left = __mt_data_index_join(left, right->left);
+    __mt_data_index_update(right);
+    return right;
+}
+
+// Take the node for the data at `start` of `branch` out of the subtree under `node`, joining its two subtrees in its place
+//
+// `out_removed`    Set to the node taken out, if there was one
+//
+// Returns:     The node now at the top of the subtree
+mt_data_index_node* __mt_data_index_unlink(mt_data_index_node* node, size_t start, mt_branch* branch, mt_data_index_node** out_removed)
+{
+    if(node == NULL) return NULL;
+
+    int order = __mt_data_index_compare(node, start, branch);
+    if(order == 0)
+    {
+        *out_removed = node;
+        return __mt_data_index_join(node->left, node->right);
+    }
+    if(order > 0) node->left = __mt_data_index_unlink(node->left, start, branch, out_removed);
+    else node->right = __mt_data_index_unlink(node->right, start, branch, out_removed);
+    __mt_data_index_update(node);
+    return node;
+}
+
+// Index `branch` by the address of its data, if it has data and its tree has a data index.
+// If the heap is exhausted the index is dropped, leaving lookups to search the tree instead
+void __mt_data_index_add(mt_branch* branch)
+{
+    mt_data_index* index = branch->tree->data_index;
+    if(index == NULL || branch->data == NULL) return;
+
+    mt_data_index_node* node = __mt_pool_alloc(&index->nodes);
+    if(node == NULL)
+    {
+        __mt_data_index_release(branch->tree);
+        mt_error("Could not allocate memory to index the data of the branch '%s'", branch->label);
+        return;
+    }
+
+    index->seed ^= index->seed << 13;       // xorshift32
+    index->seed ^= index->seed >> 17;
+    index->seed ^= index->seed << 5;
+    node->start = (size_t)branch->data;
+    node->end = node->start + (branch->data_size > 0 ? branch->data_size : 1);
+    node->max_end = node->end;
+    node->branch = branch;
+    node->priority = index->seed;
+    index->top = __mt_data_index_insert(index->top, node);
+    index->count++;
+}
+
+// Take `branch` out of the data index of its tree, if the tree has one, before its data changes or it is freed
+void __mt_data_index_remove(mt_branch* branch)
+{
+    mt_data_index* index = branch->tree->data_index;
+    if(index == NULL || branch->data == NULL) return;
+
+    mt_data_index_node* removed = NULL;
+    index->top = __mt_data_index_unlink(index->top, (size_t)branch->data, branch, &removed);
+    if(removed == NULL) return;
+    __mt_pool_free(&index->nodes, removed);
+    index->count--;
+}
+
+// Find the node with the smallest key after that of the data at `start` of `branch`
+//
+// Returns:     The node, or NULL if there is none
+mt_data_index_node* __mt_data_index_next(mt_data_index* index, size_t start, mt_branch* branch)
+{
+    mt_data_index_node* found = NULL;
+    for(mt_data_index_node* node = index->top; node != NULL; )
+    {
+        if(__mt_data_index_compare(node, start, branch) > 0) { found = node; node = node->left; }
+        else node = node->right;
+    }
+    return found;
+}
+
+// Find the node under `node` whose data `address` lies inside, preferring the data that starts closest before it
+//
+// Returns:     The node, or NULL if there is none
+mt_data_index_node* __mt_data_index_containing(mt_data_index_node* node, size_t address)
+{
+    while(node != NULL && node->max_end > address)
+    {
+        if(address >= node->start)
+        {
+            mt_data_index_node* found = __mt_data_index_containing(node->right, address);
+            if(found != NULL) return found;
+            if(node->end > address) return node;
+        }
+        node = node->left;
+    }
+    return NULL;
+}
+
+// Check the arguments shared by every data lookup, and load any branches the lookup would otherwise miss
+//
+// Returns:     1 if the lookup can go ahead, 0 if not
+int __mt_check_data_query(mt_branch* branch, void* data)
+{
+    if (branch == NULL) mt_error("Attempted to find data from a branch which is a null pointer");
+    if (data == NULL)   mt_error("Attempted to find the branch of data at a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_load_all_children(branch->tree);  // Copies still sharing their children may link to the data too
+    return 1;
+}
+
+// Get a branch whose data starts at `data`, from the same tree as `branch`.
+// Uses the tree's data index if it has one, see `mt_enable_data_index`, and searches the tree if not
+//
+// `branch`     Any branch of the tree to search
+// `data`       The address to look for, e.g. of an object linked to with `mt_set_data_pointer`
+//
+// Returns:     The branch, or NULL if there is none. If several branches link to the data, one of them
+mt_branch* mt_get_by_data(mt_branch* branch, void* data)
+{
+    if (!__mt_check_data_query(branch, data)) return 0;
+
+    mt_tree* tree = branch->tree;
+    if (tree->data_index != NULL)
+    {
+        mt_data_index_node* node = __mt_data_index_next(tree->data_index, (size_t)data, NULL);
+        return (node != NULL && node->start == (size_t)data) ? node->branch : NULL;
+    }
+
+    for(mt_branch* found = tree->root; found != NULL; found = __mt_next_descendant(found, tree->root))
+    {
+        if(found->data == data) return found;
+    }
+    return NULL;
+}
+
+// Get the branch whose data `address` lies inside, from the same tree as `branch`, e.g. to find the branch
+// linked to a struct from a pointer to one of its members. Empty data counts as being one byte long
+//
+// Returns:     The branch, or NULL if there is none. If the data of several branches overlap at `address`,
+//              the one whose data starts closest before it
+mt_branch* mt_get_by_data_address(mt_branch* branch, void* address)
+{
+    if (!__mt_check_data_query(branch, address)) return 0;
+
+    mt_tree* tree = branch->tree;
+    if (tree->data_index != NULL)
+    {
+        mt_data_index_node* node = __mt_data_index_containing(tree->data_index->top, (size_t)address);
+        return (node != NULL) ? node->branch : NULL;
+    }
+
+    mt_branch* closest = NULL;
+    for(mt_branch* found = tree->root; found != NULL; found = __mt_next_descendant(found, tree->root))
+    {
+        size_t start = (size_t)found->data;
+        size_t end = start + (found->data_size > 0 ? found->data_size : 1);
+        if(found->data == NULL || start > (size_t)address || end <= (size_t)address) continue;
+        if(closest == NULL || start > (size_t)closest->data) closest = found;
+    }
+    return closest;
+}
+
+// Unlink `data` from every branch of the tree of `branch` that links to it with `mt_set_data_pointer`, e.g. because
+// it is about to be freed. Each of those branches is left without data. With a data index this takes O(log n) time
+// per branch unlinked, rather than a search of the tree
+//
+// Returns:     The number of branches unlinked
+size_t mt_detach_data(mt_branch* branch, void* data)
+{
+    if (!__mt_check_data_query(branch, data)) return 0;
+
+    mt_tree* tree = branch->tree;
+    size_t detached = 0;
+    if (tree->data_index != NULL)
+    {
+        mt_branch* after = NULL;
+        mt_data_index_node* node;
+        while((node = __mt_data_index_next(tree->data_index, (size_t)data, after)) != NULL && node->start == (size_t)data)
+        {
+            after = node->branch;
+            if(after->data_storage != MT_DATA_EXTERNAL) continue;
+            mt_set_data_pointer(after, NULL, 0);
+            detached++;
+        }
+        return detached;
+    }
+
+    for(mt_branch* found = tree->root; found != NULL; found = __mt_next_descendant(found, tree->root))
+    {
+        if(found->data != data || found->data_storage != MT_DATA_EXTERNAL) continue;
+        mt_set_data_pointer(found, NULL, 0);
+        detached++;
+    }
+    return detached;
+}
+
+
+
+
+#define ________GET_DATA
+
+
+// Get a pointer to the data belonging to `branch`
+// Small copied data is stored inside the branch, so the pointer is only valid until the data is changed
+// or the branch is deleted. The data may be written through the pointer, so copies still sharing the branch,
+// see `mt_copy_branch`, first take their own copies of it
+//
+// Returns:     A pointer to the data or NULL if there is no data or if `branch` doesn't exist
+void* mt_get_data_pointer(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to get the data of a branch which is a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_unshare_path(branch);      // Nothing to do while other threads may be reading, as nothing is shared then
+    return __atomic_load_n(&branch->data, __ATOMIC_ACQUIRE);
+}
+
+// Get a pointer to the data belonging to `branch` that can be written through
+// Data mapped from a snapshot file is read-only, so it is first copied into memory owned by the branch.
+// The file is never changed
+//
+// Returns:     A pointer to the data or NULL if there is no data or if `branch` doesn't exist
+void* mt_get_data_pointer_writable(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to get the data of a branch which is a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+
+    if (branch->data_storage == MT_DATA_MAPPED && !mt_set_data_copy(branch, branch->data, branch->data_size)) return 0;
+    __mt_unshare_path(branch);
+    __mt_mark_changed(branch);     // It is about to be written to
+    return branch->data;
+}
+
+// Copies the data belonging to `branch` into `out_buffer`, up to a maximum of `out_capacity` bytes
+//
+// Returns:     The number of bytes copied; 0 if there is no data or e.g. `branch` doesn't exist
+int mt_get_data_copy(mt_branch* branch, void* out_buffer, size_t out_capacity)
+{
+    if (branch == NULL)     mt_error("Attempted to copy the data of a branch which is a null pointer"); 
+    if (out_buffer == NULL) mt_error("Attempted to copy the data of a branch into a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+
+    size_t bytes;
+    size_t sequence;
+    do  // Repeated if the data was changed while it was being copied, see `mt_enable_concurrent_reads`
+    {
+        sequence = __mt_read_sequence(branch->tree);
+        void* data = __atomic_load_n(&branch->data, __ATOMIC_ACQUIRE);
+        size_t data_size = __atomic_load_n(&branch->data_size, __ATOMIC_RELAXED);
+        bytes = (data_size < out_capacity) ? data_size : out_capacity;
+        if (!__mt_check_read_sequence(branch->tree, sequence)) continue;    // `data` and `bytes` may not belong together
+        if (data == branch->inline_data) __mt_copy_shared_bytes(out_buffer, data, bytes);   // Which is changed in place
+        else if (bytes > 0) memcpy(out_buffer, data, bytes);
+    } while(!__mt_check_read_sequence(branch->tree, sequence));
+    return bytes;
+}
+
+
+// Get the size of the data belonging to `branch`
+// This only includes data fields, and not any tree metadata
+//
+// Returns:     the data size, in bytes, or 0 if there is no data or if the branch doesn't exist
+size_t mt_get_data_size(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to get the data size of a branch which is a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+
+    return __atomic_load_n(&branch->data_size, __ATOMIC_RELAXED);
+}
+
+// Get the total size of the data belonging to the direct children of `branch`
+// This only includes data fields, and not any tree metadata
+//
+// Returns:     the data size, in bytes, or 0 if there is no data or if there are no children
+size_t mt_get_childrens_data_size(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to get the data size of the children of a branch which is a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+
+    if (!(branch->flags & MT_BRANCH_TOTALS_STALE)) return branch->childrens_data_size;
+
+    __mt_ensure_children(branch);       // Only the children are needed, not a count of the whole subtree
+    size_t total = 0;
+    for(mt_branch* child = branch->first_child; child != NULL; child = child->next_sibling) total += child->data_size;
+    return total;
+}
+
+// Get the total size of the data belonging to all the descendants of `branch`
+// This only includes data fields, and not any tree metadata
+//
+// Returns:     the data size, in bytes, or 0 if there is no data or if there are no children
+size_t mt_get_childrens_data_size_recursive(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to get the data size of the descendants of a branch which is a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_totals_update(branch);
+    return branch->descendants_data_size;
+}
+
+
+
+
+#define ________CHANGE_TRACKING
+
+// Every edit marks the branch it changes, and the ancestors of that branch, so that a delta snapshot can find
+// everything that has changed since the last snapshot without looking at the rest of the tree.
+// Marking stops at the first ancestor that is already marked, so it costs O(1) amortised per edit
+
+// Note that `branch` has changed since the tree was last marked clean, and that its ancestors have changes below them
+void __mt_mark_changed(mt_branch* branch)
+{
+    __mt_set_flags(branch, MT_BRANCH_CHANGED);
+    for(mt_branch* ancestor = branch->parent; ancestor != NULL && !(ancestor->flags & MT_BRANCH_CHANGED_BELOW); ancestor = ancestor->parent)
+    {
+        __mt_set_flags(ancestor, MT_BRANCH_CHANGED_BELOW);
+    }
+}
+
+// Check whether `branch`, or anything below it, has changed since the tree was last marked clean with `mt_mark_clean`.
+// Setting a label, data or data type, getting a writable data pointer, and creating, deleting, copying or moving
+// branches all count as changes. Data linked with `mt_set_data_pointer` that is then changed in place does not
+//
+// Returns:     1 if it has changed, 0 if not or if there was an error
+int mt_check_changed(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to check whether a branch which is a null pointer has changed");
+    if (__mt_check_error_flag()) return 0;
+
+    return (branch->flags & (MT_BRANCH_CHANGED | MT_BRANCH_CHANGED_BELOW)) != 0;
+}
+
+// Mark `branch` and everything below it as unchanged, usually once the tree has been saved, so that the next delta
+// only holds what changes after that. This only visits the branches that were marked as changed, and their siblings.
+// A tree that has just been loaded as a new tree is already clean
+void mt_mark_clean(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to mark a branch which is a null pointer as clean");
+    if (__mt_check_error_flag()) return;
+
+    int changed = MT_BRANCH_CHANGED | MT_BRANCH_CHANGED_BELOW;
+    for(mt_branch* current = branch; current != NULL; )
+    {
+        mt_branch* next = NULL;
+        if (current->flags & changed)
+        {
+            __mt_clear_flags(current, changed);
+            for(next = current->first_child; next != NULL && !(next->flags & changed); next = next->next_sibling);
+        }
+
+        // Once a subtree has been cleaned, move on to the next changed sibling of it or of one of its ancestors
+        while(next == NULL && current != branch)
+        {
+            for(next = current->next_sibling; next != NULL && !(next->flags & changed); next = next->next_sibling);
+            if (next == NULL) current = current->parent;
+        }
+        current = next;
+    }
+}
+
+
+
+#define ________EDIT
+
+// Sets the label for the specified Megatree branch.
+// 
+// `branch`     The branch to set the label of
+// `new_label`  The label to set it to
+//
 // Returns:     A pointer to the new label string 
 char* mt_set_label(mt_branch* branch, char* new_label)
 {
     if (new_label == NULL)  mt_error("Attempted to set a label to a string which is a null pointer"); 
-    if (new_label[0] == 0)  mt_error("Attempted to set a label to a string which is empty"); 
-    if (branch == NULL)     mt_error("Attempted to set the label '%s' to a branch which is a null pointer"); 
-    if (!mt_check_label_valid) mt_error("Attempted to set the label '%s', which contains disallowed characters"); 
+    else if (new_label[0] == 0)  mt_error("Attempted to set a label to a string which is empty"); 
+    else if (!mt_check_label_valid(new_label)) mt_error("Attempted to set the label '%s', which contains disallowed characters", new_label); 
+    if (branch == NULL)     mt_error("Attempted to set the label '%s' to a branch which is a null pointer", new_label); 
     if (__mt_check_error_flag()) return 0;
 
-    if (branch->label != NULL) free(branch->label); // Check whether there is already a label, and free it if needed
+    __mt_unshare_path(branch);
+
+    // Share the tree's copy of the label. Concurrent readers looking for either label repeat their lookup
+    char* interned = __mt_tree_intern_string(branch->tree, new_label);
+    if (interned == NULL) mt_error("Could not allocate memory for the label '%s'", new_label);
+    if (__mt_check_error_flag()) return 0;
 
-    branch->label = strdup(new_label);              // Create the new label
+    __mt_begin_write(branch->tree);
+    mt_child_index* sibling_index = (branch->parent != NULL) ? branch->parent->child_index : NULL;
+    if (sibling_index != NULL) __mt_child_index_remove(sibling_index, branch);
+    __mt_label_index_remove(branch);
+
+    char* old_label = branch->label;
+    __atomic_store_n(&branch->label, interned, __ATOMIC_RELEASE);
+    if (sibling_index != NULL) __mt_child_index_insert(sibling_index, branch, 0);
+    __mt_label_index_add(branch);
+    __mt_end_write(branch->tree);
+    __mt_path_cache_invalidate(branch->tree);                     // Paths through this branch now lead somewhere else
+
+    // Free any previous label afterwards, in case `new_label` points at it
+    if (old_label != NULL) __mt_tree_release_string(branch->tree, old_label);
+    __mt_mark_changed(branch);
+    __mt_journal_record(branch->tree, MT_JOURNAL_LABEL, branch->id, 0, branch->label, strlen(branch->label));
     return branch->label;
 }
 
@@ -453,113 +3901,672 @@ char* mt_set_label(mt_branch* branch, char* new_label)
 // Returns:     A pointer to the new data type string
 char* mt_set_data_type(mt_branch* branch, char* data_type)
 {
-    if (branch == NULL)     mt_error("Attempted to set the data type '%s' to a branch which is a null pointer"); 
-    if (!mt_check_label_valid) mt_error("Attempted to set the data type '%s', which contains disallowed characters"); 
+    if (branch == NULL)     mt_error("Attempted to set the data type '%s' to a branch which is a null pointer", data_type); 
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_unshare_path(branch);
+    char* old_data_type = branch->data_type;
+    char* interned = (data_type != NULL) ? __mt_tree_intern_string(branch->tree, data_type) : NULL;
+    __atomic_store_n(&branch->data_type, interned, __ATOMIC_RELEASE);
+
+    // Check whether there was already a data type, and release it if needed
+    if (old_data_type != NULL) __mt_tree_release_string(branch->tree, old_data_type);
+    __mt_mark_changed(branch);
+    __mt_journal_record(branch->tree, MT_JOURNAL_DATA_TYPE, branch->id, branch->data_type != NULL, 
+        branch->data_type, branch->data_type ? strlen(branch->data_type) : 0);
+    return branch->data_type;
+}
+
+// Create a new root megatree branch node.
+//
+// Returns:     A pointer to the new branch
+mt_branch* mt_create_root()
+{
+    mt_tree* tree = calloc(1, sizeof *tree);    // Every root owns the pools its tree is allocated from
+    if (tree == NULL) mt_error("Could not allocate memory for a new tree");
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_pool_init(&tree->branch_pool, sizeof(mt_branch));
+    for(int i=0; i<MT_LABEL_SIZE_CLASSES; i++) __mt_pool_init(&tree->label_pools[i], (size_t)16 << i);
+    tree->path_cache.capacity = MT_PATH_CACHE_DEFAULT_ENTRIES;
+
+    mt_branch* new_root = __mt_pool_alloc(&tree->branch_pool);
+    if (new_root == NULL) { free(tree); return 0; }
+
+    new_root->tree = tree;
+    new_root->parent = NULL;
+    new_root->first_child = NULL;
+    new_root->last_child = NULL;
+    mt_set_label(new_root, "root");
+    new_root->id = 0;
+    __mt_id_index_insert(tree, new_root);
+
+    new_root->data_size = 0;
+    new_root->data = NULL;
+
+    tree->root = new_root;
+
+    return new_root;
+}
+
+
+
+// Create a new branch as the last child of `parent`
+//
+// `parent`     The branch to add the new branch to
+// `label`      The label of the new branch. Does not have to be unique among its siblings
+//
+// Returns:     A pointer to the new branch, or NULL if there was an error
+mt_branch* mt_create_branch(mt_branch* parent, char* label)
+{
+    if (parent == NULL)     mt_error("Attempted to create a branch with a parent which is a null pointer"); 
+    if (label == NULL)      mt_error("Attempted to create a branch with a label which is a null pointer"); 
+    else if (label[0] == 0) mt_error("Attempted to create a branch with a label which is empty"); 
+    else if (!mt_check_label_valid(label)) mt_error("Attempted to create a branch with the label '%s', which contains disallowed characters", label); 
+    if (__mt_check_error_flag()) return 0;
+
+    return __mt_create_branch_as(parent, label, 0);
+}
+
+// Create a new branch as `mt_create_branch` does, once its arguments have been checked. It is given the id `id`
+// if that is not 0 and no other branch has it, so that a replayed journal gives branches the ids they had
+//
+// Returns:     A pointer to the new branch, or NULL if there was an error
+mt_branch* __mt_create_branch_as(mt_branch* parent, char* label, size_t id)
+{
+    mt_tree* tree = parent->tree;
+    __mt_unshare_path(parent);
+
+    mt_branch* new_branch = __mt_new_branch(parent, label, id);
+    if (new_branch == NULL) return 0;
+
+    __mt_mark_changed(new_branch);
+    __mt_mark_changed(parent);
+    __mt_journal_record(tree, MT_JOURNAL_CREATE, new_branch->id, parent->id, label, strlen(label));
+
+    return new_branch;
+}
+
+// Allocate a branch labelled `label` and add it to the end of the list of children of `parent`, without counting
+// it as a change. It is given the id `id` if that is not 0 and no other branch has it
+//
+// Returns:     The new branch, or NULL if the heap is exhausted
+mt_branch* __mt_new_branch(mt_branch* parent, char* label, size_t id)
+{
+    mt_tree* tree = parent->tree;
+
+    mt_branch* new_branch = __mt_pool_alloc(&tree->branch_pool);
+    if (new_branch == NULL) return 0;
+
+    new_branch->tree = tree;
+    new_branch->label = __mt_tree_intern_string(tree, label);
+    if (new_branch->label == NULL)
+    {
+        __mt_pool_free(&tree->branch_pool, new_branch);
+        mt_error("Could not allocate memory for the label '%s'", label);
+        __mt_check_error_flag();
+        return 0;
+    }
+    if (!__mt_tree_register_branch_as(tree, new_branch, id))
+    {
+        __mt_tree_release_string(tree, new_branch->label);
+        __mt_pool_free(&tree->branch_pool, new_branch);
+        return 0;
+    }
+
+    __mt_label_index_add(new_branch);
+    __mt_link_child(parent, new_branch);
+    return new_branch;
+}
+
+// Add `child` to the end of the list of children of `parent`
+void __mt_link_child(mt_branch* parent, mt_branch* child)
+{
+    __mt_ensure_children(parent);   // So that the loaded children come first
+    child->parent = parent;
+    child->prev_sibling = parent->last_child;
+    child->next_sibling = NULL;
+
+    // Concurrent readers only find the child once everything it holds has been written
+    if (parent->last_child != NULL) __atomic_store_n(&parent->last_child->next_sibling, child, __ATOMIC_RELEASE);
+    else __atomic_store_n(&parent->first_child, child, __ATOMIC_RELEASE);
+    __atomic_store_n(&parent->last_child, child, __ATOMIC_RELAXED);
+
+    parent->num_children++;
+    __mt_totals_link(parent, child, 1);
+    if (parent->child_index != NULL) __mt_child_index_insert(parent->child_index, child, 1);
+    else if (parent->num_children >= MT_CHILD_INDEX_THRESHOLD) __mt_child_index_build(parent);
+}
+
+// Remove `child` from the list of children of its parent, leaving its own sub-branches attached to it
+void __mt_unlink_child(mt_branch* child)
+{
+    mt_branch* parent = child->parent;
+
+    if (parent->child_index != NULL) __mt_child_index_remove(parent->child_index, child);
+    parent->num_children--;
+    __mt_totals_link(parent, child, -1);
+    if (parent->num_children < MT_CHILD_INDEX_THRESHOLD / 2) __mt_child_index_release(parent);
+
+    // Concurrent readers may be following the links meanwhile, so each is stored whole
+    if (child->prev_sibling != NULL) __atomic_store_n(&child->prev_sibling->next_sibling, child->next_sibling, __ATOMIC_RELEASE);
+    else __atomic_store_n(&parent->first_child, child->next_sibling, __ATOMIC_RELEASE);
+    if (child->next_sibling != NULL) __atomic_store_n(&child->next_sibling->prev_sibling, child->prev_sibling, __ATOMIC_RELAXED);
+    else __atomic_store_n(&parent->last_child, child->prev_sibling, __ATOMIC_RELAXED);
+
+    // A concurrent reader may be standing on the child, so it keeps the links that lead such a reader back into the tree
+    __atomic_store_n(&child->prev_sibling, NULL, __ATOMIC_RELAXED);
+    if (parent->tree->reclaimer == NULL)
+    {
+        child->parent = NULL;
+        child->next_sibling = NULL;
+    }
+
+    __mt_path_cache_invalidate(parent->tree);    // Any cached path through `child` is no longer valid
+}
+
+// Create a tree structure matching the specified path string
+// leaving any existing branches and data unchanged
+// Segments that refer to ids, e.g. {12}, must already exist, as a new branch's id cannot be chosen
+//
+// `root`       The branch that `path` is relative to
+// `path`       The path to create. It is not modified, so it can be a string literal
+//
+//  Returns:    The deepest branch node created (i.e. the final element in the path string), or NULL if there was an error
+mt_branch* mt_create_path(mt_branch* root, char* path)
+{
+    if (root == NULL) mt_error("Attempted to create a path from a branch which is a null pointer"); 
+    if (path == NULL) mt_error("Attempted to create a path which is a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+
+    // Follow the part of the path that already exists
+    mt_branch* current_branch = root;
+    size_t position = 0;
+    size_t segment_length;
+    char* segment;
+    while((segment = __mt_path_next_segment(path, &position, &segment_length)) != NULL)
+    {
+        mt_branch* next_branch = __mt_resolve_segment(current_branch, segment, segment_length);
+        if(next_branch == NULL) break;
+        current_branch = next_branch;
+    }
+    if(segment == NULL) return current_branch;   // The whole path already exists
+
+    // Make sure to disallow labels with illegal characters before creating anything
+    size_t first_missing = position - segment_length;
+    if(!__mt_check_path_creatable(path, first_missing)) return 0;
+
+    // Create the rest
+    position = first_missing;
+    while(current_branch != NULL && (segment = __mt_path_next_segment(path, &position, &segment_length)) != NULL)
+    {
+        current_branch = __mt_create_segment(current_branch, segment, segment_length);
+    }
+
+    return current_branch;
+}
+
+// Check that the segments of `path` from the offset `first_missing` on can all be created as new branches:
+// none of them may refer to an id, nor contain braces
+//
+// Returns:     1 if they can, 0 if not, with the error raised
+int __mt_check_path_creatable(char* path, size_t first_missing)
+{
+    size_t segment_length;
+    size_t id;
+    char* segment;
+    for(size_t check = first_missing; (segment = __mt_path_next_segment(path, &check, &segment_length)) != NULL; )
+    {
+        if(__mt_parse_id_segment(segment, segment_length, &id)) mt_error("Attempted to create the path '%s', but the branch with id %ld does not exist there", path, id); 
+        else if(memchr(segment, '{', segment_length) || memchr(segment, '}', segment_length)) mt_error("Attempted to create the path '%s', which contains disallowed characters", path); 
+        if (__mt_check_error_flag()) return 0;
+    }
+    return 1;
+}
+
+// Create a child of `parent` labelled with the `segment_length` characters of the path segment `segment`
+//
+// Returns:     The new branch, or NULL if there was an error
+mt_branch* __mt_create_segment(mt_branch* parent, char* segment, size_t segment_length)
+{
+    char label_buffer[256];
+    char* label = label_buffer;
+    if(segment_length >= sizeof label_buffer) label = malloc(segment_length + 1);
+    if (label == NULL) return 0;
+
+    memcpy(label, segment, segment_length);
+    label[segment_length] = 0;
+    mt_branch* created = mt_create_branch(parent, label);
+
+    if(label != label_buffer) free(label);
+    return created;
+}
+
+
+
+// Copy data into the data field of `branch` from the buffer `data`
+// 
+// `branch`         The branch to copy data into
+// `data`           A pointer to the buffer of data to be copied
+// `data_length`    The number of bytes to copy from `data`
+// 
+// Returns:     The number of bytes copied, or 0 if an error occurred
+int mt_set_data_copy(mt_branch* branch, void* data, size_t data_length)
+{
+    if (branch == NULL) mt_error("Attempted to copy data into a branch which is a null pointer"); 
+    if (data == NULL && data_length > 0) mt_error("Attempted to copy %ld bytes of data from a null pointer", data_length); 
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_unshare_path(branch);
+
+    // Make the copy before disposing of any existing data, in case `data` points into it
+    void* old_heap_data = (branch->data_storage == MT_DATA_HEAP) ? branch->data : NULL;
+    void* copy = NULL;
+    unsigned char staged[MT_INLINE_DATA_SIZE];
+    if (data_length > MT_INLINE_DATA_SIZE)
+    {
+        copy = malloc(data_length);
+        if (copy == NULL) mt_error("Could not allocate %ld bytes for a branch's data", data_length);
+        if (__mt_check_error_flag()) return 0;
+        memcpy(copy, data, data_length);
+    }
+    else if (data_length > 0) memcpy(staged, data, data_length);
+
+    __mt_begin_write(branch->tree);     // So that concurrent readers never copy data that is half written
+    if (copy == NULL && data_length > 0)
+    {
+        __mt_copy_shared_bytes(branch->inline_data, staged, data_length);  // Small enough to keep in the branch itself
+    }
+    __mt_set_data_storage(branch, copy, data_length, 
+        (copy != NULL) ? MT_DATA_HEAP : (data_length > 0) ? MT_DATA_INLINE : MT_DATA_NONE);
+    __mt_end_write(branch->tree);
+    __mt_retire(branch->tree, MT_RETIRE_MEMORY, old_heap_data);
+    __mt_mark_changed(branch);
+    __mt_journal_record(branch->tree, MT_JOURNAL_DATA, branch->id, 0, branch->data, data_length);
+    return data_length;
+}
+
+// Point `branch` at new data, keeping the tree's count of heap buffers in step. 
+// Any previous heap data must be freed by the caller
+void __mt_set_data_storage(mt_branch* branch, void* data, size_t data_size, int data_storage)
+{
+    if (branch->data_storage == MT_DATA_HEAP) branch->tree->heap_data_buffers--;
+    if (data_storage == MT_DATA_HEAP) branch->tree->heap_data_buffers++;
+    __mt_data_index_remove(branch);
+
+    if (branch->parent != NULL && data_size != branch->data_size)
+    {
+        mt_branch* parent = branch->parent;
+        int sign = (data_size > branch->data_size) ? 1 : -1;
+        size_t difference = (sign > 0) ? data_size - branch->data_size : branch->data_size - data_size;
+        parent->childrens_data_size += (sign > 0) ? difference : -difference;
+        __mt_totals_add(parent, 0, difference, sign);
+    }
+
+    __atomic_store_n(&branch->data, (data_storage == MT_DATA_INLINE) ? branch->inline_data : data, __ATOMIC_RELEASE);
+    __atomic_store_n(&branch->data_size, data_size, __ATOMIC_RELAXED);
+    __atomic_store_n(&branch->data_storage, data_storage, __ATOMIC_RELAXED);
+    __mt_data_index_add(branch);
+}
+
+
+// Link the data field for `branch` by setting it to a pointer 
+// to an already-existing buffer somewhere in memory
+// 
+// `branch`         The branch to link data to
+// `data`           A pointer to the buffer of data to be linked
+// `data_length`    The data length of the buffer. The buffer is still owned by the caller, and must outlive the branch
+// 
+// Returns:     1 if success, 0 if error
+int mt_set_data_pointer(mt_branch* branch, void* data, size_t data_length)
+{
+    if (branch == NULL) mt_error("Attempted to link data to a branch which is a null pointer"); 
+    if (data == NULL && data_length > 0) mt_error("Attempted to link %ld bytes of data at a null pointer", data_length); 
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_unshare_path(branch);
+
+    // Dispose of any existing data by freeing it, if the branch owns it
+    void* old_heap_data = (branch->data_storage == MT_DATA_HEAP && branch->data != data) ? branch->data : NULL;
+    __mt_begin_write(branch->tree);
+    __mt_set_data_storage(branch, data, data_length, (data != NULL) ? MT_DATA_EXTERNAL : MT_DATA_NONE);
+    __mt_end_write(branch->tree);
+    __mt_retire(branch->tree, MT_RETIRE_MEMORY, old_heap_data);
+    __mt_mark_changed(branch);
+    __mt_journal_record(branch->tree, MT_JOURNAL_DATA, branch->id, 0, data, data_length);   // The data as it is now
+    return 1;
+}
+
+// Hand a heap buffer over to `branch` without copying it. The branch then owns the buffer: it is freed when
+// the data is replaced or the branch is deleted, and the caller must not free it
+// 
+// `branch`         The branch to give data to
+// `data`           A buffer allocated with `malloc`, `calloc` or `realloc`
+// `data_length`    The data length of the buffer
+// 
+// Returns:     1 if success, 0 if error. On error the caller still owns `data`
+int mt_set_data_owned(mt_branch* branch, void* data, size_t data_length)
+{
+    if (branch == NULL) mt_error("Attempted to give data to a branch which is a null pointer"); 
+    if (data == NULL && data_length > 0) mt_error("Attempted to give %ld bytes of data at a null pointer", data_length); 
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_unshare_path(branch);
+
+    // Dispose of any existing data by freeing it, unless the branch is being given the buffer it already owns
+    void* old_heap_data = (branch->data_storage == MT_DATA_HEAP && branch->data != data) ? branch->data : NULL;
+    __mt_begin_write(branch->tree);
+    __mt_set_data_storage(branch, data, data_length, (data != NULL) ? MT_DATA_HEAP : MT_DATA_NONE);
+    __mt_end_write(branch->tree);
+    __mt_retire(branch->tree, MT_RETIRE_MEMORY, old_heap_data);
+    __mt_mark_changed(branch);
+    __mt_journal_record(branch->tree, MT_JOURNAL_DATA, branch->id, 0, data, data_length);
+    return 1;
+}
+
+// Check whether the data of `branch` is owned by the tree, and so will be freed along with the branch
+//
+// Returns:     1 if the data was copied or handed over with `mt_set_data_owned`, 
+//              0 if it was linked with `mt_set_data_pointer` or there is no data
+int mt_check_data_owned(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to check the data ownership of a branch which is a null pointer"); 
+    if (__mt_check_error_flag()) return 0;
+
+    return branch->data_storage == MT_DATA_HEAP || branch->data_storage == MT_DATA_INLINE;
+}
+
+#define ________DELETE
+
+
+
+// Give `branch`, all of its sub-branches, and their labels back to the tree's pools.
+// Children that have not been loaded or copied yet are never created
+void __mt_free_branch_recursive(mt_branch* branch)
+{
+    __mt_traverse(branch, -1, NULL, __mt_visit_free, NULL, 0);
+}
+
+// Visitor for `__mt_free_branch_recursive`, freeing each branch once its children have been freed
+int __mt_visit_free(mt_branch* branch, int depth, void* context)
+{
+    mt_tree* tree = branch->tree;
+    __mt_child_index_release(branch);
+    if(branch->flags & MT_BRANCH_UNLOADED) __mt_unloaded_index_remove(&tree->unloaded, branch);
+    if(branch->flags & MT_BRANCH_SHARING) __mt_sharing_remove(tree, branch);
+    if(branch->flags & MT_BRANCH_SHARED) __mt_unloaded_index_remove(&tree->sharers, branch);    // Its copies left are being deleted too
+    __mt_tree_unregister_branch(tree, branch);
+    __mt_label_index_remove(branch);
+    __mt_data_index_remove(branch);
+    __mt_tree_release_string(tree, branch->label);
+    __mt_tree_release_string(tree, branch->data_type);
+    if(branch->data_storage == MT_DATA_HEAP)
+    {
+        __mt_retire(tree, MT_RETIRE_MEMORY, branch->data);
+        tree->heap_data_buffers--;
+    }
+    __mt_retire(tree, MT_RETIRE_BRANCH, branch);
+    return MT_VISIT_CONTINUE;
+}
+
+// Delete the entire branch and its sub-branches
+//
+// `branch`     The branch to delete (along with sub-branches)
+// 
+// Returns:     The parent of the deleted branch, or NULL if failure
+mt_branch* mt_delete_branch(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to delete a branch which is a null pointer"); 
+    else if (mt_check_is_root(branch)) mt_error("Attempted to delete the root branch. Use mt_destroy_tree instead"); 
     if (__mt_check_error_flag()) return 0;
 
-    if (branch->data_type != NULL) free(branch->data_type); // Check whether there is already a data type, and free it if needed
+    mt_branch* parent = branch->parent;
+    __mt_journal_record(branch->tree, MT_JOURNAL_DELETE, branch->id, 0, NULL, 0);
+    if (branch->tree->shared.count > 0)     // Copies of anything being deleted must make their own copies first
+    {
+        __mt_unshare_path(parent);
+        __mt_unshare_branch(branch->tree, branch, 1);
+    }
 
-    branch->data_type = strdup(data_type);
-    return branch->data_type;
+    __mt_unlink_child(branch);
+    __mt_free_branch_recursive(branch);
+    __mt_mark_changed(parent);
+    return parent;
 }
 
-// Create a new root megatree branch node.
+// Delete an entire tree, releasing all of its memory at once
+// This frees the tree's slabs rather than visiting each branch, so it takes time proportional 
+// to the amount of memory the tree uses rather than the number of branches in it
 //
-// Returns:     A pointer to the new branch
-mt_branch* mt_create_root()
+// `root`       The root branch of the tree to delete. All branches of the tree become invalid
+//
+// Returns:     1 if success, 0 if failure
+int mt_destroy_tree(mt_branch* root)
 {
-    mt_branch* new_root = calloc( sizeof *new_root, 0 );
+    if (root == NULL) mt_error("Attempted to destroy a tree whose root is a null pointer"); 
+    else if (!mt_check_is_root(root)) mt_error("Attempted to destroy a tree starting from a branch which is not the root"); 
+    if (__mt_check_error_flag()) return 0;
 
-    DEBUG(sizeof *new_root);
+    mt_tree* tree = root->tree;
+    if (tree->journal != NULL) __mt_close_journal(tree);   // Everything recorded so far is synced first
+    if (tree->reclaimer != NULL)    // Retired branches and strings go with the pools, but the rest was allocated separately
+    {
+        for(size_t i=0; i<tree->reclaimer->num_retired; i++)
+        {
+            if (tree->reclaimer->retired[i].kind == MT_RETIRE_MEMORY) free(tree->reclaimer->retired[i].pointer);
+        }
+        free(tree->reclaimer->retired);
+        free(tree->reclaimer);
+    }
 
-    new_root->parent = NULL;
-    new_root->first_child = NULL;
-    mt_set_label(&new_root, "root");
-    new_root->id = 0;
+    // Copied data too large to keep inside the branches has to be freed branch by branch. Every branch
+    // is in the id index, which is faster to sweep than the tree itself
+    for(size_t i=0; i<tree->id_index.capacity && tree->heap_data_buffers > 0; i++)
+    {
+        mt_branch* branch = tree->id_index.slots[i].branch;
+        if(branch != NULL && branch->data_storage == MT_DATA_HEAP)
+        {
+            free(branch->data);
+            tree->heap_data_buffers--;
+        }
+    }
 
-    new_root->data_size = 0;
-    new_root->data = NULL;
+    __mt_path_cache_release(tree);
+    __mt_label_index_release(tree);
+    __mt_data_index_release(tree);
+    free(tree->id_index.slots);
+    free(tree->strings.slots);      // The strings themselves live in the pools
+    while(tree->child_indexes != NULL)
+    {
+        mt_child_index* next = tree->child_indexes->next;
+        free(tree->child_indexes->slots);
+        free(tree->child_indexes);
+        tree->child_indexes = next;
+    }
 
-    return &new_root;
+    __mt_pool_release(&tree->branch_pool);
+    for(int i=0; i<MT_LABEL_SIZE_CLASSES; i++) __mt_pool_release(&tree->label_pools[i]);
+
+    while(tree->large_strings != NULL)
+    {
+        mt_large_string* next = tree->large_strings->next;
+        free(tree->large_strings);
+        tree->large_strings = next;
+    }
+
+    free(tree->shared.slots);
+    free(tree->sharers.slots);
+    __mt_release_lazy_snapshots(tree);
+    __mt_release_mappings(tree);    // Last, as interned strings may point into them
+    free(tree);
+    return 1;
 }
 
 
+#define ________COPY
 
-// Create a new branch on the tree at 
-//
-//
-//
-//
+
+// Check whether `branch` is `ancestor` or one of its descendants
 //
-mt_branch* mt_create_branch(mt_branch* parent, char* label)
+// Returns:     1 if it is, 0 if not
+int __mt_is_within(mt_branch* branch, mt_branch* ancestor)
 {
-    
-
+    for(; branch != NULL; branch = branch->parent)
+    {
+        if(branch == ancestor) return 1;
+    }
+    return 0;
 }
 
-// Create a tree structure matching the specified path string
-// leaving any existing branches and data unchanged
+// Check the arguments shared by every copy and move function
 //
-// `root`       The 
-// `path`       The path to create
-//
-//  Returns:    The deepest branch node created (i.e. the final element in the path string)
-mt_branch* mt_create_path(mt_branch* root, char* path)
+// Returns:     1 if `to_copy` can be copied or moved to `new_parent`, 0 if not
+int __mt_check_copy_arguments(mt_branch* to_copy, mt_branch* new_parent)
 {
-    // Make sure to disallow labels with illegal characters
+    if (to_copy == NULL)    mt_error("Attempted to copy or move a branch which is a null pointer"); 
+    if (new_parent == NULL) mt_error("Attempted to copy or move a branch to a parent which is a null pointer"); 
+    else if (to_copy != NULL && __mt_is_within(new_parent, to_copy)) mt_error("Attempted to copy or move the branch '%s' into itself", to_copy->label); 
+    if (__mt_check_error_flag()) return 0;
+    return 1;
 }
 
+// Copy the data type and data of `source` to `destination`, replacing whatever `destination` had
+// Data owned by `source` is copied, so each branch owns its own buffer. Data that `source` only links to 
+// is linked to by `destination` as well, since the caller is responsible for it either way
+void __mt_copy_data(mt_branch* source, mt_branch* destination)
+{
+    mt_set_data_type(destination, source->data_type);
+    if(source->data_storage == MT_DATA_EXTERNAL) mt_set_data_pointer(destination, source->data, source->data_size);
+    else if(source->data_size > 0) mt_set_data_copy(destination, source->data, source->data_size);
+}
 
-
-// Copy data into the data field of `branch` from the buffer `data`
-// 
-// `branch`         The branch to copy data into
-// `data`           A pointer to the buffer of data to be copied
-// `data_length`    The number of bytes to copy from `data`
-// 
-// Returns:     The number of bytes copied, or 0 if an error occurred
-int mt_set_data_copy(mt_branch* branch, void* data, size_t data_length)
+#if INTERFACE
+typedef struct mt_copy_cursor       // Where a copy, merge or move walking the branches being copied has got to
 {
-    // Dispose of any existing data by freeing it
+    mt_branch* counterpart;         // The branch that the branch visited last was copied or merged into
+    int depth;                      // The depth of the branch visited last, or -1 before the first
+    mt_branch* exclude;             // A child of the destination not to merge into, or NULL
+    mt_branch* result;              // The copy of the first branch visited
+    int failed;                     // Set if the traversal was stopped by an error
+} mt_copy_cursor;
+#endif
 
+// Start `cursor` off for copying a subtree into `new_parent`, not merging into `exclude`
+void __mt_copy_cursor_init(mt_copy_cursor* cursor, mt_branch* new_parent, mt_branch* exclude)
+{
+    memset(cursor, 0, sizeof *cursor);
+    cursor->counterpart = new_parent;
+    cursor->depth = -1;
+    cursor->exclude = exclude;
 }
 
-
-// Link the data field for `branch` by setting it to a pointer 
-// to an already-existing buffer somewhere in memory
-// 
-// `branch`         The branch to link data to
-// `data`           A pointer to the buffer of data to be linked
-// `data_length`    The data length of the 
-// 
-// Returns:     1 if success, 0 if error
-int mt_set_data_pointer(mt_branch* branch, void* data, size_t data_length)
+// Find where the branch being visited at `depth` goes. A traversal always arrives at a branch straight from its parent,
+// an earlier sibling, or a descendant of one of those, so the counterpart of its parent is an ancestor of the last counterpart
+//
+// Returns:     The counterpart of the parent of the branch being visited
+mt_branch* __mt_copy_cursor_parent(mt_copy_cursor* cursor, int depth)
 {
-    // Dispose of any existing data by freeing it
+    mt_branch* parent = cursor->counterpart;
+    for(int level = cursor->depth; level >= depth; level--) parent = parent->parent;
+    return parent;
+}
 
+// Record that the branch being visited at `depth` was copied or merged into `counterpart`
+void __mt_copy_cursor_visited(mt_copy_cursor* cursor, mt_branch* counterpart, int depth)
+{
+    cursor->counterpart = counterpart;
+    cursor->depth = depth;
+    if(depth == 0) cursor->result = counterpart;
+}
 
+// Find the child of `parent` that `source` is merged into: the first with the same label, other than `exclude`
+//
+// Returns:     The child, or NULL if there is none
+mt_branch* __mt_find_merge_target(mt_branch* parent, mt_branch* source, mt_branch* exclude)
+{
+    mt_branch* existing = __mt_find_child_by_label(parent, source->label, strlen(source->label));
+    if(existing == exclude && existing != NULL) existing = __mt_next_sibling_with_same_label(existing);
+    return existing;
 }
 
-#define ________DELETE
+// Create a copy of `to_copy` and all of its sub-branches as the last child of `new_parent`.
+// Within one tree the copy shares the sub-branches of `to_copy` until they are reached, see `mt_copy_branch`
+//
+// Returns:     The new copy, or NULL if there was an error
+mt_branch* __mt_copy_branch_recursive(mt_branch* to_copy, mt_branch* new_parent)
+{
+    mt_copy_cursor cursor;
+    __mt_copy_cursor_init(&cursor, new_parent, NULL);
+    __mt_traverse(to_copy, -1, __mt_visit_copy, NULL, &cursor, 1);
+    return cursor.failed ? NULL : cursor.result;
+}
 
+// Visitor for `__mt_copy_branch_recursive`, copying each branch into the copy of its parent
+int __mt_visit_copy(mt_branch* branch, int depth, void* context)
+{
+    mt_copy_cursor* cursor = context;
+    mt_branch* copy = mt_create_branch(__mt_copy_cursor_parent(cursor, depth), branch->label);
+    if(copy == NULL) { cursor->failed = 1; return MT_VISIT_STOP; }
+    __mt_copy_cursor_visited(cursor, copy, depth);
+
+    __mt_copy_data(branch, copy);
+    if(!__mt_check_can_share(branch, copy)) return MT_VISIT_CONTINUE;
+    if(!__mt_share_children(branch, copy)) { cursor->failed = 1; return MT_VISIT_STOP; }
+    return MT_VISIT_SKIP;
+}
 
+// Delete every child of `parent` with the label `label`, except for `keep`
+void __mt_delete_children_labelled(mt_branch* parent, char* label, mt_branch* keep)
+{
+    mt_branch* child = __mt_find_child_by_label(parent, label, strlen(label));
+    while(child != NULL)
+    {
+        mt_branch* next = __mt_next_sibling_with_same_label(child);
+        if(child != keep) mt_delete_branch(child);
+        child = next;
+    }
+}
 
-// Delete the entire branch and its sub-branches
+// Merge `source` into the first child of `new_parent` that has the same label (ignoring `exclude`),
+// replacing its data and then merging each of `source`'s children into it in the same way.
+// If there is no such child, `source` is copied.
 //
-// `branch`     The branch to delete (along with sub-branches)
-// 
-// Returns:     The parent of the deleted branch, or NULL if failure
-mt_branch* mt_delete_branch(mt_branch* branch)
+// Returns:     1 if success, 0 if failure
+int __mt_merge_branch_recursive(mt_branch* source, mt_branch* new_parent, mt_branch* exclude)
 {
-
+    mt_copy_cursor cursor;
+    __mt_copy_cursor_init(&cursor, new_parent, exclude);
+    __mt_traverse(source, -1, __mt_visit_merge, NULL, &cursor, 1);
+    return !cursor.failed;
 }
 
+// Visitor for `__mt_merge_branch_recursive`, merging each branch into the branch its parent was merged into
+int __mt_visit_merge(mt_branch* branch, int depth, void* context)
+{
+    mt_copy_cursor* cursor = context;
+    mt_branch* parent = __mt_copy_cursor_parent(cursor, depth);
+    mt_branch* existing = __mt_find_merge_target(parent, branch, (depth == 0) ? cursor->exclude : NULL);
 
-#define ________COPY
+    if(existing == NULL)
+    {
+        if(__mt_copy_branch_recursive(branch, parent) != NULL) return MT_VISIT_SKIP;
+        cursor->failed = 1;
+        return MT_VISIT_STOP;
+    }
+    if(existing == branch) return MT_VISIT_SKIP;    // Merging a branch into itself changes nothing
 
+    __mt_copy_data(branch, existing);
+    __mt_copy_cursor_visited(cursor, existing, depth);
+    return MT_VISIT_CONTINUE;
+}
 
 // Copy an entire branch and any sub-branches to a different location
 // leaving any branches with the same names as their siblings as duplicates
+// Within one tree this takes O(1) time: the copy shares the sub-branches of `to_copy`, which are only copied, 
+// one list of children at a time, when they are first reached or when the branches they were copied from change.
+// Any lookup or walk that reaches them creates them, as each branch has one parent and its own id. Until then
+// they have no ids and the copy's `first_child` field reads NULL, so copies must be walked with
+// `mt_get_first_child` and `mt_get_next_sibling`. `mt_get_num_branches` counts them all the same
 // 
 // `to_copy`    The branch to be copied (along with sub-branches)
 // `new_parent` The branch to become the new parent of `to_copy`
@@ -567,13 +4574,15 @@ mt_branch* mt_delete_branch(mt_branch* branch)
 // Returns:     1 if success, 0 if failure
 int mt_copy_branch(mt_branch* to_copy, mt_branch* new_parent)
 {
-    
+    if (!__mt_check_copy_arguments(to_copy, new_parent)) return 0;
 
+    return __mt_copy_branch_recursive(to_copy, new_parent) != NULL;
 }
 
 // Copy an entire branch and any sub-branches to a different location
 // replacing any existing top-level branch with the same label as the
 // incoming branch `to_copy`, and deleting all of that branch's sub-branches
+// If `to_copy` is already a child of `new_parent`, it is kept and its namesakes are deleted
 // 
 // `to_copy`    The branch to be copied (along with sub-branches)
 // `new_parent` The branch to become the new parent of `to_copy`
@@ -581,8 +4590,14 @@ int mt_copy_branch(mt_branch* to_copy, mt_branch* new_parent)
 // Returns:     1 if success, 0 if failure
 int mt_copy_branch_replace(mt_branch* to_copy, mt_branch* new_parent)
 {
-    
+    if (!__mt_check_copy_arguments(to_copy, new_parent)) return 0;
+
+    mt_branch* copy = to_copy;
+    if(to_copy->parent != new_parent) copy = __mt_copy_branch_recursive(to_copy, new_parent);
+    if(copy == NULL) return 0;
 
+    __mt_delete_children_labelled(new_parent, copy->label, copy);
+    return 1;
 }
 
 // Copy an entire branch and any sub-branches to a different location
@@ -595,15 +4610,376 @@ int mt_copy_branch_replace(mt_branch* to_copy, mt_branch* new_parent)
 // Returns:     1 if success, 0 if failure
 int mt_copy_branch_merge(mt_branch* to_copy, mt_branch* new_parent)
 {
-    
+    if (!__mt_check_copy_arguments(to_copy, new_parent)) return 0;
+
+    return __mt_merge_branch_recursive(to_copy, new_parent, NULL);
+}
+
+#define ________COPY_ON_WRITE
+
+// A copy made within one tree starts out as a single branch with its own label and data, marked MT_BRANCH_SHARING:
+// its children are still those of the branch it was copied from, which is marked MT_BRANCH_SHARED. The first time
+// anything looks at the copy's children, `__mt_ensure_children` creates them, each sharing the children of its own
+// original in turn, so copying takes O(1) time and only the branches that are reached are ever created.
+// Since every branch has one parent and its own id, what is shared is one branch's list of children, not a whole subtree.
+// Before a branch is changed, `__mt_unshare_path` makes the copies sharing the children of it or of any of its
+// ancestors create their children, so that nothing a copy still shares ever changes underneath it.
+// The tree's `shared` index finds the original of each copy, and its `sharers` index the copies of each original,
+// which are linked into a list through their slots of `shared`
+
+// Check whether `copy`, a new copy of `source`, can share the children of `source` instead of copying them now.
+// Copies into other trees cannot, as the original may be destroyed first. Nor can copies within a tree with a journal,
+// which has to record every branch that is created, or one that other threads may be reading, which must not change as they read
+//
+// Returns:     1 if it can, 0 if it has to copy them now, or if `source` has no children
+int __mt_check_can_share(mt_branch* source, mt_branch* copy)
+{
+    mt_tree* tree = copy->tree;
+    if (source->tree != tree || tree->journal != NULL || tree->reclaimer != NULL) return 0;
+    return source->first_child != NULL || (source->flags & (MT_BRANCH_UNLOADED | MT_BRANCH_SHARING));
+}
+
+// Make `copy`, which has just been created as a copy of `source`, share the children of `source` until they are reached
+//
+// Returns:     1 if success, 0 if the heap is exhausted, leaving the error raised
+int __mt_share_children(mt_branch* source, mt_branch* copy)
+{
+    mt_tree* tree = copy->tree;
+    if (source->flags & MT_BRANCH_SHARING) source = __mt_unloaded_index_probe(&tree->shared, source)->source;   // Share with the original
+
+    if (!__mt_sharing_add(tree, copy, source)) return 0;
+    __mt_set_flags(copy, MT_BRANCH_SHARING);
+
+    // Until they are copied, the children count towards the totals as those of the original do
+    if(source->flags & MT_BRANCH_TOTALS_STALE) __mt_totals_invalidate(copy);
+    else
+    {
+        copy->childrens_data_size = source->childrens_data_size;
+        __mt_totals_add(copy, source->num_descendants, source->descendants_data_size, 1);
+    }
+    return 1;
+}
+
+// Give `copy`, which is being created as part of a copy of `source`, the data type and data of `source` as
+// `__mt_copy_data` does, without counting that as another change
+//
+// Returns:     1 if success, 0 if the heap is exhausted, leaving the error raised
+int __mt_copy_data_to_new_branch(mt_branch* source, mt_branch* copy)
+{
+    if (source->data_type != NULL) copy->data_type = __mt_tree_intern_string(copy->tree, source->data_type);
+    if (source->data_storage == MT_DATA_EXTERNAL)
+    {
+        __mt_set_data_storage(copy, source->data, source->data_size, MT_DATA_EXTERNAL);
+    }
+    else if (source->data_size > MT_INLINE_DATA_SIZE)
+    {
+        void* data = malloc(source->data_size);
+        if (data == NULL) { mt_error("Could not allocate %ld bytes for a branch's data", source->data_size); return 0; }
+        memcpy(data, source->data, source->data_size);
+        __mt_set_data_storage(copy, data, source->data_size, MT_DATA_HEAP);
+    }
+    else if (source->data_size > 0)
+    {
+        memcpy(copy->inline_data, source->data, source->data_size);
+        __mt_set_data_storage(copy, NULL, source->data_size, MT_DATA_INLINE);
+    }
+    return 1;
+}
+
+// Create the children of `branch`, a copy still sharing the children of its original, as copies of those children
+// that share their own children in turn. This takes time proportional to the number of children, however big their
+// subtrees are. They count as changed only if `branch` itself has changed since the tree was last marked clean.
+// If the heap runs out, the error is reported and the rest of the children are left out
+void __mt_copy_shared_children(mt_branch* branch)
+{
+    mt_tree* tree = branch->tree;
+    mt_branch* source = __mt_unloaded_index_probe(&tree->shared, branch)->source;
+    __mt_sharing_remove(tree, branch);
+    __mt_clear_flags(branch, MT_BRANCH_SHARING);
+    __mt_totals_add(branch, branch->num_descendants, branch->descendants_data_size, -1);  // The copies count themselves in
+    branch->childrens_data_size = 0;
+
+    __mt_ensure_children(source);
+    for(mt_branch* child = source->first_child; child != NULL; child = child->next_sibling)
+    {
+        mt_branch* copy = __mt_new_branch(branch, child->label, 0);
+        if (copy == NULL) break;
+        if (branch->flags & MT_BRANCH_CHANGED) __mt_mark_changed(copy);
+        if (!__mt_copy_data_to_new_branch(child, copy)) break;
+        if (__mt_check_can_share(child, copy) && !__mt_share_children(child, copy)) break;
+    }
+    __mt_check_error_flag();    // Any error has been reported, and whatever looked at the children carries on with those that were copied
+}
+
+// Link `copy` into the list of copies sharing the children of `source`, which becomes MT_BRANCH_SHARED if it was not
+//
+// Returns:     1 if success, 0 if the heap is exhausted, leaving the error raised
+int __mt_sharing_add(mt_tree* tree, mt_branch* copy, mt_branch* source)
+{
+    mt_unloaded_slot* sharer = __mt_sharer_find(tree, source);
+    mt_branch* first = (sharer != NULL) ? sharer->source : NULL;
+
+    mt_unloaded_slot entry = { copy, NULL, 0, source, first, NULL };
+    if (!__mt_unloaded_index_insert(&tree->shared, &entry)) return 0;
+    if (first != NULL)
+    {
+        __mt_unloaded_index_probe(&tree->shared, first)->prev_copy = copy;
+        __mt_unloaded_index_probe(&tree->sharers, source)->source = copy;
+        return 1;
+    }
+
+    mt_unloaded_slot owner = { source, NULL, 0, copy, NULL, NULL };
+    if (!__mt_unloaded_index_insert(&tree->sharers, &owner))
+    {
+        __mt_unloaded_index_remove(&tree->shared, copy);
+        return 0;
+    }
+    __mt_set_flags(source, MT_BRANCH_SHARED);
+    __mt_share_epoch_advance(tree);
+    return 1;
+}
+
+// Returns:     The slot of `sharers` for `source`, or NULL if no copy is sharing its children
+mt_unloaded_slot* __mt_sharer_find(mt_tree* tree, mt_branch* source)
+{
+    if (tree->sharers.count == 0) return NULL;
+    mt_unloaded_slot* sharer = __mt_unloaded_index_probe(&tree->sharers, source);
+    return (sharer->branch == source) ? sharer : NULL;
+}
+
+// Unlink `copy`, a branch marked MT_BRANCH_SHARING, from the list of copies sharing the children of its original,
+// which stops being MT_BRANCH_SHARED once no copy is sharing them. If the original has been freed already, as the
+// copies left sharing its children are being deleted along with it, the list is all that is changed
+void __mt_sharing_remove(mt_tree* tree, mt_branch* copy)
+{
+    mt_unloaded_slot entry = *__mt_unloaded_index_probe(&tree->shared, copy);
+    __mt_unloaded_index_remove(&tree->shared, copy);
+
+    mt_unloaded_slot* sharer = __mt_sharer_find(tree, entry.source);
+    if (entry.prev_copy != NULL) __mt_unloaded_index_probe(&tree->shared, entry.prev_copy)->next_copy = entry.next_copy;
+    else if (sharer != NULL) sharer->source = entry.next_copy;
+    if (entry.next_copy != NULL) __mt_unloaded_index_probe(&tree->shared, entry.next_copy)->prev_copy = entry.prev_copy;
+
+    if (sharer != NULL && sharer->source == NULL)
+    {
+        __mt_unloaded_index_remove(&tree->sharers, entry.source);
+        __mt_clear_flags(entry.source, MT_BRANCH_SHARED);
+    }
+}
+
+// Returns:     The share epoch that `branch` was stamped in, see `__mt_unshare_path`, or 0 if it has not been
+unsigned int __mt_share_stamp(mt_branch* branch)
+{
+    return (unsigned int)branch->flags >> MT_BRANCH_SHARE_STAMP_SHIFT;
+}
+
+// Stamp `branch` with the share epoch `epoch`, see `__mt_unshare_path`
+void __mt_set_share_stamp(mt_branch* branch, unsigned int epoch)
+{
+    int flags = (branch->flags & ((1 << MT_BRANCH_SHARE_STAMP_SHIFT) - 1)) | (int)(epoch << MT_BRANCH_SHARE_STAMP_SHIFT);
+    __atomic_store_n(&branch->flags, flags, __ATOMIC_RELAXED);      // Stored whole, as `__mt_set_flags` does
+}
+
+// Start a new share epoch, as a branch has just become MT_BRANCH_SHARED and the stamps of the branches below it are
+// no longer true. Once the epochs run out, the stamps of the whole tree are cleared so that they can start again
+void __mt_share_epoch_advance(mt_tree* tree)
+{
+    if (tree->share_epoch < MT_BRANCH_SHARE_STAMP_MAX) { tree->share_epoch++; return; }
+    __mt_traverse(tree->root, -1, __mt_visit_clear_share_stamp, NULL, NULL, 0);
+    tree->share_epoch = 1;
+}
+
+// Visitor for `__mt_share_epoch_advance`, clearing each branch's stamp
+int __mt_visit_clear_share_stamp(mt_branch* branch, int depth, void* context)
+{
+    __mt_set_share_stamp(branch, 0);
+    return MT_VISIT_CONTINUE;
+}
+
+#if INTERFACE
+typedef struct mt_unshare_walk     // The copies that have to create their subtrees before a branch is deleted
+{
+    mt_branch* deleted;            // The branch being deleted
+    mt_branch** copies;            // Copies outside it sharing the children of a branch within it
+    size_t num_copies;
+    size_t capacity;
+} mt_unshare_walk;
+#endif
+
+// Make the copies still sharing the children of `source` create them, so that those children can be changed.
+// With `deep`, the copies sharing the children of `source` or of any branch below it create their whole subtrees,
+// so that `source` can be deleted. Copies that are themselves below `source` are left as they are.
+// The copies are found from `sharers`, and for `deep` by walking the branches below `source` that exist, which deleting
+// it walks anyway
+void __mt_unshare_branch(mt_tree* tree, mt_branch* source, int deep)
+{
+    if (!deep)
+    {
+        // Each copy takes itself off the list as it creates its children
+        for(mt_unloaded_slot* sharer; (sharer = __mt_sharer_find(tree, source)) != NULL; ) __mt_ensure_children(sharer->source);
+        return;
+    }
+
+    // Creating subtrees changes the lists, so the copies are found first
+    mt_unshare_walk walk = { source, NULL, 0, 0 };
+    __mt_traverse(source, -1, __mt_visit_find_copies, NULL, &walk, 0);
+    for(size_t i=0; i<walk.num_copies; i++)
+    {
+        for(mt_branch* branch = walk.copies[i]; branch != NULL; branch = __mt_next_descendant(branch, walk.copies[i]));
+    }
+    free(walk.copies);
+}
+
+// Visitor for `__mt_unshare_branch`, listing the copies outside the branch being deleted that share this branch's children
+int __mt_visit_find_copies(mt_branch* branch, int depth, void* context)
+{
+    mt_unshare_walk* walk = context;
+    if (!(branch->flags & MT_BRANCH_SHARED)) return MT_VISIT_CONTINUE;
+
+    mt_tree* tree = branch->tree;
+    for(mt_branch* copy = __mt_sharer_find(tree, branch)->source; copy != NULL;
+        copy = __mt_unloaded_index_probe(&tree->shared, copy)->next_copy)
+    {
+        if (__mt_is_within(copy, walk->deleted)) continue;
+        if (walk->num_copies == walk->capacity)
+        {
+            size_t capacity = walk->capacity ? walk->capacity * 2 : 16;
+            mt_branch** copies = realloc(walk->copies, capacity * sizeof *copies);
+            if (copies == NULL) mt_error("Could not allocate memory for copying %ld shared branches", capacity);
+            if (__mt_check_error_flag()) return MT_VISIT_STOP;
+            walk->copies = copies;
+            walk->capacity = capacity;
+        }
+        walk->copies[walk->num_copies++] = copy;
+    }
+    return MT_VISIT_CONTINUE;
+}
+
+// Make every copy still sharing the children of `branch`, or of one of its ancestors, create its children,
+// so that `branch` can be changed without changing those copies. Anything that changes a branch must call this first.
+// Once no branch on the way up is shared, each is stamped with the share epoch, which only moves on when another
+// branch becomes shared, and later walks stop at the first branch stamped in the current epoch. Repeated changes
+// in the same part of the tree then cost O(1) each, and nothing is done at all while no copy is sharing children
+void __mt_unshare_path(mt_branch* branch)
+{
+    mt_tree* tree = branch->tree;
+    while (tree->shared.count > 0)
+    {
+        // Start from the highest, as the copies of its children then share the children of the next one down
+        mt_branch* shared = NULL;
+        mt_branch* stamped = branch;
+        for(; stamped != NULL && __mt_share_stamp(stamped) != tree->share_epoch; stamped = stamped->parent)
+        {
+            if (stamped->flags & MT_BRANCH_SHARED) shared = stamped;
+        }
 
+        if (shared == NULL)
+        {
+            for(mt_branch* ancestor = branch; ancestor != stamped; ancestor = ancestor->parent) __mt_set_share_stamp(ancestor, tree->share_epoch);
+            return;
+        }
+        __mt_unshare_branch(tree, shared, 0);
+    }
 }
 
+
 #define ________MOVE
 
+// Within one tree a branch is moved by unlinking it from its parent's list of children and linking it onto the end of
+// its new parent's, so it keeps its id, label and data, and its sub-branches are not touched at all.
+// The id index doesn't change, and each parent's index of children is updated for the one branch that moved
+
+
+// Check whether `to_move` can be moved to `new_parent` by relinking it. Moves into another tree cannot, as every branch
+// belongs to the pools of its own tree, and nor can moves in a tree that other threads may be reading, since a reader
+// standing on the moved branch would follow its new links out of the list of children it was walking
+//
+// Returns:     1 if it can, 0 if it has to be copied and then deleted
+int __mt_check_can_relink(mt_branch* to_move, mt_branch* new_parent)
+{
+    return to_move->tree == new_parent->tree && to_move->tree->reclaimer == NULL;
+}
+
+// Move `to_move`, along with its sub-branches, to the end of the children of `new_parent` in the same tree
+void __mt_relink_branch(mt_branch* to_move, mt_branch* new_parent)
+{
+    mt_branch* old_parent = to_move->parent;
+    __mt_unshare_path(old_parent);      // Copies sharing either list of children keep it as it was
+    __mt_unshare_path(new_parent);
+    __mt_journal_record(to_move->tree, MT_JOURNAL_MOVE, to_move->id, new_parent->id, NULL, 0);
+
+    __mt_unlink_child(to_move);
+    __mt_link_child(new_parent, to_move);
+
+    // A delta lists the new children of both parents, which places `to_move` by its id, see `mt_write_delta_to_buffer`
+    __mt_mark_changed(old_parent);
+    __mt_mark_changed(new_parent);
+}
+
+// Give `destination` the data type and data of `source` as `__mt_copy_data` does, except that data owned by `source`
+// is handed over rather than copied. `source` is left without it, as it is about to be deleted
+//
+// Returns:     1 if success, 0 if failure
+int __mt_move_data(mt_branch* source, mt_branch* destination)
+{
+    if (source->data_storage != MT_DATA_HEAP)
+    {
+        __mt_copy_data(source, destination);
+        return !__mt_check_error_flag();
+    }
+
+    void* data = source->data;
+    size_t data_size = source->data_size;
+    mt_set_data_type(destination, source->data_type);
+    __mt_set_data_storage(source, NULL, 0, MT_DATA_NONE);
+    return mt_set_data_owned(destination, data, data_size);
+}
+
+// Merge `source` into the first child of `new_parent` that has the same label (ignoring `exclude`) as
+// `__mt_merge_branch_recursive` does, but by moving branches instead of copying them. If there is no such child,
+// `source` is relinked as it is. Otherwise that child takes over the data of `source`, each child of `source` is
+// merged into it in the same way, and `source`, left with nothing, is deleted. This takes time proportional to the
+// number of branches whose labels collide, however big the subtrees being moved are
+//
+// Returns:     1 if success, 0 if failure
+int __mt_merge_by_relinking(mt_branch* source, mt_branch* new_parent, mt_branch* exclude)
+{
+    mt_copy_cursor cursor;
+    __mt_copy_cursor_init(&cursor, new_parent, exclude);
+    __mt_traverse(source, -1, __mt_visit_merge_by_relinking, __mt_visit_delete_merged, &cursor, 1);
+    return !cursor.failed;
+}
+
+// Visitor for `__mt_merge_by_relinking`, relinking each branch that has nothing to merge into, and skipping its children
+int __mt_visit_merge_by_relinking(mt_branch* branch, int depth, void* context)
+{
+    mt_copy_cursor* cursor = context;
+    mt_branch* parent = __mt_copy_cursor_parent(cursor, depth);
+    mt_branch* existing = __mt_find_merge_target(parent, branch, (depth == 0) ? cursor->exclude : NULL);
+
+    if(existing == NULL)
+    {
+        __mt_relink_branch(branch, parent);
+        return MT_VISIT_SKIP;
+    }
+    if(existing == branch) return MT_VISIT_SKIP;
+
+    if(!__mt_move_data(branch, existing)) { cursor->failed = 1; return MT_VISIT_STOP; }
+    __mt_copy_cursor_visited(cursor, existing, depth);
+    return MT_VISIT_CONTINUE;
+}
+
+// Visitor for `__mt_merge_by_relinking`, deleting each merged branch once all of its children have been moved away
+int __mt_visit_delete_merged(mt_branch* branch, int depth, void* context)
+{
+    mt_delete_branch(branch);
+    return MT_VISIT_CONTINUE;
+}
+
 
 // Move an entire branch and any sub-branches to a different location
 // leaving any branches with the same names as their siblings as duplicates
+// Within one tree this relinks the branch in O(1) time, keeping the ids, labels and data of it and its sub-branches
 // 
 // `to_move`    The branch to be moved (along with sub-branches)
 // `new_parent` The branch to become the new parent of `to_move`
@@ -611,7 +4987,20 @@ int mt_copy_branch_merge(mt_branch* to_copy, mt_branch* new_parent)
 // Returns:     1 if success, 0 if failure
 int mt_move_branch(mt_branch* to_move, mt_branch* new_parent)
 {
-    // Copy using mt_copy_branch then delete original
+    if (!__mt_check_copy_arguments(to_move, new_parent)) return 0;
+    if (mt_check_is_root(to_move)) mt_error("Attempted to move the root branch"); 
+    if (__mt_check_error_flag()) return 0;
+
+    if(__mt_check_can_relink(to_move, new_parent))
+    {
+        __mt_relink_branch(to_move, new_parent);
+        return 1;
+    }
+
+    // Otherwise copy it, then delete the original
+    if(__mt_copy_branch_recursive(to_move, new_parent) == NULL) return 0;
+    mt_delete_branch(to_move);
+    return 1;
 }
 
 
@@ -625,12 +5014,20 @@ int mt_move_branch(mt_branch* to_move, mt_branch* new_parent)
 // Returns:     1 if success, 0 if failure
 int mt_move_branch_replace(mt_branch* to_move, mt_branch* new_parent)
 {
-    // Copy using mt_copy_branch_replace then delete original 
+    if (!__mt_check_copy_arguments(to_move, new_parent)) return 0;
+    if (mt_check_is_root(to_move)) mt_error("Attempted to move the root branch"); 
+    if (__mt_check_error_flag()) return 0;
+
+    // Clear the way, then move as normal
+    __mt_delete_children_labelled(new_parent, to_move->label, to_move);
+    return mt_move_branch(to_move, new_parent);
 }
 
 // Move an entire branch and any sub-branches to a different location
 // replacing the data of any branches that have the same labels and locations as
 // those being moved, but keeping all children intact
+// Within one tree only branches whose labels collide are visited: the rest are relinked as they are,
+// and the colliding branches of `new_parent` take over the data of those moved into them
 // 
 // `to_move`    The branch to be moved (along with sub-branches)
 // `new_parent` The branch to become the new parent of `to_move`
@@ -638,43 +5035,14 @@ int mt_move_branch_replace(mt_branch* to_move, mt_branch* new_parent)
 // Returns:     1 if success, 0 if failure
 int mt_move_branch_merge(mt_branch* to_move, mt_branch* new_parent)
 {
-    // Copy using mt_copy_branch_merge then delete original
-}
-
-
-
-
-#define ________SERIALIZATION
-
-
-// Calculate the total size in bytes of the tree, if serialised,
-// by performing a simulated serialisation (no bytes are actually written)
-// This is useful for allocating a buffer to write
-// 
-// `root`       The branch to start serialising at
-// 
-// Returns:     The total size of the tree in bytes
-size_t mt_get_tree_file_size(mt_branch* root)
-{
-
-}
-
-// Write the (sub-)tree starting at `root` to the buffer `out_buffer`, up to a maximum of `out_capacity` bytes
-// 
-// Returns:     The number of bytes written, or 0 if error
-int mt_write_tree_to_buffer(mt_branch* root, void* out_buffer, size_t out_capacity)
-{
-
-}
+    if (!__mt_check_copy_arguments(to_move, new_parent)) return 0;
+    if (mt_check_is_root(to_move)) mt_error("Attempted to move the root branch"); 
+    if (__mt_check_error_flag()) return 0;
 
-// Read the (sub-)tree from the buffer `in_buffer`, up to a maximum of `buffer_length` bytes,
-// re-create the tree structure including all data fields, and attatch this tree as a child of
-// the branch `new_parent`.
-// 
-// Returns:  a pointer to the root of the newly-loaded tree that has been attatched to `new_parent`
-//           or NULL if there was an error.
-mt_branch* mt_load_tree_from_buffer(mt_branch* new_parent, void* in_buffer, size_t buffer_length)
-{
+    if(__mt_check_can_relink(to_move, new_parent)) return __mt_merge_by_relinking(to_move, new_parent, to_move);
 
-   
+    // Otherwise merge using the same steps as mt_copy_branch_merge then delete original
+    if(!__mt_merge_branch_recursive(to_move, new_parent, to_move)) return 0;
+    mt_delete_branch(to_move);
+    return 1;
 }
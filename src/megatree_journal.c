@@ -0,0 +1,646 @@
+#define _POSIX_C_SOURCE 200809L    // For fsync, clock_gettime and pthread_cond_timedwait
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#include <fcntl.h>
+#define fsync _commit
+#define ftruncate _chsize
+#endif
+
+#include "debug.h"
+
+#include "common.h"
+
+
+
+#define ________JOURNAL_FORMAT
+
+// A journal is an append-only file recording every change made to a tree since its last snapshot, so that frequent
+// small changes can be made durable without saving the whole tree. It starts with a header, followed by one record
+// for each change, in the order they were made. Every integer is little-endian
+//
+//  Header              MT_JOURNAL_HEADER_SIZE bytes: MT_JOURNAL_MAGIC, then the u32 version and u32 header size
+//  Records             Each MT_JOURNAL_RECORD_SIZE bytes, see the MT_JOURNAL_RECORD_ offsets below, followed by its
+//                      bytes: the label, data type or data that the change set, without a terminator
+//
+// Branches are named by id, which snapshots keep, so the journal can be replayed onto the snapshot it follows.
+// A record whose checksum does not match was torn by a crash while it was being written, and it and
+// everything after it are ignored
+
+#if INTERFACE
+#define MT_JOURNAL_MAGIC "MTJOURNL"
+#define MT_JOURNAL_VERSION 1
+#define MT_JOURNAL_HEADER_SIZE          16
+
+#define MT_JOURNAL_RECORD_SIZE          32
+#define MT_JOURNAL_RECORD_LENGTH        0   // u64: the size of the record, including its bytes
+#define MT_JOURNAL_RECORD_CHECKSUM      8   // u32: checksum of everything in the record after this field
+#define MT_JOURNAL_RECORD_TYPE          12  // u32: one of the MT_JOURNAL_ types below
+#define MT_JOURNAL_RECORD_ID            16  // u64: the id of the branch that changed
+#define MT_JOURNAL_RECORD_ARGUMENT      24  // u64: the parent's id for MT_JOURNAL_CREATE and MT_JOURNAL_MOVE, 1 if MT_JOURNAL_DATA_TYPE sets a type
+
+#define MT_JOURNAL_CREATE       1   // The branch was created as the last child of `argument`, with the bytes as its label
+#define MT_JOURNAL_LABEL        2   // The branch was relabelled with the bytes
+#define MT_JOURNAL_DATA_TYPE    3   // The branch's data type was set to the bytes, or removed if `argument` is 0
+#define MT_JOURNAL_DATA         4   // The branch's data was set to a copy of the bytes
+#define MT_JOURNAL_DELETE       5   // The branch and all of its sub-branches were deleted
+#define MT_JOURNAL_MOVE         6   // The branch and all of its sub-branches were moved to the end of the children of `argument`
+
+#define MT_JOURNAL_BUFFER_SIZE  4096        // Bytes kept for putting a record together. It grows to fit bigger records
+
+
+typedef struct mt_journal mt_journal;     // A journal that changes to a tree are being recorded in, defined below
+
+typedef struct mt_journal_stats    // Summary of a tree's journal, see `mt_get_journal_stats`
+{
+    size_t records;                // Changes recorded since the journal was opened
+    size_t bytes;                  // Bytes of records written for them
+    size_t syncs;                  // Times the journal has been synced to disk. Fewer than `records` with group commit
+    size_t pending;                // Bytes of records that have been written, but not synced yet
+} mt_journal_stats;
+#endif
+
+// Only this file needs the threading types, so the journal is not part of the interface
+struct mt_journal                  // A journal that changes to a tree are being recorded in
+{
+    int fd;                        // The journal file, open for appending
+    double commit_window;          // How many seconds records may wait to be synced, so that one sync covers them all
+
+    unsigned char* buffer;         // The record being put together, before it is written
+    size_t capacity;
+
+    // Shared with the flusher thread, which syncs records once they have waited for the commit window, under `lock`
+    pthread_mutex_t lock;
+    pthread_cond_t wake;           // Signalled when there are records to sync, or the flusher should stop
+    pthread_cond_t synced;         // Signalled when a sync has finished
+    pthread_t flusher;
+    int has_flusher;               // Set if the flusher thread was started, which it is if the commit window is not 0
+    int stopping;                  // Set when the flusher should stop
+    int syncing;                   // Set while the file is being synced, with the lock released
+    double first_unsynced;         // When the oldest record that has not been synced yet was written, in seconds
+    size_t unsynced;               // Bytes of records written since the last sync
+    int failed;                    // Set once the file could not be written or synced, after which nothing more is recorded
+
+    size_t records;                // Records made since the journal was opened
+    size_t bytes;                  // Bytes of records made since then
+    size_t syncs;                  // Times the file has been synced since then
+};
+
+
+// Returns:     A checksum of `length` bytes at `data`, to find records that were torn while they were being written
+unsigned long __mt_journal_checksum(unsigned char* data, size_t length)
+{
+    unsigned long hash = 2166136261UL;      // 32-bit FNV-1a
+    for(size_t i=0; i<length; i++) hash = ((hash ^ data[i]) * 16777619UL) & 0xffffffffUL;
+    return hash;
+}
+
+// Returns:     The time in seconds, from a clock which only ever goes forwards
+double __mt_journal_seconds()
+{
+    struct timespec now;
+#if defined(_WIN32)
+    timespec_get(&now, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+
+
+#define ________RECORDING
+
+// Records are written to the file as soon as they are made, so they survive the program crashing. Syncing the file is
+// what makes them survive the system crashing or losing power, and is slow, so records are synced in groups: a flusher
+// thread syncs every record written within the commit window with one sync, once the oldest of them has waited for the
+// window. A record is durable, surviving a system crash, once it is synced, at most the window after it was made
+
+// Sync the file of `journal` to disk, if records have been written since it was last synced. Called with its lock
+// held, which is released during the sync so that records can still be written. A sync already under way is waited for
+// first, as it may not cover every record written before this was called
+//
+// Returns:     1 if success, 0 if the file could not be synced
+int __mt_journal_sync_locked(mt_journal* journal)
+{
+    while(journal->syncing) pthread_cond_wait(&journal->synced, &journal->lock);
+    if (journal->unsynced == 0 || journal->failed) return !journal->failed;
+
+    journal->syncing = 1;
+    journal->unsynced = 0;
+    journal->syncs++;
+    pthread_mutex_unlock(&journal->lock);
+    int failed = fsync(journal->fd) != 0;
+    pthread_mutex_lock(&journal->lock);
+    if (failed) journal->failed = 1;
+    journal->syncing = 0;
+    pthread_cond_broadcast(&journal->synced);
+    return !journal->failed;
+}
+
+// Sync every record written to the file of `journal`
+//
+// Returns:     1 if success, 0 if the file could not be written or synced
+int __mt_journal_sync(mt_journal* journal)
+{
+    pthread_mutex_lock(&journal->lock);
+    int synced = __mt_journal_sync_locked(journal);
+    pthread_mutex_unlock(&journal->lock);
+
+    if (!synced) mt_error("Could not write to the journal. Changes are no longer being recorded");
+    __mt_check_error_flag();    // The change being recorded has still been made
+    return synced;
+}
+
+// Flusher thread of the journal `context`, syncing its records once the oldest of them has waited for the commit
+// window, so that they become durable within the window even if no more changes are made
+void* __mt_journal_flusher_thread(void* context)
+{
+    mt_journal* journal = context;
+    pthread_mutex_lock(&journal->lock);
+    while(!journal->stopping)
+    {
+        double wait = journal->first_unsynced + journal->commit_window - __mt_journal_seconds();
+        if (journal->unsynced == 0 || journal->failed) pthread_cond_wait(&journal->wake, &journal->lock);
+        else if (wait > 0)
+        {
+            struct timespec deadline;       // Timed waits are measured against the real-time clock
+#if defined(_WIN32)
+            timespec_get(&deadline, TIME_UTC);
+#else
+            clock_gettime(CLOCK_REALTIME, &deadline);
+#endif
+            long nanoseconds = deadline.tv_nsec + (long)((wait - (long)wait) * 1e9);
+            deadline.tv_sec += (long)wait + nanoseconds / 1000000000L;
+            deadline.tv_nsec = nanoseconds % 1000000000L;
+            pthread_cond_timedwait(&journal->wake, &journal->lock, &deadline);
+        }
+        else __mt_journal_sync_locked(journal);
+    }
+    pthread_mutex_unlock(&journal->lock);
+    return NULL;
+}
+
+// Write the `length` bytes at `bytes` to the end of the file of `journal`. With no commit window they are synced
+// straight away, and otherwise the flusher thread is woken to sync them once the window has passed
+//
+// Returns:     1 if success, 0 if the file could not be written, or could not be before
+int __mt_journal_write(mt_journal* journal, unsigned char* bytes, size_t length)
+{
+    pthread_mutex_lock(&journal->lock);
+    if (journal->failed) { pthread_mutex_unlock(&journal->lock); return 0; }     // Already reported
+
+    for(size_t written = 0; written < length && !journal->failed; )
+    {
+        long result = write(journal->fd, bytes + written, length - written);
+        if (result <= 0) journal->failed = 1;
+        else written += result;
+    }
+    if (!journal->failed && journal->unsynced == 0)
+    {
+        journal->first_unsynced = __mt_journal_seconds();
+        pthread_cond_signal(&journal->wake);
+    }
+    if (!journal->failed) journal->unsynced += length;
+    if (!journal->has_flusher) __mt_journal_sync_locked(journal);
+    int failed = journal->failed;
+    pthread_mutex_unlock(&journal->lock);
+
+    if (failed) mt_error("Could not write to the journal. Changes are no longer being recorded");
+    __mt_check_error_flag();    // The change being recorded has still been made
+    return !failed;
+}
+
+// Record a change to `tree` in its journal, if it has one. The record is written to the file straight away, and
+// synced within the journal's commit window, see above
+//
+// `type`       One of the MT_JOURNAL_ types
+// `id`         The id of the branch that changed
+// `argument`   See MT_JOURNAL_RECORD_ARGUMENT
+// `bytes`      The label, data type or data the change set, `length` bytes long
+void __mt_journal_record(mt_tree* tree, int type, size_t id, size_t argument, void* bytes, size_t length)
+{
+    mt_journal* journal = tree->journal;
+    if (journal == NULL) return;
+
+    size_t record_length = MT_JOURNAL_RECORD_SIZE + length;
+    if (record_length > journal->capacity)  // Too big for the buffer, so it grows to fit this record
+    {
+        unsigned char* grown = realloc(journal->buffer, record_length);
+        if (grown == NULL)
+        {
+            pthread_mutex_lock(&journal->lock);
+            journal->failed = 1;
+            pthread_mutex_unlock(&journal->lock);
+            mt_error("Could not allocate %ld bytes for a journal record. Changes are no longer being recorded", record_length);
+            __mt_check_error_flag();
+            return;
+        }
+        journal->buffer = grown;
+        journal->capacity = record_length;
+    }
+
+    unsigned char* record = journal->buffer;
+    __mt_put_u64(record + MT_JOURNAL_RECORD_LENGTH, record_length);
+    __mt_put_u32(record + MT_JOURNAL_RECORD_TYPE, type);
+    __mt_put_u64(record + MT_JOURNAL_RECORD_ID, id);
+    __mt_put_u64(record + MT_JOURNAL_RECORD_ARGUMENT, argument);
+    if (length > 0) memcpy(record + MT_JOURNAL_RECORD_SIZE, bytes, length);
+    __mt_put_u32(record + MT_JOURNAL_RECORD_CHECKSUM, __mt_journal_checksum(record + MT_JOURNAL_RECORD_TYPE, record_length - MT_JOURNAL_RECORD_TYPE));
+    if (!__mt_journal_write(journal, record, record_length)) return;
+    journal->records++;
+    journal->bytes += record_length;
+}
+
+// Find how much of the journal `in`, of `length` bytes, is made of whole records, ignoring any torn record at the end
+//
+// Returns:     The number of bytes, from the start of the journal, or 0 if it is not a journal
+size_t __mt_journal_valid_length(unsigned char* in, size_t length)
+{
+    if (length < MT_JOURNAL_HEADER_SIZE || memcmp(in, MT_JOURNAL_MAGIC, 8) != 0
+        || __mt_get_u32(in + 8) != MT_JOURNAL_VERSION || __mt_get_u32(in + 12) != MT_JOURNAL_HEADER_SIZE) return 0;
+
+    size_t position = MT_JOURNAL_HEADER_SIZE;
+    while(length - position >= MT_JOURNAL_RECORD_SIZE)
+    {
+        size_t record_length = __mt_get_u64(in + position + MT_JOURNAL_RECORD_LENGTH);
+        if (record_length < MT_JOURNAL_RECORD_SIZE || record_length > length - position) break;
+        if (__mt_get_u32(in + position + MT_JOURNAL_RECORD_CHECKSUM)
+            != __mt_journal_checksum(in + position + MT_JOURNAL_RECORD_TYPE, record_length - MT_JOURNAL_RECORD_TYPE)) break;
+        position += record_length;
+    }
+    return position;
+}
+
+// Read the whole of the file `filename` into memory
+//
+// Returns:     The contents, which must be freed, or NULL if the file does not exist or could not be read
+unsigned char* __mt_journal_read_file(char* filename, size_t* out_length)
+{
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) return NULL;
+
+    long length = -1;
+    if (fseek(file, 0, SEEK_END) == 0) length = ftell(file);
+    unsigned char* contents = (length >= 0 && fseek(file, 0, SEEK_SET) == 0) ? malloc(length ? length : 1) : NULL;
+    if (contents != NULL && fread(contents, 1, length, file) != (size_t)length)
+    {
+        free(contents);
+        contents = NULL;
+    }
+    fclose(file);
+
+    *out_length = length;
+    return contents;
+}
+
+// Start recording every change made to the tree of `root` in the journal file `filename`, as a compact record
+// appended to the file: creating, relabelling and deleting branches and setting their data and data types.
+// Moves within the tree are recorded as moves. Copies, and moves that have to copy the branch, see `mt_move_branch`, are
+// recorded as the branches they create and delete. Data that is changed in place, through
+// `mt_get_data_pointer_writable` or a pointer linked with `mt_set_data_pointer`, is not seen: set it again to record it.
+// Loading snapshots into the tree and applying deltas to it are not recorded either, so take a checkpoint afterwards.
+//
+// If the file already exists, records are added to the end of it, after cutting off any record that was torn by a crash.
+// Each record is written as soon as it is made, so only a crash of the whole system can lose it, and only until it has
+// been synced to disk. Syncing is slow, so a background thread syncs records in groups: each record is synced at most
+// `commit_window` seconds after it was made, together with every other record made by then. A window of 0 syncs
+// every record before the change that made it returns, and needs no thread
+//
+// Returns:     1 if success, 0 if the journal could not be opened
+int mt_open_journal(mt_branch* root, char* filename, double commit_window)
+{
+    if (root == NULL)           mt_error("Attempted to open a journal for a tree whose root is a null pointer");
+    else if (!mt_check_is_root(root)) mt_error("Attempted to open a journal for a branch which is not the root of its tree");
+    else if (root->tree->journal != NULL) mt_error("Attempted to open a second journal for the same tree");
+    if (filename == NULL)       mt_error("Attempted to open a journal whose file name is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    // Keep only the whole records of an existing journal, so that new records follow straight on from them
+    size_t length = 0, valid_length = 0;
+    unsigned char* existing = __mt_journal_read_file(filename, &length);
+    if (existing != NULL) valid_length = __mt_journal_valid_length(existing, length);
+    free(existing);
+    if (existing != NULL && length > 0 && valid_length == 0) mt_error("Attempted to open '%s' as a journal, but it is not one", filename);
+    if (__mt_check_error_flag()) return 0;
+
+    __mt_load_all_children(root->tree);     // Copies still sharing children create them now, as a replay has to create every branch
+    mt_journal* journal = calloc(1, sizeof *journal);
+    if (journal != NULL) journal->buffer = malloc(MT_JOURNAL_BUFFER_SIZE);
+    if (journal == NULL || journal->buffer == NULL)
+    {
+        if (journal != NULL) free(journal);
+        mt_error("Could not allocate memory for a journal");
+    }
+    if (__mt_check_error_flag()) return 0;
+    journal->capacity = MT_JOURNAL_BUFFER_SIZE;
+    journal->commit_window = commit_window;
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_cond_init(&journal->wake, NULL);
+    pthread_cond_init(&journal->synced, NULL);
+
+#if defined(_WIN32)
+    journal->fd = open(filename, O_WRONLY | O_CREAT | O_BINARY, 0644);
+#else
+    journal->fd = open(filename, O_WRONLY | O_CREAT, 0644);
+#endif
+    int failed = (journal->fd < 0);
+    if (!failed && valid_length == 0)   // A new journal starts with its header
+    {
+        unsigned char* header = journal->buffer;
+        memcpy(header, MT_JOURNAL_MAGIC, 8);
+        __mt_put_u32(header + 8, MT_JOURNAL_VERSION);
+        __mt_put_u32(header + 12, MT_JOURNAL_HEADER_SIZE);
+        failed = ftruncate(journal->fd, 0) != 0 || write(journal->fd, header, MT_JOURNAL_HEADER_SIZE) != MT_JOURNAL_HEADER_SIZE;
+    }
+    else if (!failed)
+    {
+        failed = (valid_length < length && ftruncate(journal->fd, valid_length) != 0)
+            || lseek(journal->fd, valid_length, SEEK_SET) != (long)valid_length;
+    }
+    if (!failed) failed = fsync(journal->fd) != 0;
+    if (!failed && commit_window > 0)
+    {
+        failed = pthread_create(&journal->flusher, NULL, __mt_journal_flusher_thread, journal) != 0;
+        journal->has_flusher = !failed;
+    }
+
+    if (failed)
+    {
+        if (journal->fd >= 0) close(journal->fd);
+        __mt_free_journal(journal);
+        mt_error("Could not open the journal '%s'", filename);
+    }
+    if (__mt_check_error_flag()) return 0;
+
+    root->tree->journal = journal;
+    return 1;
+}
+
+// Sync every change recorded in the journal of the tree that `branch` belongs to, without waiting for the commit
+// window to pass, so that they are all durable when this returns
+//
+// Returns:     1 if success, 0 if the tree has no journal or it could not be written
+int mt_sync_journal(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to sync the journal of a branch which is a null pointer");
+    else if (branch->tree->journal == NULL) mt_error("Attempted to sync the journal of a tree which does not have one");
+    if (__mt_check_error_flag()) return 0;
+
+    return __mt_journal_sync(branch->tree->journal);
+}
+
+// Sync the journal of `tree` and stop recording changes in it
+//
+// Returns:     1 if everything recorded was written, 0 if not
+int __mt_close_journal(mt_tree* tree)
+{
+    mt_journal* journal = tree->journal;
+    if (journal->has_flusher)
+    {
+        pthread_mutex_lock(&journal->lock);
+        journal->stopping = 1;
+        pthread_cond_signal(&journal->wake);
+        pthread_mutex_unlock(&journal->lock);
+        pthread_join(journal->flusher, NULL);
+    }
+    int synced = __mt_journal_sync(journal);
+    close(journal->fd);
+    __mt_free_journal(journal);
+    tree->journal = NULL;
+    return synced;
+}
+
+// Free `journal`, once its file is closed and its flusher thread has stopped
+void __mt_free_journal(mt_journal* journal)
+{
+    pthread_cond_destroy(&journal->synced);
+    pthread_cond_destroy(&journal->wake);
+    pthread_mutex_destroy(&journal->lock);
+    free(journal->buffer);
+    free(journal);
+}
+
+// Sync the journal of the tree that `branch` belongs to, and stop recording changes to the tree.
+// Destroying a tree closes its journal too
+//
+// Returns:     1 if everything recorded was written, 0 if not or if the tree has no journal
+int mt_close_journal(mt_branch* branch)
+{
+    if (branch == NULL) mt_error("Attempted to close the journal of a branch which is a null pointer");
+    else if (branch->tree->journal == NULL) mt_error("Attempted to close the journal of a tree which does not have one");
+    if (__mt_check_error_flag()) return 0;
+
+    return __mt_close_journal(branch->tree);
+}
+
+// Get statistics on the journal of the tree that `branch` belongs to, into `out_stats`. All zero if it has none
+void mt_get_journal_stats(mt_branch* branch, mt_journal_stats* out_stats)
+{
+    if (branch == NULL)     mt_error("Attempted to get the journal stats of a branch which is a null pointer");
+    if (out_stats == NULL)  mt_error("Attempted to get journal stats into a null pointer");
+    if (__mt_check_error_flag()) return;
+
+    memset(out_stats, 0, sizeof *out_stats);
+    mt_journal* journal = branch->tree->journal;
+    if (journal == NULL) return;
+    out_stats->records = journal->records;
+    out_stats->bytes = journal->bytes;
+    pthread_mutex_lock(&journal->lock);
+    out_stats->syncs = journal->syncs;
+    out_stats->pending = journal->unsynced;
+    pthread_mutex_unlock(&journal->lock);
+}
+
+
+
+#define ________REPLAY
+
+// Make the change recorded in `record` to `tree`. Changes to branches that no longer exist, and creations of
+// branches that already do, are skipped: they are already in the snapshot being replayed onto, or were undone later
+//
+// Returns:     1 if the change was made or skipped, 0 if the record is damaged or the heap is exhausted
+int __mt_replay_journal_record(mt_tree* tree, unsigned char* record)
+{
+    size_t length = __mt_get_u64(record + MT_JOURNAL_RECORD_LENGTH) - MT_JOURNAL_RECORD_SIZE;
+    int type = __mt_get_u32(record + MT_JOURNAL_RECORD_TYPE);
+    size_t id = __mt_get_u64(record + MT_JOURNAL_RECORD_ID);
+    size_t argument = __mt_get_u64(record + MT_JOURNAL_RECORD_ARGUMENT);
+    unsigned char* bytes = record + MT_JOURNAL_RECORD_SIZE;
+
+    mt_branch* branch = __mt_id_index_find(tree, id);
+    if (type == MT_JOURNAL_CREATE) branch = (branch == NULL) ? __mt_id_index_find(tree, argument) : NULL;
+    mt_branch* new_parent = (type == MT_JOURNAL_MOVE) ? __mt_id_index_find(tree, argument) : NULL;
+    if (type == MT_JOURNAL_MOVE && new_parent == NULL) branch = NULL;
+    if (branch == NULL) return type >= MT_JOURNAL_CREATE && type <= MT_JOURNAL_MOVE;
+
+    // Labels and data types are recorded without their terminators
+    char* string = NULL;
+    if (type == MT_JOURNAL_CREATE || type == MT_JOURNAL_LABEL || (type == MT_JOURNAL_DATA_TYPE && argument))
+    {
+        string = malloc(length + 1);
+        if (string == NULL) { mt_error("Could not allocate memory for replaying a journal"); return 0; }
+        memcpy(string, bytes, length);
+        string[length] = 0;
+    }
+
+    int replayed = 0;
+    switch(type)
+    {
+        case MT_JOURNAL_CREATE:
+            replayed = string[0] != 0 && mt_check_label_valid(string) && __mt_create_branch_as(branch, string, id) != NULL;
+            break;
+        case MT_JOURNAL_LABEL:      replayed = mt_set_label(branch, string) != NULL; break;
+        case MT_JOURNAL_DATA_TYPE:  mt_set_data_type(branch, string); replayed = 1; break;
+        case MT_JOURNAL_DATA:       mt_set_data_copy(branch, bytes, length); replayed = branch->data_size == length; break;
+        case MT_JOURNAL_DELETE:     replayed = branch->parent != NULL && mt_delete_branch(branch) != NULL; break;
+        case MT_JOURNAL_MOVE:       // Taken to be moved already only if it is the last child of its new parent
+            replayed = branch->parent != NULL && !__mt_is_within(new_parent, branch)
+                && (new_parent->last_child == branch || mt_move_branch(branch, new_parent));
+            break;
+    }
+    free(string);
+    return replayed;
+}
+
+// Replay the journal file `filename` onto `tree`, counting the records replayed in `out_replayed`
+//
+// Returns:     1 if success, 0 if there was an error
+int __mt_replay_journal(mt_tree* tree, char* filename, size_t* out_replayed)
+{
+    size_t length = 0;
+    unsigned char* in = __mt_journal_read_file(filename, &length);
+    size_t valid_length = (in != NULL) ? __mt_journal_valid_length(in, length) : 0;
+    if (in == NULL) mt_error("Could not read the journal '%s'", filename);
+    else if (valid_length == 0) mt_error("Attempted to replay '%s', which is not a journal", filename);
+    if (__mt_check_error_flag()) { free(in); return 0; }
+
+    __mt_load_all_children(tree);     // Any branch may be named by id
+    size_t replayed = 0;
+    for(size_t position = MT_JOURNAL_HEADER_SIZE; position < valid_length; position += __mt_get_u64(in + position + MT_JOURNAL_RECORD_LENGTH))
+    {
+        if (!__mt_replay_journal_record(tree, in + position))
+        {
+            mt_error("Could not replay record %ld of the journal '%s'", replayed, filename);
+            break;
+        }
+        replayed++;
+    }
+
+    free(in);
+    *out_replayed = replayed;
+    return !__mt_check_error_flag();
+}
+
+// Replay the changes recorded in the journal file `filename` onto the tree of `root`, which should be the snapshot
+// that was taken when the journal was started. Records torn by a crash are ignored, and so are changes that
+// are already in the tree, so a journal can be replayed onto a snapshot taken after some of its changes.
+// Moves are the exception: a branch counts as moved already only if it is the last child of its new parent, so on
+// such a snapshot a branch that had later siblings added after it is moved again, to the end of its siblings.
+// If the tree has a journal open, the replayed changes are recorded in it
+//
+// Returns:     The number of records replayed, or 0 if there was an error
+size_t mt_replay_journal(mt_branch* root, char* filename)
+{
+    if (root == NULL) mt_error("Attempted to replay a journal onto a tree whose root is a null pointer");
+    if (filename == NULL) mt_error("Attempted to replay a journal whose file name is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    size_t replayed = 0;
+    if (!__mt_replay_journal(root->tree, filename, &replayed)) return 0;
+    return replayed;
+}
+
+// Save the tree of `root` as a full snapshot in `snapshot_filename`, then empty its journal, whose changes
+// the snapshot now holds. The snapshot is written to a temporary file which then replaces the old one, so a crash
+// part way through leaves the old snapshot and the journal as they were
+//
+// Returns:     1 if success, 0 if error
+int mt_checkpoint_journal(mt_branch* root, char* snapshot_filename)
+{
+    if (root == NULL)           mt_error("Attempted to checkpoint a tree whose root is a null pointer");
+    else if (!mt_check_is_root(root)) mt_error("Attempted to checkpoint a branch which is not the root of its tree");
+    else if (root->tree->journal == NULL) mt_error("Attempted to checkpoint a tree which does not have a journal");
+    if (snapshot_filename == NULL) mt_error("Attempted to checkpoint a tree to a file name which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_journal* journal = root->tree->journal;
+    if (!__mt_journal_sync(journal)) return 0;
+
+    size_t name_length = strlen(snapshot_filename);
+    char* temporary_filename = malloc(name_length + 5);
+    if (temporary_filename == NULL) mt_error("Could not allocate memory for checkpointing a tree");
+    if (__mt_check_error_flag()) return 0;
+    memcpy(temporary_filename, snapshot_filename, name_length);
+    memcpy(temporary_filename + name_length, ".tmp", 5);
+
+#if defined(_WIN32)
+    int fd = open(temporary_filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+#else
+    int fd = open(temporary_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    int failed = (fd < 0) || mt_write_tree_to_fd(root, fd) == 0 || fsync(fd) != 0;
+    if (fd >= 0) close(fd);
+#if defined(_WIN32)
+    remove(snapshot_filename);      // Windows will not rename over an existing file
+#endif
+    if (!failed) failed = rename(temporary_filename, snapshot_filename) != 0;
+    if (failed) remove(temporary_filename);
+    free(temporary_filename);
+    if (failed) mt_error("Could not write the snapshot '%s'", snapshot_filename);
+    if (__mt_check_error_flag()) return 0;
+
+    // Everything in the journal is in the snapshot now
+    if (ftruncate(journal->fd, MT_JOURNAL_HEADER_SIZE) != 0 || lseek(journal->fd, MT_JOURNAL_HEADER_SIZE, SEEK_SET) != MT_JOURNAL_HEADER_SIZE
+        || fsync(journal->fd) != 0)
+    {
+        pthread_mutex_lock(&journal->lock);
+        journal->failed = 1;
+        pthread_mutex_unlock(&journal->lock);
+        mt_error("Could not empty the journal after saving the snapshot '%s'", snapshot_filename);
+    }
+    if (__mt_check_error_flag()) return 0;
+    return 1;
+}
+
+// Reopen a tree that was being journalled: load the snapshot `snapshot_filename` if it exists, or start a new tree
+// if not, replay the journal `journal_filename` onto it if that exists, and then carry on recording changes in the
+// journal, as `mt_open_journal` does with `commit_window`
+//
+// Returns:     The root of the recovered tree, or NULL if there was an error
+mt_branch* mt_recover_tree(char* snapshot_filename, char* journal_filename, double commit_window)
+{
+    if (snapshot_filename == NULL) mt_error("Attempted to recover a tree from a snapshot whose file name is a null pointer");
+    if (journal_filename == NULL) mt_error("Attempted to recover a tree from a journal whose file name is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_branch* root;
+    FILE* snapshot = fopen(snapshot_filename, "rb");
+    if (snapshot != NULL)
+    {
+        fclose(snapshot);
+        root = mt_map_tree_from_file(NULL, snapshot_filename);
+    }
+    else root = mt_create_root();
+    if (root == NULL) return 0;
+
+    FILE* journal = fopen(journal_filename, "rb");
+    size_t replayed = 0;
+    if (journal != NULL) fclose(journal);
+    if ((journal != NULL && !__mt_replay_journal(root->tree, journal_filename, &replayed))
+        || !mt_open_journal(root, journal_filename, commit_window))
+    {
+        mt_destroy_tree(root);
+        return 0;
+    }
+    return root;
+}
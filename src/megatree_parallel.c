@@ -0,0 +1,435 @@
+#define _POSIX_C_SOURCE 200809L    // For sysconf and sched_yield
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#include "debug.h"
+
+#include "common.h"
+
+
+
+#define ________PARALLEL_TRAVERSAL
+
+// Queries over a whole subtree can be spread over several threads. The subtree is split into tasks, each a branch
+// whose subtree is walked by one thread. A branch with fewer than MT_PARALLEL_TASK_BRANCHES descendants is walked in
+// one go, while a bigger one is handled by itself and its children become tasks of their own. Each thread keeps its
+// tasks in a double-ended queue, taking them from the back of its own queue and, when that runs out, stealing from the
+// front of the others', so the tasks that get stolen are the big ones nearest the top of the tree.
+// The cached totals give every task the position its branch has in a serial depth-first walk, so that queries whose
+// result depends on order find what a serial walk would, and can skip tasks that come after something already found.
+// Subtrees of fewer than MT_PARALLEL_MIN_BRANCHES branches are walked on the calling thread, as are those of trees
+// with branches that have not been loaded or copied yet, since those would have to be created as they are reached.
+// The tree must not change while a parallel query is running. Bringing stale totals up to date writes to the tree, so
+// while other threads may be reading it (see `mt_enable_concurrent_reads`) a subtree whose totals are stale is walked
+// on the calling thread instead, and the query writes nothing
+
+#if INTERFACE
+#define MT_PARALLEL_MIN_BRANCHES 65536     // Subtrees with fewer branches than this are not worth starting threads for
+#define MT_PARALLEL_TASK_BRANCHES 4096     // Branches with fewer descendants than this are walked by one thread
+#define MT_PARALLEL_MAX_THREADS 256
+
+typedef struct mt_parallel_task     // A subtree to be walked by one thread
+{
+    mt_branch* branch;
+    mt_branch* other;               // The branch that `branch` is being compared with, or NULL
+    size_t position;                // The position of `branch` in a depth-first walk of the whole query
+} mt_parallel_task;
+
+typedef struct mt_parallel_queue    // The tasks of one thread. It takes them from the back, and others steal from the front
+{
+    mt_parallel_task* tasks;
+    size_t front;                   // The first task still queued
+    size_t back;                    // One past the last task still queued
+    size_t capacity;
+    int lock;                       // Held while the queue is changed. See `__mt_parallel_lock`
+} mt_parallel_queue;
+
+typedef struct mt_parallel_job      // A query being run by several threads
+{
+    int (*split)(mt_parallel_job* job, mt_parallel_task* task);    // Handles the branch of a task that is split up.
+                                                                    // Returns 0 if its children need not be walked
+    void (*walk)(mt_parallel_job* job, mt_parallel_task* task);    // Handles the branch of a task and all its descendants
+    void* context;                  // Anything the query needs, such as what it is searching for
+    int num_threads;
+    mt_parallel_queue* queues;      // One for each thread
+    size_t outstanding;             // The number of tasks queued or being worked on. The threads finish when it reaches 0
+
+    size_t first_position;          // The position of the earliest branch found so far, or SIZE_MAX
+    mt_branch* first_found;         // The branch found at `first_position`
+    int found_lock;                 // Held while `first_position` and `first_found` are changed
+    size_t max_id;                  // The largest id seen by any thread
+} mt_parallel_job;
+
+typedef struct mt_parallel_worker
+{
+    mt_parallel_job* job;
+    int index;                      // The worker's own queue in `job->queues`
+} mt_parallel_worker;
+#endif
+
+// Take the spin lock `lock`. It is only ever held for the few instructions it takes to change a queue
+void __mt_parallel_lock(int* lock)
+{
+    while(__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+    {
+        while(__atomic_load_n(lock, __ATOMIC_RELAXED));
+    }
+}
+
+// Release the spin lock `lock`
+void __mt_parallel_unlock(int* lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+// Add `task` to the back of `queue`
+//
+// Returns:     1 if success, 0 if the heap is exhausted
+int __mt_parallel_push(mt_parallel_queue* queue, mt_parallel_task* task)
+{
+    __mt_parallel_lock(&queue->lock);
+    if(queue->back == queue->capacity)
+    {
+        // Move what is left to the start first, and only grow the queue if it is more than half full
+        size_t queued = queue->back - queue->front;
+        if(queued > 0) memmove(queue->tasks, queue->tasks + queue->front, queued * sizeof *queue->tasks);
+        __atomic_store_n(&queue->front, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&queue->back, queued, __ATOMIC_RELAXED);
+        if(queued * 2 >= queue->capacity)
+        {
+            size_t capacity = queue->capacity ? queue->capacity * 2 : 64;
+            mt_parallel_task* grown = realloc(queue->tasks, capacity * sizeof *grown);
+            if(grown == NULL) { __mt_parallel_unlock(&queue->lock); return 0; }
+            queue->tasks = grown;
+            queue->capacity = capacity;
+        }
+    }
+    queue->tasks[queue->back] = *task;
+    __atomic_store_n(&queue->back, queue->back + 1, __ATOMIC_RELAXED);
+    __mt_parallel_unlock(&queue->lock);
+    return 1;
+}
+
+// Take the task from the back of `queue`, or with `steal` from the front
+//
+// Returns:     1 if a task was taken, 0 if the queue is empty
+int __mt_parallel_take(mt_parallel_queue* queue, mt_parallel_task* out_task, int steal)
+{
+    if(__atomic_load_n(&queue->back, __ATOMIC_RELAXED) == __atomic_load_n(&queue->front, __ATOMIC_RELAXED)) return 0;
+
+    __mt_parallel_lock(&queue->lock);
+    int taken = (queue->back > queue->front);
+    if(taken && steal)
+    {
+        *out_task = queue->tasks[queue->front];
+        __atomic_store_n(&queue->front, queue->front + 1, __ATOMIC_RELAXED);   // Stored atomically for the check above
+    }
+    else if(taken)
+    {
+        *out_task = queue->tasks[queue->back - 1];
+        __atomic_store_n(&queue->back, queue->back - 1, __ATOMIC_RELAXED);
+    }
+    __mt_parallel_unlock(&queue->lock);
+    return taken;
+}
+
+// Record that the query has found `branch` at `position`, unless it has found something earlier already
+void __mt_parallel_found(mt_parallel_job* job, size_t position, mt_branch* branch)
+{
+    __mt_parallel_lock(&job->found_lock);
+    if(position < job->first_position)
+    {
+        job->first_found = branch;
+        __atomic_store_n(&job->first_position, position, __ATOMIC_RELAXED);
+    }
+    __mt_parallel_unlock(&job->found_lock);
+}
+
+// Check whether the query has already found something before `position`, so that nothing from there on needs walking
+//
+// Returns:     1 if it has, 0 if not
+int __mt_parallel_found_before(mt_parallel_job* job, size_t position)
+{
+    return __atomic_load_n(&job->first_position, __ATOMIC_RELAXED) < position;
+}
+
+// Work on `task` for the worker with queue `index`: walk its subtree if that is small enough,
+// or else handle its branch and queue each of its children as a task of its own
+void __mt_parallel_run_task(mt_parallel_job* job, int index, mt_parallel_task* task)
+{
+    if(__mt_parallel_found_before(job, task->position)) return;
+    if(task->branch->num_descendants < MT_PARALLEL_TASK_BRANCHES) { job->walk(job, task); return; }
+    if(!job->split(job, task)) return;
+
+    // The children are queued last first, so that the first child is the next this worker takes.
+    // Each child's position is worked back from where the subtree of the child after it starts
+    __atomic_add_fetch(&job->outstanding, task->branch->num_children, __ATOMIC_RELAXED);
+    size_t position = task->position + 1 + task->branch->num_descendants;
+    mt_branch* other = (task->other != NULL) ? task->other->last_child : NULL;
+    for(mt_branch* child = task->branch->last_child; child != NULL; child = child->prev_sibling)
+    {
+        position -= 1 + child->num_descendants;
+        mt_parallel_task child_task = { child, other, position };
+        if(!__mt_parallel_push(&job->queues[index], &child_task))     // Out of memory: walk it now instead
+        {
+            job->walk(job, &child_task);
+            __atomic_sub_fetch(&job->outstanding, 1, __ATOMIC_RELEASE);
+        }
+        if(other != NULL) other = other->prev_sibling;
+    }
+}
+
+// Work on the tasks of `context`, an `mt_parallel_worker`, stealing from the other workers when it has none of its own,
+// until every task of the query has been finished
+void* __mt_parallel_worker_thread(void* context)
+{
+    mt_parallel_worker* worker = context;
+    mt_parallel_job* job = worker->job;
+    mt_parallel_task task;
+    while(__atomic_load_n(&job->outstanding, __ATOMIC_ACQUIRE) > 0)
+    {
+        int found = __mt_parallel_take(&job->queues[worker->index], &task, 0);
+        for(int i=1; i<job->num_threads && !found; i++)
+        {
+            found = __mt_parallel_take(&job->queues[(worker->index + i) % job->num_threads], &task, 1);
+        }
+        if(!found)
+        {
+#if !defined(_WIN32)
+            sched_yield();
+#endif
+            continue;
+        }
+
+        __mt_parallel_run_task(job, worker->index, &task);
+        __atomic_sub_fetch(&job->outstanding, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+// Decide how many threads a query over `root` should use, given the `num_threads` asked for, where 0 asks for one
+// on each processor. The totals of `root` are brought up to date, as the tasks are split and placed using them,
+// unless other threads may be reading the tree, when stale totals leave the query on the calling thread
+//
+// Returns:     The number of threads, which is 1 if the query should run on the calling thread
+int __mt_parallel_threads_for(mt_branch* root, int num_threads)
+{
+#if defined(_WIN32)
+    return 1;
+#else
+    mt_tree* tree = root->tree;
+    if(tree->unloaded.count > 0 || tree->shared.count > 0) return 1;
+
+    if(__atomic_load_n(&root->flags, __ATOMIC_RELAXED) & MT_BRANCH_TOTALS_STALE)
+    {
+        if(tree->reclaimer != NULL) return 1;      // Only the thread changing the tree may count them again
+        __mt_totals_update(root);
+    }
+    if(root->num_descendants < MT_PARALLEL_MIN_BRANCHES) return 1;
+
+    if(num_threads <= 0) num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_threads > MT_PARALLEL_MAX_THREADS) num_threads = MT_PARALLEL_MAX_THREADS;
+    return (num_threads > 1) ? num_threads : 1;
+#endif
+}
+
+// Run `job` over the subtree of `root`, compared with `other` if it is not NULL, on `job->num_threads` threads
+// including the calling one. If the threads or their queues cannot be created, the whole subtree is walked on the calling thread
+void __mt_parallel_run(mt_parallel_job* job, mt_branch* root, mt_branch* other)
+{
+    mt_parallel_task root_task = { root, other, 0 };
+    job->first_position = SIZE_MAX;
+    job->first_found = NULL;
+    job->found_lock = 0;
+    job->outstanding = 1;
+
+#if !defined(_WIN32)
+    int num_threads = job->num_threads;
+    job->queues = calloc(num_threads, sizeof *job->queues);
+    mt_parallel_worker* workers = malloc(num_threads * sizeof *workers);
+    pthread_t* threads = malloc(num_threads * sizeof *threads);
+    if(job->queues != NULL && workers != NULL && threads != NULL && __mt_parallel_push(&job->queues[0], &root_task))
+    {
+        int started = 1;
+        for(int i=0; i<num_threads; i++)
+        {
+            workers[i].job = job;
+            workers[i].index = i;
+            if(i == 0) continue;
+            if(pthread_create(&threads[i], NULL, __mt_parallel_worker_thread, &workers[i]) != 0) break;     // The queues of the rest stay empty
+            started++;
+        }
+        __mt_parallel_worker_thread(&workers[0]);
+        for(int i=1; i<started; i++) pthread_join(threads[i], NULL);
+        root_task.branch = NULL;
+    }
+
+    if(job->queues != NULL) for(int i=0; i<num_threads; i++) free(job->queues[i].tasks);
+    free(job->queues);
+    free(workers);
+    free(threads);
+#endif
+    if(root_task.branch != NULL) job->walk(job, &root_task);
+}
+
+
+
+#define ________PARALLEL_QUERIES
+
+// Walk the subtree of `task` for `mt_search_for_label_parallel`, stopping at the first branch with the label being
+// searched for, or where an earlier one has been found. The branch the search started from does not count
+void __mt_parallel_walk_search(mt_parallel_job* job, mt_parallel_task* task)
+{
+    char* label = job->context;
+    size_t position = task->position;
+    for(mt_branch* branch = task->branch; branch != NULL; branch = __mt_next_descendant(branch, task->branch), position++)
+    {
+        if(__mt_parallel_found_before(job, position)) return;
+        if(branch->label == label && position > 0)
+        {
+            __mt_parallel_found(job, position, branch);
+            return;
+        }
+    }
+}
+
+// Check the branch of a task that `mt_search_for_label_parallel` is splitting up
+//
+// Returns:     1 if its children still need to be searched, 0 if it has the label
+int __mt_parallel_split_search(mt_parallel_job* job, mt_parallel_task* task)
+{
+    if(task->branch->label != job->context || task->position == 0) return 1;
+    __mt_parallel_found(job, task->position, task->branch);
+    return 0;
+}
+
+// Find the first occurrence of a branch descending from `root` with the label `label`, as `mt_search_for_label` does,
+// spreading the search over `num_threads` threads, or one per processor if it is 0. Searches of small trees are run on
+// the calling thread. The branch found is always the one that `mt_search_for_label` would find.
+// The tree must not be changed during the search. It may bring the tree's cached totals up to date, so it needs the tree
+// to itself, unless concurrent reads are enabled, when it writes nothing and may run alongside other readers
+//
+// Returns:     The branch, or NULL if there is none
+mt_branch* mt_search_for_label_parallel(mt_branch* root, char* label, int num_threads)
+{
+    if (root == NULL)   mt_error("Attempted to search for a label in a branch which is a null pointer");
+    if (label == NULL)  mt_error("Attempted to search for a label which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    num_threads = __mt_parallel_threads_for(root, num_threads);
+    if (num_threads == 1) return mt_search_for_label(root, label);
+
+    char* interned = __mt_tree_find_label(root->tree, label);
+    if (interned == NULL) return NULL;      // No branch of the tree has this label
+
+    mt_parallel_job job = { .split = __mt_parallel_split_search, .walk = __mt_parallel_walk_search, .context = interned, .num_threads = num_threads };
+    __mt_parallel_run(&job, root, NULL);
+    return job.first_found;
+}
+
+// Raise the maximum id of `job` to `max_id`, unless another thread has seen a larger one
+void __mt_parallel_max_id(mt_parallel_job* job, size_t max_id)
+{
+    size_t current = __atomic_load_n(&job->max_id, __ATOMIC_RELAXED);
+    while(current < max_id && !__atomic_compare_exchange_n(&job->max_id, &current, max_id, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Walk the subtree of `task` for `mt_find_max_id_parallel`
+void __mt_parallel_walk_max_id(mt_parallel_job* job, mt_parallel_task* task)
+{
+    size_t max_id = 0;
+    for(mt_branch* branch = task->branch; branch != NULL; branch = __mt_next_descendant(branch, task->branch))
+    {
+        if(branch->id > max_id) max_id = branch->id;
+    }
+    __mt_parallel_max_id(job, max_id);
+}
+
+// Check the branch of a task that `mt_find_max_id_parallel` is splitting up
+//
+// Returns:     1, as its children always need to be checked too
+int __mt_parallel_split_max_id(mt_parallel_job* job, mt_parallel_task* task)
+{
+    __mt_parallel_max_id(job, task->branch->id);
+    return 1;
+}
+
+// Find the maximum id of `root` and all of its descendants, as `mt_find_max_id` does with no depth limit,
+// spreading the search over `num_threads` threads, or one per processor if it is 0.
+// Searches of small trees are run on the calling thread. The tree must not be changed during the search, and as with
+// `mt_search_for_label_parallel`, it needs the tree to itself unless concurrent reads are enabled
+//
+// `root`       The branch to start searching from
+// `max_id`     The maximum `id` already known
+//
+// Returns:     The larger of `max_id` and the maximum id found
+size_t mt_find_max_id_parallel(mt_branch* root, size_t max_id, int num_threads)
+{
+    if (root == NULL) mt_error("Attempted to find the maximum id below a branch which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    num_threads = __mt_parallel_threads_for(root, num_threads);
+    if (num_threads == 1) return mt_find_max_id(root, max_id, -1);
+
+    mt_parallel_job job = { .split = __mt_parallel_split_max_id, .walk = __mt_parallel_walk_max_id, .num_threads = num_threads, .max_id = max_id };
+    __mt_parallel_run(&job, root, NULL);
+    return job.max_id;
+}
+
+// Walk the subtree of `task` for `mt_check_branches_identical_parallel`, alongside the subtree it is compared with,
+// stopping at the first branch that does not match, or where an earlier one has been found
+void __mt_parallel_walk_identical(mt_parallel_job* job, mt_parallel_task* task)
+{
+    mt_branch* branch_b = task->other;
+    size_t position = task->position;
+    for(mt_branch* branch_a = task->branch; branch_a != NULL; branch_a = __mt_next_descendant(branch_a, task->branch), position++)
+    {
+        if(__mt_parallel_found_before(job, position)) return;
+        if(!__mt_check_branch_matches(branch_a, branch_b))
+        {
+            __mt_parallel_found(job, position, branch_a);
+            return;
+        }
+        branch_b = __mt_next_descendant(branch_b, task->other);
+    }
+}
+
+// Compare the branch of a task that `mt_check_branches_identical_parallel` is splitting up with its counterpart
+//
+// Returns:     1 if they match, so their children need comparing too, 0 if they do not
+int __mt_parallel_split_identical(mt_parallel_job* job, mt_parallel_task* task)
+{
+    if(__mt_check_branch_matches(task->branch, task->other)) return 1;
+    __mt_parallel_found(job, task->position, task->branch);
+    return 0;
+}
+
+// Check whether two branches, and all their sub-branches and data, are identical, as `mt_check_branches_identical`
+// does, spreading the comparison over `num_threads` threads, or one per processor if it is 0. Comparisons of small trees
+// are run on the calling thread. The branch returned is always the one that `mt_check_branches_identical` would return.
+// Neither tree may be changed during the comparison, and as with `mt_search_for_label_parallel`, it needs them to
+// itself unless concurrent reads are enabled
+//
+// Returns:     NULL if the branches are identical, or the first branch found in `branch_a` that does not match
+mt_branch* mt_check_branches_identical_parallel(mt_branch* branch_a, mt_branch* branch_b, int num_threads)
+{
+    if (branch_a == NULL || branch_b == NULL) mt_error("Attempted to compare a branch which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    num_threads = __mt_parallel_threads_for(branch_a, num_threads);
+    if (num_threads > 1 && __mt_parallel_threads_for(branch_b, 2) == 1) num_threads = 1;  // Its branches must all be there too
+    if (num_threads == 1) return mt_check_branches_identical(branch_a, branch_b);
+
+    mt_parallel_job job = { .split = __mt_parallel_split_identical, .walk = __mt_parallel_walk_identical, .num_threads = num_threads };
+    __mt_parallel_run(&job, branch_a, branch_b);
+    return job.first_found;
+}
@@ -0,0 +1,2181 @@
+#define _POSIX_C_SOURCE 200809L    // For mmap
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#else
+#include <io.h>
+#endif
+
+#include "debug.h"
+
+#include "common.h"
+
+
+
+#define ________FILE_FORMAT
+
+// A serialised (sub-)tree is laid out as follows. Every integer is little-endian, and every reference
+// to another part of the file is a byte offset from the start of the file, so a snapshot can be used
+// in place without any pointers being fixed up
+//
+//  Header              MT_FILE_HEADER_SIZE bytes, see the MT_FILE_HEADER_ offsets below
+//  String offsets      `num_strings` u64 offsets, one for each distinct label and data type
+//  Strings             The strings themselves, each followed by a 0 terminator, padded to 8 bytes
+//  Branch records      `num_branches` records of MT_FILE_BRANCH_SIZE bytes, in depth-first order,
+//                      so that the first record is the branch that was serialised
+//  Data                Every branch's data, each starting on a MT_FILE_DATA_ALIGNMENT byte boundary
+//
+// Records find their parent by index, and also store the index just past their last descendant,
+// so that a reader can skip a whole subtree without looking at it
+
+#if INTERFACE
+#define MT_FILE_MAGIC "MEGATREE"
+#define MT_FILE_VERSION 1
+
+#define MT_FILE_HEADER_SIZE             64
+#define MT_FILE_HEADER_MAGIC            0   // 8 bytes: MT_FILE_MAGIC, without a terminator
+#define MT_FILE_HEADER_VERSION          8   // u32: MT_FILE_VERSION
+#define MT_FILE_HEADER_HEADER_SIZE      12  // u32: MT_FILE_HEADER_SIZE
+#define MT_FILE_HEADER_FILE_SIZE        16  // u64: the size of the whole file
+#define MT_FILE_HEADER_NUM_STRINGS      24  // u64: the number of strings
+#define MT_FILE_HEADER_STRINGS          32  // u64: offset of the string offsets
+#define MT_FILE_HEADER_NUM_BRANCHES     40  // u64: the number of branch records
+#define MT_FILE_HEADER_BRANCHES         48  // u64: offset of the first branch record
+#define MT_FILE_HEADER_DATA             56  // u64: offset of the data section
+
+#define MT_FILE_BRANCH_SIZE             48
+#define MT_FILE_BRANCH_ID               0   // u64: the branch's id
+#define MT_FILE_BRANCH_PARENT           8   // u64: index of the parent's record. The first record refers to itself
+#define MT_FILE_BRANCH_SUBTREE_END      16  // u64: index of the first record after this branch's descendants
+#define MT_FILE_BRANCH_LABEL            24  // u32: index of the label in the string offsets
+#define MT_FILE_BRANCH_DATA_TYPE        28  // u32: index of the data type plus one, or 0 if there is none
+#define MT_FILE_BRANCH_DATA_OFFSET      32  // u64: offset of the data, or 0 if there is none
+#define MT_FILE_BRANCH_DATA_SIZE        40  // u64: the size of the data in bytes
+
+#define MT_FILE_DATA_ALIGNMENT          16
+
+// A delta holds the changes made to a tree since an earlier snapshot of it, see `mt_write_delta_to_buffer`.
+// It is laid out in the same way, but its records may also keep a branch of the earlier snapshot as it is
+#define MT_DELTA_MAGIC "MEGADLTA"
+#define MT_FILE_LABEL_KEPT              0xffffffff  // In place of a label: keep the branch with this id as it is
+
+
+typedef struct mt_serialize_plan   // Everything needed to size and write a (sub-)tree, found by one walk through it
+{
+    size_t num_branches;           // Branches in the (sub-)tree
+    size_t num_strings;            // Distinct labels and data types used by them
+    size_t strings_size;           // Bytes taken by the strings, including terminators and padding
+    size_t data_size;              // Bytes taken by the data, including alignment padding
+
+    char** strings;                // The distinct strings, in the order they will be written
+    size_t strings_capacity;       // Space in `strings`
+
+    char** map_keys;               // Hash table from interned string to its index in `strings`
+    size_t* map_values;
+    size_t map_capacity;           // The number of slots. Always a power of 2
+
+    size_t* extents;               // For streams: where the subtree of each branch with children ends, in depth-first order
+    size_t num_extents;
+    size_t extents_capacity;
+} mt_serialize_plan;
+
+typedef struct mt_delta_plan       // The records of a delta, found by one walk through the changes
+{
+    mt_serialize_plan plan;        // The strings and data of the changed branches, and the number of records
+    mt_branch** branches;          // The branch of each record, in depth-first order
+    size_t* parents;               // The index of each record's parent
+    size_t* subtree_ends;          // The index of the first record after each record's descendants
+    size_t capacity;               // Space in each of the arrays
+} mt_delta_plan;
+
+typedef struct mt_tree_checker     // Checks the branch records of a serialised tree one at a time, in order
+{
+    size_t num_branches;
+    size_t num_strings;
+    size_t data_offset;
+    size_t file_size;
+    unsigned char* strings;        // The string offsets followed by the strings, as they are in the file
+    size_t strings_offset;         // Where `strings` starts in the file
+    unsigned char* labels_checked; // Which strings are known to be valid labels
+
+    size_t* open_ends;             // The index just past each subtree that is still open, innermost last
+    size_t* open_indexes;          // And the record each of those subtrees starts at
+    size_t num_open;
+    size_t open_capacity;
+
+    int data_in_order;             // Set if each record's data must directly follow the previous record's, as in a stream
+    size_t data_end;               // Where the previous record's data ended
+    int kept_allowed;              // Set for deltas, whose records may keep a branch as it is with MT_FILE_LABEL_KEPT
+} mt_tree_checker;
+
+
+// Streams. A writer function is handed the bytes of a serialised tree in order, and a reader function is asked for them in order
+typedef int mt_write_function(void* context, void* data, size_t length);          // Returns 1 if all `length` bytes were written, 0 if not
+typedef size_t mt_read_function(void* context, void* out_data, size_t capacity);  // Returns the number of bytes read, or 0 at the end or on error
+
+#define MT_STREAM_BUFFER_SIZE   65536   // Bytes staged before they are written, and bytes of records read at a time
+#define MT_STREAM_GATHER_SIZE   4096    // Payloads at least this big are written from where they are instead of being staged
+#define MT_STREAM_SEGMENTS      64      // The most pieces gathered into one write
+
+typedef struct mt_stream_segment
+{
+    void* address;
+    size_t length;
+} mt_stream_segment;
+
+typedef struct mt_stream_writer    // Where a tree is being written to, and the pieces waiting to be written
+{
+    int fd;                        // The file descriptor to write to, if there is no `write` function
+    mt_write_function* write;
+    void* context;                 // Passed to `write`
+
+    unsigned char* buffer;         // MT_STREAM_BUFFER_SIZE bytes for staging small pieces
+    size_t used;                   // Bytes of `buffer` in use
+    size_t gathered;               // Bytes of `buffer` already added to `segments`
+    mt_stream_segment segments[MT_STREAM_SEGMENTS];
+    int num_segments;
+
+    size_t position;               // Bytes written so far, counting those still waiting
+    int failed;
+} mt_stream_writer;
+
+typedef struct mt_stream_reader    // Where a tree is being read from
+{
+    int fd;                        // The file descriptor to read from, if there is no `read` function
+    mt_read_function* read;
+    void* context;                 // Passed to `read`
+
+    unsigned char* buffer;         // MT_STREAM_BUFFER_SIZE bytes read ahead, so that small pieces do not each need a call
+    size_t start;                  // The bytes of `buffer` which have been read ahead but not used yet
+    size_t end;
+    size_t position;               // Bytes used so far
+    size_t limit;                  // Where the tree ends, which is never read past
+} mt_stream_reader;
+#endif
+
+
+// Round `size` up to a multiple of `alignment`, which must be a power of 2
+size_t __mt_align(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+// Store `value` as a little-endian u64 at `at`
+void __mt_put_u64(unsigned char* at, unsigned long long value)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(at, &value, 8);
+#else
+    for(int i=0; i<8; i++) at[i] = (unsigned char)(value >> (8 * i));
+#endif
+}
+
+// Store `value` as a little-endian u32 at `at`
+void __mt_put_u32(unsigned char* at, unsigned long value)
+{
+    for(int i=0; i<4; i++) at[i] = (unsigned char)(value >> (8 * i));
+}
+
+// Returns:     The little-endian u64 at `at`
+unsigned long long __mt_get_u64(unsigned char* at)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    unsigned long long value;
+    memcpy(&value, at, 8);
+    return value;
+#else
+    unsigned long long value = 0;
+    for(int i=0; i<8; i++) value |= (unsigned long long)at[i] << (8 * i);
+    return value;
+#endif
+}
+
+// Returns:     The little-endian u32 at `at`
+unsigned long __mt_get_u32(unsigned char* at)
+{
+    unsigned long value = 0;
+    for(int i=0; i<4; i++) value |= (unsigned long)at[i] << (8 * i);
+    return value;
+}
+
+
+
+#define ________SERIALIZATION
+
+// Find the index of an interned string in `plan`, adding it if this is the first time it has been seen
+//
+// Returns:     The index, or (size_t)-1 if the heap is exhausted
+size_t __mt_serialize_plan_string(mt_serialize_plan* plan, char* string)
+{
+    if((plan->num_strings + 1) * 10 > plan->map_capacity * 7)   // Keep the load factor below 70%
+    {
+        char** old_keys = plan->map_keys;
+        size_t* old_values = plan->map_values;
+        size_t old_capacity = plan->map_capacity;
+
+        plan->map_capacity = old_capacity ? old_capacity * 2 : 64;
+        plan->map_keys = calloc(plan->map_capacity, sizeof *plan->map_keys);
+        plan->map_values = malloc(plan->map_capacity * sizeof *plan->map_values);
+        char** grown_strings = realloc(plan->strings, plan->map_capacity * sizeof *plan->strings);
+        if(grown_strings != NULL) { plan->strings = grown_strings; plan->strings_capacity = plan->map_capacity; }
+        if(plan->map_keys == NULL || plan->map_values == NULL || grown_strings == NULL)
+        {
+            mt_error("Could not allocate a string map of %ld entries for serialising a tree", plan->map_capacity);
+            free(old_keys);
+            free(old_values);
+            return (size_t)-1;
+        }
+
+        // Labels are interned, so the map can be keyed on their addresses
+        size_t mask = plan->map_capacity - 1;
+        for(size_t i=0; i<old_capacity; i++)
+        {
+            if(old_keys[i] == NULL) continue;
+            size_t slot = __mt_child_index_hash(old_keys[i]) >> 32 & mask;
+            while(plan->map_keys[slot] != NULL) slot = (slot + 1) & mask;
+            plan->map_keys[slot] = old_keys[i];
+            plan->map_values[slot] = old_values[i];
+        }
+        free(old_keys);
+        free(old_values);
+    }
+
+    size_t mask = plan->map_capacity - 1;
+    size_t slot = __mt_child_index_hash(string) >> 32 & mask;
+    while(plan->map_keys[slot] != NULL)
+    {
+        if(plan->map_keys[slot] == string) return plan->map_values[slot];
+        slot = (slot + 1) & mask;
+    }
+
+    plan->map_keys[slot] = string;
+    plan->map_values[slot] = plan->num_strings;
+    plan->strings[plan->num_strings] = string;
+    plan->strings_size += strlen(string) + 1;
+    return plan->num_strings++;
+}
+
+// Walk the (sub-)tree starting at `root`, counting its branches, strings and data
+//
+// Returns:     1 if success, 0 if the heap is exhausted. Either way the plan must be released
+int __mt_serialize_plan_build(mt_serialize_plan* plan, mt_branch* root)
+{
+    memset(plan, 0, sizeof *plan);
+
+    for(mt_branch* branch = root; branch != NULL; branch = __mt_next_descendant(branch, root))
+    {
+        plan->num_branches++;
+        if(__mt_serialize_plan_string(plan, branch->label) == (size_t)-1) return 0;
+        if(branch->data_type != NULL && __mt_serialize_plan_string(plan, branch->data_type) == (size_t)-1) return 0;
+        plan->data_size += __mt_align(branch->data_size, MT_FILE_DATA_ALIGNMENT);
+    }
+
+    plan->strings_size = __mt_align(plan->strings_size, 8);
+    return 1;
+}
+
+// Free the memory used by `plan`
+void __mt_serialize_plan_release(mt_serialize_plan* plan)
+{
+    free(plan->strings);
+    free(plan->map_keys);
+    free(plan->map_values);
+    free(plan->extents);
+    memset(plan, 0, sizeof *plan);
+}
+
+// Find where the index of an interned string is, in a plan that has already been built
+size_t __mt_serialize_plan_find(mt_serialize_plan* plan, char* string)
+{
+    size_t mask = plan->map_capacity - 1;
+    size_t slot = __mt_child_index_hash(string) >> 32 & mask;
+    while(plan->map_keys[slot] != string) slot = (slot + 1) & mask;
+    return plan->map_values[slot];
+}
+
+// Returns:     The offsets of each section of a file written from `plan`, and the size of the whole file
+void __mt_serialize_plan_layout(mt_serialize_plan* plan, size_t* out_strings, size_t* out_branches, size_t* out_data, size_t* out_size)
+{
+    *out_strings = MT_FILE_HEADER_SIZE;
+    *out_branches = *out_strings + plan->num_strings * 8 + plan->strings_size;
+    *out_data = __mt_align(*out_branches + plan->num_branches * MT_FILE_BRANCH_SIZE, MT_FILE_DATA_ALIGNMENT);
+    *out_size = *out_data + plan->data_size;
+}
+
+// Find where the subtree of every branch with children ends, for writers which cannot go back and fill it in.
+// They are kept in depth-first order, one for each branch with children, which is usually far fewer than all of them
+//
+// Returns:     1 if success, 0 if the heap is exhausted
+int __mt_serialize_plan_extents(mt_serialize_plan* plan, mt_branch* root)
+{
+    size_t open_capacity = 64, num_open = 0;
+    size_t* open = malloc(open_capacity * sizeof *open);    // The extents of the subtrees which are still open
+    int failed = (open == NULL);
+
+    size_t index = 0;
+    for(mt_branch* branch = root; branch != NULL && !failed; )
+    {
+        index++;
+        if(branch->first_child != NULL)
+        {
+            if(plan->num_extents == plan->extents_capacity)
+            {
+                size_t capacity = plan->extents_capacity ? plan->extents_capacity * 2 : 64;
+                size_t* grown = realloc(plan->extents, capacity * sizeof *grown);
+                if(grown == NULL) { failed = 1; break; }
+                plan->extents = grown;
+                plan->extents_capacity = capacity;
+            }
+            if(num_open == open_capacity)
+            {
+                size_t* grown = realloc(open, open_capacity * 2 * sizeof *grown);
+                if(grown == NULL) { failed = 1; break; }
+                open = grown;
+                open_capacity *= 2;
+            }
+            open[num_open++] = plan->num_extents++;
+            branch = branch->first_child;
+            continue;
+        }
+
+        // Close off the subtrees that have been finished
+        while(1)
+        {
+            if(branch == root) { branch = NULL; break; }
+            if(branch->next_sibling != NULL) { branch = branch->next_sibling; break; }
+            branch = branch->parent;
+            plan->extents[open[--num_open]] = index;
+        }
+    }
+
+    free(open);
+    if (failed) mt_error("Could not allocate memory for serialising a tree");
+    return !failed;
+}
+
+// Write the header of a file laid out by `plan` to `out`, which must have space for MT_FILE_HEADER_SIZE bytes
+void __mt_put_tree_header(unsigned char* out, mt_serialize_plan* plan)
+{
+    size_t strings_offset, branches_offset, data_offset, file_size;
+    __mt_serialize_plan_layout(plan, &strings_offset, &branches_offset, &data_offset, &file_size);
+
+    memset(out, 0, MT_FILE_HEADER_SIZE);
+    memcpy(out + MT_FILE_HEADER_MAGIC, MT_FILE_MAGIC, 8);
+    __mt_put_u32(out + MT_FILE_HEADER_VERSION, MT_FILE_VERSION);
+    __mt_put_u32(out + MT_FILE_HEADER_HEADER_SIZE, MT_FILE_HEADER_SIZE);
+    __mt_put_u64(out + MT_FILE_HEADER_FILE_SIZE, file_size);
+    __mt_put_u64(out + MT_FILE_HEADER_NUM_STRINGS, plan->num_strings);
+    __mt_put_u64(out + MT_FILE_HEADER_STRINGS, strings_offset);
+    __mt_put_u64(out + MT_FILE_HEADER_NUM_BRANCHES, plan->num_branches);
+    __mt_put_u64(out + MT_FILE_HEADER_BRANCHES, branches_offset);
+    __mt_put_u64(out + MT_FILE_HEADER_DATA, data_offset);
+}
+
+// Write the string offsets and strings of a file laid out by `plan` to `out`, which holds the whole file
+void __mt_put_string_table(unsigned char* out, mt_serialize_plan* plan)
+{
+    size_t strings_offset, branches_offset, data_offset, file_size;
+    __mt_serialize_plan_layout(plan, &strings_offset, &branches_offset, &data_offset, &file_size);
+
+    // String offsets, then the strings themselves
+    size_t string_cursor = strings_offset + plan->num_strings * 8;
+    for(size_t i=0; i<plan->num_strings; i++)
+    {
+        __mt_put_u64(out + strings_offset + i * 8, string_cursor);
+        string_cursor += strlen(plan->strings[i]) + 1;
+    }
+    unsigned char* string_out = out + strings_offset + plan->num_strings * 8;
+    for(size_t i=0; i<plan->num_strings; i++)
+    {
+        size_t length = strlen(plan->strings[i]) + 1;
+        memcpy(string_out, plan->strings[i], length);
+        string_out += length;
+    }
+    memset(string_out, 0, out + branches_offset - string_out);    // Padding
+}
+
+// Write the record of `branch` to `record`, which must have space for MT_FILE_BRANCH_SIZE bytes
+//
+// `parent`         The index of the parent's record
+// `subtree_end`    The index of the first record after the branch's descendants
+// `data_offset`    Where the branch's data will be written, if it has any
+void __mt_put_branch_record(unsigned char* record, mt_serialize_plan* plan, mt_branch* branch, size_t parent, size_t subtree_end, size_t data_offset)
+{
+    __mt_put_u64(record + MT_FILE_BRANCH_ID, branch->id);
+    __mt_put_u64(record + MT_FILE_BRANCH_PARENT, parent);
+    __mt_put_u64(record + MT_FILE_BRANCH_SUBTREE_END, subtree_end);
+    __mt_put_u32(record + MT_FILE_BRANCH_LABEL, __mt_serialize_plan_find(plan, branch->label));
+    __mt_put_u32(record + MT_FILE_BRANCH_DATA_TYPE, branch->data_type ? __mt_serialize_plan_find(plan, branch->data_type) + 1 : 0);
+    __mt_put_u64(record + MT_FILE_BRANCH_DATA_OFFSET, branch->data_size > 0 ? data_offset : 0);
+    __mt_put_u64(record + MT_FILE_BRANCH_DATA_SIZE, branch->data_size);
+}
+
+
+// Calculate the total size in bytes of the tree, if serialised.
+// This walks the tree to count its branches, strings and data, but nothing is written
+// This is useful for allocating a buffer to write
+//
+// `root`       The branch to start serialising at
+//
+// Returns:     The total size of the tree in bytes, or 0 if error
+size_t mt_get_tree_file_size(mt_branch* root)
+{
+    if (root == NULL) mt_error("Attempted to get the file size of a tree whose root is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_serialize_plan plan;
+    size_t strings_offset, branches_offset, data_offset, file_size = 0;
+    if(__mt_serialize_plan_build(&plan, root))
+    {
+        __mt_serialize_plan_layout(&plan, &strings_offset, &branches_offset, &data_offset, &file_size);
+    }
+    __mt_serialize_plan_release(&plan);
+    return file_size;
+}
+
+// Write the (sub-)tree starting at `root` to the buffer `out_buffer`, up to a maximum of `out_capacity` bytes
+// The buffer is written from start to end in a single pass, and must be at least `mt_get_tree_file_size` bytes
+//
+// Returns:     The number of bytes written, or 0 if error
+size_t mt_write_tree_to_buffer(mt_branch* root, void* out_buffer, size_t out_capacity)
+{
+    if (root == NULL)       mt_error("Attempted to write a tree whose root is a null pointer to a buffer");
+    if (out_buffer == NULL) mt_error("Attempted to write a tree to a buffer which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_serialize_plan plan;
+    size_t strings_offset, branches_offset, data_offset, file_size;
+    if(!__mt_serialize_plan_build(&plan, root)) { __mt_serialize_plan_release(&plan); return 0; }
+    __mt_serialize_plan_layout(&plan, &strings_offset, &branches_offset, &data_offset, &file_size);
+
+    if (file_size > out_capacity) mt_error("Attempted to write a tree of %ld bytes to a buffer of %ld bytes", file_size, out_capacity);
+    if (__mt_check_error_flag()) { __mt_serialize_plan_release(&plan); return 0; }
+
+    unsigned char* out = out_buffer;
+    __mt_put_tree_header(out, &plan);
+    __mt_put_string_table(out, &plan);
+
+    // Branch records and their data. The index of each record's parent is found by remembering the index of
+    // every ancestor of the current branch, which needs space for the depth of the tree rather than for every branch
+    size_t ancestors_capacity = 64;
+    size_t* ancestors = malloc(ancestors_capacity * sizeof *ancestors);
+    if (ancestors == NULL) mt_error("Could not allocate memory for serialising a tree");
+    if (__mt_check_error_flag()) { __mt_serialize_plan_release(&plan); return 0; }
+
+    unsigned char* record = out + branches_offset;
+    size_t data_cursor = data_offset;
+    size_t index = 0;
+    size_t depth = 0;
+    for(mt_branch* branch = root; branch != NULL; )
+    {
+        if(depth == ancestors_capacity)
+        {
+            ancestors_capacity *= 2;
+            size_t* grown = realloc(ancestors, ancestors_capacity * sizeof *ancestors);
+            if (grown == NULL) mt_error("Could not allocate memory for serialising a tree");
+            if (__mt_check_error_flag()) { free(ancestors); __mt_serialize_plan_release(&plan); return 0; }
+            ancestors = grown;
+        }
+        ancestors[depth] = index;
+
+        // The end of the subtree is filled in once the last descendant has been written
+        __mt_put_branch_record(record, &plan, branch, depth > 0 ? ancestors[depth - 1] : 0, 0, data_cursor);
+        if(branch->data_size > 0)   // The data section is filled in step with the records
+        {
+            size_t padded_size = __mt_align(branch->data_size, MT_FILE_DATA_ALIGNMENT);
+            memcpy(out + data_cursor, branch->data, branch->data_size);
+            memset(out + data_cursor + branch->data_size, 0, padded_size - branch->data_size);
+            data_cursor += padded_size;
+        }
+        record += MT_FILE_BRANCH_SIZE;
+        index++;
+
+        // Move on to the next branch in depth-first order, closing off the subtrees that have been finished
+        if(branch->first_child != NULL) { branch = branch->first_child; depth++; continue; }
+        while(1)
+        {
+            __mt_put_u64(out + branches_offset + ancestors[depth] * MT_FILE_BRANCH_SIZE + MT_FILE_BRANCH_SUBTREE_END, index);
+            if(branch == root) { branch = NULL; break; }
+            if(branch->next_sibling != NULL) { branch = branch->next_sibling; break; }
+            branch = branch->parent;
+            depth--;
+        }
+    }
+    free(ancestors);
+    memset(record, 0, out + data_offset - record);     // Padding
+
+    __mt_serialize_plan_release(&plan);
+    return file_size;
+}
+
+
+// Raise an error if the header `in` of a serialised tree is damaged.
+// `available` is the most bytes the whole tree can take up, or (size_t)-1 if that is not known in advance
+void __mt_check_tree_header(unsigned char* in, size_t available)
+{
+    size_t file_size = __mt_get_u64(in + MT_FILE_HEADER_FILE_SIZE);
+    size_t num_strings = __mt_get_u64(in + MT_FILE_HEADER_NUM_STRINGS);
+    size_t strings_offset = __mt_get_u64(in + MT_FILE_HEADER_STRINGS);
+    size_t num_branches = __mt_get_u64(in + MT_FILE_HEADER_NUM_BRANCHES);
+    size_t branches_offset = __mt_get_u64(in + MT_FILE_HEADER_BRANCHES);
+    size_t data_offset = __mt_get_u64(in + MT_FILE_HEADER_DATA);
+
+    if (__mt_get_u32(in + MT_FILE_HEADER_VERSION) != MT_FILE_VERSION)
+        mt_error("Attempted to load a tree saved in version %ld of the file format. Only version %d can be loaded", __mt_get_u32(in + MT_FILE_HEADER_VERSION), MT_FILE_VERSION);
+    else if (file_size > available) mt_error("Attempted to load a tree of %ld bytes from a buffer of %ld bytes", file_size, available);
+    else if (__mt_get_u32(in + MT_FILE_HEADER_HEADER_SIZE) != MT_FILE_HEADER_SIZE || strings_offset != MT_FILE_HEADER_SIZE
+        || num_strings > file_size / 8 || num_branches == 0 || num_branches > file_size / MT_FILE_BRANCH_SIZE
+        || branches_offset < strings_offset + num_strings * 8 || branches_offset > file_size
+        || data_offset < branches_offset + num_branches * MT_FILE_BRANCH_SIZE || data_offset > file_size)
+        mt_error("Attempted to load a tree whose header is damaged");
+}
+
+// Start checking the branch records of the serialised tree whose header is `header`. `strings` is its string offsets
+// followed by the strings, which every string must lie within and be terminated in
+//
+// Returns:     1 if the strings are valid, 0 if not. Either way the checker must be released
+int __mt_tree_checker_init(mt_tree_checker* checker, unsigned char* header, unsigned char* strings)
+{
+    memset(checker, 0, sizeof *checker);
+    checker->file_size = __mt_get_u64(header + MT_FILE_HEADER_FILE_SIZE);
+    checker->num_strings = __mt_get_u64(header + MT_FILE_HEADER_NUM_STRINGS);
+    checker->num_branches = __mt_get_u64(header + MT_FILE_HEADER_NUM_BRANCHES);
+    checker->data_offset = __mt_get_u64(header + MT_FILE_HEADER_DATA);
+    checker->data_end = checker->data_offset;
+    checker->strings = strings;
+    checker->strings_offset = __mt_get_u64(header + MT_FILE_HEADER_STRINGS);
+    size_t branches_offset = __mt_get_u64(header + MT_FILE_HEADER_BRANCHES);
+
+    checker->open_capacity = 64;
+    checker->open_ends = malloc(checker->open_capacity * sizeof *checker->open_ends);
+    checker->open_indexes = malloc(checker->open_capacity * sizeof *checker->open_indexes);
+    checker->labels_checked = calloc(checker->num_strings ? checker->num_strings : 1, 1);
+    int failed = 0;
+    if (checker->open_ends == NULL || checker->open_indexes == NULL || checker->labels_checked == NULL)
+    {
+        mt_error("Could not allocate memory for loading a tree");
+        failed = 1;
+    }
+
+    for(size_t i=0; i<checker->num_strings && !failed; i++)
+    {
+        size_t offset = __mt_get_u64(strings + i * 8);
+        if(offset < checker->strings_offset + checker->num_strings * 8 || offset >= branches_offset
+            || memchr(strings + (offset - checker->strings_offset), 0, branches_offset - offset) == NULL)
+        {
+            mt_error("Attempted to load a tree whose string %ld is outside the string table", i);
+            failed = 1;
+        }
+    }
+
+    __mt_check_error_flag();    // Failures are reported through the return value
+    return !failed;
+}
+
+// Returns:     String `index` of the tree being checked
+char* __mt_tree_checker_string(mt_tree_checker* checker, size_t index)
+{
+    return (char*)checker->strings + (__mt_get_u64(checker->strings + index * 8) - checker->strings_offset);
+}
+
+// Check `record`, which must be record `i` of the tree. Records must be checked in order, and must form
+// a single tree in depth-first order, which is checked by keeping track of which subtrees are still open.
+// Afterwards, the record's own subtree is the innermost open one
+//
+// Returns:     1 if the record is valid, 0 if not
+int __mt_tree_checker_record(mt_tree_checker* checker, unsigned char* record, size_t i)
+{
+    size_t parent = __mt_get_u64(record + MT_FILE_BRANCH_PARENT);
+    size_t subtree_end = __mt_get_u64(record + MT_FILE_BRANCH_SUBTREE_END);
+    size_t label = __mt_get_u32(record + MT_FILE_BRANCH_LABEL);
+    size_t data_type = __mt_get_u32(record + MT_FILE_BRANCH_DATA_TYPE);
+    size_t data_offset = __mt_get_u64(record + MT_FILE_BRANCH_DATA_OFFSET);
+    size_t data_size = __mt_get_u64(record + MT_FILE_BRANCH_DATA_SIZE);
+    int kept = checker->kept_allowed && label == MT_FILE_LABEL_KEPT;
+
+    while(checker->num_open > 0 && checker->open_ends[checker->num_open - 1] <= i) checker->num_open--;
+    size_t num_open = checker->num_open;
+    size_t parent_end = (num_open > 0) ? checker->open_ends[num_open - 1] : checker->num_branches;
+
+    int failed = 1;
+    if (i == 0 ? (parent != 0 || subtree_end != checker->num_branches) : (num_open == 0 || parent != checker->open_indexes[num_open - 1]))
+        mt_error("Attempted to load a tree whose branch record %ld is not in depth-first order", i);
+    else if (subtree_end <= i || subtree_end > parent_end) mt_error("Attempted to load a tree whose branch record %ld has an invalid subtree", i);
+    else if (kept ? (data_type != 0 || data_size != 0) : (label >= checker->num_strings || data_type > checker->num_strings))
+        mt_error("Attempted to load a tree whose branch record %ld has an invalid string", i);
+    else if (data_size > 0 && (data_offset < checker->data_offset || data_offset > checker->file_size
+        || data_size > checker->file_size - data_offset)) mt_error("Attempted to load a tree whose branch record %ld has data outside the file", i);
+    else if (data_size > 0 && checker->data_in_order && data_offset != __mt_align(checker->data_end, MT_FILE_DATA_ALIGNMENT))
+        mt_error("Attempted to load a tree from a stream whose branch record %ld has data out of order", i);
+    else if (!kept && !checker->labels_checked[label] && (__mt_tree_checker_string(checker, label)[0] == 0 || !mt_check_label_valid(__mt_tree_checker_string(checker, label))))
+        mt_error("Attempted to load a tree with the invalid label '%s'", __mt_tree_checker_string(checker, label));
+    else failed = 0;
+
+    if (!failed)
+    {
+        if (!kept) checker->labels_checked[label] = 1;
+        if (data_size > 0) checker->data_end = data_offset + data_size;
+
+        if (num_open == checker->open_capacity)
+        {
+            size_t* grown_ends = realloc(checker->open_ends, num_open * 2 * sizeof *grown_ends);
+            if (grown_ends != NULL) checker->open_ends = grown_ends;
+            size_t* grown_indexes = realloc(checker->open_indexes, num_open * 2 * sizeof *grown_indexes);
+            if (grown_indexes != NULL) checker->open_indexes = grown_indexes;
+            if (grown_ends == NULL || grown_indexes == NULL) { mt_error("Could not allocate memory for loading a tree"); failed = 1; }
+            else checker->open_capacity *= 2;
+        }
+    }
+    if (!failed)
+    {
+        checker->open_ends[num_open] = subtree_end;
+        checker->open_indexes[num_open] = i;
+        checker->num_open++;
+    }
+
+    __mt_check_error_flag();    // Failures are reported through the return value
+    return !failed;
+}
+
+// Free the memory used by `checker`
+void __mt_tree_checker_release(mt_tree_checker* checker)
+{
+    free(checker->open_ends);
+    free(checker->open_indexes);
+    free(checker->labels_checked);
+    memset(checker, 0, sizeof *checker);
+}
+
+// Check the string table and branch records of a serialised tree before anything is loaded from it,
+// so that a damaged or hostile buffer is rejected as a whole rather than half loaded.
+// Counts how many labels and data types use each string into `out_references`, which must hold `num_strings` entries.
+// If `is_delta` is set, records may also keep a branch as it is, see `mt_write_delta_to_buffer`
+//
+// Returns:     1 if the buffer holds a valid tree, 0 if not
+int __mt_validate_tree_buffer(unsigned char* in, size_t* out_references, int is_delta)
+{
+    size_t num_strings = __mt_get_u64(in + MT_FILE_HEADER_NUM_STRINGS);
+    size_t num_branches = __mt_get_u64(in + MT_FILE_HEADER_NUM_BRANCHES);
+    size_t branches_offset = __mt_get_u64(in + MT_FILE_HEADER_BRANCHES);
+    for(size_t i=0; i<num_strings; i++) out_references[i] = 0;
+
+    mt_tree_checker checker;
+    int failed = !__mt_tree_checker_init(&checker, in, in + __mt_get_u64(in + MT_FILE_HEADER_STRINGS));
+    checker.kept_allowed = is_delta;
+    for(size_t i=0; i<num_branches && !failed; i++)
+    {
+        unsigned char* record = in + branches_offset + i * MT_FILE_BRANCH_SIZE;
+        if (!__mt_tree_checker_record(&checker, record, i)) { failed = 1; break; }
+        if (__mt_get_u32(record + MT_FILE_BRANCH_LABEL) == MT_FILE_LABEL_KEPT && is_delta) continue;
+
+        size_t data_type = __mt_get_u32(record + MT_FILE_BRANCH_DATA_TYPE);
+        out_references[__mt_get_u32(record + MT_FILE_BRANCH_LABEL)]++;
+        if (data_type > 0) out_references[data_type - 1]++;
+    }
+
+    __mt_tree_checker_release(&checker);
+    return !failed;
+}
+
+// Create the branch for a loaded record under `parent`, keeping the id it was saved with if no other branch has it.
+// The first record of a tree loaded as a new tree is not created, but takes the place of that tree's root `replaced_root`.
+// The label is set before the branch is linked, so that `parent`'s index of children files it under that label
+//
+// `label`, `data_type`     Interned strings whose references the branch takes over
+//
+// Returns:     The branch, whose data is still to be filled in, or NULL if the heap is exhausted
+mt_branch* __mt_load_branch(mt_tree* tree, mt_branch* parent, unsigned char* record, mt_branch* replaced_root, char* label, char* data_type)
+{
+    if (replaced_root != NULL)
+    {
+        __mt_label_index_remove(replaced_root);
+        __mt_tree_release_string(tree, replaced_root->label);
+        replaced_root->label = label;
+        __mt_label_index_add(replaced_root);
+        replaced_root->data_type = data_type;
+        __mt_clear_flags(replaced_root, MT_BRANCH_CHANGED | MT_BRANCH_CHANGED_BELOW);   // The new tree is just as it was saved
+        return replaced_root;
+    }
+
+    mt_branch* branch = __mt_pool_alloc(&tree->branch_pool);
+    if (branch == NULL) return NULL;
+    branch->tree = tree;
+    if (!__mt_tree_register_branch_as(tree, branch, __mt_get_u64(record + MT_FILE_BRANCH_ID)))
+    {
+        __mt_pool_free(&tree->branch_pool, branch);
+        return NULL;
+    }
+
+    branch->label = label;
+    branch->data_type = data_type;
+    __mt_label_index_add(branch);
+    __mt_link_child(parent, branch);
+    return branch;
+}
+
+// Mark a tree that has just been loaded into the existing branch `new_parent` as changed, all the way down,
+// since none of it is in any earlier snapshot of the tree it now belongs to
+void __mt_mark_loaded_changed(mt_branch* new_parent, mt_branch* loaded_root)
+{
+    for(mt_branch* branch = loaded_root; branch != NULL; branch = __mt_next_descendant(branch, loaded_root)) __mt_set_flags(branch, MT_BRANCH_CHANGED);
+    __mt_mark_changed(new_parent);
+}
+
+// Give a loaded `branch` the data its `record` describes, from the serialised tree `in`.
+// With `zero_copy`, `in` is a mapped file and the data is left where it is, to be paged in when it is used
+//
+// Returns:     1 if success, 0 if the heap is exhausted
+int __mt_load_branch_data(mt_branch* branch, unsigned char* in, unsigned char* record, int zero_copy)
+{
+    size_t data_size = __mt_get_u64(record + MT_FILE_BRANCH_DATA_SIZE);
+    unsigned char* data = in + __mt_get_u64(record + MT_FILE_BRANCH_DATA_OFFSET);
+    if (data_size == 0) return 1;
+
+    if (zero_copy) __mt_set_data_storage(branch, data, data_size, MT_DATA_MAPPED);
+    else if (data_size > MT_INLINE_DATA_SIZE)
+    {
+        void* copy = malloc(data_size);
+        if (copy == NULL) { mt_error("Could not allocate %ld bytes for a branch's data", data_size); return 0; }
+        memcpy(copy, data, data_size);
+        __mt_set_data_storage(branch, copy, data_size, MT_DATA_HEAP);
+    }
+    else
+    {
+        memcpy(branch->inline_data, data, data_size);
+        __mt_set_data_storage(branch, NULL, data_size, MT_DATA_INLINE);
+    }
+    return 1;
+}
+
+// Read the (sub-)tree from the buffer `in_buffer`, up to a maximum of `buffer_length` bytes,
+// re-create the tree structure including all data fields, and attatch this tree as a child of
+// the branch `new_parent`. If `new_parent` is NULL, the loaded tree becomes a new tree of its own
+// Branches keep the ids they were saved with, unless another branch of the tree already has that id.
+// The data is copied out of the buffer, which can be freed once the tree has been loaded
+//
+// Returns:  a pointer to the root of the newly-loaded tree that has been attatched to `new_parent`
+//           or NULL if there was an error.
+mt_branch* mt_load_tree_from_buffer(mt_branch* new_parent, void* in_buffer, size_t buffer_length)
+{
+    return __mt_load_tree(new_parent, in_buffer, buffer_length, NULL);
+}
+
+// Load a tree from `in_buffer` as `mt_load_tree_from_buffer` does. If `mapping` is given, the buffer is that
+// mapped snapshot, and the loaded labels and data point straight into it instead of being copied.
+// The mapping is handed over: it belongs to the tree afterwards, or is released if nothing was loaded
+//
+// Returns:     The root of the loaded tree, or NULL if there was an error
+mt_branch* __mt_load_tree(mt_branch* new_parent, void* in_buffer, size_t buffer_length, mt_mapping* mapping)
+{
+    unsigned char* in = in_buffer;
+    int zero_copy = (mapping != NULL);
+    if (in == NULL) mt_error("Attempted to load a tree from a buffer which is a null pointer");
+    else if (buffer_length < MT_FILE_HEADER_SIZE || memcmp(in + MT_FILE_HEADER_MAGIC, MT_FILE_MAGIC, 8) != 0)
+        mt_error("Attempted to load a tree from a buffer which does not contain a tree");
+    else __mt_check_tree_header(in, buffer_length);
+    if (__mt_check_error_flag()) { __mt_release_mapping(mapping); return 0; }
+    if (new_parent != NULL) __mt_unshare_path(new_parent);     // Copies of `new_parent` keep the children it has now
+
+    size_t num_strings = __mt_get_u64(in + MT_FILE_HEADER_NUM_STRINGS);
+    size_t strings_offset = __mt_get_u64(in + MT_FILE_HEADER_STRINGS);
+    size_t num_branches = __mt_get_u64(in + MT_FILE_HEADER_NUM_BRANCHES);
+    size_t branches_offset = __mt_get_u64(in + MT_FILE_HEADER_BRANCHES);
+
+    size_t* references = malloc((num_strings ? num_strings : 1) * sizeof *references);
+    char** interned = malloc((num_strings ? num_strings : 1) * sizeof *interned);
+    size_t open_capacity = 64, num_open = 0;
+    size_t* open_ends = malloc(open_capacity * sizeof *open_ends);
+    mt_branch** open_branches = malloc(open_capacity * sizeof *open_branches);
+    int failed = 0;
+    if (references == NULL || interned == NULL || open_ends == NULL || open_branches == NULL)
+    {
+        mt_error("Could not allocate memory for loading a tree");
+        failed = 1;
+    }
+
+    mt_branch* loaded_root = NULL;
+    if (!failed && __mt_validate_tree_buffer(in, references, 0))
+    {
+        // Intern each string once, for all the branches that use it
+        mt_tree* tree;
+        if (new_parent == NULL)
+        {
+            loaded_root = mt_create_root();
+            tree = loaded_root ? loaded_root->tree : NULL;
+        }
+        else tree = new_parent->tree;
+
+        if (tree == NULL || !__mt_id_index_reserve(tree, tree->id_index.count + num_branches)) failed = 1;
+        else if (mapping != NULL)   // The tree keeps the mapping for as long as anything might point into it
+        {
+            mapping->next = tree->mappings;
+            tree->mappings = mapping;
+            mapping = NULL;
+        }
+
+        for(size_t i=0; i<num_strings && !failed; i++)
+        {
+            char* string = (char*)in + __mt_get_u64(in + strings_offset + i * 8);
+            interned[i] = references[i] ? __mt_tree_intern_string_references(tree, string, references[i], zero_copy) : NULL;
+            if (references[i] && interned[i] == NULL) failed = 1;
+        }
+
+        for(size_t i=0; i<num_branches && !failed; i++)
+        {
+            unsigned char* record = in + branches_offset + i * MT_FILE_BRANCH_SIZE;
+            size_t data_type = __mt_get_u32(record + MT_FILE_BRANCH_DATA_TYPE);
+
+            while(num_open > 0 && open_ends[num_open - 1] <= i) num_open--;
+            mt_branch* branch = __mt_load_branch(tree, num_open > 0 ? open_branches[num_open - 1] : new_parent, record,
+                (i == 0 && new_parent == NULL) ? loaded_root : NULL, interned[__mt_get_u32(record + MT_FILE_BRANCH_LABEL)],
+                data_type ? interned[data_type - 1] : NULL);
+            if (branch == NULL) { failed = 1; break; }
+            if (i == 0) loaded_root = branch;
+
+            if (!__mt_load_branch_data(branch, in, record, zero_copy)) { failed = 1; break; }
+
+            if (num_open == open_capacity)
+            {
+                open_capacity *= 2;
+                size_t* grown_ends = realloc(open_ends, open_capacity * sizeof *open_ends);
+                if (grown_ends != NULL) open_ends = grown_ends;
+                mt_branch** grown_branches = realloc(open_branches, open_capacity * sizeof *open_branches);
+                if (grown_branches != NULL) open_branches = grown_branches;
+                if (grown_ends == NULL || grown_branches == NULL) { mt_error("Could not allocate memory for loading a tree"); failed = 1; break; }
+            }
+            open_ends[num_open] = __mt_get_u64(record + MT_FILE_BRANCH_SUBTREE_END);
+            open_branches[num_open++] = branch;
+        }
+
+        // If the heap ran out part way through, give back everything that was loaded. Strings that were
+        // interned for branches which were never created stay in the tree until it is destroyed
+        if (failed && loaded_root != NULL)
+        {
+            __mt_check_error_flag();    // The error has been reported, and must not stop the clean-up
+            if (new_parent == NULL) mt_destroy_tree(loaded_root);
+            else mt_delete_branch(loaded_root);
+            loaded_root = NULL;
+        }
+        else if (new_parent != NULL && loaded_root != NULL) __mt_mark_loaded_changed(new_parent, loaded_root);
+    }
+
+    free(references);
+    free(interned);
+    free(open_ends);
+    free(open_branches);
+    __mt_release_mapping(mapping);
+    __mt_check_error_flag();    // Failures are reported by returning NULL
+    return loaded_root;
+}
+
+
+#define ________STREAMS
+
+// Write every piece `writer` is holding, in order, and empty its buffer
+void __mt_stream_flush(mt_stream_writer* writer)
+{
+    if(writer->used > writer->gathered)     // There is always room for this, see `__mt_stream_gather`
+    {
+        writer->segments[writer->num_segments].address = writer->buffer + writer->gathered;
+        writer->segments[writer->num_segments].length = writer->used - writer->gathered;
+        writer->num_segments++;
+    }
+
+    if(!writer->failed && writer->num_segments > 0)
+    {
+        if(writer->write != NULL)
+        {
+            for(int i=0; i<writer->num_segments && !writer->failed; i++)
+            {
+                if(!writer->write(writer->context, writer->segments[i].address, writer->segments[i].length)) writer->failed = 1;
+            }
+        }
+        else writer->failed = !__mt_write_segments_to_fd(writer->fd, writer->segments, writer->num_segments);
+    }
+
+    writer->num_segments = 0;
+    writer->used = 0;
+    writer->gathered = 0;
+}
+
+// Write `segments` to `fd` with as few system calls as possible, carrying on after partial writes
+//
+// Returns:     1 if success, 0 if error
+int __mt_write_segments_to_fd(int fd, mt_stream_segment* segments, int num_segments)
+{
+#if defined(_WIN32)
+    for(int i=0; i<num_segments; i++)
+    {
+        char* from = segments[i].address;
+        size_t remaining = segments[i].length;
+        while(remaining > 0)
+        {
+            int written = write(fd, from, remaining > 0x40000000 ? 0x40000000 : (unsigned)remaining);
+            if (written <= 0) return 0;
+            from += written;
+            remaining -= written;
+        }
+    }
+    return 1;
+#else
+    struct iovec vectors[MT_STREAM_SEGMENTS];
+    for(int i=0; i<num_segments; i++)
+    {
+        vectors[i].iov_base = segments[i].address;
+        vectors[i].iov_len = segments[i].length;
+    }
+
+    struct iovec* next = vectors;
+    while(num_segments > 0)
+    {
+        ssize_t written = writev(fd, next, num_segments);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return 0;
+
+        while(num_segments > 0 && (size_t)written >= next->iov_len) { written -= next->iov_len; next++; num_segments--; }
+        if (num_segments > 0) { next->iov_base = (char*)next->iov_base + written; next->iov_len -= written; }
+    }
+    return 1;
+#endif
+}
+
+// Queue the `length` bytes at `address` to be written by `writer` from where they are, without copying them.
+// They must stay there until the writer is flushed
+void __mt_stream_gather(mt_stream_writer* writer, void* address, size_t length)
+{
+    if(length == 0) return;
+    writer->segments[writer->num_segments].address = address;
+    writer->segments[writer->num_segments].length = length;
+    writer->num_segments++;
+
+    // Keep a segment free for whatever is staged in the buffer
+    if(writer->num_segments >= MT_STREAM_SEGMENTS - 1) __mt_stream_flush(writer);
+}
+
+// Write the `length` bytes at `data` through `writer`. Small pieces are copied into its buffer,
+// and pieces of MT_STREAM_GATHER_SIZE bytes or more are gathered from where they are
+void __mt_stream_write(mt_stream_writer* writer, void* data, size_t length)
+{
+    writer->position += length;
+    if(writer->failed) return;
+
+    if(length >= MT_STREAM_GATHER_SIZE)
+    {
+        size_t staged = writer->gathered;   // Whatever was staged before it has to be written first
+        writer->gathered = writer->used;
+        __mt_stream_gather(writer, writer->buffer + staged, writer->used - staged);
+        __mt_stream_gather(writer, data, length);
+        return;
+    }
+
+    unsigned char* from = data;
+    while(length > 0)
+    {
+        if(writer->used == MT_STREAM_BUFFER_SIZE) __mt_stream_flush(writer);
+        size_t part = MT_STREAM_BUFFER_SIZE - writer->used;
+        if(part > length) part = length;
+        memcpy(writer->buffer + writer->used, from, part);
+        writer->used += part;
+        from += part;
+        length -= part;
+    }
+}
+
+// Write zeros through `writer` until it reaches the offset `to`
+void __mt_stream_pad(mt_stream_writer* writer, size_t to)
+{
+    static unsigned char zeros[MT_FILE_DATA_ALIGNMENT];
+    while(writer->position < to)
+    {
+        size_t part = to - writer->position;
+        __mt_stream_write(writer, zeros, part < sizeof zeros ? part : sizeof zeros);
+    }
+}
+
+// Write the (sub-)tree starting at `root` through `writer`. The bytes are the same as `mt_write_tree_to_buffer` writes,
+// but no more than MT_STREAM_BUFFER_SIZE of them are held at a time. Records are written in one walk through the tree
+// and data in a second, so neither has to be gone back to
+//
+// Returns:     The number of bytes written, or 0 if error
+size_t __mt_write_tree_to_stream(mt_branch* root, mt_stream_writer* writer)
+{
+    mt_serialize_plan plan;
+    size_t strings_offset, branches_offset, data_offset, file_size = 0;
+    size_t ancestors_capacity = 64, depth = 0;
+    size_t* ancestors = malloc(ancestors_capacity * sizeof *ancestors);
+    writer->buffer = malloc(MT_STREAM_BUFFER_SIZE);
+
+    int failed = !__mt_serialize_plan_build(&plan, root) || !__mt_serialize_plan_extents(&plan, root);
+    if (!failed && (ancestors == NULL || writer->buffer == NULL)) { mt_error("Could not allocate memory for serialising a tree"); failed = 1; }
+    if (!failed)
+    {
+        __mt_serialize_plan_layout(&plan, &strings_offset, &branches_offset, &data_offset, &file_size);
+
+        unsigned char scratch[MT_FILE_HEADER_SIZE];
+        __mt_put_tree_header(scratch, &plan);
+        __mt_stream_write(writer, scratch, MT_FILE_HEADER_SIZE);
+
+        // String offsets, then the strings themselves
+        size_t string_cursor = strings_offset + plan.num_strings * 8;
+        for(size_t i=0; i<plan.num_strings; i++)
+        {
+            __mt_put_u64(scratch, string_cursor);
+            __mt_stream_write(writer, scratch, 8);
+            string_cursor += strlen(plan.strings[i]) + 1;
+        }
+        for(size_t i=0; i<plan.num_strings; i++) __mt_stream_write(writer, plan.strings[i], strlen(plan.strings[i]) + 1);
+        __mt_stream_pad(writer, branches_offset);
+
+        // Branch records. The ends of subtrees were found while planning, as they cannot be filled in afterwards
+        size_t data_cursor = data_offset;
+        size_t index = 0;
+        size_t next_extent = 0;
+        for(mt_branch* branch = root; branch != NULL && !failed; )
+        {
+            if(depth == ancestors_capacity)
+            {
+                size_t* grown = realloc(ancestors, ancestors_capacity * 2 * sizeof *ancestors);
+                if (grown == NULL) { mt_error("Could not allocate memory for serialising a tree"); failed = 1; break; }
+                ancestors = grown;
+                ancestors_capacity *= 2;
+            }
+            ancestors[depth] = index;
+
+            size_t subtree_end = (branch->first_child != NULL) ? plan.extents[next_extent++] : index + 1;
+            __mt_put_branch_record(scratch, &plan, branch, depth > 0 ? ancestors[depth - 1] : 0, subtree_end, data_cursor);
+            __mt_stream_write(writer, scratch, MT_FILE_BRANCH_SIZE);
+            data_cursor += __mt_align(branch->data_size, MT_FILE_DATA_ALIGNMENT);
+            index++;
+
+            if(branch->first_child != NULL) { branch = branch->first_child; depth++; continue; }
+            while(1)
+            {
+                if(branch == root) { branch = NULL; break; }
+                if(branch->next_sibling != NULL) { branch = branch->next_sibling; break; }
+                branch = branch->parent;
+                depth--;
+            }
+        }
+
+        // Data, in the same order as the records
+        __mt_stream_pad(writer, data_offset);
+        for(mt_branch* branch = root; branch != NULL && !failed; branch = __mt_next_descendant(branch, root))
+        {
+            if(branch->data_size == 0) continue;
+            __mt_stream_write(writer, branch->data, branch->data_size);
+            __mt_stream_pad(writer, __mt_align(writer->position, MT_FILE_DATA_ALIGNMENT));
+        }
+        __mt_stream_flush(writer);
+
+        if (!failed && writer->failed) { mt_error("Could not write a tree of %ld bytes to a stream", file_size); failed = 1; }
+    }
+
+    free(ancestors);
+    free(writer->buffer);
+    writer->buffer = NULL;
+    __mt_serialize_plan_release(&plan);
+    __mt_check_error_flag();    // Failures are reported by returning 0
+    return failed ? 0 : file_size;
+}
+
+// Write the (sub-)tree starting at `root` to the open file descriptor `fd`, which may be a file, pipe or socket.
+// The bytes are the same as `mt_write_tree_to_buffer` writes, but saving takes the same small amount of memory however
+// big the tree is: small pieces are staged in a buffer of MT_STREAM_BUFFER_SIZE bytes, and payloads of MT_STREAM_GATHER_SIZE
+// bytes or more are gathered into the same `writev` calls from where they are, without being copied.
+// The descriptor is left open, just past the end of the tree
+//
+// Returns:     The number of bytes written, or 0 if error
+size_t mt_write_tree_to_fd(mt_branch* root, int fd)
+{
+    if (root == NULL) mt_error("Attempted to write a tree whose root is a null pointer to a file descriptor");
+    if (fd < 0)       mt_error("Attempted to write a tree to the invalid file descriptor %d", fd);
+    if (__mt_check_error_flag()) return 0;
+
+    mt_stream_writer writer;
+    memset(&writer, 0, sizeof writer);
+    writer.fd = fd;
+    return __mt_write_tree_to_stream(root, &writer);
+}
+
+// Write the (sub-)tree starting at `root` by calling `write` with each piece of it in turn, as `mt_write_tree_to_fd` does.
+// Large payloads are passed to `write` where they are, and smaller pieces in batches of up to MT_STREAM_BUFFER_SIZE bytes
+//
+// `write`      Called as write(context, data, length), and returns 1 if all of it was written or 0 to stop with an error
+// `context`    Passed to `write`
+//
+// Returns:     The number of bytes written, or 0 if error
+size_t mt_write_tree_to_callback(mt_branch* root, mt_write_function* write, void* context)
+{
+    if (root == NULL)  mt_error("Attempted to write a tree whose root is a null pointer to a callback");
+    if (write == NULL) mt_error("Attempted to write a tree to a callback which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_stream_writer writer;
+    memset(&writer, 0, sizeof writer);
+    writer.write = write;
+    writer.context = context;
+    return __mt_write_tree_to_stream(root, &writer);
+}
+
+// Read up to `capacity` bytes from the file descriptor or function of `reader` into `out`
+//
+// Returns:     The number of bytes read, or 0 if the stream has ended or failed
+size_t __mt_stream_fill(mt_stream_reader* reader, unsigned char* out, size_t capacity)
+{
+    if(reader->read != NULL)
+    {
+        size_t got = reader->read(reader->context, out, capacity);
+        return (got > capacity) ? 0 : got;
+    }
+
+    while(1)
+    {
+#if defined(_WIN32)
+        int result = read(reader->fd, out, capacity > 0x40000000 ? 0x40000000 : (unsigned)capacity);
+#else
+        ssize_t result = read(reader->fd, out, capacity);
+        if (result < 0 && errno == EINTR) continue;
+#endif
+        return (result > 0) ? (size_t)result : 0;
+    }
+}
+
+// Read exactly `length` bytes from `reader` into `out`. Small pieces are taken from what has been read ahead,
+// and large ones are read straight into `out`
+//
+// Returns:     1 if success, 0 if the stream ended first
+int __mt_stream_read(mt_stream_reader* reader, void* out, size_t length)
+{
+    unsigned char* to = out;
+    if(length > reader->limit - reader->position)
+    {
+        mt_error("Attempted to load a tree from a stream past the end of the tree, at %ld bytes", reader->limit);
+        return 0;
+    }
+
+    while(length > 0)
+    {
+        if(reader->start == reader->end)    // Nothing has been read ahead, so the stream is at `position`
+        {
+            size_t got = (length >= MT_STREAM_GATHER_SIZE) ? __mt_stream_fill(reader, to, length) : 0;
+            if(got > 0)
+            {
+                to += got;
+                length -= got;
+                reader->position += got;
+                continue;
+            }
+
+            reader->start = 0;
+            size_t ahead = reader->limit - reader->position;
+            if(ahead > MT_STREAM_BUFFER_SIZE) ahead = MT_STREAM_BUFFER_SIZE;
+            reader->end = (length < MT_STREAM_GATHER_SIZE) ? __mt_stream_fill(reader, reader->buffer, ahead) : 0;
+            if(reader->end == 0)
+            {
+                mt_error("Attempted to load a tree from a stream which ended after %ld bytes", reader->position);
+                return 0;
+            }
+        }
+
+        size_t part = reader->end - reader->start;
+        if(part > length) part = length;
+        memcpy(to, reader->buffer + reader->start, part);
+        reader->start += part;
+        to += part;
+        length -= part;
+        reader->position += part;
+    }
+    return 1;
+}
+
+// Read and throw away the bytes of `reader` up to the offset `to`
+//
+// Returns:     1 if success, 0 if the stream ended first
+int __mt_stream_skip(mt_stream_reader* reader, size_t to)
+{
+    unsigned char scratch[256];
+    while(reader->position < to)
+    {
+        size_t part = to - reader->position;
+        if(!__mt_stream_read(reader, scratch, part < sizeof scratch ? part : sizeof scratch)) return 0;
+    }
+    return 1;
+}
+
+// Get the tree's copy of string `index` of a tree being streamed in, for one more label or data type.
+// Only its first use interns it: later ones are counted in `references`, and added by `__mt_add_string_references`
+//
+// Returns:     The interned string, or NULL if the heap is exhausted
+char* __mt_load_stream_string(mt_tree* tree, mt_tree_checker* checker, char** interned, size_t* references, size_t index)
+{
+    if(interned[index] != NULL) { references[index]++; return interned[index]; }
+    return interned[index] = __mt_tree_intern_string_references(tree, __mt_tree_checker_string(checker, index), 1, 0);
+}
+
+// Add the references counted by `__mt_load_stream_string` to the tree's strings. This never allocates, as every
+// one of them is already interned
+void __mt_add_string_references(mt_tree* tree, char** interned, size_t* references, size_t num_strings)
+{
+    for(size_t i=0; i<num_strings; i++)
+    {
+        if(references[i] == 0) continue;
+        size_t length = strlen(interned[i]);
+        __mt_string_table_probe(&tree->strings, interned[i], length, __mt_label_hash(interned[i], length))->references += references[i];
+        references[i] = 0;
+    }
+}
+
+// Load a tree from `reader` as `mt_load_tree_from_buffer` does, a piece at a time. Branch records are read
+// MT_STREAM_BUFFER_SIZE bytes at a time and each payload is read straight into its branch's own storage,
+// so besides the loaded tree itself only the string table is held in memory.
+// Records are checked as they arrive, and if one is damaged everything loaded before it is deleted again
+//
+// Returns:     The root of the loaded tree, or NULL if there was an error
+mt_branch* __mt_load_tree_from_stream(mt_branch* new_parent, mt_stream_reader* reader)
+{
+    unsigned char header[MT_FILE_HEADER_SIZE];
+    reader->buffer = malloc(MT_STREAM_BUFFER_SIZE);
+    reader->limit = MT_FILE_HEADER_SIZE;    // Until the header says how big the tree is
+    if (reader->buffer == NULL) mt_error("Could not allocate memory for loading a tree");
+    else if (__mt_stream_read(reader, header, MT_FILE_HEADER_SIZE))
+    {
+        if (memcmp(header + MT_FILE_HEADER_MAGIC, MT_FILE_MAGIC, 8) != 0) mt_error("Attempted to load a tree from a stream which does not contain a tree");
+        else __mt_check_tree_header(header, (size_t)-1);
+    }
+    if (__mt_check_error_flag()) { free(reader->buffer); return 0; }
+    if (new_parent != NULL) __mt_unshare_path(new_parent);
+
+    size_t file_size = __mt_get_u64(header + MT_FILE_HEADER_FILE_SIZE);
+    size_t num_strings = __mt_get_u64(header + MT_FILE_HEADER_NUM_STRINGS);
+    size_t num_branches = __mt_get_u64(header + MT_FILE_HEADER_NUM_BRANCHES);
+    size_t branches_offset = __mt_get_u64(header + MT_FILE_HEADER_BRANCHES);
+    size_t data_offset = __mt_get_u64(header + MT_FILE_HEADER_DATA);
+    reader->limit = file_size;
+
+    mt_tree_checker checker;
+    memset(&checker, 0, sizeof checker);
+    size_t strings_size = branches_offset - MT_FILE_HEADER_SIZE;
+    unsigned char* strings = malloc(strings_size ? strings_size : 1);
+    unsigned char* records = malloc(MT_STREAM_BUFFER_SIZE);
+    char** interned = calloc(num_strings ? num_strings : 1, sizeof *interned);
+    size_t* references = calloc(num_strings ? num_strings : 1, sizeof *references);
+    size_t open_capacity = 64;
+    mt_branch** open_branches = malloc(open_capacity * sizeof *open_branches);   // The loaded branches whose subtrees are still open
+    int failed = 0;
+    if (strings == NULL || records == NULL || interned == NULL || references == NULL || open_branches == NULL)
+    {
+        mt_error("Could not allocate memory for loading a tree");
+        failed = 1;
+    }
+    else if (!__mt_stream_read(reader, strings, strings_size) || !__mt_tree_checker_init(&checker, header, strings)) failed = 1;
+    checker.data_in_order = 1;
+
+    mt_branch* loaded_root = NULL;
+    mt_tree* tree = NULL;
+    if (!failed)
+    {
+        if (new_parent == NULL)
+        {
+            loaded_root = mt_create_root();
+            tree = loaded_root ? loaded_root->tree : NULL;
+        }
+        else tree = new_parent->tree;
+        if (tree == NULL || !__mt_id_index_reserve(tree, tree->id_index.count + num_branches)) failed = 1;
+    }
+
+    // Records. Each branch's data is not there yet, so only its size is kept until the data section is reached
+    for(size_t first = 0; first < num_branches && !failed; )
+    {
+        size_t count = num_branches - first;
+        if (count > MT_STREAM_BUFFER_SIZE / MT_FILE_BRANCH_SIZE) count = MT_STREAM_BUFFER_SIZE / MT_FILE_BRANCH_SIZE;
+        if (!__mt_stream_read(reader, records, count * MT_FILE_BRANCH_SIZE)) { failed = 1; break; }
+
+        for(size_t i = first; i < first + count; i++)
+        {
+            unsigned char* record = records + (i - first) * MT_FILE_BRANCH_SIZE;
+            if (!__mt_tree_checker_record(&checker, record, i)) { failed = 1; break; }
+
+            size_t data_type_index = __mt_get_u32(record + MT_FILE_BRANCH_DATA_TYPE);
+            char* label = __mt_load_stream_string(tree, &checker, interned, references, __mt_get_u32(record + MT_FILE_BRANCH_LABEL));
+            char* data_type = data_type_index ? __mt_load_stream_string(tree, &checker, interned, references, data_type_index - 1) : NULL;
+            if (label == NULL || (data_type_index && data_type == NULL)) { failed = 1; break; }
+
+            size_t depth = checker.num_open - 1;
+            if (depth >= open_capacity)
+            {
+                mt_branch** grown = realloc(open_branches, open_capacity * 2 * sizeof *open_branches);
+                if (grown == NULL) { mt_error("Could not allocate memory for loading a tree"); failed = 1; break; }
+                open_branches = grown;
+                open_capacity *= 2;
+            }
+
+            mt_branch* branch = __mt_load_branch(tree, depth > 0 ? open_branches[depth - 1] : new_parent, record,
+                (i == 0 && new_parent == NULL) ? loaded_root : NULL, label, data_type);
+            if (branch == NULL) { failed = 1; break; }
+            if (i == 0) loaded_root = branch;
+            open_branches[depth] = branch;
+
+            __mt_set_data_storage(branch, NULL, __mt_get_u64(record + MT_FILE_BRANCH_DATA_SIZE), MT_DATA_NONE);
+        }
+        first += count;
+    }
+    if (tree != NULL && references != NULL) __mt_add_string_references(tree, interned, references, num_strings);
+
+    // Data, which the records have checked is in the same order as they are
+    if (!failed && !__mt_stream_skip(reader, data_offset)) failed = 1;
+    for(mt_branch* branch = loaded_root; branch != NULL && !failed; branch = __mt_next_descendant(branch, loaded_root))
+    {
+        size_t data_size = branch->data_size;
+        if (data_size == 0) continue;
+        if (!__mt_stream_skip(reader, __mt_align(reader->position, MT_FILE_DATA_ALIGNMENT))) { failed = 1; break; }
+
+        if (data_size > MT_INLINE_DATA_SIZE)
+        {
+            void* data = malloc(data_size);
+            if (data == NULL) { mt_error("Could not allocate %ld bytes for a branch's data", data_size); failed = 1; break; }
+            if (!__mt_stream_read(reader, data, data_size)) { free(data); failed = 1; break; }
+            __mt_set_data_storage(branch, data, data_size, MT_DATA_HEAP);
+        }
+        else
+        {
+            if (!__mt_stream_read(reader, branch->inline_data, data_size)) { failed = 1; break; }
+            __mt_set_data_storage(branch, NULL, data_size, MT_DATA_INLINE);
+        }
+    }
+    if (!failed && !__mt_stream_skip(reader, file_size)) failed = 1;  // Leave the stream just past the tree
+
+    if (failed && loaded_root != NULL)
+    {
+        __mt_check_error_flag();    // The error has been reported, and must not stop the clean-up
+        if (new_parent == NULL) mt_destroy_tree(loaded_root);
+        else mt_delete_branch(loaded_root);
+        loaded_root = NULL;
+    }
+    else if (!failed && new_parent != NULL) __mt_mark_loaded_changed(new_parent, loaded_root);
+
+    __mt_tree_checker_release(&checker);
+    free(reader->buffer);
+    free(strings);
+    free(records);
+    free(interned);
+    free(references);
+    free(open_branches);
+    __mt_check_error_flag();    // Failures are reported by returning NULL
+    return loaded_root;
+}
+
+// Read a tree from the open file descriptor `fd`, which may be a file, pipe or socket, and attach it to `new_parent`
+// as `mt_load_tree_from_buffer` does. The tree is read a piece at a time, so loading takes the same small amount of
+// memory besides the loaded tree however big it is, and each payload is read straight into its branch.
+// The descriptor is left open, just past the end of the tree
+//
+// Returns:     The root of the loaded tree, or NULL if there was an error
+mt_branch* mt_load_tree_from_fd(mt_branch* new_parent, int fd)
+{
+    if (fd < 0) mt_error("Attempted to load a tree from the invalid file descriptor %d", fd);
+    if (__mt_check_error_flag()) return 0;
+
+    mt_stream_reader reader;
+    memset(&reader, 0, sizeof reader);
+    reader.fd = fd;
+    return __mt_load_tree_from_stream(new_parent, &reader);
+}
+
+// Read a tree by calling `read` for each piece of it in turn, and attach it to `new_parent` as `mt_load_tree_from_fd` does
+//
+// `read`       Called as read(context, out_data, capacity), and returns the number of bytes it put in `out_data`,
+//              which may be fewer than `capacity`, or 0 if the stream has ended or failed
+// `context`    Passed to `read`
+//
+// Returns:     The root of the loaded tree, or NULL if there was an error
+mt_branch* mt_load_tree_from_callback(mt_branch* new_parent, mt_read_function* read, void* context)
+{
+    if (read == NULL) mt_error("Attempted to load a tree from a callback which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_stream_reader reader;
+    memset(&reader, 0, sizeof reader);
+    reader.read = read;
+    reader.context = context;
+    return __mt_load_tree_from_stream(new_parent, &reader);
+}
+
+
+
+#define ________LAZY_LOADING
+
+// A tree can be loaded lazily, decoding only the branches that are actually reached. Loading creates just the
+// first branch of the snapshot, and marks any branch whose children have not been decoded yet as MT_BRANCH_UNLOADED.
+// The first time anything looks at the children of such a branch, `__mt_ensure_children` decodes them, leaving
+// their own children unloaded in turn. Each record stores the index just past its subtree, which serves as
+// the directory of the snapshot: the children of a record are found by hopping from one sibling's subtree to the next,
+// without looking at anything inside them
+
+// Returns:     The slot of `index` holding `branch`, or the empty slot where it would go
+mt_unloaded_slot* __mt_unloaded_index_probe(mt_unloaded_index* index, mt_branch* branch)
+{
+    size_t mask = index->capacity - 1;
+    for(size_t slot = __mt_child_index_hash((char*)branch) >> 32 & mask; ; slot = (slot + 1) & mask)
+    {
+        if(index->slots[slot].branch == NULL || index->slots[slot].branch == branch) return &index->slots[slot];
+    }
+}
+
+// Remember where the children of `entry->branch` are still to be found: record `entry->record` of `entry->snapshot`,
+// or the children of `entry->source`
+//
+// Returns:     1 if success, 0 if the heap is exhausted, leaving the error raised
+int __mt_unloaded_index_insert(mt_unloaded_index* index, mt_unloaded_slot* entry)
+{
+    if((index->count + 1) * 10 > index->capacity * 7)   // Keep the load factor below 70%
+    {
+        mt_unloaded_slot* old_slots = index->slots;
+        size_t old_capacity = index->capacity;
+
+        size_t capacity = old_capacity ? old_capacity * 2 : 64;
+        mt_unloaded_slot* slots = calloc(capacity, sizeof *slots);
+        if(slots == NULL) { mt_error("Could not allocate an index of %ld unloaded branches", capacity); return 0; }
+
+        index->slots = slots;
+        index->capacity = capacity;
+        for(size_t i=0; i<old_capacity; i++)
+        {
+            if(old_slots[i].branch != NULL) *__mt_unloaded_index_probe(index, old_slots[i].branch) = old_slots[i];
+        }
+        free(old_slots);
+    }
+
+    *__mt_unloaded_index_probe(index, entry->branch) = *entry;
+    index->count++;
+    return 1;
+}
+
+// Forget where the children of `branch` are, because they are being loaded or `branch` is being deleted
+void __mt_unloaded_index_remove(mt_unloaded_index* index, mt_branch* branch)
+{
+    if(index->count == 0) return;
+    mt_unloaded_slot* entry = __mt_unloaded_index_probe(index, branch);
+    if(entry->branch != branch) return;
+
+    // Empty the slot, shifting later entries back to fill the gap
+    size_t mask = index->capacity - 1;
+    size_t gap = entry - index->slots;
+    for(size_t next = (gap + 1) & mask; index->slots[next].branch != NULL; next = (next + 1) & mask)
+    {
+        size_t home = __mt_child_index_hash((char*)index->slots[next].branch) >> 32 & mask;
+        if(((next - home) & mask) >= ((next - gap) & mask))
+        {
+            index->slots[gap] = index->slots[next];
+            gap = next;
+        }
+    }
+    memset(&index->slots[gap], 0, sizeof index->slots[gap]);
+    index->count--;
+}
+
+// Check record `i` of `snapshot` just before it is loaded. It must be a child of record `parent`,
+// and its subtree must end by `parent_end`
+//
+// Returns:     1 if the record is valid, 0 if not
+int __mt_check_lazy_record(mt_lazy_snapshot* snapshot, size_t i, size_t parent, size_t parent_end)
+{
+    unsigned char* in = snapshot->buffer;
+    unsigned char* record = in + snapshot->branches_offset + i * MT_FILE_BRANCH_SIZE;
+    size_t subtree_end = __mt_get_u64(record + MT_FILE_BRANCH_SUBTREE_END);
+    size_t label = __mt_get_u32(record + MT_FILE_BRANCH_LABEL);
+    size_t data_type = __mt_get_u32(record + MT_FILE_BRANCH_DATA_TYPE);
+    size_t data_offset = __mt_get_u64(record + MT_FILE_BRANCH_DATA_OFFSET);
+    size_t data_size = __mt_get_u64(record + MT_FILE_BRANCH_DATA_SIZE);
+    char* label_string = (label < snapshot->num_strings) ? (char*)in + __mt_get_u64(in + snapshot->strings_offset + label * 8) : NULL;
+
+    int failed = 1;
+    if (__mt_get_u64(record + MT_FILE_BRANCH_PARENT) != parent) mt_error("Attempted to load a tree whose branch record %ld is not in depth-first order", i);
+    else if (subtree_end <= i || subtree_end > parent_end || (i == 0 && subtree_end != snapshot->num_branches))
+        mt_error("Attempted to load a tree whose branch record %ld has an invalid subtree", i);
+    else if (label_string == NULL || data_type > snapshot->num_strings) mt_error("Attempted to load a tree whose branch record %ld has an invalid string", i);
+    else if (data_size > 0 && (data_offset < snapshot->data_offset || data_offset > snapshot->file_size
+        || data_size > snapshot->file_size - data_offset)) mt_error("Attempted to load a tree whose branch record %ld has data outside the file", i);
+    else if (!snapshot->labels_checked[label] && (label_string[0] == 0 || !mt_check_label_valid(label_string)))
+        mt_error("Attempted to load a tree with the invalid label '%s'", label_string);
+    else failed = 0;
+
+    if (!failed) snapshot->labels_checked[label] = 1;
+    return !failed;
+}
+
+// Create the branch for record `i` of `snapshot` as the last child of `parent`, or in place of `replaced_root`.
+// If it has children, they are left in the snapshot until they are reached
+//
+// Returns:     The branch, or NULL if it could not be created. If the heap runs out after it has been created,
+//              the error is raised and the branch is returned without all of its data or children
+mt_branch* __mt_load_lazy_branch(mt_tree* tree, mt_lazy_snapshot* snapshot, mt_branch* parent, size_t i, mt_branch* replaced_root)
+{
+    unsigned char* in = snapshot->buffer;
+    unsigned char* record = in + snapshot->branches_offset + i * MT_FILE_BRANCH_SIZE;
+    size_t label = __mt_get_u32(record + MT_FILE_BRANCH_LABEL);
+    size_t data_type = __mt_get_u32(record + MT_FILE_BRANCH_DATA_TYPE);
+
+    char* label_string = __mt_tree_intern_string_references(tree, (char*)in + __mt_get_u64(in + snapshot->strings_offset + label * 8), 1, snapshot->zero_copy);
+    char* data_type_string = NULL;
+    if (data_type > 0) data_type_string = __mt_tree_intern_string_references(tree, (char*)in + __mt_get_u64(in + snapshot->strings_offset + (data_type - 1) * 8), 1, snapshot->zero_copy);
+    if (label_string == NULL || (data_type > 0 && data_type_string == NULL)) return NULL;
+
+    mt_branch* branch = __mt_load_branch(tree, parent, record, replaced_root, label_string, data_type_string);
+    if (branch == NULL) return NULL;
+    if (snapshot->changed) __mt_set_flags(branch, MT_BRANCH_CHANGED);
+    if (!__mt_load_branch_data(branch, in, record, snapshot->zero_copy)) return branch;   // With the error raised
+
+    mt_unloaded_slot entry = { .branch = branch, .snapshot = snapshot, .record = i };
+    if (__mt_get_u64(record + MT_FILE_BRANCH_SUBTREE_END) > i + 1 && __mt_unloaded_index_insert(&tree->unloaded, &entry))
+    {
+        __mt_set_flags(branch, MT_BRANCH_UNLOADED);
+        __mt_totals_invalidate(branch);     // Its totals are counted once its subtree has been loaded
+    }
+    return branch;
+}
+
+// Load the children of the unloaded branch `branch` from its snapshot, leaving each of their children unloaded in turn.
+// This takes time proportional to the number of children, however big their subtrees are.
+// If a record turns out to be damaged, the error is reported and it and the rest of the children are left out
+void __mt_load_children(mt_branch* branch)
+{
+    mt_tree* tree = branch->tree;
+    mt_unloaded_slot* slot = __mt_unloaded_index_probe(&tree->unloaded, branch);
+    mt_lazy_snapshot* snapshot = slot->snapshot;
+    size_t record = slot->record;
+    __mt_unloaded_index_remove(&tree->unloaded, branch);
+    __mt_clear_flags(branch, MT_BRANCH_UNLOADED);
+
+    unsigned char* records = snapshot->buffer + snapshot->branches_offset;
+    size_t end = __mt_get_u64(records + record * MT_FILE_BRANCH_SIZE + MT_FILE_BRANCH_SUBTREE_END);
+    for(size_t i = record + 1; i < end; i = __mt_get_u64(records + i * MT_FILE_BRANCH_SIZE + MT_FILE_BRANCH_SUBTREE_END))
+    {
+        if (!__mt_check_lazy_record(snapshot, i, record, end)) break;
+        if (__mt_load_lazy_branch(tree, snapshot, branch, i, NULL) == NULL || __mt_check_error_flag()) break;
+    }
+    __mt_check_error_flag();    // Any error has been reported, and whatever looked at the children carries on with those that loaded
+}
+
+// Load every branch of `tree` that has not been loaded yet, and create every branch that copies are still sharing,
+// for operations that need to see all of them
+void __mt_load_all_children(mt_tree* tree)
+{
+    if (tree->unloaded.count == 0 && tree->shared.count == 0) return;
+    for(mt_branch* branch = tree->root; branch != NULL; branch = __mt_next_descendant(branch, tree->root));
+}
+
+// Free the snapshots that `tree` was loading lazily, and its index of unloaded branches
+void __mt_release_lazy_snapshots(mt_tree* tree)
+{
+    free(tree->unloaded.slots);
+    memset(&tree->unloaded, 0, sizeof tree->unloaded);
+    while(tree->lazy_snapshots != NULL)
+    {
+        mt_lazy_snapshot* next = tree->lazy_snapshots->next;
+        free(tree->lazy_snapshots->labels_checked);
+        free(tree->lazy_snapshots);
+        tree->lazy_snapshots = next;
+    }
+}
+
+// Attach the tree in the buffer `in_buffer`, up to a maximum of `buffer_length` bytes, to `new_parent` as
+// `mt_load_tree_from_buffer` does, but only decode its branches when they are first reached: through
+// `mt_get_by_path`, `mt_get_nth_child`, `mt_get_next_sibling`, a search or any other walk through the tree.
+// Loading takes time proportional to the number of distinct labels rather than the size of the tree, and branches
+// that are never reached are never created. Damaged records are only found when they are reached, and are left out.
+// `mt_get_by_id` has to load the whole tree to find an id that has not been loaded yet.
+// The buffer is read from until the tree is destroyed, so it must stay where it is and not be changed until then
+//
+// Returns:     The root of the loaded tree, or NULL if there was an error
+mt_branch* mt_load_tree_lazily_from_buffer(mt_branch* new_parent, void* in_buffer, size_t buffer_length)
+{
+    return __mt_load_tree_lazily(new_parent, in_buffer, buffer_length, NULL);
+}
+
+// Find the highest id of any record in a lazily loaded snapshot. Ids are at a fixed place in each record,
+// so this reads them without decoding the records
+//
+// Returns:     The highest id
+size_t __mt_snapshot_max_id(mt_lazy_snapshot* snapshot)
+{
+    size_t max_id = 0;
+    unsigned char* record = snapshot->buffer + snapshot->branches_offset;
+    for(size_t i=0; i<snapshot->num_branches; i++, record += MT_FILE_BRANCH_SIZE)
+    {
+        size_t id = __mt_get_u64(record + MT_FILE_BRANCH_ID);
+        if (id > max_id) max_id = id;
+    }
+    return max_id;
+}
+
+// Load a tree from `in_buffer` as `mt_load_tree_lazily_from_buffer` does. If `mapping` is given, the buffer is that
+// mapped snapshot, and the loaded labels and data point straight into it instead of being copied.
+// The mapping is handed over: it belongs to the tree afterwards, or is released if nothing was loaded
+//
+// Returns:     The root of the loaded tree, or NULL if there was an error
+mt_branch* __mt_load_tree_lazily(mt_branch* new_parent, void* in_buffer, size_t buffer_length, mt_mapping* mapping)
+{
+    unsigned char* in = in_buffer;
+    if (in == NULL) mt_error("Attempted to load a tree from a buffer which is a null pointer");
+    else if (buffer_length < MT_FILE_HEADER_SIZE || memcmp(in + MT_FILE_HEADER_MAGIC, MT_FILE_MAGIC, 8) != 0)
+        mt_error("Attempted to load a tree from a buffer which does not contain a tree");
+    else __mt_check_tree_header(in, buffer_length);
+    if (new_parent != NULL && new_parent->tree->reclaimer != NULL)
+        mt_error("Attempted to load a tree lazily into a tree which other threads may be reading, which must never change it");
+    if (__mt_check_error_flag()) { __mt_release_mapping(mapping); return 0; }
+    if (new_parent != NULL) __mt_unshare_path(new_parent);
+
+    // The string table is checked now, as it is small, and each record is checked when it is reached
+    mt_tree_checker checker;
+    int strings_valid = __mt_tree_checker_init(&checker, in, in + __mt_get_u64(in + MT_FILE_HEADER_STRINGS));
+    __mt_tree_checker_release(&checker);
+
+    mt_lazy_snapshot* snapshot = strings_valid ? calloc(1, sizeof *snapshot) : NULL;
+    if (snapshot != NULL)
+    {
+        snapshot->buffer = in;
+        snapshot->zero_copy = (mapping != NULL);
+        snapshot->changed = (new_parent != NULL);
+        snapshot->file_size = __mt_get_u64(in + MT_FILE_HEADER_FILE_SIZE);
+        snapshot->num_strings = __mt_get_u64(in + MT_FILE_HEADER_NUM_STRINGS);
+        snapshot->strings_offset = __mt_get_u64(in + MT_FILE_HEADER_STRINGS);
+        snapshot->num_branches = __mt_get_u64(in + MT_FILE_HEADER_NUM_BRANCHES);
+        snapshot->branches_offset = __mt_get_u64(in + MT_FILE_HEADER_BRANCHES);
+        snapshot->data_offset = __mt_get_u64(in + MT_FILE_HEADER_DATA);
+        snapshot->labels_checked = calloc(snapshot->num_strings ? snapshot->num_strings : 1, 1);
+        if (snapshot->labels_checked == NULL) { free(snapshot); snapshot = NULL; }
+    }
+    if (strings_valid && snapshot == NULL) mt_error("Could not allocate memory for loading a tree");
+    if (snapshot == NULL || !__mt_check_lazy_record(snapshot, 0, 0, snapshot->num_branches))
+    {
+        if (snapshot != NULL) free(snapshot->labels_checked);
+        free(snapshot);
+        __mt_release_mapping(mapping);
+        __mt_check_error_flag();    // Failures are reported by returning NULL
+        return 0;
+    }
+
+    mt_branch* loaded_root = (new_parent == NULL) ? mt_create_root() : NULL;
+    mt_tree* tree = (new_parent != NULL) ? new_parent->tree : loaded_root ? loaded_root->tree : NULL;
+    if (tree == NULL)
+    {
+        free(snapshot->labels_checked);
+        free(snapshot);
+        __mt_release_mapping(mapping);
+        return 0;
+    }
+
+    // The tree keeps the snapshot for as long as anything might still be loaded from it
+    snapshot->next = tree->lazy_snapshots;
+    tree->lazy_snapshots = snapshot;
+    if (mapping != NULL)
+    {
+        mapping->next = tree->mappings;
+        tree->mappings = mapping;
+    }
+
+    // Branches created before the rest is loaded must not take ids that records still waiting to be loaded have
+    size_t max_id = __mt_snapshot_max_id(snapshot);
+    if (max_id > tree->last_issued_id) tree->last_issued_id = max_id;
+
+    mt_branch* branch = __mt_load_lazy_branch(tree, snapshot, new_parent, 0, loaded_root);
+    if (__mt_check_error_flag())    // Failures are reported by returning NULL, after giving back whatever was created
+    {
+        if (loaded_root != NULL) mt_destroy_tree(loaded_root);
+        else if (branch != NULL) mt_delete_branch(branch);
+        return 0;
+    }
+    if (new_parent != NULL) __mt_mark_changed(new_parent);
+    return branch;
+}
+
+
+#define ________MAPPED_FILES
+
+// Open the snapshot file `filename` and load the tree in it without reading or copying its data.
+// The file is mapped into memory, and branches' labels and data point straight into it, so a large tree
+// opens in the time it takes to read its branch records, and data is paged in from the file when it is used.
+// Mapped data is read-only: use `mt_get_data_pointer_writable` to get a private copy that can be changed.
+// The file is never written to, and stays mapped until the tree is destroyed
+//
+// `new_parent`     The branch to attach the loaded tree to, or NULL to load it as a new tree of its own
+// `filename`       The file to open, as written by `mt_write_tree_to_buffer`
+//
+// Returns:     The root of the loaded tree, or NULL if there was an error
+mt_branch* mt_map_tree_from_file(mt_branch* new_parent, char* filename)
+{
+    if (filename == NULL) mt_error("Attempted to map a tree from a file name which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_mapping* mapping = __mt_map_file(filename);
+    if (mapping == NULL) return 0;
+    return __mt_load_tree(new_parent, mapping->address, mapping->size, mapping);
+}
+
+// Open the snapshot file `filename` and load the tree in it lazily, as `mt_load_tree_lazily_from_buffer` does.
+// Like `mt_map_tree_from_file`, labels and data point straight into the mapped file, so opening even a huge snapshot
+// reads only its header and string table, and the rest is paged in as branches are reached
+//
+// `new_parent`     The branch to attach the loaded tree to, or NULL to load it as a new tree of its own
+// `filename`       The file to open, as written by `mt_write_tree_to_buffer` or `mt_write_tree_to_fd`
+//
+// Returns:     The root of the loaded tree, or NULL if there was an error
+mt_branch* mt_map_tree_lazily_from_file(mt_branch* new_parent, char* filename)
+{
+    if (filename == NULL) mt_error("Attempted to map a tree from a file name which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_mapping* mapping = __mt_map_file(filename);
+    if (mapping == NULL) return 0;
+    return __mt_load_tree_lazily(new_parent, mapping->address, mapping->size, mapping);
+}
+
+// Map the whole of the file `filename` into memory, read-only
+//
+// Returns:     The mapping, or NULL if there was an error
+mt_mapping* __mt_map_file(char* filename)
+{
+    mt_mapping* mapping = calloc(1, sizeof *mapping);
+    if (mapping == NULL) mt_error("Could not allocate memory for mapping '%s'", filename);
+    if (__mt_check_error_flag()) return 0;
+
+#if defined(_WIN32)
+    // Without mmap, read the whole file into memory instead. Branches still point into it rather than copying
+    FILE* file = fopen(filename, "rb");
+    if (file != NULL && fseek(file, 0, SEEK_END) == 0) mapping->size = ftell(file);
+    if (file != NULL && mapping->size > 0 && fseek(file, 0, SEEK_SET) == 0) mapping->address = malloc(mapping->size);
+    if (mapping->address != NULL && fread(mapping->address, 1, mapping->size, file) != mapping->size) 
+    {
+        free(mapping->address);
+        mapping->address = NULL;
+    }
+    if (file != NULL) fclose(file);
+#else
+    int file = open(filename, O_RDONLY);
+    struct stat file_stats;
+    if (file >= 0 && fstat(file, &file_stats) == 0 && file_stats.st_size > 0)
+    {
+        mapping->size = file_stats.st_size;
+        mapping->address = mmap(NULL, mapping->size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapping->address == MAP_FAILED) mapping->address = NULL;
+    }
+    if (file >= 0) close(file);     // The mapping stays valid without the descriptor
+#endif
+
+    if (mapping->address == NULL) 
+    {
+        free(mapping);
+        mt_error("Could not map the file '%s'", filename);
+    }
+    if (__mt_check_error_flag()) return 0;
+    return mapping;
+}
+
+// Unmap a snapshot file and free `mapping`, which may be NULL
+void __mt_release_mapping(mt_mapping* mapping)
+{
+    if (mapping == NULL) return;
+#if defined(_WIN32)
+    free(mapping->address);
+#else
+    munmap(mapping->address, mapping->size);
+#endif
+    free(mapping);
+}
+
+// Unmap every snapshot file that branches of `tree` point into
+void __mt_release_mappings(mt_tree* tree)
+{
+    while(tree->mappings != NULL)
+    {
+        mt_mapping* next = tree->mappings->next;
+        __mt_release_mapping(tree->mappings);
+        tree->mappings = next;
+    }
+}
+
+
+
+#define ________DELTAS
+
+// A delta holds what has changed below a branch since the tree was last marked clean, written as a snapshot whose
+// records refer back to the branches of the earlier snapshot by id. It has a record for
+//  - every branch marked MT_BRANCH_CHANGED, with its label and data, followed by records for its new list of children
+//  - every other child of such a branch, labelled MT_FILE_LABEL_KEPT and without records for its own children, to say
+//    that the earlier branch with that id goes there as it was, even if it has been moved there
+//  - every unchanged branch with changes below it, also labelled MT_FILE_LABEL_KEPT, followed by records for only
+//    those of its children that have changed or have changes below them
+// The first record is always the branch the delta was written from. A delta is about as big as the changes themselves,
+// plus a record for each unchanged sibling of a changed branch, however big the rest of the tree is
+
+// Check whether the delta written from an ancestor of `branch` has a record for it
+int __mt_delta_has_record(mt_branch* branch)
+{
+    return (branch->parent->flags & MT_BRANCH_CHANGED) || (branch->flags & (MT_BRANCH_CHANGED | MT_BRANCH_CHANGED_BELOW));
+}
+
+// Find the next branch after `branch`, in depth-first order, that the delta written from `root` has a record for
+//
+// Returns:     The branch, or NULL if there are no more
+mt_branch* __mt_next_delta_branch(mt_branch* branch, mt_branch* root)
+{
+    if(branch->flags & (MT_BRANCH_CHANGED | MT_BRANCH_CHANGED_BELOW))
+    {
+        if(branch->flags & MT_BRANCH_CHANGED) __mt_ensure_children(branch);     // Every child is listed
+        for(mt_branch* child = branch->first_child; child != NULL; child = child->next_sibling)
+        {
+            if(__mt_delta_has_record(child)) return child;
+        }
+    }
+
+    for(; branch != root; branch = branch->parent)
+    {
+        for(mt_branch* sibling = branch->next_sibling; sibling != NULL; sibling = sibling->next_sibling)
+        {
+            if(__mt_delta_has_record(sibling)) return sibling;
+        }
+    }
+    return NULL;
+}
+
+// Find every record of the delta to be written from `root`, and the strings and data of the changed branches
+//
+// Returns:     1 if success, 0 if the heap is exhausted. Either way the plan must be released
+int __mt_delta_plan_build(mt_delta_plan* delta, mt_branch* root)
+{
+    memset(delta, 0, sizeof *delta);
+    size_t ancestors_capacity = 64, depth = 0;
+    size_t* ancestors = malloc(ancestors_capacity * sizeof *ancestors);     // The records of the current branch's ancestors
+    int failed = (ancestors == NULL);
+
+    for(mt_branch* branch = root; branch != NULL && !failed; branch = __mt_next_delta_branch(branch, root))
+    {
+        size_t index = delta->plan.num_branches;
+        if(index == delta->capacity)
+        {
+            size_t capacity = delta->capacity ? delta->capacity * 2 : 64;
+            mt_branch** grown_branches = realloc(delta->branches, capacity * sizeof *grown_branches);
+            if(grown_branches != NULL) delta->branches = grown_branches;
+            size_t* grown_parents = realloc(delta->parents, capacity * sizeof *grown_parents);
+            if(grown_parents != NULL) delta->parents = grown_parents;
+            size_t* grown_ends = realloc(delta->subtree_ends, capacity * sizeof *grown_ends);
+            if(grown_ends != NULL) delta->subtree_ends = grown_ends;
+            if(grown_branches == NULL || grown_parents == NULL || grown_ends == NULL) { failed = 1; break; }
+            delta->capacity = capacity;
+        }
+        if(depth == ancestors_capacity)
+        {
+            size_t* grown = realloc(ancestors, ancestors_capacity * 2 * sizeof *grown);
+            if(grown == NULL) { failed = 1; break; }
+            ancestors = grown;
+            ancestors_capacity *= 2;
+        }
+
+        while(depth > 0 && delta->branches[ancestors[depth - 1]] != branch->parent) depth--;
+        delta->branches[index] = branch;
+        delta->parents[index] = (depth > 0) ? ancestors[depth - 1] : 0;
+        delta->subtree_ends[index] = index + 1;
+        ancestors[depth++] = index;
+        delta->plan.num_branches++;
+
+        if(!(branch->flags & MT_BRANCH_CHANGED)) continue;     // Kept as it was, so it has no strings or data
+        if(__mt_serialize_plan_string(&delta->plan, branch->label) == (size_t)-1) { free(ancestors); return 0; }
+        if(branch->data_type != NULL && __mt_serialize_plan_string(&delta->plan, branch->data_type) == (size_t)-1) { free(ancestors); return 0; }
+        delta->plan.data_size += __mt_align(branch->data_size, MT_FILE_DATA_ALIGNMENT);
+    }
+    free(ancestors);
+    if (failed) mt_error("Could not allocate memory for writing a delta");
+    if (failed) return 0;
+
+    // Every subtree ends where the last of its descendants' subtrees does
+    for(size_t i = delta->plan.num_branches; i-- > 1; )
+    {
+        size_t parent = delta->parents[i];
+        if(delta->subtree_ends[i] > delta->subtree_ends[parent]) delta->subtree_ends[parent] = delta->subtree_ends[i];
+    }
+    delta->plan.strings_size = __mt_align(delta->plan.strings_size, 8);
+    return 1;
+}
+
+// Free the memory used by `delta`
+void __mt_delta_plan_release(mt_delta_plan* delta)
+{
+    __mt_serialize_plan_release(&delta->plan);
+    free(delta->branches);
+    free(delta->parents);
+    free(delta->subtree_ends);
+    memset(delta, 0, sizeof *delta);
+}
+
+// Calculate the size in bytes of the delta that `mt_write_delta_to_buffer` would write from `root`
+//
+// Returns:     The size of the delta in bytes, or 0 if error
+size_t mt_get_delta_file_size(mt_branch* root)
+{
+    if (root == NULL) mt_error("Attempted to get the size of a delta from a branch which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_delta_plan delta;
+    size_t strings_offset, branches_offset, data_offset, file_size = 0;
+    if(__mt_delta_plan_build(&delta, root))
+    {
+        __mt_serialize_plan_layout(&delta.plan, &strings_offset, &branches_offset, &data_offset, &file_size);
+    }
+    __mt_delta_plan_release(&delta);
+    return file_size;
+}
+
+// Write what has changed below `root` since the tree was last marked clean to the buffer `out_buffer`, up to a maximum
+// of `out_capacity` bytes, as a delta against the snapshot that was taken then. This takes time proportional to the
+// changes rather than the size of the tree. Applying the delta to that snapshot with `mt_apply_delta_from_buffer`
+// gives the tree as it is now. Call `mt_mark_clean` afterwards so that the next delta follows on from this one.
+// The buffer must be at least `mt_get_delta_file_size` bytes
+//
+// Returns:     The number of bytes written, or 0 if error
+size_t mt_write_delta_to_buffer(mt_branch* root, void* out_buffer, size_t out_capacity)
+{
+    if (root == NULL)       mt_error("Attempted to write a delta from a branch which is a null pointer");
+    if (out_buffer == NULL) mt_error("Attempted to write a delta to a buffer which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_delta_plan delta;
+    size_t strings_offset, branches_offset, data_offset, file_size;
+    if(!__mt_delta_plan_build(&delta, root)) { __mt_delta_plan_release(&delta); return 0; }
+    __mt_serialize_plan_layout(&delta.plan, &strings_offset, &branches_offset, &data_offset, &file_size);
+
+    if (file_size > out_capacity) mt_error("Attempted to write a delta of %ld bytes to a buffer of %ld bytes", file_size, out_capacity);
+    if (__mt_check_error_flag()) { __mt_delta_plan_release(&delta); return 0; }
+
+    unsigned char* out = out_buffer;
+    __mt_put_tree_header(out, &delta.plan);
+    memcpy(out + MT_FILE_HEADER_MAGIC, MT_DELTA_MAGIC, 8);
+    __mt_put_string_table(out, &delta.plan);
+
+    size_t data_cursor = data_offset;
+    for(size_t i=0; i<delta.plan.num_branches; i++)
+    {
+        unsigned char* record = out + branches_offset + i * MT_FILE_BRANCH_SIZE;
+        mt_branch* branch = delta.branches[i];
+        if(!(branch->flags & MT_BRANCH_CHANGED))
+        {
+            memset(record, 0, MT_FILE_BRANCH_SIZE);
+            __mt_put_u64(record + MT_FILE_BRANCH_ID, branch->id);
+            __mt_put_u64(record + MT_FILE_BRANCH_PARENT, delta.parents[i]);
+            __mt_put_u64(record + MT_FILE_BRANCH_SUBTREE_END, delta.subtree_ends[i]);
+            __mt_put_u32(record + MT_FILE_BRANCH_LABEL, MT_FILE_LABEL_KEPT);
+            continue;
+        }
+
+        __mt_put_branch_record(record, &delta.plan, branch, delta.parents[i], delta.subtree_ends[i], data_cursor);
+        if(branch->data_size > 0)
+        {
+            size_t padded_size = __mt_align(branch->data_size, MT_FILE_DATA_ALIGNMENT);
+            memcpy(out + data_cursor, branch->data, branch->data_size);
+            memset(out + data_cursor + branch->data_size, 0, padded_size - branch->data_size);
+            data_cursor += padded_size;
+        }
+    }
+    unsigned char* records_end = out + branches_offset + delta.plan.num_branches * MT_FILE_BRANCH_SIZE;
+    memset(records_end, 0, out + data_offset - records_end);     // Padding
+
+    __mt_delta_plan_release(&delta);
+    return file_size;
+}
+
+// Check that the delta `in` can be applied to `root` before anything is changed. Every branch it keeps must exist
+// below `root`, and must still be a child of its parent's branch where the parent is kept too, and no branch
+// may be named twice. Finds the branch each record refers to, or NULL for new branches, into `out_branches`
+//
+// Returns:     1 if the delta matches the tree, 0 if not
+int __mt_check_delta_matches(mt_branch* root, unsigned char* in, mt_branch** out_branches)
+{
+    size_t num_branches = __mt_get_u64(in + MT_FILE_HEADER_NUM_BRANCHES);
+    unsigned char* records = in + __mt_get_u64(in + MT_FILE_HEADER_BRANCHES);
+
+    out_branches[0] = root;
+    size_t i;
+    for(i=1; i<num_branches; i++)
+    {
+        unsigned char* record = records + i * MT_FILE_BRANCH_SIZE;
+        size_t parent = __mt_get_u64(record + MT_FILE_BRANCH_PARENT);
+        int kept = __mt_get_u32(record + MT_FILE_BRANCH_LABEL) == MT_FILE_LABEL_KEPT;
+        int parent_kept = __mt_get_u32(records + parent * MT_FILE_BRANCH_SIZE + MT_FILE_BRANCH_LABEL) == MT_FILE_LABEL_KEPT;
+
+        mt_branch* branch = __mt_id_index_find(root->tree, __mt_get_u64(record + MT_FILE_BRANCH_ID));
+        mt_branch* ancestor = branch;
+        while(ancestor != NULL && ancestor != root) ancestor = ancestor->parent;
+
+        out_branches[i] = branch;
+        if(branch == NULL ? (kept || parent_kept) : (branch == root || ancestor == NULL || (branch->flags & MT_BRANCH_VISITED)
+            || (parent_kept && branch->parent != out_branches[parent]))) break;
+        if(branch != NULL) __mt_set_flags(branch, MT_BRANCH_VISITED);
+    }
+
+    for(size_t j=1; j<i; j++) if(out_branches[j] != NULL) __mt_clear_flags(out_branches[j], MT_BRANCH_VISITED);
+    if (i < num_branches) mt_error("Attempted to apply a delta whose branch record %ld does not match the tree", i);
+    return i == num_branches;
+}
+
+// Replace the label, data type and data of the existing branch `branch` with those of `record` from the delta `in`,
+// and detach its children into `detached`, since the records that follow list them afresh
+//
+// Returns:     1 if success, 0 if the heap is exhausted
+int __mt_apply_delta_record(mt_branch* branch, unsigned char* in, unsigned char* record, char* label, char* data_type,
+    mt_branch*** detached, size_t* num_detached, size_t* detached_capacity)
+{
+    mt_tree* tree = branch->tree;
+    mt_child_index* sibling_index = (branch->parent != NULL) ? branch->parent->child_index : NULL;
+    if (sibling_index != NULL) __mt_child_index_remove(sibling_index, branch);
+    __mt_label_index_remove(branch);
+    __mt_tree_release_string(tree, branch->label);
+    branch->label = label;
+    if (sibling_index != NULL) __mt_child_index_insert(sibling_index, branch, 0);
+    __mt_label_index_add(branch);
+    __mt_tree_release_string(tree, branch->data_type);
+    branch->data_type = data_type;
+
+    if (branch->data_storage == MT_DATA_HEAP) free(branch->data);
+    __mt_set_data_storage(branch, NULL, 0, MT_DATA_NONE);
+    if (!__mt_load_branch_data(branch, in, record, 0)) return 0;
+
+    while(branch->first_child != NULL)
+    {
+        if (*num_detached == *detached_capacity)
+        {
+            size_t capacity = *detached_capacity ? *detached_capacity * 2 : 64;
+            mt_branch** grown = realloc(*detached, capacity * sizeof *grown);
+            if (grown == NULL) { mt_error("Could not allocate memory for applying a delta"); return 0; }
+            *detached = grown;
+            *detached_capacity = capacity;
+        }
+        (*detached)[(*num_detached)++] = branch->first_child;
+        __mt_unlink_child(branch->first_child);
+    }
+    return 1;
+}
+
+// Apply the delta in the buffer `in_buffer`, up to a maximum of `buffer_length` bytes, to the tree starting at `root`,
+// which must be as it was when the delta's earlier snapshot was taken: usually that snapshot, loaded as a new tree,
+// with any deltas written before this one already applied. Branches are matched by id, and `root` takes the place
+// of the branch the delta was written from. Changed branches take their new labels and data, branches listed afresh
+// are moved into place, new branches are created, and branches that are no longer listed are deleted.
+// The delta is checked against the tree before anything is changed. Like a loaded tree, the result is not marked
+// as changed. The data is copied out of the buffer, which can be freed afterwards
+//
+// Returns:     1 if success, 0 if error
+int mt_apply_delta_from_buffer(mt_branch* root, void* in_buffer, size_t buffer_length)
+{
+    unsigned char* in = in_buffer;
+    if (root == NULL) mt_error("Attempted to apply a delta to a branch which is a null pointer");
+    else if (root->tree->reclaimer != NULL) mt_error("Attempted to apply a delta to a tree which other threads may be reading");
+    if (in == NULL) mt_error("Attempted to apply a delta from a buffer which is a null pointer");
+    else if (buffer_length < MT_FILE_HEADER_SIZE || memcmp(in + MT_FILE_HEADER_MAGIC, MT_DELTA_MAGIC, 8) != 0)
+        mt_error("Attempted to apply a delta from a buffer which does not contain a delta");
+    else __mt_check_tree_header(in, buffer_length);
+    if (__mt_check_error_flag()) return 0;
+
+    mt_tree* tree = root->tree;
+    size_t num_strings = __mt_get_u64(in + MT_FILE_HEADER_NUM_STRINGS);
+    size_t strings_offset = __mt_get_u64(in + MT_FILE_HEADER_STRINGS);
+    size_t num_branches = __mt_get_u64(in + MT_FILE_HEADER_NUM_BRANCHES);
+    unsigned char* records = in + __mt_get_u64(in + MT_FILE_HEADER_BRANCHES);
+    __mt_load_all_children(tree);     // Any branch may be named by id
+
+    size_t* references = malloc((num_strings ? num_strings : 1) * sizeof *references);
+    char** interned = malloc((num_strings ? num_strings : 1) * sizeof *interned);
+    mt_branch** branches = malloc(num_branches * sizeof *branches);
+    mt_branch** detached = NULL;
+    size_t num_detached = 0, detached_capacity = 0;
+    int failed = 0;
+    if (references == NULL || interned == NULL || branches == NULL)
+    {
+        mt_error("Could not allocate memory for applying a delta");
+        failed = 1;
+    }
+    if (!failed && (!__mt_validate_tree_buffer(in, references, 1) || !__mt_check_delta_matches(root, in, branches))) failed = 1;
+
+    for(size_t i=0; i<num_strings && !failed; i++)
+    {
+        char* string = (char*)in + __mt_get_u64(in + strings_offset + i * 8);
+        interned[i] = references[i] ? __mt_tree_intern_string_references(tree, string, references[i], 0) : NULL;
+        if (references[i] && interned[i] == NULL) failed = 1;
+    }
+
+    for(size_t i=0; i<num_branches && !failed; i++)
+    {
+        unsigned char* record = records + i * MT_FILE_BRANCH_SIZE;
+        size_t parent = __mt_get_u64(record + MT_FILE_BRANCH_PARENT);
+        size_t label = __mt_get_u32(record + MT_FILE_BRANCH_LABEL);
+        size_t data_type = __mt_get_u32(record + MT_FILE_BRANCH_DATA_TYPE);
+        int listed_afresh = (i > 0 && __mt_get_u32(records + parent * MT_FILE_BRANCH_SIZE + MT_FILE_BRANCH_LABEL) != MT_FILE_LABEL_KEPT);
+
+        if (branches[i] == NULL)
+        {
+            branches[i] = __mt_load_branch(tree, branches[parent], record, NULL, interned[label], data_type ? interned[data_type - 1] : NULL);
+            if (branches[i] == NULL || !__mt_load_branch_data(branches[i], in, record, 0)) failed = 1;
+            continue;
+        }
+
+        if (listed_afresh)  // Its parent's children are being listed in order, so it goes after those listed so far
+        {
+            if (branches[i]->parent != NULL) __mt_unlink_child(branches[i]);
+            __mt_link_child(branches[parent], branches[i]);
+        }
+        if (label != MT_FILE_LABEL_KEPT && !__mt_apply_delta_record(branches[i], in, record, interned[label],
+            data_type ? interned[data_type - 1] : NULL, &detached, &num_detached, &detached_capacity)) failed = 1;
+    }
+
+    // Whatever was detached and never listed again is gone
+    for(size_t i=0; i<num_detached; i++) if (detached[i]->parent == NULL) __mt_free_branch_recursive(detached[i]);
+    __mt_path_cache_invalidate(tree);
+
+    free(references);
+    free(interned);
+    free(branches);
+    free(detached);
+    __mt_check_error_flag();    // Failures are reported by returning 0
+    return !failed;
+}
+
+// Load the snapshot in `base` as a new tree, then apply each of the `num_deltas` deltas in `deltas` to it in turn,
+// as `mt_apply_delta_from_buffer` does. `base_length` and `delta_lengths` are the most bytes each buffer can hold
+//
+// Returns:     The root of the new tree, or NULL if there was an error
+mt_branch* mt_load_tree_with_deltas(void* base, size_t base_length, void** deltas, size_t* delta_lengths, size_t num_deltas)
+{
+    if (num_deltas > 0 && (deltas == NULL || delta_lengths == NULL)) mt_error("Attempted to apply deltas from a list which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_branch* root = mt_load_tree_from_buffer(NULL, base, base_length);
+    for(size_t i=0; i<num_deltas && root != NULL; i++)
+    {
+        if (!mt_apply_delta_from_buffer(root, deltas[i], delta_lengths[i])) { mt_destroy_tree(root); root = NULL; }
+    }
+    return root;
+}
+
+// Fold the deltas in `deltas` back into the snapshot in `base`, and write the result as a single full snapshot by
+// calling `write` for each piece of it in turn, as `mt_write_tree_to_callback` does. The deltas can then be discarded
+//
+// Returns:     The number of bytes written, or 0 if error
+size_t mt_compact_snapshot(void* base, size_t base_length, void** deltas, size_t* delta_lengths, size_t num_deltas,
+    mt_write_function* write, void* context)
+{
+    if (write == NULL) mt_error("Attempted to write a compacted snapshot to a callback which is a null pointer");
+    if (__mt_check_error_flag()) return 0;
+
+    mt_branch* root = mt_load_tree_with_deltas(base, base_length, deltas, delta_lengths, num_deltas);
+    if (root == NULL) return 0;
+    size_t written = mt_write_tree_to_callback(root, write, context);
+    mt_destroy_tree(root);
+    return written;
+}
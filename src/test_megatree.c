@@ -1,6 +1,13 @@
 #include <stdlib.h>
 #include <time.h>    // Only needed for tests
 #include <stdio.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <pthread.h>
 
 #include "debug.h"
 
@@ -55,7 +62,7 @@ int __mt_rand_string(char* out_buffer, size_t length)
     int i;
     for(i=0; i<length-1; i++) *(out_buffer + i) = __mt_rand(48, 122); // '0' to 'z'
 
-    out_buffer[length] = 0; // Null-terminated
+    out_buffer[length-1] = 0; // Null-terminated
     return i;
 }
 
@@ -73,6 +80,144 @@ int __mt_strings_equal(char* string_a, char* string_b)
     return 0;
 }
 
+// Check if the first `length` bytes of the input buffers are identical
+//
+// Return 1 if identical, 0 if not
+int __mt_buffers_identical(void* buffer_a, void* buffer_b, size_t length)
+{
+    if(length == 0 || memcmp(buffer_a, buffer_b, length)==0) return 1;
+    return 0;
+}
+
+// Check if two branches have the same labels, data types and data, and so do all of their descendants
+//
+// Return 1 if identical, 0 if not
+int __mt_branches_identical(mt_branch* branch_a, mt_branch* branch_b)
+{
+    if(!__mt_strings_equal(branch_a->label, branch_b->label)) return 0;
+    if((branch_a->data_type == NULL) != (branch_b->data_type == NULL)) return 0;
+    if(branch_a->data_type != NULL && !__mt_strings_equal(branch_a->data_type, branch_b->data_type)) return 0;
+    if(branch_a->data_size != branch_b->data_size) return 0;
+    if(!__mt_buffers_identical(branch_a->data, branch_b->data, branch_a->data_size)) return 0;
+    if(mt_get_num_children(branch_a) != mt_get_num_children(branch_b)) return 0;
+
+    mt_branch* child_b = branch_b->first_child;
+    for(mt_branch* child_a = branch_a->first_child; child_a != NULL; child_a = child_a->next_sibling)
+    {
+        if(!__mt_branches_identical(child_a, child_b)) return 0;
+        child_b = child_b->next_sibling;
+    }
+    return 1;
+}
+
+#if INTERFACE
+typedef struct mt_test_stream  // A stream held in memory, which is written or read `chunk` bytes at a time
+{
+    char* buffer;
+    size_t length;
+    size_t capacity;
+    size_t position;    // Where the next read starts
+    size_t chunk;
+} mt_test_stream;
+#endif
+
+// An `mt_write_function` which appends to the `mt_test_stream` `context`, growing it as needed
+//
+// Return 1 if all of `data` was written, 0 if not
+int __mt_test_stream_write(void* context, void* data, size_t length)
+{
+    mt_test_stream* stream = context;
+    if(stream->length + length > stream->capacity)
+    {
+        size_t capacity = (stream->length + length) * 2;
+        char* grown = realloc(stream->buffer, capacity);
+        if(grown == NULL) return 0;
+        stream->buffer = grown;
+        stream->capacity = capacity;
+    }
+    memcpy(stream->buffer + stream->length, data, length);
+    stream->length += length;
+    return 1;
+}
+
+// An `mt_read_function` which reads up to `chunk` bytes at a time from the `mt_test_stream` `context`
+//
+// Return the number of bytes read
+size_t __mt_test_stream_read(void* context, void* out_data, size_t capacity)
+{
+    mt_test_stream* stream = context;
+    size_t length = stream->length - stream->position;
+    if(length > capacity) length = capacity;
+    if(length > stream->chunk) length = stream->chunk;
+    memcpy(out_data, stream->buffer + stream->position, length);
+    stream->position += length;
+    return length;
+}
+
+#if INTERFACE
+typedef struct mt_test_reader  // A thread looking branches up while the main thread changes the tree
+{
+    mt_branch* root;
+    int* stop;                  // Set by the main thread once it has finished changing the tree
+    mt_path* compiled;          // "wide/stable", compiled
+    size_t reads;
+    size_t misses;              // Lookups of branches that were never removed, which failed
+    size_t torn;                // Copies of data which mixed two different values
+} mt_test_reader;
+#endif
+
+// Make an error on another thread, which `context`, a branch, is a child of. Returns the branch it tried to create,
+// or NULL if the error was not fatal there
+void* __mt_test_error_thread(void* context)
+{
+    return mt_create_branch(context, "bad/label");
+}
+
+// Look up branches of `context`, an `mt_test_reader`, which the main thread never removes, until it is stopped
+void* __mt_test_concurrent_reader(void* context)
+{
+    mt_test_reader* test = context;
+    mt_reader* reader = mt_register_reader(test->root);
+    size_t words[8];
+    while(!__atomic_load_n(test->stop, __ATOMIC_ACQUIRE) || test->reads < 1000)
+    {
+        mt_begin_read(reader);
+        mt_branch* stable = mt_get_by_path(test->root, "wide/stable");
+        if(stable == NULL || mt_get_by_path(test->root, "a/b/c") == NULL || mt_get_by_id(test->root, stable->id) != stable
+            || mt_get_by_compiled_path(test->root, test->compiled) != stable) test->misses++;
+        else
+        {
+            // The main thread sets data whose words are all the same, either inline or on the heap
+            size_t bytes = mt_get_data_copy(stable, words, sizeof words);
+            for(size_t i=1; i<bytes / sizeof words[0]; i++) if(words[i] != words[0]) { test->torn++; break; }
+        }
+        mt_list siblings = { 0 };
+        while(mt_get_next_sibling(mt_get_parent(stable), &siblings) != NULL) test->reads++;
+        mt_end_read(reader);
+    }
+    mt_unregister_reader(reader);
+    return NULL;
+}
+
+// Pre-order visitor counting the branches visited in `context`, an array of counters, skipping the children
+// of branches labelled 'pruned' and stopping at any labelled 'stop'
+int __mt_test_visit_before(mt_branch* branch, int depth, void* context)
+{
+    size_t* counts = context;
+    counts[0]++;
+    if(strcmp(branch->label, "pruned") == 0) return MT_VISIT_SKIP;
+    if(strcmp(branch->label, "stop") == 0) return MT_VISIT_STOP;
+    return MT_VISIT_CONTINUE;
+}
+
+// Post-order visitor counting the branches visited in `context`, and keeping the depth of the first
+int __mt_test_visit_after(mt_branch* branch, int depth, void* context)
+{
+    size_t* counts = context;
+    if(counts[1]++ == 0) counts[2] = depth;
+    return MT_VISIT_CONTINUE;
+}
+
 void __mt_assert(int condition, char* error_message)
 {
     if(!condition)
@@ -86,9 +231,16 @@ void __mt_assert(int condition, char* error_message)
 
 
 // A sort-of reasonably ok test of most, or all of the megatree code
-int main()
+int main(int argc, char** argv)
 {
     setvbuf(stdout, NULL, _IONBF, 0);
+
+    if(argc > 1 && __mt_strings_equal(argv[1], "--bench"))
+    {
+        __mt_run_benchmarks();
+        return 0;
+    }
+
     printf("Running megatree tests...\n");
     
     srand(time(NULL));    // Make the tests fuzzier. Fluffier.
@@ -118,6 +270,30 @@ int main()
         last_second_level_node = mt_create_branch(last_first_level_node, label);
     }
 
+    __mt_test_log(" Count and iterate through children");
+    __mt_assert(mt_get_num_children(root) == first_level_branches_to_create, "Wrong number of first level children");
+    __mt_assert(mt_get_num_descendants(root, 0, -1) == first_level_branches_to_create + second_level_branches_to_create, "Wrong number of descendants");
+    __mt_assert(mt_get_nth_child(root, first_level_branches_to_create - 1) == last_first_level_node, "nth child is not the last child created");
+    __mt_assert(mt_get_nth_child(root, first_level_branches_to_create) == NULL, "nth child found beyond the last child");
+
+    mt_list child_iterator = { 0 };
+    mt_list batch_iterator = { 0 };
+    mt_branch* child_batch[4];
+    int children_iterated = 0;
+    int batch_size;
+    while((batch_size = mt_get_children_as_pointer_array(last_first_level_node, &batch_iterator, child_batch, 4)) > 0)
+    {
+        for(int i=0; i<4; i++)
+        {
+            if(i < batch_size) __mt_assert(child_batch[i] == mt_get_next_sibling(last_first_level_node, &child_iterator), "Pointer array does not match sibling iteration");
+            else __mt_assert(child_batch[i] == NULL, "Pointer array not padded with NULLs");
+        }
+        children_iterated += batch_size;
+    }
+    __mt_assert(children_iterated == second_level_branches_to_create, "Wrong number of children iterated");
+    __mt_assert(mt_get_next_sibling(last_first_level_node, &child_iterator) == NULL, "Sibling iteration did not finish");
+    __mt_assert(child_iterator.item == last_second_level_node, "Sibling iteration did not finish at the last child");
+
     __mt_test_log(" Set the label of an existing branch");
     mt_set_label(last_first_level_node, "last_first_level");
     __mt_test_log(" Verify correct");
@@ -160,8 +336,10 @@ int main()
     mt_create_path(root, "/creating_path_test///creating_path_test8/test//test//test/");
 
     __mt_test_log(" Create branches based on a path that includes invalid characters");
-    mt_create_path(root, "/creating_path_test/{134}");
-    mt_create_path(root, "/creating_path_test/{invalid characters}");
+    MT_ERRORS_ARE_FATAL = 0;
+    __mt_assert(mt_create_path(root, "/creating_path_test/{134}") == NULL, "Created a path with an id that does not exist");
+    __mt_assert(mt_create_path(root, "/creating_path_test/{invalid characters}") == NULL, "Created a path with invalid characters");
+    MT_ERRORS_ARE_FATAL = 1;
 
     __mt_test_log(" Create branches based on a path (very long)");
     mt_create_path(root, "/very_long_path/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/");
@@ -206,73 +384,1059 @@ int main()
     // TODO: implement a mt_check_path_exists and also write a test for it
     //       Then use it to check all of these path operations
 
-    // Also write a __mt_check_buffers_identical(void* buffer_a, void* buffer_b, size_t length)
-    //      and use it to check that the data copying is good
-
-
-
-
-
-    // Replace the data in a branch with new data by copying it from a buffer
-    // Replace the data in a branch with new data by assigning a pointer to it
-
-    // Remove data from a branch
+    __mt_test_log(" Check copied data is identical to the original");
+    data_test_branch = mt_get_by_path(root, "/test/data_insertion/copied_from_buffer_1_megabyte");
+    __mt_assert(data_test_branch->data != test_data, "Copied data was not copied");
+    __mt_assert(__mt_buffers_identical(data_test_branch->data, test_data, 1000000), "Copied data is not identical to the original");
+    data_test_branch = mt_get_by_path(root, "/test/data_insertion/copied_from_buffer_1_byte");
+    __mt_assert(data_test_branch->data == data_test_branch->inline_data, "Small data was not stored inside the branch");
+    __mt_assert(__mt_buffers_identical(data_test_branch->data, test_data, 1), "Copied data is not identical to the original");
+    data_test_branch = mt_get_by_path(root, "/test/data_insertion/pointer_3_bytes");
+    __mt_assert(data_test_branch->data == test_data, "Linked data is not the original buffer");
+
+    __mt_test_log(" Replace the data in a branch with new data by copying it from a buffer");
+    data_test_branch = mt_get_by_path(root, "/test/data_insertion/copied_from_buffer_89_bytes");
+    mt_set_data_copy(data_test_branch, test_data + 100, MT_INLINE_DATA_SIZE);   // Large data replaced by inline data
+    __mt_assert(data_test_branch->data == data_test_branch->inline_data, "Replaced data was not stored inside the branch");
+    __mt_assert(__mt_buffers_identical(data_test_branch->data, test_data + 100, MT_INLINE_DATA_SIZE), "Replaced data is not identical");
+    mt_set_data_copy(data_test_branch, test_data, MT_INLINE_DATA_SIZE + 1);     // Inline data replaced by large data
+    __mt_assert(data_test_branch->data != data_test_branch->inline_data, "Large data was stored inside the branch");
+    __mt_assert(__mt_buffers_identical(data_test_branch->data, test_data, MT_INLINE_DATA_SIZE + 1), "Replaced data is not identical");
+    mt_set_data_copy(data_test_branch, (char*)data_test_branch->data + 1, 8);  // Copying part of its own data
+    __mt_assert(__mt_buffers_identical(data_test_branch->data, test_data + 1, 8), "Data copied from itself is not identical");
+
+    __mt_test_log(" Replace the data in a branch with new data by assigning a pointer to it");
+    mt_set_data_pointer(data_test_branch, test_data, 89);
+    __mt_assert(data_test_branch->data == test_data && data_test_branch->data_size == 89, "Linked data did not replace copied data");
+
+    __mt_test_log(" Remove data from a branch");
+    mt_set_data_copy(data_test_branch, NULL, 0);
+    __mt_assert(data_test_branch->data == NULL && data_test_branch->data_size == 0, "Data was not removed");
+    mt_set_data_copy(data_test_branch, test_data, 89);
+
+    __mt_test_log(" Hand a buffer over to a branch without copying it");
+    mt_branch* ownership_test = mt_create_path(root, "ownership_test/owned");
+    char* owned_buffer = malloc(1000000);
+    memcpy(owned_buffer, test_data, 1000000);
+    mt_set_data_owned(ownership_test, owned_buffer, 1000000);
+    __mt_assert(ownership_test->data == owned_buffer, "Owned data was copied");
+    __mt_assert(mt_check_data_owned(ownership_test), "Handed over data is not owned by the branch");
+    mt_set_data_owned(ownership_test, owned_buffer, 1000);              // Handing over the same buffer again must not free it
+    __mt_assert(ownership_test->data == owned_buffer && ownership_test->data_size == 1000, "Owned data was not resized");
+
+    __mt_test_log(" Copy branches with owned and linked data");
+    mt_branch* linked_test = mt_create_path(root, "ownership_test/linked");
+    mt_set_data_pointer(linked_test, test_data, 1000000);
+    __mt_assert(!mt_check_data_owned(linked_test), "Linked data is owned by the branch");
+    mt_copy_branch(ownership_test, linked_test);
+    mt_copy_branch(linked_test, ownership_test);
+    mt_branch* owned_copy = mt_get_by_path(linked_test, "owned");
+    mt_branch* linked_copy = mt_get_by_path(ownership_test, "linked");
+    __mt_assert(owned_copy->data != owned_buffer && __mt_buffers_identical(owned_copy->data, owned_buffer, 1000), "Owned data was not copied");
+    __mt_assert(mt_check_data_owned(owned_copy), "Copied data is not owned by the copy");
+    __mt_assert(linked_copy->data == test_data && !mt_check_data_owned(linked_copy), "Linked data was not linked by the copy");
+
+    __mt_test_log(" Replace and delete owned data");
+    mt_set_data_owned(owned_copy, malloc(10), 10);                    // Frees the copy's previous buffer
+    mt_set_data_pointer(ownership_test, test_data, 10);                 // Frees `owned_buffer`
+    mt_set_data_owned(linked_test, malloc(20), 20);                     // Must not free `test_data`
+    mt_delete_branch(mt_get_by_path(root, "ownership_test"));
 
 
 
     // -------- Retrieve data
 
     // Search for a label
-    // Retrieve a branch based on a path
-    // Try to retrieve an invalid path
-    // Try to retrieve a path that does not exist
 
-    // Get the size of a branch's data
-    // Get a branch's data as a pointer
-    // Get a branch's data by copying it into a buffer
+    __mt_test_log(" Retrieve a branch based on a path");
+    mt_branch* path_test_branch = mt_get_by_path(root, "creating_path_test/creating_path_test2/test");
+    __mt_assert(path_test_branch != NULL && __mt_strings_equal(path_test_branch->label, "test"), "Branch not found from its path");
+    __mt_assert(mt_get_by_path(root, "  //creating_path_test/creating_path_test2//test/ ") == path_test_branch, "Equivalent path found a different branch");
+    __mt_assert(mt_check_path_exists(root, "creating_path_test/spaces/used/test/with/spaces"), "Path created with spaces not found");
+    __mt_assert(mt_check_path_exists(root, "very_long_path/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j/j"), "Very long path not found");
+    __mt_assert(mt_get_by_path(root, "") == root, "Empty path did not find the root");
+
+    __mt_test_log(" Retrieve a branch based on a path containing ids");
+    char id_path[64];
+    sprintf(id_path, "{%ld}/{%ld}/test", path_test_branch->parent->parent->id, path_test_branch->parent->id);
+    __mt_assert(mt_get_by_path(root, id_path) == path_test_branch, "Path containing ids not found");
+
+    __mt_test_log(" Try to retrieve an invalid path");
+    __mt_assert(mt_get_by_path(root, "creating_path_test/{invalid_id}") == NULL, "Found a branch from an invalid path");
+
+    __mt_test_log(" Try to retrieve a path that does not exist");
+    __mt_assert(mt_get_by_path(root, "creating_path_test/does_not_exist") == NULL, "Found a branch from a path that does not exist");
+
+    __mt_test_log(" Compile paths once, and follow them to the same branches as the paths themselves");
+    char* compiled_sources[] = { "creating_path_test/creating_path_test2/test", " //creating_path_test/creating_path_test2//test/ ",
+        id_path, "", "creating_path_test/spaces/used/test/with/spaces", "creating_path_test/does_not_exist" };
+    for(int i=0; i<6; i++)
+    {
+        mt_path* compiled = mt_compile_path(root, compiled_sources[i]);
+        __mt_assert(compiled != NULL && mt_get_by_compiled_path(root, compiled) == mt_get_by_path(root, compiled_sources[i]),
+            "A compiled path found a different branch than the path itself");
+        mt_free_path(compiled);
+    }
+    mt_path* compiled_new = mt_compile_path(root, "creating_path_test/compiled/new path");
+    __mt_assert(mt_get_by_compiled_path(root, compiled_new) == NULL, "A compiled path found a branch that does not exist yet");
+    mt_branch* compiled_created = mt_create_compiled_path(root, compiled_new);
+    __mt_assert(compiled_created == mt_get_by_path(root, "creating_path_test/compiled/new/path") &&
+        mt_create_compiled_path(root, compiled_new) == compiled_created, "A compiled path was not created just once");
+    __mt_assert(mt_get_by_compiled_path(root, compiled_new) == compiled_created, "A created compiled path was not found");
+    mt_branch* other_tree = mt_create_root();
+    MT_ERRORS_ARE_FATAL = 0;
+    __mt_assert(mt_compile_path(root, "creating_path_test/{not_an_id}") == NULL, "Compiled a path with disallowed characters");
+    __mt_assert(mt_get_by_compiled_path(other_tree, compiled_new) == NULL, "Followed a path compiled for another tree");
+    mt_path* compiled_id = mt_compile_path(root, "creating_path_test/{999999}/new");
+    __mt_assert(mt_create_compiled_path(root, compiled_id) == NULL, "Created a compiled path through a missing id");
+    MT_ERRORS_ARE_FATAL = 1;
+    mt_clear_last_error();
+    mt_free_path(compiled_id);
+    mt_free_path(compiled_new);
+    mt_destroy_tree(other_tree);
+    mt_delete_branch(mt_get_by_path(root, "creating_path_test/compiled"));
+
+    __mt_test_log(" Retrieve a batch of paths sharing prefixes, in the order they were given");
+    char* batch_paths[] = { "creating_path_test/creating_path_test2/test", "creating_path_test/does_not_exist", id_path,
+        " //creating_path_test/creating_path_test2//test/ ", "", "creating_path_test/spaces/used/test/with/spaces",
+        "creating_path_test/does_not_exist/below" };
+    mt_branch* batch_branches[7];
+    __mt_assert(mt_get_by_paths(root, batch_paths, 7, batch_branches) == 5, "Did not find every path of a batch");
+    for(int i=0; i<7; i++)
+    {
+        __mt_assert(batch_branches[i] == mt_get_by_path(root, batch_paths[i]), "A batch found a different branch than a single lookup");
+    }
 
-    // Get the size of the data belonging to a branch's children
-    // Get the size of the data belonging to all a branch's descendants
+    __mt_test_log(" Create a batch of paths sharing prefixes, just as creating them one at a time does");
+    char* created_paths[] = { "tenants/a/sessions/1/state", "tenants/a/sessions/2/state", "tenants/b/sessions/1",
+        "tenants/a/sessions/1/state/deeper", "tenants/a", "tenants/b/sessions/1/state", "/tenants//a/limits" };
+    mt_branch* batch_root = mt_create_root();
+    mt_branch* single_root = mt_create_root();
+    mt_branch* created_branches[7];
+    __mt_assert(mt_create_paths(batch_root, created_paths, 7, created_branches), "Could not create a batch of paths");
+    for(int i=0; i<7; i++)
+    {
+        __mt_assert(mt_create_path(single_root, created_paths[i])->id == created_branches[i]->id, "A batch created a different branch");
+        __mt_assert(created_branches[i] == mt_get_by_path(batch_root, created_paths[i]), "A batch did not return the branch it created");
+    }
+    __mt_assert(mt_check_branches_identical(batch_root, single_root) == NULL, "A batch created a different tree");
+    char many_paths[300][48];
+    char* many_path_pointers[300];
+    mt_branch* many_branches[300];
+    for(int i=0; i<300; i++)
+    {
+        sprintf(many_paths[i], "tenants/%c/sessions/long_session_name_%d", "ab"[i % 2], (i * 37) % 300);
+        many_path_pointers[i] = many_paths[i];
+        if(i % 3 == 0) mt_create_path(batch_root, many_paths[i]);
+    }
+    __mt_assert(mt_get_by_paths(batch_root, many_path_pointers, 300, many_branches) == 100, "Did not find every path of a large batch");
+    for(int i=0; i<300; i++)
+    {
+        __mt_assert(many_branches[i] == mt_get_by_path(batch_root, many_paths[i]), "A large batch found a different branch than a single lookup");
+    }
+    char* failing_paths[] = { "tenants/c", "tenants/d/{12345}/state", "tenants/e" };
+    MT_ERRORS_ARE_FATAL = 0;
+    __mt_assert(!mt_create_paths(batch_root, failing_paths, 3, NULL), "Created a batch with a path through a missing id");
+    MT_ERRORS_ARE_FATAL = 1;
+    mt_clear_last_error();
+    __mt_assert(mt_check_path_exists(batch_root, "tenants/c") && !mt_check_path_exists(batch_root, "tenants/d") &&
+        !mt_check_path_exists(batch_root, "tenants/e"), "A failing batch did not stop at the path that failed");
+    mt_destroy_tree(batch_root);
+    mt_destroy_tree(single_root);
+
+    __mt_test_log(" Retrieve the same path repeatedly from the path cache");
+    mt_path_cache_stats cache_stats_before, cache_stats_after;
+    mt_get_path_cache_stats(root, &cache_stats_before);
+    for(int i=0; i<10; i++) mt_get_by_path(root, "/creating_path_test/creating_path_test2/test");
+    mt_get_path_cache_stats(root, &cache_stats_after);
+    __mt_assert(cache_stats_after.hits == cache_stats_before.hits + 10, "Repeated path lookups were not answered from the cache");
+    printf("  path cache: %ld hits, %ld misses, %ld entries in use\n", cache_stats_after.hits, cache_stats_after.misses, cache_stats_after.entries_in_use);
+
+    __mt_test_log(" Check cached paths are invalidated when a branch is relabelled");
+    mt_set_label(path_test_branch->parent, "relabelled");
+    __mt_assert(mt_get_by_path(root, "creating_path_test/creating_path_test2/test") == NULL, "Cached path survived relabelling");
+    __mt_assert(mt_get_by_path(root, "creating_path_test/relabelled/test") == path_test_branch, "Relabelled path not found");
+    mt_set_label(path_test_branch->parent, "creating_path_test2");
+
+    __mt_test_log(" Find children of a wide branch through its label index");
+    mt_branch* wide = mt_create_branch(root, "wide");
+    mt_branch* wide_children[1000];
+    char wide_label[32];
+    for(int i=0; i<1000; i++)
+    {
+        sprintf(wide_label, "child%d", i % 500);    // Every label is shared by two children
+        wide_children[i] = mt_create_branch(wide, wide_label);
+    }
+    __mt_assert(wide->child_index != NULL, "Wide branch was not indexed");
+    __mt_assert(mt_get_num_children(wide) == 1000, "Wrong number of children in wide branch");
+    __mt_assert(mt_get_by_path(wide, "child123") == wide_children[123], "Indexed lookup did not find the first matching child");
+    mt_delete_branch(wide_children[123]);
+    __mt_assert(mt_get_by_path(wide, "child123") == wide_children[623], "Indexed lookup did not find the remaining duplicate");
+    mt_set_label(wide_children[7], "child623");     // Earlier than the existing child623, so it now comes first
+    __mt_assert(mt_get_by_path(wide, "child623") == wide_children[7], "Relabelled child not found first");
+    __mt_assert(mt_get_by_path(wide, "child7") == wide_children[507], "Relabelled child still found by its old label");
+    for(int i=999; i>=10; i--) if(i != 123) mt_delete_branch(wide_children[i]);
+    __mt_assert(wide->child_index == NULL, "Index of a narrow branch was not released");
+    __mt_assert(mt_get_by_path(wide, "child623") == wide_children[7], "Child not found after its parent's index was released");
+    mt_delete_branch(wide);
+
+    __mt_test_log(" Check identical labels share one interned copy");
+    mt_branch* interning_test = mt_create_branch(root, "interning_test");
+    mt_string_stats string_stats_before, string_stats_after;
+    mt_get_string_stats(root, &string_stats_before);
+    mt_branch* shared_a = mt_create_branch(interning_test, "shared_label");
+    mt_branch* shared_b = mt_create_branch(mt_create_branch(interning_test, "other"), "shared_label");
+    mt_set_data_type(shared_a, "shared_type");
+    mt_set_data_type(shared_b, "shared_type");
+    __mt_assert(shared_a->label == shared_b->label, "Identical labels were not interned");
+    __mt_assert(shared_a->data_type == shared_b->data_type, "Identical data types were not interned");
+    mt_get_string_stats(root, &string_stats_after);
+    __mt_assert(string_stats_after.distinct_strings == string_stats_before.distinct_strings + 3, "Wrong number of distinct strings");
+    __mt_assert(string_stats_after.references == string_stats_before.references + 5, "Wrong number of string references");
+    printf("  %ld distinct strings used %ld times: %ld bytes saved\n", string_stats_after.distinct_strings,
+        string_stats_after.references, string_stats_after.bytes_saved);
+
+    __mt_test_log(" Search for a label");
+    __mt_assert(mt_search_for_label(root, "shared_label") == shared_a, "Search did not find the first branch with a label");
+    __mt_assert(mt_search_for_label(mt_get_by_path(interning_test, "other"), "shared_label") == shared_b, "Search did not stay within its branch");
+    __mt_assert(mt_search_for_label(shared_a, "shared_label") == NULL, "Search found the branch it started from");
+    __mt_assert(mt_search_for_label(root, "no_such_label") == NULL, "Search found a label that does not exist");
+
+    __mt_test_log(" Check interned strings are released when no longer used");
+    mt_set_label(shared_a, "relabelled_shared");
+    mt_delete_branch(interning_test);
+    mt_get_string_stats(root, &string_stats_after);
+    __mt_assert(string_stats_after.distinct_strings == string_stats_before.distinct_strings - 1, "Unused strings were not released");  // "interning_test" has gone too
+
+    __mt_test_log(" Get the size of a branch's data");
+    mt_branch* data_insertion = mt_get_by_path(root, "/test/data_insertion");
+    __mt_assert(mt_get_data_size(mt_get_by_path(data_insertion, "copied_from_buffer_1k")) == 1000, "Wrong data size");
+    __mt_assert(mt_get_data_size(mt_get_by_path(data_insertion, "copied_from_buffer_empty")) == 0, "Wrong data size for an empty branch");
+
+    __mt_test_log(" Get a branch's data as a pointer");
+    __mt_assert(mt_get_data_pointer(mt_get_by_path(data_insertion, "pointer_1_megabyte")) == test_data, "Wrong data pointer");
+    __mt_assert(mt_get_data_pointer(mt_get_by_path(data_insertion, "copied_from_buffer_empty")) == NULL, "Empty branch has a data pointer");
+
+    __mt_test_log(" Get a branch's data by copying it into a buffer");
+    char data_copy[100];
+    __mt_assert(mt_get_data_copy(mt_get_by_path(data_insertion, "copied_from_buffer_1_byte"), data_copy, sizeof data_copy) == 1, "Wrong number of bytes copied");
+    __mt_assert(__mt_buffers_identical(data_copy, test_data, 1), "Copied inline data is not identical");
+    __mt_assert(mt_get_data_copy(mt_get_by_path(data_insertion, "copied_from_buffer_1k"), data_copy, sizeof data_copy) == sizeof data_copy, "Copy overran the buffer");
+    __mt_assert(__mt_buffers_identical(data_copy, test_data, sizeof data_copy), "Copied data is not identical");
+
+    __mt_test_log(" Get the size of the data belonging to a branch's children");
+    size_t data_insertion_size = 89 + 0 + 1 + 1000 + 1000000 + 1000000 + 3;
+    __mt_assert(mt_get_childrens_data_size(data_insertion) == data_insertion_size, "Wrong size for the children's data");
+
+    __mt_test_log(" Get the size of the data belonging to all a branch's descendants");
+    __mt_assert(mt_get_childrens_data_size_recursive(mt_get_by_path(root, "test")) == data_insertion_size, "Wrong size for the descendants' data");
+
+    __mt_test_log(" Keep the totals of a branch's ancestors up to date as its data and children change");
+    mt_branch* totals_test = mt_create_path(root, "test/totals/a");
+    mt_set_data_copy(totals_test, test_data, 500);
+    mt_set_data_copy(mt_create_branch(totals_test, "b"), test_data, 20);
+    __mt_assert(mt_get_childrens_data_size_recursive(mt_get_by_path(root, "test")) == data_insertion_size + 520, "Totals not updated for new data");
+    mt_set_data_copy(totals_test, test_data, 5);
+    __mt_assert(mt_get_childrens_data_size(mt_get_parent(totals_test)) == 5, "Totals not updated for smaller data");
+    __mt_assert(mt_get_num_descendants(mt_get_by_path(root, "test"), 0, -1) == mt_get_num_descendants(data_insertion, 0, -1) + 4, "Totals not updated for new branches");
+    mt_delete_branch(mt_get_parent(totals_test));
+    __mt_assert(mt_get_childrens_data_size_recursive(mt_get_by_path(root, "test")) == data_insertion_size, "Totals not updated for deleted branches");
+    __mt_assert(mt_check_totals(root), "Cached totals do not match the tree");
+
+    __mt_test_log(" Find cached totals that do not match the tree");
+    MT_ERRORS_ARE_FATAL = 0;
+    data_insertion->num_descendants++;
+    __mt_assert(!mt_check_totals(root), "Wrong totals were not found");
+    data_insertion->num_descendants--;
+    MT_ERRORS_ARE_FATAL = 1;
 
 
     // -------- Delete branches
 
-    // Delete a single branch
-    // Verify the memory has been freed
+    __mt_test_log(" Delete a single branch");
+    size_t branches_before_delete = mt_get_num_branches(root);
+    mt_branch* to_delete = mt_create_branch(root, "to_delete");
+    mt_create_branch(to_delete, "child_a");
+    mt_create_branch(mt_create_branch(to_delete, "child_b"), "a_label_long_enough_that_it_cannot_be_stored_in_any_of_the_label_pools");
+    __mt_assert(mt_get_num_branches(root) == branches_before_delete + 4, "Branch count not incremented when creating branches");
+    __mt_assert(mt_delete_branch(to_delete) == root, "Deleting a branch did not return its parent");
+
+    __mt_test_log(" Verify the memory has been freed");
+    __mt_assert(mt_get_num_branches(root) == branches_before_delete, "Branch count not decremented when deleting branches");
+    mt_branch* recycled = mt_create_branch(root, "recycled");
+    __mt_assert(recycled == to_delete, "A deleted branch's memory was not reused");
+    mt_delete_branch(recycled);
 
 
     // -------- Copy branches
     
-    // Copy a branch, ignoring duplicates
-    // Check duplicates now exist
-
-    // Copy a branch, replacing top-level duplicates
-    // Check no duplicates exist, and any original deeper-level items have been removed
-
-    // Copy a branch, merging duplicates
-    // Check duplicates exist
+    __mt_test_log(" Copy a branch, ignoring duplicates");
+    mt_branch* copy_source = mt_create_path(root, "copy_test/source/template");
+    mt_create_path(root, "copy_test/source/template/a/b");
+    mt_branch* copy_destination = mt_create_path(root, "copy_test/destination");
+    mt_create_path(root, "copy_test/destination/template/existing_child");
+    __mt_assert(mt_copy_branch(copy_source, copy_destination), "Copying a branch failed");
+
+    __mt_test_log(" Check duplicates now exist");
+    __mt_assert(mt_get_num_children(copy_destination) == 2, "Copied branch is not a duplicate");
+    __mt_assert(mt_get_first_child(mt_get_first_child(mt_get_nth_child(copy_destination, 1))) != NULL, "Sub-branches were not copied");
+    __mt_assert(mt_check_path_exists(root, "copy_test/source/template/a/b"), "Original branch changed by copying");
+
+    __mt_test_log(" Copy a branch, replacing top-level duplicates");
+    mt_get_by_path(root, "copy_test/destination/template/existing_child");    // Make sure it's cached
+    __mt_assert(mt_copy_branch_replace(copy_source, copy_destination), "Copying a branch with replacement failed");
+
+    __mt_test_log(" Check no duplicates exist, and any original deeper-level items have been removed");
+    __mt_assert(mt_get_num_children(copy_destination) == 1, "Duplicates were not replaced");
+    __mt_assert(!mt_check_path_exists(root, "copy_test/destination/template/existing_child"), "Replaced branch is still reachable");
+    __mt_assert(mt_check_path_exists(root, "copy_test/destination/template/a/b"), "Replacement branch not found");
+
+    __mt_test_log(" Copy a branch, merging duplicates");
+    mt_create_path(root, "copy_test/destination/template/merged_child");
+    mt_create_path(root, "copy_test/source/template/a/c");
+    __mt_assert(mt_copy_branch_merge(copy_source, copy_destination), "Copying a branch with merging failed");
+
+    __mt_test_log(" Check duplicates were merged");
+    __mt_assert(mt_get_num_children(copy_destination) == 1, "Merged branch was duplicated");
+    __mt_assert(mt_get_num_descendants(mt_get_by_path(copy_destination, "template"), 0, -1) == 4, "Merged branch has the wrong descendants");
+    __mt_assert(mt_check_path_exists(copy_destination, "template/merged_child"), "Merging removed an existing child");
+    __mt_assert(mt_check_path_exists(copy_destination, "template/a/c"), "Merging did not add a new child");
+
+    __mt_test_log(" Try to copy a branch into itself");
+    MT_ERRORS_ARE_FATAL = 0;
+    __mt_assert(!mt_copy_branch(copy_source, mt_get_by_path(copy_source, "a")), "Copied a branch into itself");
+    MT_ERRORS_ARE_FATAL = 1;
+
+    __mt_test_log(" Copy a branch many times, sharing its sub-branches until they are reached");
+    mt_branch* shared_template = mt_create_path(root, "copy_test/shared/template");
+    int shared_value = 1, read_value = 0;
+    mt_set_data_copy(mt_create_path(shared_template, "limits/memory"), &shared_value, sizeof shared_value);
+    mt_create_path(shared_template, "limits/cpu");
+    mt_create_path(shared_template, "name");
+    mt_branch* tenants = mt_create_path(root, "copy_test/shared/tenants");
+    size_t branches_before_copies = mt_get_num_branches(root);
+    size_t created_before_copies = root->tree->branch_pool.objects_in_use;
+    for(int i=0; i<100; i++) __mt_assert(mt_copy_branch(shared_template, tenants), "Copying a shared branch failed");
+    __mt_assert(root->tree->branch_pool.objects_in_use == created_before_copies + 100, "Copies created their sub-branches straight away");
+    __mt_assert(mt_get_num_branches(root) == branches_before_copies + 100 * 5, "The branches copies share are not counted");
+    __mt_assert(mt_get_num_descendants(tenants, 0, -1) == 100 * 5, "Copies do not count the sub-branches they share");
+    __mt_assert(root->tree->branch_pool.objects_in_use == created_before_copies + 100, "Counting the copies' sub-branches created them");
+
+    __mt_test_log(" Change a copy, creating only the branches on the way to the change");
+    shared_value = 2;
+    mt_set_data_copy(mt_get_by_path(mt_get_nth_child(tenants, 7), "limits/memory"), &shared_value, sizeof shared_value);
+    __mt_assert(root->tree->branch_pool.objects_in_use == created_before_copies + 104, "Changing a copy created more than the path to the change");
+    __mt_assert(mt_get_num_branches(root) == branches_before_copies + 100 * 5, "Creating a copy's branches changed the count");
+    mt_get_data_copy(mt_get_by_path(shared_template, "limits/memory"), &read_value, sizeof read_value);
+    __mt_assert(read_value == 1, "Changing a copy changed the original");
+    mt_get_data_copy(mt_get_by_path(mt_get_nth_child(tenants, 8), "limits/memory"), &read_value, sizeof read_value);
+    __mt_assert(read_value == 1, "Changing a copy changed another copy");
+
+    __mt_test_log(" Change the original, leaving its copies as they were");
+    shared_value = 3;
+    mt_set_data_copy(mt_get_by_path(shared_template, "limits/memory"), &shared_value, sizeof shared_value);
+    mt_create_path(shared_template, "limits/disk");
+    mt_set_label(mt_get_by_path(shared_template, "name"), "title");
+    mt_get_data_copy(mt_get_by_path(mt_get_nth_child(tenants, 9), "limits/memory"), &read_value, sizeof read_value);
+    __mt_assert(read_value == 1, "Changing the original changed its copy's data");
+    __mt_assert(!mt_check_path_exists(mt_get_nth_child(tenants, 9), "limits/disk"), "Changing the original added to its copy");
+    __mt_assert(mt_check_path_exists(mt_get_nth_child(tenants, 9), "name"), "Changing the original relabelled its copy's branch");
+    *(int*)mt_get_data_pointer(mt_get_by_path(shared_template, "limits/memory")) = 5;
+    mt_get_data_copy(mt_get_by_path(mt_get_nth_child(tenants, 11), "limits/memory"), &read_value, sizeof read_value);
+    __mt_assert(read_value == 1, "Writing through the original's data pointer changed its copy");
+
+    __mt_test_log(" Copy a copy, then delete the original");
+    __mt_assert(mt_copy_branch(mt_get_nth_child(tenants, 10), tenants), "Copying a copy failed");
+    mt_delete_branch(shared_template);
+    __mt_assert(mt_get_num_descendants(tenants, 0, -1) == 101 * 5, "Deleting the original changed its copies");
+    __mt_assert(mt_check_totals(root), "Copies have the wrong totals");
+    mt_get_data_copy(mt_get_by_path(mt_get_nth_child(tenants, 100), "limits/memory"), &read_value, sizeof read_value);
+    __mt_assert(read_value == 1, "The copy of a copy has the wrong data");
+    mt_get_data_copy(mt_get_by_path(mt_get_nth_child(tenants, 7), "limits/memory"), &read_value, sizeof read_value);
+    __mt_assert(read_value == 2, "A changed copy lost its change");
+
+    __mt_test_log(" Stop looking for shared ancestors at a branch already found to have none");
+    mt_create_path(root, "copy_test/shared/kept/a");
+    mt_copy_branch(mt_get_by_path(root, "copy_test/shared/kept"), tenants);
+    mt_branch* stamped = mt_create_path(root, "copy_test/shared/stamped/deep/branch");
+    shared_value = 4;
+    mt_set_data_copy(stamped, &shared_value, sizeof shared_value);
+    __mt_assert(__mt_share_stamp(root) == root->tree->share_epoch && __mt_share_stamp(stamped) == root->tree->share_epoch,
+        "Branches without shared ancestors were not stamped");
+    mt_copy_branch(mt_get_by_path(root, "copy_test/shared/stamped"), tenants);
+    __mt_assert(__mt_share_stamp(stamped) != root->tree->share_epoch, "Sharing a branch did not start a new share epoch");
+    shared_value = 5;
+    mt_set_data_copy(stamped, &shared_value, sizeof shared_value);
+    mt_get_data_copy(mt_get_by_path(tenants->last_child, "deep/branch"), &read_value, sizeof read_value);
+    __mt_assert(read_value == 4 && mt_check_totals(root), "Changing a branch below a stamped one changed a copy sharing it");
+
+    __mt_test_log(" Delete an original along with copies still sharing its children");
+    mt_branch* deleted_together = mt_create_path(root, "copy_test/shared/together/original");
+    mt_create_path(deleted_together, "a/b");
+    for(int i=0; i<3; i++) mt_copy_branch(deleted_together, mt_get_by_path(root, "copy_test/shared/together"));
+    __mt_assert(deleted_together->flags & MT_BRANCH_SHARED, "Copies did not share the children of their original");
+    mt_delete_branch(mt_get_by_path(root, "copy_test/shared/together"));
+    __mt_assert(mt_check_totals(root), "Deleting an original with its copies left the wrong totals");
 
 
     // -------- Move branches
-    // Copy a branch, ignoring duplicates
-    // Check original has been removed
+    __mt_test_log(" Move a branch, ignoring duplicates");
+    mt_get_by_path(root, "copy_test/source/template/a/b");    // Make sure it's cached
+    __mt_assert(mt_move_branch(copy_source, copy_destination), "Moving a branch failed");
+
+    __mt_test_log(" Check original has been removed");
+    __mt_assert(mt_get_by_path(root, "copy_test/source/template/a/b") == NULL, "Moved branch is still reachable at its old path");
+    __mt_assert(mt_get_num_children(copy_destination) == 2, "Moved branch is not a duplicate");
+
+    __mt_test_log(" Move a branch, replacing duplicates");
+    __mt_assert(mt_move_branch_replace(mt_create_path(root, "copy_test/source/template"), copy_destination), "Moving a branch with replacement failed");
+    __mt_assert(mt_get_num_children(copy_destination) == 1, "Duplicates were not replaced when moving");
+    __mt_assert(mt_get_num_children(mt_get_by_path(root, "copy_test/source")) == 0, "Moved branch was not removed");
+
+    __mt_test_log(" Move a branch by relinking it, keeping its ids and data");
+    mt_branch* relinked = mt_create_path(root, "move_test/from/relinked");
+    mt_branch* relinked_child = mt_create_branch(relinked, "child");
+    mt_set_data_copy(relinked, test_data, 100);
+    void* relinked_data = mt_get_data_pointer(relinked);
+    size_t relinked_id = relinked->id;
+    mt_branch* move_target = mt_create_path(root, "move_test/to");
+    __mt_assert(mt_move_branch(relinked, move_target), "Moving a branch by relinking it failed");
+    __mt_assert(mt_get_by_path(root, "move_test/to/relinked") == relinked && relinked->parent == move_target, "Moved branch is not at its new path");
+    __mt_assert(mt_get_by_path(root, "move_test/from/relinked") == NULL, "Moved branch is still reachable at its old path");
+    __mt_assert(mt_get_by_id(root, relinked_id) == relinked && mt_get_by_path(relinked, "child") == relinked_child, "Moving a branch changed its ids");
+    __mt_assert(mt_get_data_pointer(relinked) == relinked_data, "Moving a branch copied its data");
+
+    __mt_test_log(" Move a branch, merging duplicates by relinking the branches that do not collide");
+    mt_branch* merged = mt_create_path(root, "move_test/merge_from/relinked");
+    mt_branch* merged_child = mt_create_branch(merged, "new_child");
+    mt_create_branch(merged, "child");
+    mt_set_data_copy(merged, test_data + 100, 100);
+    void* merged_data = mt_get_data_pointer(merged);
+    __mt_assert(mt_move_branch_merge(merged, move_target), "Moving a branch with merging failed");
+    __mt_assert(mt_get_num_children(move_target) == 1 && mt_get_num_children(relinked) == 2, "Moved branches were not merged");
+    __mt_assert(mt_get_by_path(relinked, "child") == relinked_child, "Merging replaced an existing branch");
+    __mt_assert(mt_get_by_path(relinked, "new_child") == merged_child, "Merging copied a branch that did not collide");
+    __mt_assert(mt_get_data_pointer(relinked) == merged_data, "Merging copied owned data instead of handing it over");
+    __mt_assert(mt_get_num_children(mt_get_by_path(root, "move_test/merge_from")) == 0, "Merged branch was not removed");
+    __mt_assert(mt_check_totals(root), "Moves left the wrong totals");
+
+    __mt_test_log(" Walk a chain of 100000 branches, deeper than recursion could go");
+    const int chain_length = 100000;
+    mt_branch* chain = mt_create_branch(root, "chain");
+    mt_branch* link = chain;
+    for(int i=1; i<=chain_length; i++) link = mt_create_branch(link, (i == chain_length / 2) ? "pruned" : "link");
+    __mt_assert(mt_get_num_descendants(chain, 0, -1) == chain_length, "Wrong number of descendants in a deep chain");
+    __mt_assert(mt_get_num_descendants(chain, 0, 10) == 10, "Depth limit not respected when counting a deep chain");
+    __mt_assert(mt_find_max_id(chain, 0, -1) == link->id, "Wrong maximum id in a deep chain");
+    __mt_assert(mt_check_totals(root), "A deep chain has the wrong totals");
+
+    __mt_test_log(" Traverse the chain, pruning it halfway and visiting branches after their children");
+    size_t visits[3] = {0};
+    __mt_assert(mt_traverse(chain, -1, __mt_test_visit_before, __mt_test_visit_after, visits), "Traversal was stopped");
+    __mt_assert(visits[0] == chain_length / 2 + 1, "Pruned traversal visited the wrong number of branches");
+    __mt_assert(visits[1] == chain_length / 2 && visits[2] == chain_length / 2 - 1, "Branches were not visited after their children");
+    memset(visits, 0, sizeof visits);
+    __mt_assert(mt_traverse(chain, -1, NULL, __mt_test_visit_after, visits), "Post-order traversal was stopped");
+    __mt_assert(visits[1] == chain_length + 1 && visits[2] == chain_length, "Post-order traversal missed branches");
+    mt_set_label(mt_get_parent(link), "stop");
+    memset(visits, 0, sizeof visits);
+    __mt_assert(!mt_traverse(mt_get_parent(mt_get_parent(link)), -1, __mt_test_visit_before, __mt_test_visit_after, visits), "Traversal was not stopped");
+    __mt_assert(visits[0] == 2 && visits[1] == 0, "Traversal carried on after being stopped");
+
+    __mt_test_log(" Copy the chain into another tree, and delete it");
+    mt_branch* chain_tree = mt_create_root();
+    __mt_assert(mt_copy_branch(chain, chain_tree), "Copying a deep chain failed");
+    __mt_assert(mt_get_num_descendants(mt_get_by_path(chain_tree, "chain"), 0, -1) == chain_length, "Deep chain was not copied");
+    mt_destroy_tree(chain_tree);
+    mt_delete_branch(chain);
+    __mt_assert(mt_get_by_path(root, "chain") == NULL, "Deep chain was not deleted");
 
 
     // -------- Save and load
-    // Test mt_get_tree_file_size
-    // Assign buffer
+    __mt_test_log(" Get the size of the tree when saved");
+    size_t tree_file_size = mt_get_tree_file_size(root);
+    __mt_assert(tree_file_size > 2000000, "Saved tree is too small to hold its data");
+    char* tree_file = malloc(tree_file_size);
+
+    __mt_test_log(" Save the tree to a buffer");
+    __mt_assert(mt_write_tree_to_buffer(root, tree_file, tree_file_size) == tree_file_size, "Bytes written differ from mt_get_tree_file_size");
+
+    __mt_test_log(" Load the tree from the buffer as a new tree");
+    mt_branch* loaded_root = mt_load_tree_from_buffer(NULL, tree_file, tree_file_size);
+    __mt_assert(loaded_root != NULL && mt_check_is_root(loaded_root), "Loaded tree is not a new tree");
+    __mt_assert(__mt_branches_identical(root, loaded_root), "Loaded tree differs from the saved tree");
+    __mt_assert(mt_get_by_id(loaded_root, path_test_branch->id) != NULL 
+        && __mt_strings_equal(mt_get_by_id(loaded_root, path_test_branch->id)->label, "test"), "Loaded branches did not keep their ids");
+    __mt_assert(mt_check_data_owned(mt_get_by_path(loaded_root, "/test/data_insertion/pointer_1_megabyte")), "Loaded data is not owned by the tree");
+    mt_destroy_tree(loaded_root);
+
+    __mt_test_log(" Map the tree from a file without copying it");
+    char* snapshot_filename = "test_megatree_snapshot.tmp";
+    FILE* snapshot_file = fopen(snapshot_filename, "wb");
+    __mt_assert(snapshot_file != NULL && fwrite(tree_file, 1, tree_file_size, snapshot_file) == tree_file_size, "Could not write the snapshot file");
+    fclose(snapshot_file);
+    mt_branch* mapped_root = mt_map_tree_from_file(NULL, snapshot_filename);
+    __mt_assert(mapped_root != NULL && __mt_branches_identical(root, mapped_root), "Mapped tree differs from the saved tree");
+    mt_branch* mapped_branch = mt_get_by_path(mapped_root, "/test/data_insertion/copied_from_buffer_1_byte");
+    __mt_assert(mapped_branch->data_storage == MT_DATA_MAPPED && !mt_check_data_owned(mapped_branch), "Mapped data was copied");
+
+    __mt_test_log(" Write to mapped data, copying it first");
+    char* writable = mt_get_data_pointer_writable(mapped_branch);
+    __mt_assert(writable != NULL && mt_check_data_owned(mapped_branch), "Writable data was not copied");
+    writable[0] ^= 0xff;
+    __mt_assert(!__mt_buffers_identical(writable, test_data, 1), "Writing to copied data did not change it");
+    mt_branch* remapped_root = mt_map_tree_from_file(NULL, snapshot_filename);
+    __mt_assert(__mt_buffers_identical(mt_get_by_path(remapped_root, "/test/data_insertion/copied_from_buffer_1_byte")->data, test_data, 1), 
+        "Writing to copied data changed the file");
+    mt_destroy_tree(remapped_root);
+    mt_destroy_tree(mapped_root);
+
+    __mt_test_log(" Load the tree lazily, decoding branches only when they are reached");
+    mt_branch* lazy_root = mt_load_tree_lazily_from_buffer(NULL, tree_file, tree_file_size);
+    __mt_assert(lazy_root != NULL && (lazy_root->flags & MT_BRANCH_UNLOADED) && lazy_root->first_child == NULL, "Lazy loading decoded more than the root");
+    mt_branch* lazy_branch = mt_get_by_path(lazy_root, "/test/data_insertion/pointer_1_megabyte");
+    __mt_assert(lazy_branch != NULL && mt_check_data_owned(lazy_branch), "Could not find a deep branch in a lazy tree");
+    __mt_assert(mt_get_by_path(lazy_root, "creating_path_test")->flags & MT_BRANCH_UNLOADED, "Lazy loading decoded a branch which was not reached");
+    __mt_assert(mt_get_by_id(lazy_root, path_test_branch->id) != NULL, "Could not find an unloaded branch by id");
+    __mt_assert(__mt_branches_identical(root, lazy_root), "Lazy tree differs from the saved tree");
+    __mt_assert(lazy_root->tree->unloaded.count == 0, "Walking the whole lazy tree left branches unloaded");
+    mt_destroy_tree(lazy_root);
+
+    __mt_test_log(" Count the totals of a lazy tree once its branches are loaded");
+    lazy_root = mt_load_tree_lazily_from_buffer(NULL, tree_file, tree_file_size);
+    __mt_assert(mt_check_totals(lazy_root), "A lazy tree has the wrong totals");
+    __mt_assert(mt_get_num_descendants(lazy_root, 0, -1) == mt_get_num_descendants(root, 0, -1), "A lazy tree has the wrong number of descendants");
+    __mt_assert(mt_get_childrens_data_size_recursive(lazy_root) == mt_get_childrens_data_size_recursive(root), "A lazy tree has the wrong data size");
+    __mt_assert(mt_check_totals(lazy_root), "Counting the totals of a lazy tree got them wrong");
+    mt_destroy_tree(lazy_root);
+
+    __mt_test_log(" Delete unloaded branches from a lazy tree");
+    lazy_root = mt_load_tree_lazily_from_buffer(NULL, tree_file, tree_file_size);
+    mt_branch* unloaded_branch = mt_get_by_path(lazy_root, "creating_path_test");
+    __mt_assert(unloaded_branch->flags & MT_BRANCH_UNLOADED, "Branch was loaded before it was reached");
+    mt_delete_branch(unloaded_branch);
+    __mt_assert(mt_get_by_path(lazy_root, "creating_path_test") == NULL, "Deleted unloaded branch is still in the tree");
+    __mt_assert(mt_get_by_id(lazy_root, path_test_branch->id) == NULL, "Found a branch under a deleted unloaded branch");
+    mt_destroy_tree(lazy_root);
+
+    __mt_test_log(" Create a branch in a lazy tree before its branches are loaded, and check they keep their ids");
+    lazy_root = mt_load_tree_lazily_from_buffer(NULL, tree_file, tree_file_size);
+    mt_branch* created_early = mt_create_branch(lazy_root, "created_early");
+    __mt_assert(created_early->id > mt_find_max_id(root, 0, -1), "A branch created early took an id still waiting to be loaded");
+    mt_branch* late_branch = mt_get_by_path(lazy_root, "creating_path_test/creating_path_test2/test");
+    __mt_assert(late_branch != NULL && late_branch->id == path_test_branch->id, "A branch loaded late lost its id");
+    __mt_assert(mt_get_by_id(lazy_root, path_test_branch->id) == late_branch, "Could not find a branch loaded late by its id");
+    mt_destroy_tree(lazy_root);
+
+    __mt_test_log(" Map the tree lazily from a file");
+    lazy_root = mt_map_tree_lazily_from_file(NULL, snapshot_filename);
+    mapped_branch = mt_get_by_path(lazy_root, "/test/data_insertion/copied_from_buffer_1_byte");
+    __mt_assert(mapped_branch != NULL && mapped_branch->data_storage == MT_DATA_MAPPED, "Lazily mapped data was copied");
+    __mt_assert(__mt_branches_identical(root, lazy_root), "Lazily mapped tree differs from the saved tree");
+    mt_destroy_tree(lazy_root);
+    remove(snapshot_filename);
+
+    __mt_test_log(" Find a damaged record only when it is reached");
+    char* damaged_file = malloc(tree_file_size);
+    memcpy(damaged_file, tree_file, tree_file_size);
+    size_t damaged_record = __mt_get_u64((unsigned char*)damaged_file + MT_FILE_HEADER_BRANCHES) + MT_FILE_BRANCH_SIZE;
+    damaged_file[damaged_record + MT_FILE_BRANCH_PARENT] = 5;     // The first child of the root
+    lazy_root = mt_load_tree_lazily_from_buffer(NULL, damaged_file, tree_file_size);
+    __mt_assert(lazy_root != NULL, "A damaged record was checked before it was reached");
+    MT_ERRORS_ARE_FATAL = 0;
+    __mt_assert(mt_get_num_children(lazy_root) == 0, "A damaged record was loaded");
+    MT_ERRORS_ARE_FATAL = 1;
+    mt_destroy_tree(lazy_root);
+    free(damaged_file);
+
+    __mt_test_log(" Find children of a wide branch in loaded trees through its label index");
+    mt_branch* wide_root = mt_create_root();
+    for(int i=0; i<100; i++)
+    {
+        sprintf(wide_label, "child%d", i);
+        mt_create_branch(wide_root, wide_label);
+    }
+    size_t wide_file_size = mt_get_tree_file_size(wide_root);
+    char* wide_file = malloc(wide_file_size);
+    mt_write_tree_to_buffer(wide_root, wide_file, wide_file_size);
+    mt_destroy_tree(wide_root);
+    wide_root = mt_load_tree_from_buffer(NULL, wide_file, wide_file_size);
+    __mt_assert(wide_root->child_index != NULL && mt_get_by_path(wide_root, "child99") != NULL, "Loaded children were not indexed by label");
+    mt_destroy_tree(wide_root);
+    wide_root = mt_load_tree_lazily_from_buffer(NULL, wide_file, wide_file_size);
+    __mt_assert(mt_get_by_path(wide_root, "child99") != NULL, "Lazily loaded children were not indexed by label");
+    mt_destroy_tree(wide_root);
+    free(wide_file);
+
+    __mt_test_log(" Track changes to a loaded tree");
+    mt_branch* edited_root = mt_load_tree_from_buffer(NULL, tree_file, tree_file_size);
+    __mt_assert(!mt_check_changed(edited_root), "A newly loaded tree has changes");
+    __mt_assert(mt_get_delta_file_size(edited_root) == MT_FILE_HEADER_SIZE + MT_FILE_BRANCH_SIZE, "Delta of an unchanged tree is not empty");
+    mt_branch* edited_branch = mt_get_by_path(edited_root, "/test/data_insertion/copied_from_buffer_1_byte");
+    mt_set_data_copy(edited_branch, "changed", 8);
+    __mt_assert(mt_check_changed(edited_branch) && mt_check_changed(edited_root), "Changing data was not tracked up to the root");
+    __mt_assert(!mt_check_changed(mt_get_by_path(edited_root, "creating_path_test")), "An unchanged branch was marked as changed");
+    mt_set_data_copy(mt_create_path(edited_root, "delta_test/new_branch"), test_data, 100);
+    mt_delete_branch(mt_get_by_path(edited_root, "/test/data_insertion/pointer_1_megabyte"));
+    mt_set_label(mt_get_by_path(edited_root, "creating_path_test/creating_path_test2"), "relabelled");
+    mt_move_branch(mt_get_by_path(edited_root, "creating_path_test"), mt_get_by_path(edited_root, "delta_test"));
+
+    __mt_test_log(" Save the changes as a delta, and apply it to the snapshot");
+    size_t delta_size = mt_get_delta_file_size(edited_root);
+    __mt_assert(delta_size > 0 && delta_size < tree_file_size / 10, "Delta is not much smaller than the whole tree");
+    char* delta = malloc(delta_size);
+    __mt_assert(mt_write_delta_to_buffer(edited_root, delta, delta_size) == delta_size, "Bytes written differ from mt_get_delta_file_size");
+    mt_mark_clean(edited_root);
+    __mt_assert(!mt_check_changed(edited_root) && !mt_check_changed(edited_branch), "Marking a tree clean left changes");
+    mt_branch* rebuilt_root = mt_load_tree_with_deltas(tree_file, tree_file_size, (void**)&delta, &delta_size, 1);
+    __mt_assert(rebuilt_root != NULL && __mt_branches_identical(edited_root, rebuilt_root), "Snapshot with a delta differs from the changed tree");
+    __mt_assert(!mt_check_changed(rebuilt_root), "Applying a delta marked the tree as changed");
+    mt_destroy_tree(rebuilt_root);
+
+    __mt_test_log(" Apply a second delta on top of the first");
+    mt_set_data_copy(mt_get_by_path(edited_root, "delta_test/new_branch"), "second", 7);
+    mt_delete_branch(mt_get_by_path(edited_root, "/test/data_insertion"));
+    size_t second_delta_size = mt_get_delta_file_size(edited_root);
+    char* second_delta = malloc(second_delta_size);
+    mt_write_delta_to_buffer(edited_root, second_delta, second_delta_size);
+    void* deltas[2] = {delta, second_delta};
+    size_t delta_sizes[2] = {delta_size, second_delta_size};
+    rebuilt_root = mt_load_tree_with_deltas(tree_file, tree_file_size, deltas, delta_sizes, 2);
+    __mt_assert(rebuilt_root != NULL && __mt_branches_identical(edited_root, rebuilt_root), "Snapshot with two deltas differs from the changed tree");
+    __mt_assert(mt_check_totals(rebuilt_root) && mt_get_childrens_data_size_recursive(rebuilt_root) == mt_get_childrens_data_size_recursive(edited_root),
+        "Applying deltas left the wrong totals");
+    mt_destroy_tree(rebuilt_root);
+
+    __mt_test_log(" Compact a snapshot and its deltas into a single snapshot");
+    mt_test_stream compacted = {0};
+    __mt_assert(mt_compact_snapshot(tree_file, tree_file_size, deltas, delta_sizes, 2, __mt_test_stream_write, &compacted) == compacted.length,
+        "Bytes written differ from the compacted snapshot");
+    rebuilt_root = mt_load_tree_from_buffer(NULL, compacted.buffer, compacted.length);
+    __mt_assert(rebuilt_root != NULL && __mt_branches_identical(edited_root, rebuilt_root), "Compacted snapshot differs from the changed tree");
+    mt_destroy_tree(rebuilt_root);
+    free(compacted.buffer);
+
+    __mt_test_log(" Try to apply deltas that do not match");
+    MT_ERRORS_ARE_FATAL = 0;
+    __mt_assert(mt_load_tree_with_deltas(tree_file, tree_file_size, &deltas[1], &delta_sizes[1], 1) == NULL, "Applied a delta out of order");
+    __mt_assert(mt_load_tree_with_deltas(tree_file, tree_file_size, (void**)&tree_file, &tree_file_size, 1) == NULL, "Applied a snapshot as a delta");
+    mt_branch* unrelated_root = mt_create_root();
+    __mt_assert(!mt_apply_delta_from_buffer(unrelated_root, second_delta, second_delta_size), "Applied a delta to an unrelated tree");
+    MT_ERRORS_ARE_FATAL = 1;
+    __mt_assert(mt_get_num_children(unrelated_root) == 0, "A delta that does not match was partly applied");
+    mt_destroy_tree(unrelated_root);
+    mt_destroy_tree(edited_root);
+    free(delta);
+    free(second_delta);
+
+    __mt_test_log(" Stream the tree through a callback");
+    mt_test_stream stream = {0};
+    __mt_assert(mt_write_tree_to_callback(root, __mt_test_stream_write, &stream) == tree_file_size, "Bytes streamed differ from mt_get_tree_file_size");
+    __mt_assert(stream.length == tree_file_size && __mt_buffers_identical(stream.buffer, tree_file, tree_file_size), 
+        "Streamed tree differs from the tree written to a buffer");
+
+    __mt_test_log(" Load the tree from a callback, a few bytes at a time");
+    stream.chunk = 1000;
+    mt_branch* streamed_root = mt_load_tree_from_callback(NULL, __mt_test_stream_read, &stream);
+    __mt_assert(streamed_root != NULL && __mt_branches_identical(root, streamed_root), "Streamed tree differs from the saved tree");
+    __mt_assert(stream.position == tree_file_size, "Loading did not stop at the end of the streamed tree");
+    __mt_assert(mt_get_by_id(streamed_root, path_test_branch->id) != NULL, "Streamed branches did not keep their ids");
+    __mt_assert(mt_check_data_owned(mt_get_by_path(streamed_root, "/test/data_insertion/pointer_1_megabyte")), "Streamed data is not owned by the tree");
+    mt_destroy_tree(streamed_root);
+
+    __mt_test_log(" Try to load a truncated stream");
+    stream.position = 0;
+    stream.length = tree_file_size - 1;
+    mt_branch* stream_destination = mt_create_branch(root, "stream_destination");
+    MT_ERRORS_ARE_FATAL = 0;
+    __mt_assert(mt_load_tree_from_callback(stream_destination, __mt_test_stream_read, &stream) == NULL, "Loaded a truncated stream");
+    stream.position = 0;
+    stream.length = __mt_get_u64((unsigned char*)tree_file + MT_FILE_HEADER_BRANCHES) + 10 * MT_FILE_BRANCH_SIZE + 5;  // Part way through the records
+    __mt_assert(mt_load_tree_from_callback(stream_destination, __mt_test_stream_read, &stream) == NULL, "Loaded a truncated stream");
+    MT_ERRORS_ARE_FATAL = 1;
+    __mt_assert(mt_get_num_children(stream_destination) == 0, "A truncated stream was partly loaded");
+    mt_delete_branch(stream_destination);
+    free(stream.buffer);
+
+#if !defined(_WIN32)
+    __mt_test_log(" Stream the tree through a file descriptor");
+    int snapshot_fd = open(snapshot_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    __mt_assert(snapshot_fd >= 0 && mt_write_tree_to_fd(root, snapshot_fd) == tree_file_size, "Could not stream the tree to a file");
+    close(snapshot_fd);
+    snapshot_fd = open(snapshot_filename, O_RDONLY);
+    streamed_root = mt_load_tree_from_fd(NULL, snapshot_fd);
+    close(snapshot_fd);
+    __mt_assert(streamed_root != NULL && __mt_branches_identical(root, streamed_root), "Tree streamed through a file differs from the saved tree");
+    mt_destroy_tree(streamed_root);
+    remove(snapshot_filename);
+#endif
+
+    __mt_test_log(" Record changes to a tree in a journal");
+    char* journal_filename = "test_megatree_journal.tmp";
+    remove(journal_filename);
+    remove(snapshot_filename);
+    mt_branch* journalled_root = mt_create_root();
+    __mt_assert(mt_open_journal(journalled_root, journal_filename, 0.001), "Could not open a journal");
+    mt_branch* journalled = mt_create_branch(journalled_root, "journalled");
+    for(int i=0; i<20; i++)
+    {
+        mt_branch* child = mt_create_branch(journalled, "child");
+        mt_set_data_copy(child, &i, sizeof i);
+        if(i % 3 == 0) mt_set_data_type(child, "int");
+    }
+    mt_set_label(journalled->first_child, "first_child");
+    mt_set_data_type(journalled->first_child, NULL);
+    mt_delete_branch(journalled->first_child->next_sibling);
+    mt_copy_branch(journalled, mt_create_branch(journalled_root, "copies"));
+    mt_move_branch(mt_get_by_path(journalled_root, "copies/journalled/first_child"), journalled_root);
+    __mt_assert(mt_sync_journal(journalled_root), "Could not sync the journal");
+    mt_journal_stats journal_stats;
+    mt_get_journal_stats(journalled_root, &journal_stats);
+    __mt_assert(journal_stats.records > 40 && journal_stats.pending == 0 && journal_stats.syncs <= journal_stats.records,
+        "Journal stats do not match the changes recorded");
+
+    __mt_test_log(" Write records straight away, and sync them once the commit window has passed");
+    char* windowed_filename = "test_megatree_windowed.tmp";
+    remove(windowed_filename);
+    mt_branch* windowed_root = mt_create_root();
+    __mt_assert(mt_open_journal(windowed_root, windowed_filename, 0.05), "Could not open a journal with a commit window");
+    mt_create_branch(windowed_root, "windowed");
+    mt_branch* windowed_replay = mt_create_root();
+    __mt_assert(mt_replay_journal(windowed_replay, windowed_filename) == 1, "A record was not written as soon as it was made");
+    mt_get_journal_stats(windowed_root, &journal_stats);
+    for(time_t started = time(NULL); journal_stats.pending > 0 && time(NULL) - started < 10; )
+    {
+        mt_get_journal_stats(windowed_root, &journal_stats);
+    }
+    __mt_assert(journal_stats.pending == 0 && journal_stats.syncs == 1, "A record was not synced once the commit window had passed");
+    mt_destroy_tree(windowed_replay);
+    mt_destroy_tree(windowed_root);
+    remove(windowed_filename);
+
+    __mt_test_log(" Recover the tree by replaying its journal");
+    mt_branch* recovered_root = mt_recover_tree(snapshot_filename, journal_filename, 0);
+    __mt_assert(recovered_root != NULL && __mt_branches_identical(journalled_root, recovered_root), "Recovered tree differs from the journalled tree");
+    __mt_assert(mt_get_by_id(recovered_root, journalled->id) != NULL && __mt_strings_equal(mt_get_by_id(recovered_root, journalled->id)->label, "journalled"),
+        "Recovered branches did not keep their ids");
+    mt_close_journal(recovered_root);
+    mt_destroy_tree(recovered_root);
+
+    __mt_test_log(" Checkpoint the tree, then recover it from the snapshot and the rest of its journal");
+    __mt_assert(mt_checkpoint_journal(journalled_root, snapshot_filename), "Could not checkpoint the tree");
+    mt_set_data_copy(mt_get_by_path(journalled_root, "first_child"), "moved", 6);
+    mt_delete_branch(mt_get_by_path(journalled_root, "copies"));
+    mt_create_branch(journalled, "after_checkpoint");
+    mt_sync_journal(journalled_root);
+    FILE* journal_file = fopen(journal_filename, "ab");     // As if a crash tore the next record
+    fwrite("torn record", 1, 11, journal_file);
+    fclose(journal_file);
+    recovered_root = mt_recover_tree(snapshot_filename, journal_filename, 0);
+    __mt_assert(recovered_root != NULL && __mt_branches_identical(journalled_root, recovered_root), "Tree recovered after a checkpoint differs");
+
+    __mt_test_log(" Replay the journal again, which changes nothing");
+    mt_close_journal(recovered_root);
+    __mt_assert(mt_replay_journal(recovered_root, journal_filename) == 3, "Torn record was replayed");
+    __mt_assert(__mt_branches_identical(journalled_root, recovered_root), "Replaying a journal twice changed the tree");
+    mt_destroy_tree(recovered_root);
+    mt_destroy_tree(journalled_root);
+    remove(journal_filename);
+    remove(snapshot_filename);
+
+    __mt_test_log(" Save a sub-tree and load it into the same tree");
+    mt_branch* subtree = mt_get_by_path(root, "creating_path_test");
+    size_t subtree_file_size = mt_get_tree_file_size(subtree);
+    __mt_assert(subtree_file_size < tree_file_size, "Sub-tree is no smaller than the whole tree");
+    __mt_assert(mt_write_tree_to_buffer(subtree, tree_file, tree_file_size) == subtree_file_size, "Bytes written differ from mt_get_tree_file_size");
+    mt_branch* load_destination = mt_create_branch(root, "load_destination");
+    mt_branch* loaded_subtree = mt_load_tree_from_buffer(load_destination, tree_file, subtree_file_size);
+    __mt_assert(loaded_subtree != NULL && loaded_subtree->parent == load_destination, "Sub-tree was not loaded into its new parent");
+    __mt_assert(__mt_branches_identical(subtree, loaded_subtree), "Loaded sub-tree differs from the saved sub-tree");
+    __mt_assert(loaded_subtree->id != subtree->id, "Loaded branch took an id which was already in use");
+    __mt_assert(mt_get_by_path(load_destination, "creating_path_test/creating_path_test2/test") != path_test_branch, "Loaded sub-tree is not a copy");
+
+    __mt_test_log(" Try to load damaged trees");
+    MT_ERRORS_ARE_FATAL = 0;
+    __mt_assert(mt_load_tree_from_buffer(load_destination, tree_file, subtree_file_size - 1) == NULL, "Loaded a truncated tree");
+    tree_file[0] = 'X';
+    __mt_assert(mt_load_tree_from_buffer(load_destination, tree_file, subtree_file_size) == NULL, "Loaded a tree without the right magic number");
+    tree_file[0] = 'M';
+    tree_file[MT_FILE_HEADER_VERSION] = MT_FILE_VERSION + 1;
+    __mt_assert(mt_load_tree_from_buffer(load_destination, tree_file, subtree_file_size) == NULL, "Loaded a tree from a future version");
+    tree_file[MT_FILE_HEADER_VERSION] = MT_FILE_VERSION;
+    size_t branches_offset = __mt_get_u64((unsigned char*)tree_file + MT_FILE_HEADER_BRANCHES);
+    tree_file[branches_offset + MT_FILE_BRANCH_SIZE + MT_FILE_BRANCH_PARENT] = 5;    // The second record's parent comes after it
+    __mt_assert(mt_load_tree_from_buffer(load_destination, tree_file, subtree_file_size) == NULL, "Loaded a tree with a damaged branch record");
+    MT_ERRORS_ARE_FATAL = 1;
+    __mt_assert(mt_get_num_children(load_destination) == 1, "A damaged tree was partly loaded");
+    mt_delete_branch(load_destination);
+    free(tree_file);
+
+
+
+    // -------- Concurrent reads
+    __mt_test_log(" Keep deleted branches for a reader that may still be looking at them");
+    mt_branch* concurrent_root = mt_create_root();
+    mt_create_path(concurrent_root, "a/b/c");
+    mt_branch* concurrent_wide = mt_create_branch(concurrent_root, "wide");
+    for(int i=0; i<MT_CHILD_INDEX_THRESHOLD; i++) mt_create_branch(concurrent_wide, "filler");
+    mt_branch* concurrent_stable = mt_create_branch(concurrent_wide, "stable");
+    __mt_assert(mt_enable_concurrent_reads(concurrent_root), "Could not enable concurrent reads");
+    mt_reader* concurrent_reader = mt_register_reader(concurrent_root);
+    mt_begin_read(concurrent_reader);
+    mt_branch* doomed = mt_create_branch(concurrent_wide, "doomed_with_a_label_long_enough_to_need_its_own_allocation");
+    mt_set_data_copy(doomed, test_data, 1000);
+    size_t branches_before_removal = mt_get_num_branches(concurrent_root);
+    mt_delete_branch(doomed);
+    __mt_assert(mt_get_num_branches(concurrent_root) == branches_before_removal - 1, "Branch count includes a deleted branch");
+    __mt_assert(mt_reclaim(concurrent_root) > 0, "A deleted branch was reclaimed during a read");
+    __mt_assert(__mt_strings_equal(doomed->label, "doomed_with_a_label_long_enough_to_need_its_own_allocation")
+        && __mt_buffers_identical(doomed->data, test_data, 1000), "A deleted branch was changed during a read");
+    mt_end_read(concurrent_reader);
+    __mt_assert(mt_reclaim(concurrent_root) == 0, "A deleted branch was not reclaimed after the read");
+    mt_unregister_reader(concurrent_reader);
+
+    __mt_test_log(" Look branches up from other threads while the tree changes");
+    int stop_readers = 0;
+    mt_path* concurrent_path = mt_compile_path(concurrent_root, "wide/stable");
+    mt_test_reader readers[2];
+    for(int i=0; i<2; i++) readers[i] = (mt_test_reader){ .root = concurrent_root, .stop = &stop_readers, .compiled = concurrent_path };
+    pthread_t reader_threads[2];
+    for(int i=0; i<2; i++) pthread_create(&reader_threads[i], NULL, __mt_test_concurrent_reader, &readers[i]);
+    size_t concurrent_words[8];
+    char concurrent_label[32];
+    for(size_t i=0; i<3000; i++)
+    {
+        for(int w=0; w<8; w++) concurrent_words[w] = i;
+        mt_set_data_copy(concurrent_stable, concurrent_words, (i % 2) ? sizeof concurrent_words : sizeof concurrent_words[0] * 2);     // On the heap, then inline
+        snprintf(concurrent_label, sizeof concurrent_label, "label_%ld", i);
+        mt_branch* added = mt_create_branch(concurrent_wide, concurrent_label);   // Each new label grows the string table and child index
+        mt_create_branch(mt_get_by_path(concurrent_root, "a/b"), concurrent_label);
+        mt_set_label(concurrent_wide->first_child, concurrent_label);
+        if(i % 3 == 0) mt_delete_branch(added);
+        if(i % 5 == 0) mt_delete_branch(mt_get_nth_child(mt_get_by_path(concurrent_root, "a/b"), 1));
+    }
+    __atomic_store_n(&stop_readers, 1, __ATOMIC_RELEASE);
+    for(int i=0; i<2; i++) pthread_join(reader_threads[i], NULL);
+    printf("  %ld children read by other threads\n", readers[0].reads + readers[1].reads);
+    __mt_assert(readers[0].misses + readers[1].misses == 0, "A concurrent lookup missed a branch which was never removed");
+    __mt_assert(readers[0].torn + readers[1].torn == 0, "A concurrent copy of data was torn");
+    __mt_assert(mt_disable_concurrent_reads(concurrent_root), "Could not disable concurrent reads");
+    __mt_assert(mt_get_by_path(concurrent_root, "wide/stable") == concurrent_stable, "Tree was changed by disabling concurrent reads");
+    mt_free_path(concurrent_path);
+    mt_destroy_tree(concurrent_root);
+
+    __mt_test_log(" Search a large tree on several threads, finding the branch a single thread finds");
+    mt_branch* parallel_root = mt_create_root();
+    mt_branch* parallel_tree = mt_create_branch(parallel_root, "all");
+    char parallel_label[32];
+    for(int i=0; i<300; i++)
+    {
+        snprintf(parallel_label, sizeof parallel_label, "branch_%d", i);
+        mt_branch* parallel_branch = mt_create_branch(parallel_tree, parallel_label);
+        for(int j=0; j<300; j++)
+        {
+            snprintf(parallel_label, sizeof parallel_label, "leaf_%d", j);
+            mt_set_data_copy(mt_create_branch(parallel_branch, parallel_label), &j, sizeof j);
+        }
+    }
+    mt_set_label(mt_get_by_path(parallel_tree, "branch_250/leaf_10"), "needle");
+    mt_set_label(mt_get_by_path(parallel_tree, "branch_200/leaf_299"), "needle");
+    mt_branch* first_needle = mt_search_for_label(parallel_tree, "needle");
+    __mt_assert(first_needle == mt_get_by_path(parallel_tree, "branch_200/needle"), "Serial search did not find the first branch");
+    for(int threads=0; threads<=8; threads+=4)
+    {
+        __mt_assert(mt_search_for_label_parallel(parallel_tree, "needle", threads) == first_needle, "Parallel search did not find the first branch");
+    }
+    __mt_assert(mt_search_for_label_parallel(parallel_tree, "no_such_label", 4) == NULL, "Parallel search found a label that does not exist");
+    __mt_assert(mt_search_for_label_parallel(parallel_tree, "all", 4) == NULL, "Parallel search found the branch it started from");
+
+    __mt_test_log(" Leave stale totals alone in a parallel search while other threads may be reading");
+    mt_enable_concurrent_reads(parallel_root);
+    mt_branch* parallel_chain = mt_get_by_path(parallel_tree, "branch_0");
+    for(int i=0; i<MT_TOTALS_EAGER_DEPTH + 8; i++) parallel_chain = mt_create_branch(parallel_chain, "chain");
+    __mt_assert(parallel_tree->flags & MT_BRANCH_TOTALS_STALE, "A deep change did not leave distant totals stale");
+    __mt_assert(mt_search_for_label_parallel(parallel_tree, "needle", 4) == first_needle, "Parallel search with stale totals did not find the first branch");
+    __mt_assert(parallel_tree->flags & MT_BRANCH_TOTALS_STALE, "A parallel search wrote to a tree other threads may be reading");
+    mt_disable_concurrent_reads(parallel_root);
+    mt_delete_branch(mt_get_by_path(parallel_tree, "branch_0/chain"));
+
+    __mt_test_log(" Find the maximum id of a large branch on several threads");
+    mt_create_branch(parallel_root, "after");
+    __mt_assert(mt_find_max_id_parallel(parallel_tree, 0, 4) == mt_find_max_id(parallel_tree, 0, -1), "Parallel maximum id differs from a serial search");
+    __mt_assert(mt_find_max_id_parallel(parallel_tree, 0, 4) < mt_get_max_id(parallel_root), "Parallel maximum id looked outside its branch");
+
+    __mt_test_log(" Compare large trees on several threads, finding the first difference a single thread finds");
+    mt_branch* parallel_copy_root = mt_create_root();
+    mt_copy_branch(parallel_tree, parallel_copy_root);
+    mt_branch* parallel_copy = mt_get_by_path(parallel_copy_root, "all");
+    __mt_assert(mt_check_branches_identical(parallel_tree, parallel_copy) == NULL, "A copy differs from its original");
+    __mt_assert(mt_check_branches_identical_parallel(parallel_tree, parallel_copy, 4) == NULL, "A copy differs from its original on several threads");
+    int changed_value = -1;
+    mt_set_data_copy(mt_get_by_path(parallel_copy, "branch_280/leaf_5"), &changed_value, sizeof changed_value);
+    mt_create_branch(mt_get_by_path(parallel_copy, "branch_100/leaf_7"), "extra");
+    mt_branch* first_difference = mt_check_branches_identical(parallel_tree, parallel_copy);
+    __mt_assert(first_difference == mt_get_by_path(parallel_tree, "branch_100/leaf_7"), "Serial comparison did not find the first difference");
+    __mt_assert(mt_check_branches_identical_parallel(parallel_tree, parallel_copy, 4) == first_difference, "Parallel comparison did not find the first difference");
+    mt_destroy_tree(parallel_copy_root);
+    mt_destroy_tree(parallel_root);
+
+    __mt_test_log(" Find every branch with a label, a label prefix or a glob, with and without a label index");
+    mt_branch* labelled_root = mt_create_root();
+    char labelled_path[64];
+    for(int i=0; i<200; i++)
+    {
+        snprintf(labelled_path, sizeof labelled_path, "users/user_%d/sess_%d", i, i % 10);
+        mt_create_path(labelled_root, labelled_path);
+        snprintf(labelled_path, sizeof labelled_path, "users/user_%d/state", i);
+        mt_create_path(labelled_root, labelled_path);
+    }
+    mt_branch* labelled_found[400];
+    for(int indexed=0; indexed<2; indexed++)
+    {
+        __mt_assert(mt_find_by_label(labelled_root, "state", labelled_found, 400) == 200, "Did not find every branch with a label");
+        __mt_assert(mt_find_by_label(labelled_root, "state", NULL, 0) == 200, "Did not count every branch with a label");
+        __mt_assert(mt_find_by_label(labelled_root, "sess_3", labelled_found, 5) == 20 && strcmp(labelled_found[4]->label, "sess_3") == 0,
+            "Did not find the branches with a label that fit");
+        __mt_assert(mt_find_by_label(labelled_root, "no_such_label", labelled_found, 400) == 0, "Found a label that does not exist");
+        __mt_assert(mt_find_by_label_prefix(labelled_root, "sess_", labelled_found, 400) == 200, "Did not find every label with a prefix");
+        __mt_assert(mt_find_by_label_prefix(labelled_root, "user_1", NULL, 0) == 111, "Did not count every label with a prefix");
+        __mt_assert(mt_find_by_label_prefix(labelled_root, "", NULL, 0) == 601, "An empty prefix did not find every branch");
+        __mt_assert(mt_find_by_label_glob(labelled_root, "user_?5", NULL, 0) == 9, "Did not find the labels matching a glob with '?'");
+        __mt_assert(mt_find_by_label_glob(labelled_root, "*_1*5", NULL, 0) == 11, "Did not find the labels matching a glob with '*'");
+        __mt_assert(mt_find_by_label_glob(labelled_root, "s*", NULL, 0) == 400, "Did not find the labels matching a trailing '*'");
+        __mt_assert(mt_find_by_label_glob(labelled_root, "state", NULL, 0) == 200, "A glob without wildcards did not find the label");
+        __mt_assert(mt_find_by_label(mt_get_by_path(labelled_root, "users/user_7"), "state", labelled_found, 400) == 1 &&
+            labelled_found[0] == mt_get_by_path(labelled_root, "users/user_7/state"), "Found branches outside the branch searched");
+        if(!indexed) __mt_assert(mt_enable_label_index(labelled_root), "Could not index the labels of a tree");
+    }
 
-    // Test writing to a buffer
-    // Is this the same as the result from mt_get_tree_file_size?
+    __mt_test_log(" Keep the label index up to date as branches are relabelled, deleted, moved and copied");
+    mt_set_label(mt_get_by_path(labelled_root, "users/user_5/state"), "sess_x");
+    mt_delete_branch(mt_get_by_path(labelled_root, "users/user_6"));
+    mt_move_branch(mt_get_by_path(labelled_root, "users/user_8"), mt_get_by_path(labelled_root, "users/user_9"));
+    mt_copy_branch(mt_get_by_path(labelled_root, "users/user_10"), labelled_root);
+    mt_create_branch(mt_get_by_path(labelled_root, "user_10"), "state");
+    __mt_assert(mt_find_by_label(labelled_root, "state", NULL, 0) == 200, "The label index was not kept up to date");
+    __mt_assert(mt_find_by_label_prefix(labelled_root, "sess_", NULL, 0) == 201, "The label prefix index was not kept up to date");
+    __mt_assert(mt_find_by_label(mt_get_by_path(labelled_root, "users/user_9"), "state", NULL, 0) == 2, "A moved branch was not found under its new parent");
+    __mt_assert(mt_find_by_label(mt_get_by_path(labelled_root, "user_10"), "state", labelled_found, 400) == 2 &&
+        mt_get_by_path(labelled_root, "user_10/state") != NULL, "A copied branch was not found by label");
+    __mt_assert(mt_disable_label_index(labelled_root), "Could not stop indexing the labels of a tree");
+    __mt_assert(mt_find_by_label(labelled_root, "state", NULL, 0) == 200, "Searching without the index found different branches");
+    MT_ERRORS_ARE_FATAL = 0;
+    __mt_assert(!mt_disable_label_index(labelled_root), "Stopped indexing the labels of a tree twice");
+    __mt_assert(!mt_enable_label_index(mt_get_by_path(labelled_root, "users")), "Indexed the labels of a tree from a branch");
+    MT_ERRORS_ARE_FATAL = 1;
+    mt_clear_last_error();
+    __mt_assert(mt_enable_label_index(labelled_root), "Could not index the labels of a tree again");
+
+    __mt_test_log(" Copy only the branches below the one a label query is for");
+    mt_copy_branch(mt_get_by_path(labelled_root, "users/user_11"), labelled_root);
+    mt_copy_branch(mt_get_by_path(labelled_root, "users/user_12"), labelled_root);
+    mt_branch* queried_copy = mt_get_by_path(labelled_root, "user_11");
+    mt_branch* unqueried_copy = mt_get_by_path(labelled_root, "user_12");
+    __mt_assert(mt_find_by_label(queried_copy, "state", labelled_found, 400) == 1 && labelled_found[0]->parent == queried_copy,
+        "A copy still sharing its children was not searched");
+    __mt_assert(unqueried_copy->flags & MT_BRANCH_SHARING, "A label query copied branches outside the branch searched");
+    __mt_assert(mt_find_by_label(mt_get_by_path(labelled_root, "users/user_13"), "sess_3", labelled_found, 400) == 1
+        && mt_find_by_label(mt_get_by_path(labelled_root, "users"), "sess_3", NULL, 0) == 20, "Found branches outside the branch searched");
+    __mt_assert(!(mt_get_by_path(labelled_root, "users")->flags & (MT_BRANCH_WITHIN_QUERY | MT_BRANCH_OUTSIDE_QUERY))
+        && !(labelled_root->flags & (MT_BRANCH_WITHIN_QUERY | MT_BRANCH_OUTSIDE_QUERY)), "A label query left its marks on branches");
+    mt_destroy_tree(labelled_root);
+
+    __mt_test_log(" Find branches by the address of their data, and detach freed objects, with and without a data index");
+    int linked_objects[100][4];
+    for(int indexed=0; indexed<2; indexed++)
+    {
+        mt_branch* linked_root = mt_create_root();
+        mt_branch* linked_branches[100];
+        for(int i=0; i<100; i++)
+        {
+            linked_branches[i] = mt_create_branch(linked_root, "object");
+            mt_set_data_pointer(linked_branches[i], linked_objects[i], sizeof linked_objects[i]);
+        }
+        mt_set_data_copy(mt_create_branch(linked_root, "copied"), "copied data", 12);
+        mt_copy_branch(linked_branches[7], linked_branches[8]);
+        if(indexed) __mt_assert(mt_enable_data_index(linked_root), "Could not index the data of a tree");
+
+        mt_branch* copied = mt_get_by_path(linked_root, "copied");
+        __mt_assert(mt_get_by_data(linked_root, linked_objects[42]) == linked_branches[42], "Did not find a branch by its data");
+        __mt_assert(mt_get_by_data(linked_root, copied->data) == copied, "Did not find a branch by data it holds itself");
+        __mt_assert(mt_get_by_data(linked_root, &linked_objects[42][1]) == NULL, "Found a branch by an address inside its data");
+        __mt_assert(mt_get_by_data_address(linked_root, &linked_objects[42][3]) == linked_branches[42], "Did not find a branch by an address inside its data");
+        __mt_assert(mt_get_by_data_address(linked_root, (char*)copied->data + 11) == copied, "Did not find a branch by the last byte of its data");
+        __mt_assert(mt_get_by_data_address(linked_root, (char*)copied->data + 12) != copied, "Found a branch by an address past its data");
+
+        __mt_assert(mt_detach_data(linked_root, linked_objects[7]) == 2, "Did not detach an object from every branch linked to it");
+        __mt_assert(linked_branches[7]->data == NULL && mt_get_by_path(linked_branches[8], "object")->data == NULL, "A detached branch still has data");
+        __mt_assert(mt_get_by_data(linked_root, linked_objects[7]) == NULL, "Found a branch by detached data");
+        __mt_assert(mt_detach_data(linked_root, copied->data) == 0, "Detached data that a branch holds itself");
+        mt_delete_branch(linked_branches[50]);
+        __mt_assert(mt_get_by_data_address(linked_root, &linked_objects[50][2]) == NULL, "Found a deleted branch by its data");
+        mt_set_data_pointer(linked_branches[51], linked_objects[50], sizeof linked_objects[50]);
+        __mt_assert(mt_get_by_data(linked_root, linked_objects[50]) == linked_branches[51] &&
+            mt_get_by_data(linked_root, linked_objects[51]) == NULL, "Did not find a branch by data linked again");
+        if(indexed) __mt_assert(mt_disable_data_index(linked_root), "Could not stop indexing the data of a tree");
+        mt_destroy_tree(linked_root);
+    }
 
 
 
     // -------- Housekeeping
-    // Test finding the maximum ID (mt_find_max_id)
-    // Test updating the maximum ID (mt_update_max_id)
-
-    // Add a node, and see if the maximum id is updated
-    // Delete a node, and see if the maximum id is updated
+    __mt_test_log(" Check the tree's pools are saving heap allocations");
+    mt_allocation_stats allocation_stats;
+    mt_get_allocation_stats(root, &allocation_stats);
+    printf("  %ld objects allocated with %ld heap allocations (%ld saved)\n", allocation_stats.objects_allocated,
+        allocation_stats.heap_allocations, allocation_stats.allocations_saved);
+    __mt_assert(allocation_stats.heap_allocations < allocation_stats.objects_allocated, "Pools did not save any allocations");
+
+    __mt_test_log(" Test finding the maximum ID (mt_find_max_id)");
+    size_t searched_max_id = mt_find_max_id(root, 0, 1000000);  // A depth limit forces a full search
+    __mt_assert(mt_find_max_id(root, 0, -1) == searched_max_id, "Indexed maximum id does not match a full search");
+
+    __mt_test_log(" Get the maximum ID kept by the tree (mt_get_max_id)");
+    __mt_assert(mt_get_max_id(root) == searched_max_id, "mt_get_max_id did not find the maximum id");
+
+    __mt_test_log(" Add a node, and see if the maximum id is updated");
+    mt_branch* id_test_branch = mt_create_branch(root, "id_test");
+    __mt_assert(mt_get_max_id(root) == id_test_branch->id && id_test_branch->id > searched_max_id, "Maximum id not updated when adding a branch");
+    __mt_assert(mt_get_by_id(root, id_test_branch->id) == id_test_branch, "New branch not found by id");
+
+    __mt_test_log(" Delete a node, and see if the maximum id is updated");
+    size_t deleted_id = id_test_branch->id;
+    mt_delete_branch(id_test_branch);
+    __mt_assert(mt_get_max_id(root) == searched_max_id, "Maximum id not updated when deleting a branch");
+    __mt_assert(mt_get_by_id(root, deleted_id) == NULL, "Deleted branch still found by id");
+
+    __mt_test_log(" Find many branches by id, after deleting every other one");
+    mt_branch* id_index_test = mt_create_branch(root, "id_index_test");
+    mt_branch* indexed_branches[1000];
+    for(int i=0; i<1000; i++) indexed_branches[i] = mt_create_branch(id_index_test, "indexed");
+    for(int i=0; i<1000; i+=2) mt_delete_branch(indexed_branches[i]);
+    for(int i=1; i<1000; i+=2) __mt_assert(mt_get_by_id(root, indexed_branches[i]->id) == indexed_branches[i], "Branch not found by id");
+    mt_delete_branch(id_index_test);
+    __mt_assert(mt_get_max_id(root) == searched_max_id, "Maximum id not updated when deleting many branches");
+
+    __mt_test_log(" Delete the top id of a snapshot with sparse ids");
+    mt_branch* sparse_root = mt_create_root();
+    mt_branch* sparse_top = mt_create_path(sparse_root, "below/top");
+    size_t sparse_file_size = mt_get_tree_file_size(sparse_root);
+    unsigned char* sparse_file = malloc(sparse_file_size);
+    mt_write_tree_to_buffer(sparse_root, sparse_file, sparse_file_size);
+    size_t sparse_records = __mt_get_u64(sparse_file + MT_FILE_HEADER_BRANCHES);
+    for(size_t record = sparse_records; record < sparse_records + 3 * MT_FILE_BRANCH_SIZE; record += MT_FILE_BRANCH_SIZE)
+    {
+        if(__mt_get_u64(sparse_file + record + MT_FILE_BRANCH_ID) == sparse_top->id) __mt_put_u64(sparse_file + record + MT_FILE_BRANCH_ID, 1UL << 40);
+    }
+    mt_destroy_tree(sparse_root);
+    sparse_root = mt_load_tree_from_buffer(NULL, sparse_file, sparse_file_size);
+    __mt_assert(mt_get_max_id(sparse_root) == 1UL << 40, "Sparse id not taken as the maximum");
+    size_t below_id = mt_get_by_path(sparse_root, "below")->id;
+    mt_delete_branch(mt_get_by_path(sparse_root, "below/top"));
+    __mt_assert(mt_get_max_id(sparse_root) == below_id, "Maximum id not found again after deleting a sparse top id");
+    __mt_assert(mt_create_branch(sparse_root, "after")->id == (1UL << 40) + 1, "An id was issued twice after deleting a sparse top id");
+    mt_destroy_tree(sparse_root);
+    free(sparse_file);
 
 
     // -------- Test data validation
@@ -282,5 +1446,43 @@ int main()
 
 
 
+    __mt_test_log(" Keep separate counters and ids for separate trees");
+    size_t branches_before_second_tree = mt_get_num_branches(root);
+    size_t max_id_before_second_tree = mt_get_max_id(root);
+    mt_branch* second_root = mt_create_root();
+    mt_create_path(second_root, "a/b/c");
+    __mt_assert(mt_get_num_branches(second_root) == 4 && mt_get_max_id(second_root) == 3, "A new tree does not have its own counters");
+    __mt_assert(mt_get_num_branches(root) == branches_before_second_tree && mt_get_max_id(root) == max_id_before_second_tree,
+        "Creating branches in one tree changed the counters of another");
+
+    __mt_test_log(" Get the message of the last error");
+    mt_clear_last_error();
+    __mt_assert(mt_get_last_error() == NULL, "An error was reported before any occurred");
+    MT_ERRORS_ARE_FATAL = 0;
+    __mt_assert(mt_create_branch(second_root, "bad/label") == NULL, "Created a branch with an invalid label");
+    MT_ERRORS_ARE_FATAL = 1;
+    __mt_assert(mt_get_last_error() != NULL && strstr(mt_get_last_error(), "bad/label") != NULL, "The last error's message was not kept");
+    mt_clear_last_error();
+
+    __mt_test_log(" Keep errors non-fatal on other threads, without sharing their messages");
+    pthread_t error_thread;
+    void* error_result = second_root;
+    MT_ERRORS_ARE_FATAL = 0;
+    pthread_create(&error_thread, NULL, __mt_test_error_thread, second_root);
+    pthread_join(error_thread, &error_result);
+    MT_ERRORS_ARE_FATAL = 1;
+    __mt_assert(error_result == NULL, "An error on another thread created a branch");
+    __mt_assert(mt_get_last_error() == NULL, "An error on another thread was reported on this one");
+
+    __mt_test_log(" Check the totals of the whole tree after everything it has been through");
+    __mt_assert(mt_check_totals(root), "Cached totals do not match the tree");
+
+    __mt_test_log(" Destroy the whole tree");
+    mt_destroy_tree(second_root);
+    __mt_assert(mt_get_num_branches(root) == branches_before_second_tree, "Destroying one tree changed the branch count of another");
+    mt_destroy_tree(root);
+    free(test_data);
+
+    printf("All megatree tests passed\n");
     return 0;
 }